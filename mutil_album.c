@@ -3,6 +3,7 @@
 
 #include "mutil_album.h"
 #include "mutil_track.h"
+#include "mutil_transcode.h"
 #include <math.h>
 
 /* ALL      : not any tag whose presence generates a warning
@@ -61,9 +62,21 @@ static gchar const *mutil_tags_single[] = {
 struct mutil_album_key;
 typedef struct mutil_album_key mutil_album_key_t;
 
+struct mutil_dedup_entry;
+typedef struct mutil_dedup_entry mutil_dedup_entry_t;
+
+struct mutil_dedup_key;
+typedef struct mutil_dedup_key mutil_dedup_key_t;
+
+/* The FLAC compression level of an album's archive targets. While levels are
+ * chosen, each album's trial runs as a separate task, which leaves its result
+ * or error in the album. */
 struct mutil_album {
     gchar *name;
     GList *tracks;
+    guint flac_level;
+    mutil_flac_level_choice_t flac_level_choice;
+    GError *flac_level_error;
 };
 
 struct mutil_album_key {
@@ -72,12 +85,31 @@ struct mutil_album_key {
     gchar *performer_text;
 };
 
+/* The job that encodes the first archive target of a recording, and the
+ * replay gain job of its album. */
+struct mutil_dedup_entry {
+    mutil_job_t *track_job;
+    mutil_job_t *replay_gain_job;
+};
+
+/* The content key of a track, computed on a thread pool before the jobs are
+ * created, since that reads the whole of a WAV file. */
+struct mutil_dedup_key {
+    mutil_track_t *track;
+    gchar *content_key;
+    GError *error;
+};
+
 static mutil_album_t *mutil_album_alloc(
         gboolean opt_flag_simple_album,
         gchar const *artist_text,
         gchar const *album_text,
         gchar const *performer_text);
 
+static void mutil_album_cb_choose_flac_level(
+        gpointer data,
+        gpointer user_data);
+
 static void mutil_album_free(
         mutil_album_t *album);
 
@@ -113,6 +145,15 @@ static void mutil_convert_filename(
         gboolean opt_flag_no_uppercase,
         gboolean opt_flag_no_space);
 
+static gint mutil_dedup_key_cb_compare(
+        gconstpointer a,
+        gconstpointer b,
+        gpointer user_data);
+
+static void mutil_dedup_key_cb_compute(
+        gpointer data,
+        gpointer user_data);
+
 mutil_album_t *mutil_album_alloc(
         gboolean opt_flag_simple_album,
         gchar const *artist_text,
@@ -141,10 +182,31 @@ mutil_album_t *mutil_album_alloc(
 
     new_album = g_malloc0(sizeof(mutil_album_t));
     new_album->name = g_string_free(album_name, FALSE);
+    new_album->flac_level = mutil_flac_level_best;
 
     return new_album;
 } /* mutil_album_alloc */
 
+void mutil_album_cb_choose_flac_level(
+        gpointer data,
+        gpointer user_data)
+{
+    mutil_album_t *album = data;
+    gdouble const *tolerance = user_data;
+
+    g_assert(album != NULL);
+    g_assert(tolerance != NULL);
+    g_assert(album->flac_level_error == NULL);
+
+    mutil_transcode_choose_flac_level(
+            album->tracks,
+            *tolerance,
+            &album->flac_level_choice,
+            &album->flac_level_error);
+
+    return;
+} /* mutil_album_cb_choose_flac_level */
+
 GList *mutil_album_create_track_list(
         mutil_album_t *album)
 {
@@ -157,6 +219,7 @@ void mutil_album_free(
     if (album != NULL) {
         mutil_track_free_list_of(album->tracks);
         g_free(album->name);
+        g_clear_error(&album->flac_level_error);
         g_free(album);
     }
 
@@ -383,6 +446,89 @@ GList *mutil_album_list_create_track_list(
     return new_track_list;
 } /* mutil_album_list_create_track_list */
 
+gint mutil_album_list_choose_flac_levels(
+        GList *album_list,
+        gdouble tolerance,
+        gint job_cnt,
+        GError **o_error)
+{
+    gint ret_value;
+    GThreadPool *pool;
+    GList *node_i;
+    mutil_album_t *album_i;
+    mutil_flac_level_choice_t const *choice_i;
+
+    g_assert(tolerance >= 0.0);
+    g_assert(job_cnt > 0);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Thread creation only fails if the system is out of resources, which is
+     * treated the same as being out of memory. */
+    pool = g_thread_pool_new(
+            mutil_album_cb_choose_flac_level,
+            &tolerance,
+            job_cnt,
+            FALSE,
+            NULL);
+    if (pool == NULL) {
+        abort();
+    }
+
+    for (node_i = album_list;
+         node_i != NULL;
+         node_i = node_i->next) {
+        g_thread_pool_push(pool, node_i->data, NULL);
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    /* Report in album order. Only the first error is reported. */
+    for (node_i = album_list;
+         node_i != NULL;
+         node_i = node_i->next) {
+
+        album_i = node_i->data;
+
+        if (album_i->flac_level_error != NULL) {
+            g_propagate_error(o_error, album_i->flac_level_error);
+            album_i->flac_level_error = NULL;
+            goto error_handling;
+        }
+
+        choice_i = &album_i->flac_level_choice;
+        album_i->flac_level = choice_i->level;
+        g_fprintf(
+                stderr,
+                "%s: FLAC level %u, %.0f%% less encoding time than --best, "
+                "%+.2f%% size\n",
+                album_i->name,
+                choice_i->level,
+                100.0 * choice_i->time_saving,
+                100.0 * choice_i->size_increase);
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    for (node_i = album_list;
+         node_i != NULL;
+         node_i = node_i->next) {
+        album_i = node_i->data;
+        g_clear_error(&album_i->flac_level_error);
+    }
+
+    return ret_value;
+} /* mutil_album_list_choose_flac_levels */
+
 void mutil_album_list_free(
         GList *album_list)
 {
@@ -394,50 +540,195 @@ void mutil_album_list_free(
     return;
 } /* mutil_album_list_free */
 
-mutil_makefile_t *mutil_album_list_generate_archive_makefile(
+void mutil_album_list_add_oggify_jobs(
         GList *album_list,
-        gboolean opt_flag_verbose_makefile,
-        gboolean opt_flag_use_echo_e)
+        mutil_job_graph_t *job_graph,
+        guint const *ogg_bitrates,
+        guint ogg_bitrate_cnt)
 {
-    static gchar const *default_target = "all";
+    GList *node_i;
+    mutil_album_t *album_i;
+    GList *node_j;
+    mutil_track_t *track_j;
+    gint j;
+    guint k;
+    mutil_job_t *dir_job;
+    mutil_job_t *track_job;
+    gchar *formatter = NULL;
+    gint track_cnt;
+    gchar *album_dir_name = NULL;
+    gchar *dir_name = NULL;
+    gchar const *title_text;
+    gchar *target_basename = NULL;
+    gchar *target_filename = NULL;
+
+    g_assert(job_graph != NULL);
+    g_assert(ogg_bitrates != NULL);
+    g_assert(ogg_bitrate_cnt > 0);
+
+    /* Create jobs for each album at each bitrate. */
+    for (k = 0; k < ogg_bitrate_cnt; k++) {
+        for (node_i = album_list;
+             node_i != NULL;
+             node_i = node_i->next) {
+
+            album_i = node_i->data;
+            track_cnt = g_list_length(album_i->tracks);
+
+            /* directory creation: */
+            g_free(album_dir_name);
+            album_dir_name = g_strdup(album_i->name);
+            mutil_convert_filename(&album_dir_name, TRUE, FALSE, FALSE);
+            g_free(dir_name);
+            if (ogg_bitrate_cnt > 1) {
+                dir_name = g_strdup_printf(
+                        "%ukbps/%s",
+                        ogg_bitrates[k],
+                        album_dir_name);
+            } else {
+                dir_name = g_strdup(album_dir_name);
+            }
+            dir_job = mutil_job_graph_add_job(
+                    job_graph,
+                    mutil_job_type_mkdir,
+                    dir_name,
+                    NULL,
+                    NULL);
+
+            /* Create jobs for each ogg target. */
+            for (node_j = album_i->tracks, j = 1;
+                 node_j != NULL;
+                 node_j = node_j->next, j++) {
+
+                track_j = node_j->data;
+
+                /* target: */
+
+                title_text = mutil_track_get_first_tag_value_by_name(
+                        track_j,
+                        mutil_tag_title);
+
+                g_free(formatter);
+                formatter = g_strdup_printf(
+                        "%%0%dd - %%s.ogg",
+                        (gint) log10(track_cnt) + 1);
+
+                g_free(target_basename);
+                target_basename = g_strdup_printf(
+                        formatter,
+                        j,
+                        title_text);
+                mutil_convert_filename(&target_basename, TRUE, FALSE, FALSE);
+
+                g_free(target_filename);
+                target_filename = g_strdup_printf(
+                        "%s/%s",
+                        dir_name,
+                        target_basename);
+
+                track_job = mutil_job_graph_add_job(
+                        job_graph,
+                        mutil_job_type_ogg_encode,
+                        target_filename,
+                        track_j,
+                        NULL);
+                mutil_job_set_ogg_bitrate(track_job, ogg_bitrates[k]);
+                mutil_job_add_order_only_dependency(track_job, dir_job);
+            }
+        }
+    }
+
+    /* Clean up. */
+
+    g_free(album_dir_name);
+    g_free(dir_name);
+    g_free(formatter);
+    g_free(target_filename);
+    g_free(target_basename);
 
-    mutil_makefile_t *new_makefile = NULL;
+    return;
+} /* mutil_album_list_add_oggify_jobs */
+
+mutil_job_graph_t *mutil_album_list_create_archive_job_graph(
+        GList *album_list,
+        gboolean opt_flag_dedup,
+        gint job_cnt)
+{
+    mutil_job_graph_t *new_job_graph = NULL;
     GList *node_i;
     mutil_album_t *album_i;
     GList *node_j;
     mutil_track_t *track_j;
     gint j;
-    gchar *tmp_str = NULL;
-    mutil_make_rule_t *new_rule = NULL;
-    mutil_make_rule_t *default_rule = NULL;
-    mutil_make_rule_t *replay_gain_rule = NULL;
+    mutil_job_t *track_job;
+    mutil_job_t *replay_gain_job;
     gchar *replay_gain_filename = NULL;
-    GString *replay_gain_command = NULL;
     gchar *formatter = NULL;
     gint track_cnt;
     gchar const *title_text;
-    gchar const *track_filename;
     gchar *target_filename = NULL;
-    gchar *encode_command = NULL;
-    gchar *decode_command = NULL;
+    GTree *dedup_map = NULL;
+    mutil_dedup_entry_t *dedup_entry;
+    mutil_dedup_key_t *dedup_keys = NULL;
+    mutil_dedup_key_t *dedup_key;
+    guint dedup_key_cnt = 0;
+    guint dedup_key_i = 0;
+    GThreadPool *pool;
+    gchar *content_key = NULL;
+    guint k;
+
+    g_assert(job_cnt > 0);
+    g_assert(new_job_graph == NULL);
+    new_job_graph = mutil_job_graph_alloc();
+
+    /* The content keys of all the tracks are computed at once, on up to
+     * job_cnt threads. Thread creation only fails if the system is out of
+     * resources, which is treated the same as being out of memory. */
+    if (opt_flag_dedup) {
+        for (node_i = album_list;
+             node_i != NULL;
+             node_i = node_i->next) {
+            album_i = node_i->data;
+            dedup_key_cnt += g_list_length(album_i->tracks);
+        }
+        dedup_keys = g_new0(mutil_dedup_key_t, dedup_key_cnt);
+
+        pool = g_thread_pool_new(
+                mutil_dedup_key_cb_compute,
+                NULL,
+                job_cnt,
+                FALSE,
+                NULL);
+        if (pool == NULL) {
+            abort();
+        }
 
-    g_assert(new_makefile == NULL);
-    new_makefile = mutil_makefile_alloc();
+        k = 0;
+        for (node_i = album_list;
+             node_i != NULL;
+             node_i = node_i->next) {
+            album_i = node_i->data;
+            for (node_j = album_i->tracks;
+                 node_j != NULL;
+                 node_j = node_j->next) {
+                dedup_keys[k].track = node_j->data;
+                g_thread_pool_push(pool, &dedup_keys[k], NULL);
+                k++;
+            }
+        }
 
-    /* default target: */
+        g_thread_pool_free(pool, FALSE, TRUE);
+    }
 
-    g_assert(new_rule == NULL);
-    new_rule = mutil_make_rule_alloc();
-    mutil_make_rule_append_target(new_rule, mutil_makefile_phony);
-    mutil_make_rule_append_prereq(new_rule, default_target);
-    mutil_makefile_append_rule(new_makefile, new_rule);
-    new_rule = NULL;
+    /* Recordings are identified by their content key. Only the first track of
+     * each recording is encoded. */
+    dedup_map = g_tree_new_full(
+            mutil_dedup_key_cb_compare,
+            NULL,
+            g_free,
+            g_free);
 
-    g_assert(default_rule == NULL);
-    default_rule = mutil_make_rule_alloc();
-    mutil_make_rule_append_target(default_rule, default_target);
-    
-    /* Create rules for each album. */
+    /* Create jobs for each album. */
     for (node_i = album_list;
          node_i != NULL;
          node_i = node_i->next) {
@@ -445,31 +736,24 @@ mutil_makefile_t *mutil_album_list_generate_archive_makefile(
         album_i = node_i->data;
         track_cnt = g_list_length(album_i->tracks);
 
-        /* replay gain (begin): */
-        g_assert(replay_gain_rule == NULL);
-        replay_gain_rule = mutil_make_rule_alloc();
+        /* Replay gain is computed over the whole album, after all of its
+         * tracks have been made. */
         g_free(replay_gain_filename);
         replay_gain_filename = g_strdup_printf("%s.replay_gain", album_i->name);
         mutil_convert_filename(&replay_gain_filename, TRUE, TRUE, TRUE);
-        mutil_make_rule_append_target(replay_gain_rule, replay_gain_filename);
-        mutil_make_rule_append_prereq(default_rule, replay_gain_filename);
-        g_assert(replay_gain_command == NULL);
-        replay_gain_command = g_string_new("");
-        g_string_append_printf(
-                replay_gain_command,
-                "%smetaflac --add-replay-gain",
-                opt_flag_verbose_makefile ? "" : "@");
-
-        /* Create rules for each archive target. */
+        replay_gain_job = mutil_job_graph_add_job(
+                new_job_graph,
+                mutil_job_type_replay_gain,
+                replay_gain_filename,
+                NULL,
+                NULL);
+
+        /* Create jobs for each archive target. */
         for (node_j = album_i->tracks, j = 1;
              node_j != NULL;
              node_j = node_j->next, j++) {
 
             track_j = node_j->data;
-            track_filename = mutil_track_get_filename(track_j);
-
-            g_assert(new_rule == NULL);
-            new_rule = mutil_make_rule_alloc();
 
             /* target: */
             g_free(formatter);
@@ -490,250 +774,185 @@ mutil_makefile_t *mutil_album_list_generate_archive_makefile(
                     title_text);
             mutil_convert_filename(&target_filename, TRUE, TRUE, TRUE);
 
-            mutil_make_rule_append_target(new_rule, target_filename);
-            mutil_make_rule_append_prereq(replay_gain_rule, target_filename);
-            mutil_make_rule_append_prereq(default_rule, target_filename);
-            g_string_append_printf(replay_gain_command, " %s", target_filename);
-
-            /* prereq: */
-            g_free(tmp_str);
-            tmp_str = g_strdup(track_filename);
+            /* dedup: */
+            g_assert(content_key == NULL);
+            if (opt_flag_dedup) {
+                dedup_key = &dedup_keys[dedup_key_i++];
+                g_assert(dedup_key->track == track_j);
+                if (dedup_key->error != NULL) {
+                    mutil_print_warning(
+                            TRUE,
+                            "%s",
+                            dedup_key->error->message);
+                    g_clear_error(&dedup_key->error);
+                }
+                content_key = dedup_key->content_key;
+                dedup_key->content_key = NULL;
+            }
 
-            mutil_make_rule_append_prereq(new_rule, tmp_str);
+            dedup_entry = content_key != NULL ?
+                g_tree_lookup(dedup_map, content_key) : NULL;
 
-            /* command: */
-            if (!opt_flag_verbose_makefile) {
+            if (dedup_entry != NULL) {
 
-                g_free(tmp_str);
-                tmp_str = g_strdup_printf(
-                        "@echo %s",
-                        target_filename);
-                mutil_make_rule_append_command(new_rule, tmp_str);
-            }
+                /* Copy the first target of the recording and replace its
+                 * tags. The first target's album replay gain job waits for
+                 * the copy so that the first target isn't rewritten while
+                 * being copied, but the copy isn't part of that album. */
 
-            /* command: */
-            g_free(decode_command);
-            decode_command = mutil_track_format_decode_command(track_j);
+                track_job = mutil_job_graph_add_job(
+                        new_job_graph,
+                        mutil_job_type_copy_retag,
+                        target_filename,
+                        track_j,
+                        dedup_entry->track_job);
+                if (dedup_entry->replay_gain_job != replay_gain_job) {
+                    mutil_job_add_order_only_dependency(
+                            dedup_entry->replay_gain_job,
+                            track_job);
+                }
 
-            g_free(encode_command);
-            encode_command = mutil_track_format_archive_encode_command(
-                    track_j,
-                    target_filename,
-                    opt_flag_use_echo_e);
+                g_free(content_key);
+                content_key = NULL;
 
-            g_free(tmp_str);
-            tmp_str = g_strdup_printf(
-                    "%s%s | %s",
-                    opt_flag_verbose_makefile ? "" : "@",
-                    decode_command,
-                    encode_command);
+            } else {
 
-            mutil_make_rule_append_command(new_rule, tmp_str);
+                track_job = mutil_job_graph_add_job(
+                        new_job_graph,
+                        mutil_job_type_archive_encode,
+                        target_filename,
+                        track_j,
+                        NULL);
+                mutil_job_set_flac_level(track_job, album_i->flac_level);
+
+                if (content_key != NULL) {
+                    dedup_entry = g_malloc0(sizeof(mutil_dedup_entry_t));
+                    dedup_entry->track_job = track_job;
+                    dedup_entry->replay_gain_job = replay_gain_job;
+                    g_tree_insert(dedup_map, content_key, dedup_entry);
+                    content_key = NULL;
+                }
+            }
 
-            mutil_makefile_append_rule(new_makefile, new_rule);
-            new_rule = NULL;
+            mutil_job_add_dependency(replay_gain_job, track_job);
         }
-
-        /* replay gain (end): */
-        g_free(tmp_str);
-        tmp_str = g_strdup_printf("@echo %s", replay_gain_filename);
-        mutil_make_rule_append_command(replay_gain_rule, tmp_str);
-
-        g_free(tmp_str);
-        tmp_str = g_string_free(replay_gain_command, FALSE);
-        replay_gain_command = NULL;
-        mutil_make_rule_append_command(replay_gain_rule, tmp_str);
-        mutil_makefile_append_rule(new_makefile, replay_gain_rule);
-        replay_gain_rule = NULL;
-
-        g_assert(new_rule == NULL);
-        new_rule = mutil_make_rule_alloc();
-        mutil_make_rule_append_target(new_rule, mutil_makefile_phony);
-        mutil_make_rule_append_prereq(new_rule, replay_gain_filename);
-        mutil_makefile_append_rule(new_makefile, new_rule);
-        new_rule = NULL;
     }
 
-    mutil_makefile_prepend_rule(new_makefile, default_rule);
-    default_rule = NULL;
-
     /* Clean up. */
 
-    mutil_make_rule_free(new_rule);
-    mutil_make_rule_free(default_rule);
-    mutil_make_rule_free(replay_gain_rule);
-    g_free(tmp_str);
     g_free(replay_gain_filename);
-    g_assert(replay_gain_command == NULL);
     g_free(formatter);
     g_free(target_filename);
-    g_free(encode_command);
-    g_free(decode_command);
+    g_tree_destroy(dedup_map);
+    g_assert(content_key == NULL);
+    g_assert(dedup_key_i == dedup_key_cnt);
+    g_free(dedup_keys);
 
-    g_assert(new_makefile != NULL);
-    return new_makefile;
-} /* mutil_album_list_generate_archive_makefile */
+    g_assert(new_job_graph != NULL);
+    return new_job_graph;
+} /* mutil_album_list_create_archive_job_graph */
 
-mutil_makefile_t *mutil_album_list_generate_oggify_makefile(
+mutil_job_graph_t *mutil_album_list_create_oggify_job_graph(
         GList *album_list,
-        gboolean opt_flag_verbose_makefile,
-        gboolean opt_flag_use_echo_e)
+        guint const *ogg_bitrates,
+        guint ogg_bitrate_cnt)
 {
-    static gchar const *default_target = "all";
+    mutil_job_graph_t *new_job_graph = NULL;
+
+    new_job_graph = mutil_job_graph_alloc();
+    mutil_album_list_add_oggify_jobs(
+            album_list,
+            new_job_graph,
+            ogg_bitrates,
+            ogg_bitrate_cnt);
+
+    g_assert(new_job_graph != NULL);
+    return new_job_graph;
+} /* mutil_album_list_create_oggify_job_graph */
+
 
-    mutil_makefile_t *new_makefile = NULL;
+mutil_job_graph_t *mutil_album_list_create_replay_gain_job_graph(
+        GList *album_list)
+{
+    mutil_job_graph_t *new_job_graph = NULL;
     GList *node_i;
     mutil_album_t *album_i;
     GList *node_j;
     mutil_track_t *track_j;
-    gint j;
-    gint track_cnt;
-    mutil_make_rule_t *new_rule = NULL;
-    mutil_make_rule_t *default_rule = NULL;
-    gchar const *title_text;
-    gchar *tmp_str = NULL;
-    gchar *dir_name = NULL;
-    gchar *formatter = NULL;
-    gchar *target_filename = NULL;
-    gchar *target_basename = NULL;
-    gchar *decode_command = NULL;
-    gchar *encode_command = NULL;
-
-    g_assert(new_makefile == NULL);
-    new_makefile = mutil_makefile_alloc();
-
-    /* default target: */
+    mutil_job_t *track_job;
+    mutil_job_t *replay_gain_job;
+    gchar *replay_gain_filename = NULL;
+    guint flac_track_cnt;
 
-    g_assert(new_rule == NULL);
-    new_rule = mutil_make_rule_alloc();
-    mutil_make_rule_append_target(new_rule, mutil_makefile_phony);
-    mutil_make_rule_append_prereq(new_rule, default_target);
-    mutil_makefile_append_rule(new_makefile, new_rule);
-    new_rule = NULL;
+    g_assert(new_job_graph == NULL);
+    new_job_graph = mutil_job_graph_alloc();
 
-    g_assert(default_rule == NULL);
-    default_rule = mutil_make_rule_alloc();
-    mutil_make_rule_append_target(default_rule, default_target);
-    
-    /* Create rules for each album. */
+    /* Create jobs for each album. */
     for (node_i = album_list;
          node_i != NULL;
          node_i = node_i->next) {
 
         album_i = node_i->data;
-        track_cnt = g_list_length(album_i->tracks);
-
-        /* directory creation: */
-        g_assert(new_rule == NULL);
-        new_rule = mutil_make_rule_alloc();
-        g_free(dir_name);
-        dir_name = g_strdup(album_i->name);
-        mutil_convert_filename(&dir_name, TRUE, FALSE, FALSE);
-        mutil_make_rule_append_target(new_rule, dir_name);
-        g_free(tmp_str);
-        tmp_str = g_strdup_printf(
-                "%smkdir -p \"$@\"",
-                opt_flag_verbose_makefile ? "" : "@");
-        mutil_make_rule_append_command(new_rule, tmp_str);
-        mutil_makefile_append_rule(new_makefile, new_rule);
-        new_rule = NULL;
 
-        mutil_make_rule_append_prereq(default_rule, dir_name);
-
-        /* Create rules for each ogg target. */
-        for (node_j = album_i->tracks, j = 1;
+        /* An album without FLAC files has nothing to tag, and would give
+         * its recipe no file arguments. */
+        flac_track_cnt = 0;
+        for (node_j = album_i->tracks;
              node_j != NULL;
-             node_j = node_j->next, j++) {
+             node_j = node_j->next) {
 
             track_j = node_j->data;
 
-            g_assert(new_rule == NULL);
-            new_rule = mutil_make_rule_alloc();
-
-            /* target: */
-
-            title_text = mutil_track_get_first_tag_value_by_name(
-                    track_j,
-                    mutil_tag_title);
-
-            g_free(formatter);
-            formatter = g_strdup_printf(
-                    "%%0%dd - %%s.ogg",
-                    (gint) log10(track_cnt) + 1);
-
-            g_free(target_basename);
-            target_basename = g_strdup_printf(
-                    formatter,
-                    j,
-                    title_text);
-            mutil_convert_filename(&target_basename, TRUE, FALSE, FALSE);
-
-            g_free(target_filename);
-            target_filename = g_strdup_printf(
-                    "%s/%s",
-                    dir_name,
-                    target_basename);
-
-            mutil_make_rule_append_target(new_rule, target_filename);
-            mutil_make_rule_append_prereq(default_rule, target_filename);
-
-            /* prereq: */
-
-            mutil_make_rule_append_prereq(
-                    new_rule,
-                    mutil_track_get_filename(track_j));
-
-            /* command: */
-
-            if (!opt_flag_verbose_makefile) {
-                g_free(tmp_str);
-                tmp_str = g_strdup("@echo \"$@\"");
-                mutil_make_rule_append_command(new_rule, tmp_str);
+            if (mutil_track_get_audio_type(track_j) != mutil_audio_type_flac) {
+                mutil_print_warning(
+                        TRUE,
+                        "skipping '%s', which isn't a FLAC file",
+                        mutil_track_get_filename(track_j));
+            } else {
+                flac_track_cnt++;
             }
+        }
+        if (flac_track_cnt == 0) {
+            continue;
+        }
 
-            g_free(decode_command);
-            decode_command = mutil_track_format_decode_command(track_j);
-
-            g_free(encode_command);
-            encode_command = mutil_track_format_ogg_encode_command(
-                    track_j,
-                    target_filename,
-                    opt_flag_use_echo_e);
-
-            g_free(tmp_str);
-            tmp_str = g_strdup_printf(
-                    "%s%s | %s",
-                    opt_flag_verbose_makefile ? "" : "@",
-                    decode_command,
-                    encode_command);
+        /* The tracks are measured concurrently, and the album's gain is
+         * computed once all of them have been. */
+        g_free(replay_gain_filename);
+        replay_gain_filename = g_strdup_printf("%s.replay_gain", album_i->name);
+        mutil_convert_filename(&replay_gain_filename, TRUE, TRUE, TRUE);
+        replay_gain_job = mutil_job_graph_add_job(
+                new_job_graph,
+                mutil_job_type_replay_gain,
+                replay_gain_filename,
+                NULL,
+                NULL);
+
+        for (node_j = album_i->tracks;
+             node_j != NULL;
+             node_j = node_j->next) {
 
-            mutil_make_rule_append_command(new_rule, tmp_str);
+            track_j = node_j->data;
 
-            mutil_makefile_append_rule(new_makefile, new_rule);
-            new_rule = NULL;
+            if (mutil_track_get_audio_type(track_j) == mutil_audio_type_flac) {
+                track_job = mutil_job_graph_add_job(
+                        new_job_graph,
+                        mutil_job_type_measure_loudness,
+                        mutil_track_get_filename(track_j),
+                        track_j,
+                        NULL);
+                mutil_job_add_dependency(replay_gain_job, track_job);
+            }
         }
     }
 
-    /* TODO */
-
-    mutil_makefile_prepend_rule(new_makefile, default_rule);
-    default_rule = NULL;
-
     /* Clean up. */
 
-    mutil_make_rule_free(new_rule);
-    mutil_make_rule_free(default_rule);
-    g_free(tmp_str);
-    g_free(dir_name);
-    g_free(formatter);
-    g_free(target_filename);
-    g_free(target_basename);
-    g_free(decode_command);
-    g_free(encode_command);
+    g_free(replay_gain_filename);
 
-    g_assert(new_makefile != NULL);
-    return new_makefile;
-} /* mutil_album_list_generate_oggify_makefile */
+    g_assert(new_job_graph != NULL);
+    return new_job_graph;
+} /* mutil_album_list_create_replay_gain_job_graph */
 
 gint mutil_album_sanity_check(
         mutil_album_t *album,
@@ -852,6 +1071,32 @@ void mutil_convert_filename(
     return;
 } /* mutil_convert_filename */
 
+gint mutil_dedup_key_cb_compare(
+        gconstpointer a,
+        gconstpointer b,
+        gpointer user_data)
+{
+    return strcmp(a, b);
+} /* mutil_dedup_key_cb_compare */
+
+void mutil_dedup_key_cb_compute(
+        gpointer data,
+        gpointer user_data)
+{
+    mutil_dedup_key_t *dedup_key = data;
+
+    g_assert(dedup_key != NULL);
+    g_assert(dedup_key->content_key == NULL);
+    g_assert(dedup_key->error == NULL);
+
+    mutil_track_compute_audio_content_key(
+            dedup_key->track,
+            &dedup_key->content_key,
+            &dedup_key->error);
+
+    return;
+} /* mutil_dedup_key_cb_compute */
+
 gint mutil_sanity_check_track(
         mutil_track_t *track,
         gboolean opt_flag_enable_sanity_warnings,
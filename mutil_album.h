@@ -5,7 +5,7 @@
 #define mutil_album_h
 
 #include "mutil_common.h"
-#include "mutil_makefile.h"
+#include "mutil_job.h"
 
 struct mutil_album;
 typedef struct mutil_album mutil_album_t;
@@ -25,21 +25,53 @@ gint mutil_album_list_create_from_track_list(
         gboolean opt_flag_auto_track_no_tags,
         GError **o_error);
 
+/* Chooses the FLAC compression level of each album's archive targets with
+ * mutil_transcode_choose_flac_level(), trying up to job_cnt albums at a time,
+ * and reports the choices to stderr. */
+gint mutil_album_list_choose_flac_levels(
+        GList *album_list,
+        gdouble tolerance,
+        gint job_cnt,
+        GError **o_error);
+
 GList *mutil_album_list_create_track_list(
         GList *album_list);
 
 void mutil_album_list_free(
         GList *album_list);
 
-mutil_makefile_t *mutil_album_list_generate_archive_makefile(
+/* Creates the jobs that encode the albums' tracks to FLAC and add replay gain
+ * tags. With opt_flag_dedup, a track holding the same audio as a track earlier
+ * in the list is not encoded but copied from that track's target and
+ * retagged. The tracks' audio is identified on up to job_cnt threads. */
+mutil_job_graph_t *mutil_album_list_create_archive_job_graph(
         GList *album_list,
-        gboolean opt_flag_verbose_makefile,
-        gboolean opt_flag_use_echo_e);
+        gboolean opt_flag_dedup,
+        gint job_cnt);
 
-mutil_makefile_t *mutil_album_list_generate_oggify_makefile(
+/* Adds the jobs that encode the albums' tracks to Ogg Vorbis at each of the
+ * bitrates in kbit/s, one directory per album. With more than one bitrate, the
+ * album directories of each go under a directory named after it, such as
+ * "128kbps". Added to an archive job graph, the Ogg jobs of a track and its
+ * FLAC job are run together, decoding the track once for all of them. */
+void mutil_album_list_add_oggify_jobs(
         GList *album_list,
-        gboolean opt_flag_verbose_makefile,
-        gboolean opt_flag_use_echo_e);
+        mutil_job_graph_t *job_graph,
+        guint const *ogg_bitrates,
+        guint ogg_bitrate_cnt);
+
+/* Creates the jobs of mutil_album_list_add_oggify_jobs() in a graph of their
+ * own. */
+mutil_job_graph_t *mutil_album_list_create_oggify_job_graph(
+        GList *album_list,
+        guint const *ogg_bitrates,
+        guint ogg_bitrate_cnt);
+
+/* Creates the jobs that measure the loudness of the albums' FLAC files and
+ * replace their replay gain tags. Tracks of other types are skipped with a
+ * warning. */
+mutil_job_graph_t *mutil_album_list_create_replay_gain_job_graph(
+        GList *album_list);
 
 #endif /* #ifndef mutil_album_h */
 
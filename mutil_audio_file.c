@@ -2,8 +2,156 @@
  */
 
 #include "mutil_audio_file.h"
+#include "mutil_cue.h"
 #include "mutil_track.h"
+#include "mutil_track_cache.h"
 #include <FLAC/all.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Number of leading file bytes needed to recognize every supported audio
+ * type. */
+#define mutil_audio_magic_sz 12
+
+/* Size of a FLAC STREAMINFO block, excluding its header. */
+#define mutil_flac_stream_info_sz 34
+
+/* Maximum number of RIFF chunks examined while looking for a WAV file's 'fmt '
+ * and 'data' chunks. */
+#define mutil_wav_max_chunk_cnt 64
+
+/* WAV format tags. */
+#define mutil_wav_format_pcm 0x0001
+#define mutil_wav_format_extensible 0xfffe
+
+/* Size of a WAVE_FORMAT_EXTENSIBLE 'fmt ' chunk, and the offset of its
+ * SubFormat GUID. */
+#define mutil_wav_extensible_fmt_sz 40
+#define mutil_wav_sub_format_offset 24
+
+/* Size of the first mapping of a FLAC file's metadata. This covers the
+ * metadata of most files, which are then read without remapping. */
+#define mutil_flac_map_initial_sz (64 * 1024)
+
+/* Size of the buffer that directory entries are read into. */
+#define mutil_dir_buffer_sz (64 * 1024)
+
+/* Size of the buffer used to read audio data for hashing. */
+#define mutil_hash_buffer_sz (256 * 1024)
+
+/* Bytes hashed at each end of a file by mutil_compute_partial_file_hash(). */
+#define mutil_partial_hash_block_sz (64 * 1024)
+
+struct mutil_audio_scan_item;
+typedef struct mutil_audio_scan_item mutil_audio_scan_item_t;
+
+struct mutil_audio_scan_walk;
+typedef struct mutil_audio_scan_walk mutil_audio_scan_walk_t;
+
+/* Files are probed on one thread pool and directories are walked on another,
+ * with each walk task pushing the files it finds straight to the probe pool.
+ * Items are added from multiple threads, so each records where it belongs in
+ * the finished track list: its push sequence number and, for files found in a
+ * directory, its path. */
+struct mutil_audio_scan {
+    GThreadPool *probe_pool;
+    GThreadPool *walk_pool;
+    mutil_track_cache_t *track_cache;
+    gint job_cnt;
+    guint64 seq_cnt;
+    GMutex mutex;
+    GCond walk_cond;
+    gint walk_pending_cnt;
+    GError *walk_error;
+    GPtrArray *items;
+    gboolean is_sort_needed;
+};
+
+/* A CUE sheet's item holds the list of its tracks instead of a track. */
+struct mutil_audio_scan_item {
+    guint64 seq;
+    gchar *filename;
+    mutil_track_t *track;
+    GList *cue_track_list;
+    GError *error;
+};
+
+/* A directory to walk, already opened by whoever found it. */
+struct mutil_audio_scan_walk {
+    guint64 seq;
+    gint dir_fd;
+    gchar *dir_name;
+};
+
+struct mutil_flac_map;
+typedef struct mutil_flac_map mutil_flac_map_t;
+
+/* A read-only mapping of the beginning of a FLAC file, grown on demand so that
+ * only the metadata blocks are mapped. */
+struct mutil_flac_map {
+    gchar const *filename;
+    gint fd;
+    gsize file_sz;
+    guint8 const *data;
+    gsize data_sz;
+};
+
+/* The MD5s of the WAV files hashed by this process, by file identity, so that
+ * each file is read once however many tracks it holds, as a CUE sheet's image
+ * does, and however many times its key is needed. A NULL MD5 is being computed
+ * by another thread, which broadcasts mutil_wav_md5_memo_cond when done. The
+ * memo lives as long as the process. */
+static GMutex mutil_wav_md5_memo_mutex;
+static GCond mutil_wav_md5_memo_cond;
+static GHashTable *mutil_wav_md5_memo;
+
+static void mutil_audio_scan_add_item(
+        mutil_audio_scan_t *audio_scan,
+        guint64 seq,
+        gchar *audio_filename);
+
+static void mutil_audio_scan_add_walk(
+        mutil_audio_scan_t *audio_scan,
+        guint64 seq,
+        gint dir_fd,
+        gchar *dir_name);
+
+static gint mutil_audio_scan_push_path(
+        mutil_audio_scan_t *audio_scan,
+        gchar const *path,
+        GError **o_error);
+
+static gint mutil_audio_scan_cb_compare_items(
+        gconstpointer a,
+        gconstpointer b);
+
+static void mutil_audio_scan_cb_probe(
+        gpointer data,
+        gpointer user_data);
+
+static void mutil_audio_scan_cb_walk(
+        gpointer data,
+        gpointer user_data);
+
+static void mutil_audio_scan_item_free(
+        mutil_audio_scan_item_t *item);
+
+static gboolean mutil_is_audio_filename(
+        gchar const *filename);
+
+static gint mutil_compute_memoized_wav_data_md5(
+        gchar const *audio_filename,
+        gchar **o_md5_text,
+        GError **o_error);
+
+static gint mutil_compute_wav_data_md5(
+        gchar const *audio_filename,
+        GChecksum *checksum,
+        GError **o_error);
 
 static mutil_track_t *mutil_create_track_from_audio_file(
         gchar const *audio_filename,
@@ -13,189 +161,429 @@ static mutil_track_t *mutil_create_track_from_audio_file__flac(
         gchar const *audio_filename,
         GError **o_error);
 
-mutil_track_t *mutil_create_track_from_audio_file(
+static gint mutil_flac_map_ensure(
+        mutil_flac_map_t *flac_map,
+        gsize end_offset,
+        GError **o_error);
+
+static gint mutil_flac_parse_vorbis_comment(
+        mutil_track_t *track,
+        guint8 const *block,
+        gsize block_sz,
+        GError **o_error);
+
+static void mutil_parse_flac_stream_info(
+        guint8 const *block,
+        mutil_stream_info_t *o_stream_info);
+
+static gint mutil_probe_audio_file(
         gchar const *audio_filename,
-        GError **o_error)
+        mutil_audio_type_t *o_audio_type,
+        mutil_stream_info_t *o_stream_info,
+        GError **o_error);
+
+static guint16 mutil_read_le16(
+        guint8 const *data);
+
+static guint32 mutil_read_le32(
+        guint8 const *data);
+
+void mutil_audio_scan_add_item(
+        mutil_audio_scan_t *audio_scan,
+        guint64 seq,
+        gchar *audio_filename)
 {
-    mutil_track_t *new_track = NULL;
+    mutil_audio_scan_item_t *new_item;
 
+    g_assert(audio_scan != NULL);
     g_assert(audio_filename != NULL);
-    g_assert(o_error == NULL || *o_error == NULL);
 
-    /* Try to extract meta-information from the audio file treating the file as
-     * supported audio file types until one works. */
+    /* Takes ownership of the filename. */
 
-    /* FLAC: */
-    if (new_track == NULL) {
-        new_track = mutil_create_track_from_audio_file__flac(
-                audio_filename,
-                NULL);
+    new_item = g_malloc0(sizeof(mutil_audio_scan_item_t));
+    new_item->seq = seq;
+    new_item->filename = audio_filename;
+
+    g_mutex_lock(&audio_scan->mutex);
+    g_ptr_array_add(audio_scan->items, new_item);
+    g_mutex_unlock(&audio_scan->mutex);
+
+    g_thread_pool_push(audio_scan->probe_pool, new_item, NULL);
+
+    return;
+} /* mutil_audio_scan_add_item */
+
+void mutil_audio_scan_add_walk(
+        mutil_audio_scan_t *audio_scan,
+        guint64 seq,
+        gint dir_fd,
+        gchar *dir_name)
+{
+    mutil_audio_scan_walk_t *new_walk;
+
+    g_assert(audio_scan != NULL);
+    g_assert(audio_scan->walk_pool != NULL);
+    g_assert(dir_fd != -1);
+    g_assert(dir_name != NULL);
+
+    /* Takes ownership of the directory descriptor and name. */
+
+    new_walk = g_malloc0(sizeof(mutil_audio_scan_walk_t));
+    new_walk->seq = seq;
+    new_walk->dir_fd = dir_fd;
+    new_walk->dir_name = dir_name;
+
+    g_mutex_lock(&audio_scan->mutex);
+    audio_scan->walk_pending_cnt++;
+    g_mutex_unlock(&audio_scan->mutex);
+
+    g_thread_pool_push(audio_scan->walk_pool, new_walk, NULL);
+
+    return;
+} /* mutil_audio_scan_add_walk */
+
+mutil_audio_scan_t *mutil_audio_scan_alloc(
+        gint job_cnt,
+        mutil_track_cache_t *track_cache)
+{
+    mutil_audio_scan_t *new_audio_scan;
+
+    g_assert(job_cnt > 0);
+
+    new_audio_scan = g_malloc0(sizeof(mutil_audio_scan_t));
+    new_audio_scan->track_cache = track_cache;
+    new_audio_scan->job_cnt = job_cnt;
+    g_mutex_init(&new_audio_scan->mutex);
+    g_cond_init(&new_audio_scan->walk_cond);
+    new_audio_scan->items = g_ptr_array_new();
+
+    /* Thread creation only fails if the system is out of resources, which is
+     * treated the same as being out of memory. */
+    new_audio_scan->probe_pool = g_thread_pool_new(
+            mutil_audio_scan_cb_probe,
+            new_audio_scan,
+            job_cnt,
+            FALSE,
+            NULL);
+    if (new_audio_scan->probe_pool == NULL) {
+        abort();
     }
 
-    /* If none of the supported audio file types worked then the file is assumed
-     * to be a "native" type and no tags are created for it. (This is the case
-     * that is used for WAV files.) */
+    return new_audio_scan;
+} /* mutil_audio_scan_alloc */
 
-    if (new_track == NULL) {
-        new_track = mutil_track_alloc(audio_filename, mutil_audio_type_native);
+gint mutil_audio_scan_cb_compare_items(
+        gconstpointer a,
+        gconstpointer b)
+{
+    mutil_audio_scan_item_t const *item_a;
+    mutil_audio_scan_item_t const *item_b;
+    guchar const *pos_a;
+    guchar const *pos_b;
+    gint ch_a;
+    gint ch_b;
+
+    /* The arguments point to elements of a pointer array. */
+    item_a = *(mutil_audio_scan_item_t const * const *) a;
+    item_b = *(mutil_audio_scan_item_t const * const *) b;
+
+    if (item_a->seq != item_b->seq) {
+        return item_a->seq < item_b->seq ? -1 : 1;
     }
 
-    g_assert(o_error == NULL || *o_error == NULL);
-    g_assert(new_track != NULL);
-    return new_track;
-} /* mutil_create_track_from_audio_file */
+    /* Files from the same directory argument are sorted by path, with '/'
+     * sorting before every other character so that a directory's files stay
+     * together ("a/b" before "a b"). */
+    pos_a = (guchar const *) item_a->filename;
+    pos_b = (guchar const *) item_b->filename;
+    while (*pos_a != '\0' && *pos_a == *pos_b) {
+        pos_a++;
+        pos_b++;
+    }
+    ch_a = *pos_a == '/' ? 1 : *pos_a;
+    ch_b = *pos_b == '/' ? 1 : *pos_b;
 
-mutil_track_t *mutil_create_track_from_audio_file__flac(
-        gchar const *audio_filename,
-        GError **o_error)
+    return ch_a - ch_b;
+} /* mutil_audio_scan_cb_compare_items */
+
+void mutil_audio_scan_cb_probe(
+        gpointer data,
+        gpointer user_data)
 {
-    mutil_track_t *new_track = NULL;
-    FLAC__Metadata_SimpleIterator *metadata_iter = NULL;
-    FLAC__bool flac_status;
-    FLAC__bool iter_done;
-    FLAC__MetadataType metadata_type;
-    FLAC__StreamMetadata *metadata_block = NULL;
-    gint comment_i;
-    mutil_tag_t *new_tag = NULL;
+    mutil_audio_scan_item_t *item = data;
+    mutil_audio_scan_t *audio_scan = user_data;
+    struct stat file_stat;
+    gint status;
 
-    g_assert(audio_filename != NULL);
-    g_assert(o_error == NULL || *o_error == NULL);
+    g_assert(item != NULL);
+    g_assert(item->track == NULL);
+    g_assert(item->error == NULL);
+    g_assert(audio_scan != NULL);
 
-    /* Open the file by attaching an metadata iterator to it. */
+    /* CUE sheets are cheap to parse and aren't cached. */
+    if (mutil_is_cue_filename(item->filename)) {
+        mutil_create_track_list_from_cue_file(
+                item->filename,
+                &item->cue_track_list,
+                &item->error);
+        return;
+    }
 
-    g_assert(metadata_iter == NULL);
-    metadata_iter = FLAC__metadata_simple_iterator_new();
-    if (metadata_iter == NULL) {
-        g_set_error(
-                o_error,
-                mutil_error_domain,
-                mutil_error_code_undefined,
-                "failed to create FLAC metadata iterator");
-        goto error_handling;
+    /* The file is stat'ed before it's opened so that a change made while the
+     * file is being probed invalidates the cache entry. */
+
+    status = -1;
+    if (audio_scan->track_cache != NULL) {
+        status = stat(item->filename, &file_stat);
     }
-    
-    flac_status = FLAC__metadata_simple_iterator_init(
-            metadata_iter,
-            audio_filename,
-            true,
-            false);
-    if (!flac_status) {
-        g_set_error(
-                o_error,
-                mutil_error_domain,
-                mutil_error_code_undefined,
-                "failed to initialize FLAC metadata iterator to file '%s'--"
-                "most likely the file cannot be opened or else is not a valid "
-                "FLAC file",
-                audio_filename);
-        goto error_handling;
+
+    if (status == 0) {
+        item->track = mutil_track_cache_look_up(
+                audio_scan->track_cache,
+                item->filename,
+                &file_stat);
     }
 
-    new_track = mutil_track_alloc(audio_filename, mutil_audio_type_flac);
+    if (item->track == NULL) {
 
-    /* Traverse all metadata blocks and retrieve ones that are Vorbis comments.
-     * */
+        item->track = mutil_create_track_from_audio_file(
+                item->filename,
+                &item->error);
 
-    do {
+        if (status == 0 && item->track != NULL) {
+            mutil_track_cache_insert(
+                    audio_scan->track_cache,
+                    &file_stat,
+                    item->track);
+        }
+    }
+
+    return;
+} /* mutil_audio_scan_cb_probe */
+
+void mutil_audio_scan_cb_walk(
+        gpointer data,
+        gpointer user_data)
+{
+    mutil_audio_scan_walk_t *walk = data;
+    mutil_audio_scan_t *audio_scan = user_data;
+    GError *local_error = NULL;
+    gchar *dir_buffer = NULL;
+    ssize_t read_sz;
+    ssize_t pos;
+    struct dirent64 const *entry;
+    guchar entry_type;
+    struct stat entry_stat;
+    gint status;
+    gint sub_dir_fd;
+    gchar *entry_filename = NULL;
+
+    g_assert(walk != NULL);
+    g_assert(audio_scan != NULL);
 
-        metadata_type = FLAC__metadata_simple_iterator_get_block_type(
-                metadata_iter);
+    /* Entries are read in bulk with getdents64() and classified by their
+     * d_type, so most entries cost no system call of their own. Symbolic links
+     * are followed for files but not directories, which can't create loops:
+     * entries of unknown or link type are stat'ed through links, and opening
+     * a directory doesn't follow them. */
 
-        if (metadata_type == FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+    dir_buffer = g_malloc(mutil_dir_buffer_sz);
 
-            if (metadata_block != NULL) {
-                FLAC__metadata_object_delete(metadata_block);
+    for (;;) {
+
+        read_sz = getdents64(walk->dir_fd, dir_buffer, mutil_dir_buffer_sz);
+        if (read_sz == -1) {
+            g_set_error(
+                    &local_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to read directory '%s': %s",
+                    walk->dir_name,
+                    g_strerror(errno));
+            goto error_handling;
+        }
+
+        if (read_sz == 0) {
+            break;
+        }
+
+        for (pos = 0; pos < read_sz; pos += entry->d_reclen) {
+
+            entry = (struct dirent64 const *) &dir_buffer[pos];
+
+            if (strcmp(entry->d_name, ".") == 0 ||
+                strcmp(entry->d_name, "..") == 0) {
+                continue;
             }
-            metadata_block = FLAC__metadata_simple_iterator_get_block(
-                    metadata_iter);
-            if (metadata_block == NULL) {
-                g_set_error(
-                        o_error,
-                        mutil_error_domain,
-                        mutil_error_code_undefined,
-                        "failed to get metadata block from file '%s'",
-                        audio_filename);
-                goto error_handling;
+
+            entry_type = entry->d_type;
+            if (entry_type == DT_UNKNOWN || entry_type == DT_LNK) {
+                status = fstatat(walk->dir_fd, entry->d_name, &entry_stat, 0);
+                if (status == -1) {
+                    continue;
+                }
+                if (S_ISREG(entry_stat.st_mode)) {
+                    entry_type = DT_REG;
+                } else if (S_ISDIR(entry_stat.st_mode)) {
+                    entry_type = DT_DIR;
+                }
             }
 
-            for (comment_i = 0;
-                 comment_i < metadata_block->data.vorbis_comment.num_comments;
-                 comment_i++) {
+            if (entry_type == DT_REG &&
+                mutil_is_audio_filename(entry->d_name)) {
 
-                g_assert(new_tag == NULL);
-                new_tag = mutil_tag_create_from_simple_assignment(
-                        (gchar const *) metadata_block->data.vorbis_comment.comments[comment_i].entry,
-                        '=',
+                g_assert(entry_filename == NULL);
+                entry_filename = g_build_filename(
+                        walk->dir_name,
+                        entry->d_name,
                         NULL);
-                if (new_tag != NULL) {
-                    mutil_track_add_tag(new_track, new_tag);
-                    new_tag = NULL;
+                mutil_audio_scan_add_item(
+                        audio_scan,
+                        walk->seq,
+                        entry_filename);
+                entry_filename = NULL;
+
+            } else if (entry_type == DT_DIR) {
+
+                sub_dir_fd = openat(
+                        walk->dir_fd,
+                        entry->d_name,
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (sub_dir_fd == -1 && (errno == ELOOP || errno == ENOTDIR)) {
+                    continue;
                 }
+                if (sub_dir_fd == -1) {
+                    g_set_error(
+                            &local_error,
+                            mutil_error_domain,
+                            mutil_error_code_undefined,
+                            "failed to open directory '%s/%s': %s",
+                            walk->dir_name,
+                            entry->d_name,
+                            g_strerror(errno));
+                    goto error_handling;
+                }
+
+                g_assert(entry_filename == NULL);
+                entry_filename = g_build_filename(
+                        walk->dir_name,
+                        entry->d_name,
+                        NULL);
+                mutil_audio_scan_add_walk(
+                        audio_scan,
+                        walk->seq,
+                        sub_dir_fd,
+                        entry_filename);
+                entry_filename = NULL;
             }
         }
+    }
 
-        iter_done = !FLAC__metadata_simple_iterator_next(metadata_iter);
-
-    } while (!iter_done);
-
-    g_assert(o_error == NULL || *o_error == NULL);
-    g_assert(new_track != NULL);
+    g_assert(local_error == NULL);
     goto cleanup;
 
 error_handling:
 
-    g_assert(o_error == NULL || *o_error != NULL);
+    g_assert(local_error != NULL);
 
-    mutil_track_free(new_track);
-    new_track = NULL;
+    /* Only the first error is reported. */
+    g_mutex_lock(&audio_scan->mutex);
+    if (audio_scan->walk_error == NULL) {
+        audio_scan->walk_error = local_error;
+        local_error = NULL;
+    }
+    g_mutex_unlock(&audio_scan->mutex);
 
 cleanup:
 
-    if (metadata_iter != NULL) {
-        FLAC__metadata_simple_iterator_delete(metadata_iter);
-    }
+    g_clear_error(&local_error);
+    g_free(entry_filename);
+    g_free(dir_buffer);
+    close(walk->dir_fd);
+    g_free(walk->dir_name);
+    g_free(walk);
 
-    if (metadata_block != NULL) {
-        FLAC__metadata_object_delete(metadata_block);
+    g_mutex_lock(&audio_scan->mutex);
+    audio_scan->walk_pending_cnt--;
+    if (audio_scan->walk_pending_cnt == 0) {
+        g_cond_broadcast(&audio_scan->walk_cond);
     }
+    g_mutex_unlock(&audio_scan->mutex);
 
-    mutil_tag_free(new_tag);
-
-    return new_track;
-} /* mutil_create_track_from_audio_file__flac */
+    return;
+} /* mutil_audio_scan_cb_walk */
 
-gint mutil_create_track_list_from_audio_files(
-        gchar const * const *audio_filenames,
-        gint audio_filename_cnt,
+gint mutil_audio_scan_finish(
+        mutil_audio_scan_t *audio_scan,
         GList **o_track_list,
         GError **o_error)
 {
     gint ret_value;
     GList *new_track_list = NULL;
-    gint audio_filename_i;
-    mutil_track_t *new_track = NULL;
+    guint i;
+    mutil_audio_scan_item_t *item_i;
 
+    g_assert(audio_scan != NULL);
+    g_assert(audio_scan->probe_pool != NULL);
     g_assert(o_track_list != NULL);
     g_assert(o_error == NULL || *o_error == NULL);
 
-    for (audio_filename_i = 0;
-         audio_filename_i < audio_filename_cnt;
-         audio_filename_i++) {
+    /* Wait for all directories to be walked. Walk tasks push more walk tasks,
+     * so the walk pool can't simply be drained. */
+    g_mutex_lock(&audio_scan->mutex);
+    while (audio_scan->walk_pending_cnt > 0) {
+        g_cond_wait(&audio_scan->walk_cond, &audio_scan->mutex);
+    }
+    g_mutex_unlock(&audio_scan->mutex);
 
-        mutil_track_free(new_track);
-        new_track = mutil_create_track_from_audio_file(
-                audio_filenames[audio_filename_i],
-                o_error);
-        if (new_track == NULL) {
+    if (audio_scan->walk_pool != NULL) {
+        g_thread_pool_free(audio_scan->walk_pool, FALSE, TRUE);
+        audio_scan->walk_pool = NULL;
+    }
+
+    /* Wait for all files to be probed. */
+    g_thread_pool_free(audio_scan->probe_pool, FALSE, TRUE);
+    audio_scan->probe_pool = NULL;
+
+    if (audio_scan->walk_error != NULL) {
+        g_propagate_error(o_error, audio_scan->walk_error);
+        audio_scan->walk_error = NULL;
+        goto error_handling;
+    }
+
+    if (audio_scan->is_sort_needed) {
+        g_ptr_array_sort(audio_scan->items, mutil_audio_scan_cb_compare_items);
+    }
+
+    /* Collect the tracks in order. The list is built backwards to avoid
+     * walking it once per track. */
+    for (i = 0; i < audio_scan->items->len; i++) {
+
+        item_i = g_ptr_array_index(audio_scan->items, i);
+
+        if (item_i->track == NULL && item_i->cue_track_list == NULL) {
+            g_assert(item_i->error != NULL);
+            g_propagate_error(o_error, item_i->error);
+            item_i->error = NULL;
             goto error_handling;
         }
 
-        new_track_list = g_list_append(new_track_list, new_track);
-        new_track = NULL;
+        if (item_i->track != NULL) {
+            new_track_list = g_list_prepend(new_track_list, item_i->track);
+            item_i->track = NULL;
+        }
+        while (item_i->cue_track_list != NULL) {
+            new_track_list = g_list_prepend(
+                    new_track_list,
+                    item_i->cue_track_list->data);
+            item_i->cue_track_list = g_list_delete_link(
+                    item_i->cue_track_list,
+                    item_i->cue_track_list);
+        }
     }
 
     g_assert(o_error == NULL || *o_error == NULL);
-    *o_track_list = new_track_list;
+    *o_track_list = g_list_reverse(new_track_list);
     new_track_list = NULL;
     ret_value = 0;
     goto cleanup;
@@ -208,46 +596,1422 @@ error_handling:
 
 cleanup:
 
-    mutil_track_free(new_track);
     mutil_track_free_list_of(new_track_list);
 
     return ret_value;
-} /* mutil_create_track_list_from_audio_files */
+} /* mutil_audio_scan_finish */
 
-gint mutil_determine_file_audio_type(
-        gchar const *audio_filename,
-        mutil_audio_type_t *o_audio_type,
+void mutil_audio_scan_free(
+        mutil_audio_scan_t *audio_scan)
+{
+    guint i;
+
+    if (audio_scan != NULL) {
+
+        /* Pending walk tasks push to the probe pool, so they must finish
+         * first. */
+
+        g_mutex_lock(&audio_scan->mutex);
+        while (audio_scan->walk_pending_cnt > 0) {
+            g_cond_wait(&audio_scan->walk_cond, &audio_scan->mutex);
+        }
+        g_mutex_unlock(&audio_scan->mutex);
+
+        if (audio_scan->walk_pool != NULL) {
+            g_thread_pool_free(audio_scan->walk_pool, FALSE, TRUE);
+        }
+
+        if (audio_scan->probe_pool != NULL) {
+            g_thread_pool_free(audio_scan->probe_pool, TRUE, TRUE);
+        }
+
+        for (i = 0; i < audio_scan->items->len; i++) {
+            mutil_audio_scan_item_free(
+                    g_ptr_array_index(audio_scan->items, i));
+        }
+        g_ptr_array_free(audio_scan->items, TRUE);
+
+        g_clear_error(&audio_scan->walk_error);
+        g_cond_clear(&audio_scan->walk_cond);
+        g_mutex_clear(&audio_scan->mutex);
+        g_free(audio_scan);
+    }
+
+    return;
+} /* mutil_audio_scan_free */
+
+void mutil_audio_scan_item_free(
+        mutil_audio_scan_item_t *item)
+{
+    if (item != NULL) {
+        g_free(item->filename);
+        mutil_track_free(item->track);
+        mutil_track_free_list_of(item->cue_track_list);
+        g_clear_error(&item->error);
+        g_free(item);
+    }
+
+    return;
+} /* mutil_audio_scan_item_free */
+
+void mutil_audio_scan_push(
+        mutil_audio_scan_t *audio_scan,
+        gchar const *audio_filename)
+{
+    g_assert(audio_scan != NULL);
+    g_assert(audio_scan->probe_pool != NULL);
+    g_assert(audio_filename != NULL);
+
+    mutil_audio_scan_add_item(
+            audio_scan,
+            audio_scan->seq_cnt++,
+            g_strdup(audio_filename));
+
+    return;
+} /* mutil_audio_scan_push */
+
+gint mutil_audio_scan_push_directory(
+        mutil_audio_scan_t *audio_scan,
+        gchar const *dir_name,
         GError **o_error)
 {
     gint ret_value;
-    mutil_track_t *new_track = NULL;
-    mutil_audio_type_t audio_type;
+    gint dir_fd;
 
-    g_assert(audio_filename != NULL);
+    g_assert(audio_scan != NULL);
+    g_assert(audio_scan->probe_pool != NULL);
+    g_assert(dir_name != NULL);
     g_assert(o_error == NULL || *o_error == NULL);
 
-    if (new_track == NULL) {
-        new_track = mutil_create_track_from_audio_file__flac(
-                audio_filename,
+    dir_fd = open(dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open directory '%s': %s",
+                dir_name,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    if (audio_scan->walk_pool == NULL) {
+        audio_scan->walk_pool = g_thread_pool_new(
+                mutil_audio_scan_cb_walk,
+                audio_scan,
+                audio_scan->job_cnt,
+                FALSE,
                 NULL);
-        if (new_track != NULL) {
-            audio_type = mutil_audio_type_flac;
+        if (audio_scan->walk_pool == NULL) {
+            abort();
         }
     }
 
-    if (new_track == NULL) {
-        audio_type = mutil_audio_type_native;
-    }
+    audio_scan->is_sort_needed = TRUE;
+    mutil_audio_scan_add_walk(
+            audio_scan,
+            audio_scan->seq_cnt++,
+            dir_fd,
+            g_strdup(dir_name));
 
     g_assert(o_error == NULL || *o_error == NULL);
-    *o_audio_type = audio_type;
     ret_value = 0;
     goto cleanup;
 
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
 cleanup:
 
-    mutil_track_free(new_track);
+    return ret_value;
+} /* mutil_audio_scan_push_directory */
+
+gint mutil_audio_scan_push_path(
+        mutil_audio_scan_t *audio_scan,
+        gchar const *path,
+        GError **o_error)
+{
+    gint ret_value;
+
+    g_assert(audio_scan != NULL);
+    g_assert(path != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+        ret_value = mutil_audio_scan_push_directory(audio_scan, path, o_error);
+    } else {
+        mutil_audio_scan_push(audio_scan, path);
+        ret_value = 0;
+    }
 
     return ret_value;
-} /* mutil_determine_file_audio_type */
+} /* mutil_audio_scan_push_path */
+
+gint mutil_compute_audio_content_key(
+        gchar const *audio_filename,
+        mutil_audio_type_t audio_type,
+        mutil_stream_info_t const *stream_info,
+        gchar **o_content_key,
+        GError **o_error)
+{
+    static guint8 const zero_md5[16];
+
+    gint ret_value;
+    gint status;
+    GString *md5_text = NULL;
+    gchar *wav_md5_text = NULL;
+    gsize byte_i;
+
+    g_assert(audio_filename != NULL);
+    g_assert(stream_info != NULL);
+    g_assert(o_content_key != NULL);
+    g_assert(*o_content_key == NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* The key is the MD5 of the decoded samples, qualified by the stream
+     * format. FLAC files store that MD5 in STREAMINFO. For WAV files, it's
+     * computed over the 'data' chunk, which for the usual 16- and 24-bit
+     * formats is the same byte sequence that FLAC hashes, so a WAV file and
+     * its FLAC encoding share a key. */
+
+    if (stream_info->sample_rate == 0 ||
+        stream_info->channels == 0 ||
+        stream_info->bits_per_sample == 0) {
+        goto success;
+    }
+
+    md5_text = g_string_new("");
+
+    switch (audio_type) {
+
+        case mutil_audio_type_flac:
+
+            /* An encoder may leave the MD5 unset. */
+            if (memcmp(stream_info->md5, zero_md5, sizeof(zero_md5)) == 0) {
+                goto success;
+            }
+
+            for (byte_i = 0; byte_i < sizeof(zero_md5); byte_i++) {
+                g_string_append_printf(
+                        md5_text,
+                        "%02x",
+                        stream_info->md5[byte_i]);
+            }
+            break;
+
+        case mutil_audio_type_native:
+
+            status = mutil_compute_memoized_wav_data_md5(
+                    audio_filename,
+                    &wav_md5_text,
+                    o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+
+            g_string_append(md5_text, wav_md5_text);
+            break;
+    }
+
+    *o_content_key = g_strdup_printf(
+            "%u:%u:%u:%s",
+            (guint) stream_info->sample_rate,
+            (guint) stream_info->channels,
+            (guint) stream_info->bits_per_sample,
+            md5_text->str);
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+    g_assert(*o_content_key == NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (md5_text != NULL) {
+        g_string_free(md5_text, TRUE);
+    }
+    g_free(wav_md5_text);
+
+    return ret_value;
+} /* mutil_compute_audio_content_key */
+
+gint mutil_compute_memoized_wav_data_md5(
+        gchar const *audio_filename,
+        gchar **o_md5_text,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    struct stat file_stat;
+    gchar *memo_key = NULL;
+    gpointer memo_value = NULL;
+    gboolean is_found;
+    GChecksum *checksum = NULL;
+
+    g_assert(audio_filename != NULL);
+    g_assert(o_md5_text != NULL);
+    g_assert(*o_md5_text == NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* A file is identified by its inode and size, as by the incremental
+     * journal, and by its modification time, so that an edit in place is
+     * seen. */
+    status = stat(audio_filename, &file_stat);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to stat file '%s': %s",
+                audio_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+    memo_key = g_strdup_printf(
+            "%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT
+            ":%" G_GINT64_FORMAT ".%09ld",
+            (guint64) file_stat.st_dev,
+            (guint64) file_stat.st_ino,
+            (guint64) file_stat.st_size,
+            (gint64) file_stat.st_mtim.tv_sec,
+            (glong) file_stat.st_mtim.tv_nsec);
+
+    /* Threads that need a file being hashed wait for its MD5 rather than
+     * read it again. */
+    g_mutex_lock(&mutil_wav_md5_memo_mutex);
+    if (mutil_wav_md5_memo == NULL) {
+        mutil_wav_md5_memo = g_hash_table_new_full(
+                g_str_hash,
+                g_str_equal,
+                g_free,
+                g_free);
+    }
+    while ((is_found = g_hash_table_lookup_extended(
+                    mutil_wav_md5_memo,
+                    memo_key,
+                    NULL,
+                    &memo_value)) &&
+           memo_value == NULL) {
+        g_cond_wait(&mutil_wav_md5_memo_cond, &mutil_wav_md5_memo_mutex);
+    }
+    if (is_found) {
+        *o_md5_text = g_strdup(memo_value);
+        g_mutex_unlock(&mutil_wav_md5_memo_mutex);
+        goto success;
+    }
+    g_hash_table_insert(mutil_wav_md5_memo, g_strdup(memo_key), NULL);
+    g_mutex_unlock(&mutil_wav_md5_memo_mutex);
+
+    checksum = g_checksum_new(G_CHECKSUM_MD5);
+    status = mutil_compute_wav_data_md5(audio_filename, checksum, o_error);
+
+    /* After a failure, the next thread to need the file tries again. */
+    g_mutex_lock(&mutil_wav_md5_memo_mutex);
+    if (status == -1) {
+        g_hash_table_remove(mutil_wav_md5_memo, memo_key);
+    } else {
+        *o_md5_text = g_strdup(g_checksum_get_string(checksum));
+        g_hash_table_replace(
+                mutil_wav_md5_memo,
+                g_strdup(memo_key),
+                g_strdup(*o_md5_text));
+    }
+    g_cond_broadcast(&mutil_wav_md5_memo_cond);
+    g_mutex_unlock(&mutil_wav_md5_memo_mutex);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (checksum != NULL) {
+        g_checksum_free(checksum);
+    }
+    g_free(memo_key);
+
+    return ret_value;
+} /* mutil_compute_memoized_wav_data_md5 */
+
+gint mutil_compute_partial_file_hash(
+        gchar const *filename,
+        gchar **o_hash,
+        GError **o_error)
+{
+    gint ret_value;
+    gint fd = -1;
+    guint8 *buffer = NULL;
+    GChecksum *checksum = NULL;
+    struct stat file_stat;
+    guint64 file_sz;
+    off_t offsets[2];
+    gsize block_sz;
+    ssize_t read_sz;
+    guint i;
+    gint status;
+
+    g_assert(filename != NULL);
+    g_assert(o_hash != NULL);
+    g_assert(*o_hash == NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open file '%s': %s",
+                filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    status = fstat(fd, &file_stat);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to stat file '%s': %s",
+                filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* Files no larger than two blocks are hashed whole, in up to two
+     * parts. */
+    file_sz = file_stat.st_size;
+    block_sz = MIN(file_sz, mutil_partial_hash_block_sz);
+    offsets[0] = 0;
+    offsets[1] = file_sz - MIN(file_sz - block_sz, block_sz);
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(checksum, (guchar const *) &file_sz, sizeof(file_sz));
+
+    buffer = g_malloc(mutil_partial_hash_block_sz);
+    for (i = 0; i < G_N_ELEMENTS(offsets); i++) {
+
+        if (i == 1) {
+            block_sz = file_sz - offsets[1];
+        }
+
+        read_sz = pread(fd, buffer, block_sz, offsets[i]);
+        if (read_sz != block_sz) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to read file '%s': %s",
+                    filename,
+                    read_sz >= 0 ? "unexpected end of file" :
+                        g_strerror(errno));
+            goto error_handling;
+        }
+
+        g_checksum_update(checksum, buffer, read_sz);
+    }
+
+    *o_hash = g_strdup(g_checksum_get_string(checksum));
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (fd != -1) {
+        close(fd);
+    }
+    if (checksum != NULL) {
+        g_checksum_free(checksum);
+    }
+    g_free(buffer);
+
+    return ret_value;
+} /* mutil_compute_partial_file_hash */
+
+gint mutil_compute_wav_data_md5(
+        gchar const *audio_filename,
+        GChecksum *checksum,
+        GError **o_error)
+{
+    gint ret_value;
+    gint fd = -1;
+    guint8 *buffer = NULL;
+    guint8 riff_header[12];
+    mutil_stream_info_t stream_info;
+    off_t data_offset = 0;
+    guint64 data_sz = 0;
+    guint64 remaining_sz;
+    ssize_t read_sz;
+    gint status;
+
+    g_assert(audio_filename != NULL);
+    g_assert(checksum != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    fd = open(audio_filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open file '%s': %s",
+                audio_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    read_sz = pread(fd, riff_header, sizeof(riff_header), 0);
+    if (read_sz != sizeof(riff_header) ||
+        memcmp(riff_header, "RIFF", 4) != 0 ||
+        memcmp(&riff_header[8], "WAVE", 4) != 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "file '%s' is not a WAV file",
+                audio_filename);
+        goto error_handling;
+    }
+
+    memset(&stream_info, 0, sizeof(stream_info));
+    status = mutil_probe_wav_chunks(fd, &stream_info, &data_offset, &data_sz);
+    if (status == -1 || data_offset == 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to find audio data in WAV file '%s'",
+                audio_filename);
+        goto error_handling;
+    }
+
+    buffer = g_malloc(mutil_hash_buffer_sz);
+    remaining_sz = data_sz;
+    while (remaining_sz > 0) {
+
+        read_sz = pread(
+                fd,
+                buffer,
+                MIN(remaining_sz, mutil_hash_buffer_sz),
+                data_offset);
+        if (read_sz <= 0) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to read file '%s': %s",
+                    audio_filename,
+                    read_sz == 0 ? "unexpected end of file" :
+                        g_strerror(errno));
+            goto error_handling;
+        }
+
+        g_checksum_update(checksum, buffer, read_sz);
+        data_offset += read_sz;
+        remaining_sz -= read_sz;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (fd != -1) {
+        close(fd);
+    }
+    g_free(buffer);
+
+    return ret_value;
+} /* mutil_compute_wav_data_md5 */
+
+mutil_track_t *mutil_create_track_from_audio_file(
+        gchar const *audio_filename,
+        GError **o_error)
+{
+    mutil_track_t *new_track = NULL;
+    mutil_audio_type_t audio_type;
+    mutil_stream_info_t stream_info;
+    gint status;
+
+    g_assert(audio_filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Only parse the metadata of a file whose header identifies it as a
+     * supported audio file type. */
+
+    status = mutil_probe_audio_file(
+            audio_filename,
+            &audio_type,
+            &stream_info,
+            NULL);
+    if (status == -1) {
+        audio_type = mutil_audio_type_native;
+        memset(&stream_info, 0, sizeof(stream_info));
+    }
+
+    /* FLAC: */
+    if (new_track == NULL && audio_type == mutil_audio_type_flac) {
+        new_track = mutil_create_track_from_audio_file__flac(
+                audio_filename,
+                NULL);
+    }
+
+    /* If none of the supported audio file types worked then the file is assumed
+     * to be a "native" type and no tags are created for it. (This is the case
+     * that is used for WAV files.) */
+
+    if (new_track == NULL) {
+        new_track = mutil_track_alloc(audio_filename, mutil_audio_type_native);
+    }
+
+    mutil_track_set_stream_info(new_track, &stream_info);
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    g_assert(new_track != NULL);
+    return new_track;
+} /* mutil_create_track_from_audio_file */
+
+mutil_track_t *mutil_create_track_from_audio_file__flac(
+        gchar const *audio_filename,
+        GError **o_error)
+{
+    mutil_track_t *new_track = NULL;
+    mutil_flac_map_t flac_map;
+    struct stat file_stat;
+    gint status;
+    gsize pos;
+    guint8 const *block_header;
+    gboolean is_last_block;
+    guint block_type;
+    gsize block_sz;
+
+    g_assert(audio_filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* The metadata blocks are walked in place in a mapping of the file rather
+     * than through libFLAC's metadata iterator, which seeks to each block and
+     * copies it onto the heap. */
+
+    memset(&flac_map, 0, sizeof(flac_map));
+    flac_map.filename = audio_filename;
+    flac_map.fd = open(audio_filename, O_RDONLY | O_CLOEXEC);
+    if (flac_map.fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open file '%s': %s",
+                audio_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    status = fstat(flac_map.fd, &file_stat);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to stat file '%s': %s",
+                audio_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+    flac_map.file_sz = file_stat.st_size;
+
+    /* Skip any ID3v2 tag preceding the FLAC stream. See
+     * mutil_probe_audio_file(). */
+
+    pos = 0;
+    status = mutil_flac_map_ensure(&flac_map, 10, NULL);
+    if (status == 0 && memcmp(flac_map.data, "ID3", 3) == 0) {
+        pos = 10 +
+            ((gsize) (flac_map.data[6] & 0x7f) << 21) +
+            ((gsize) (flac_map.data[7] & 0x7f) << 14) +
+            ((gsize) (flac_map.data[8] & 0x7f) << 7) +
+            ((gsize) (flac_map.data[9] & 0x7f)) +
+            ((flac_map.data[5] & 0x10) != 0 ? 10 : 0);
+    }
+
+    status = mutil_flac_map_ensure(&flac_map, pos + 4, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    if (memcmp(&flac_map.data[pos], "fLaC", 4) != 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "file '%s' is not a valid FLAC file",
+                audio_filename);
+        goto error_handling;
+    }
+    pos += 4;
+
+    new_track = mutil_track_alloc(audio_filename, mutil_audio_type_flac);
+
+    /* Traverse all metadata blocks and retrieve ones that are Vorbis comments.
+     * Each block starts with a 4-byte header: a last-block flag, a 7-bit block
+     * type and a 24-bit big-endian length. The audio frames start right after
+     * the last block. */
+
+    do {
+
+        status = mutil_flac_map_ensure(&flac_map, pos + 4, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+
+        block_header = &flac_map.data[pos];
+        is_last_block = (block_header[0] & 0x80) != 0 ? TRUE : FALSE;
+        block_type = block_header[0] & 0x7f;
+        block_sz =
+            ((gsize) block_header[1] << 16) |
+            ((gsize) block_header[2] << 8) |
+            ((gsize) block_header[3]);
+        pos += 4;
+
+        if (block_type == FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+
+            status = mutil_flac_map_ensure(&flac_map, pos + block_sz, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+
+            status = mutil_flac_parse_vorbis_comment(
+                    new_track,
+                    &flac_map.data[pos],
+                    block_sz,
+                    o_error);
+            if (status == -1) {
+                g_prefix_error(o_error, "file '%s': ", audio_filename);
+                goto error_handling;
+            }
+        }
+
+        pos += block_sz;
+
+    } while (!is_last_block);
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    g_assert(new_track != NULL);
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    mutil_track_free(new_track);
+    new_track = NULL;
+
+cleanup:
+
+    if (flac_map.data != NULL) {
+        munmap((gpointer) flac_map.data, flac_map.data_sz);
+    }
+
+    if (flac_map.fd != -1) {
+        close(flac_map.fd);
+    }
+
+    return new_track;
+} /* mutil_create_track_from_audio_file__flac */
+
+gint mutil_create_track_list_from_audio_files(
+        gchar const * const *audio_filenames,
+        gint audio_filename_cnt,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
+        GList **o_track_list,
+        GError **o_error)
+{
+    gint ret_value;
+    mutil_audio_scan_t *audio_scan = NULL;
+    gint audio_filename_i;
+    gint status;
+
+    g_assert(o_track_list != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    audio_scan = mutil_audio_scan_alloc(job_cnt, track_cache);
+
+    for (audio_filename_i = 0;
+         audio_filename_i < audio_filename_cnt;
+         audio_filename_i++) {
+
+        status = mutil_audio_scan_push_path(
+                audio_scan,
+                audio_filenames[audio_filename_i],
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    status = mutil_audio_scan_finish(audio_scan, o_track_list, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_audio_scan_free(audio_scan);
+
+    return ret_value;
+} /* mutil_create_track_list_from_audio_files */
+
+gint mutil_create_track_list_from_file_list(
+        gchar const *list_filename,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
+        GList **o_track_list,
+        GError **o_error)
+{
+    gint ret_value;
+    mutil_audio_scan_t *audio_scan = NULL;
+    FILE *list_file = NULL;
+    gchar *line = NULL;
+    gsize line_alloc_sz = 0;
+    ssize_t line_sz;
+    gint status;
+
+    g_assert(list_filename != NULL);
+    g_assert(o_track_list != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (strcmp(list_filename, "-") == 0) {
+        list_file = stdin;
+    } else {
+        list_file = fopen(list_filename, "r");
+        if (list_file == NULL) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to open file list '%s': %s",
+                    list_filename,
+                    g_strerror(errno));
+            goto error_handling;
+        }
+    }
+
+    audio_scan = mutil_audio_scan_alloc(job_cnt, track_cache);
+
+    /* Each filename is pushed as soon as its terminating null character is
+     * read, so probing overlaps with whatever is producing the list. */
+    for (;;) {
+
+        errno = 0;
+        line_sz = getdelim(&line, &line_alloc_sz, '\0', list_file);
+        if (line_sz == -1 && errno != 0) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to read file list '%s': %s",
+                    list_filename,
+                    g_strerror(errno));
+            goto error_handling;
+        }
+
+        if (line_sz == -1) {
+            break;
+        }
+
+        /* The last filename needn't be terminated. */
+        if (line_sz > 0 && line[line_sz - 1] == '\0') {
+            line_sz--;
+        }
+
+        if (line_sz == 0) {
+            continue;
+        }
+
+        status = mutil_audio_scan_push_path(audio_scan, line, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    status = mutil_audio_scan_finish(audio_scan, o_track_list, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_audio_scan_free(audio_scan);
+
+    if (list_file != NULL && list_file != stdin) {
+        fclose(list_file);
+    }
+
+    free(line);
+
+    return ret_value;
+} /* mutil_create_track_list_from_file_list */
+
+gint mutil_determine_file_audio_type(
+        gchar const *audio_filename,
+        mutil_audio_type_t *o_audio_type,
+        mutil_stream_info_t *o_stream_info,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_stream_info_t stream_info;
+
+    g_assert(audio_filename != NULL);
+    g_assert(o_audio_type != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* A file that can't be read is assumed to be "native" so that the failure
+     * is reported when the file is used, same as for any other native file. */
+    status = mutil_probe_audio_file(
+            audio_filename,
+            o_audio_type,
+            &stream_info,
+            NULL);
+    if (status == -1) {
+        *o_audio_type = mutil_audio_type_native;
+        memset(&stream_info, 0, sizeof(stream_info));
+    }
+
+    if (o_stream_info != NULL) {
+        *o_stream_info = stream_info;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+
+    return ret_value;
+} /* mutil_determine_file_audio_type */
+
+gint mutil_flac_map_ensure(
+        mutil_flac_map_t *flac_map,
+        gsize end_offset,
+        GError **o_error)
+{
+    gint ret_value;
+    gsize new_data_sz;
+    gpointer new_data;
+
+    g_assert(flac_map != NULL);
+    g_assert(flac_map->fd != -1);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (end_offset <= flac_map->data_sz) {
+        ret_value = 0;
+        goto cleanup;
+    }
+
+    if (end_offset > flac_map->file_sz) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "file '%s' ends in the middle of its FLAC metadata",
+                flac_map->filename);
+        goto error_handling;
+    }
+
+    /* Grow the mapping geometrically to bound the number of remappings, but
+     * never past the end of the file. Pages of blocks that are skipped, such
+     * as pictures, are mapped but never touched. */
+    new_data_sz = MAX(end_offset, 2 * flac_map->data_sz);
+    new_data_sz = MAX(new_data_sz, mutil_flac_map_initial_sz);
+    new_data_sz = MIN(new_data_sz, flac_map->file_sz);
+
+    if (flac_map->data == NULL) {
+        new_data = mmap(
+                NULL,
+                new_data_sz,
+                PROT_READ,
+                MAP_PRIVATE,
+                flac_map->fd,
+                0);
+    } else {
+        new_data = mremap(
+                (gpointer) flac_map->data,
+                flac_map->data_sz,
+                new_data_sz,
+                MREMAP_MAYMOVE);
+    }
+
+    if (new_data == MAP_FAILED) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to map file '%s': %s",
+                flac_map->filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    flac_map->data = new_data;
+    flac_map->data_sz = new_data_sz;
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_flac_map_ensure */
+
+gint mutil_flac_parse_vorbis_comment(
+        mutil_track_t *track,
+        guint8 const *block,
+        gsize block_sz,
+        GError **o_error)
+{
+    gint ret_value;
+    gsize pos;
+    guint32 field_sz;
+    guint32 comment_cnt;
+    guint32 comment_i;
+    mutil_tag_t *new_tag = NULL;
+
+    g_assert(track != NULL);
+    g_assert(block != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* A Vorbis comment block is a length-prefixed vendor string followed by a
+     * count of length-prefixed "NAME=value" comments. All integers are 32-bit
+     * little-endian. The comments aren't null-terminated, so they're parsed
+     * straight out of the block using their length. */
+
+    pos = 0;
+
+    if (block_sz - pos < 4) {
+        goto error_handling;
+    }
+    field_sz = mutil_read_le32(&block[pos]);
+    pos += 4;
+    if (block_sz - pos < field_sz) {
+        goto error_handling;
+    }
+    pos += field_sz;
+
+    if (block_sz - pos < 4) {
+        goto error_handling;
+    }
+    comment_cnt = mutil_read_le32(&block[pos]);
+    pos += 4;
+
+    for (comment_i = 0; comment_i < comment_cnt; comment_i++) {
+
+        if (block_sz - pos < 4) {
+            goto error_handling;
+        }
+        field_sz = mutil_read_le32(&block[pos]);
+        pos += 4;
+        if (block_sz - pos < field_sz) {
+            goto error_handling;
+        }
+
+        g_assert(new_tag == NULL);
+        new_tag = mutil_tag_create_from_simple_assignment(
+                (gchar const *) &block[pos],
+                field_sz,
+                '=',
+                NULL);
+        if (new_tag != NULL) {
+            mutil_track_add_tag(track, new_tag);
+            mutil_tag_free(new_tag);
+            new_tag = NULL;
+        }
+
+        pos += field_sz;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_set_error(
+            o_error,
+            mutil_error_domain,
+            mutil_error_code_undefined,
+            "invalid Vorbis comment block");
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_tag_free(new_tag);
+
+    return ret_value;
+} /* mutil_flac_parse_vorbis_comment */
+
+gboolean mutil_is_audio_filename(
+        gchar const *filename)
+{
+    static gchar const *audio_suffixes[] = {
+        ".flac",
+        ".wav",
+        NULL
+    };
+
+    gchar const *dot_pos;
+    gint i;
+
+    g_assert(filename != NULL);
+
+    dot_pos = strrchr(filename, '.');
+
+    i = 0;
+    while (dot_pos != NULL &&
+           audio_suffixes[i] != NULL &&
+           g_ascii_strcasecmp(dot_pos, audio_suffixes[i]) != 0) {
+        i++;
+    }
+
+    return dot_pos != NULL && audio_suffixes[i] != NULL ? TRUE : FALSE;
+} /* mutil_is_audio_filename */
+
+void mutil_parse_flac_stream_info(
+        guint8 const *block,
+        mutil_stream_info_t *o_stream_info)
+{
+    g_assert(block != NULL);
+    g_assert(o_stream_info != NULL);
+
+    /* STREAMINFO is big-endian and packed on bit boundaries: block and frame
+     * sizes (80 bits), sample rate (20), channels - 1 (3), bits per sample - 1
+     * (5), total samples (36) and the MD5 of the unencoded audio (128). */
+
+    o_stream_info->sample_rate =
+        ((guint32) block[10] << 12) |
+        ((guint32) block[11] << 4) |
+        ((guint32) block[12] >> 4);
+    o_stream_info->channels = ((block[12] >> 1) & 0x07) + 1;
+    o_stream_info->bits_per_sample =
+        (((block[12] & 0x01) << 4) | (block[13] >> 4)) + 1;
+    o_stream_info->total_samples =
+        ((guint64) (block[13] & 0x0f) << 32) |
+        ((guint64) block[14] << 24) |
+        ((guint64) block[15] << 16) |
+        ((guint64) block[16] << 8) |
+        ((guint64) block[17]);
+    memcpy(o_stream_info->md5, &block[18], sizeof(o_stream_info->md5));
+
+    return;
+} /* mutil_parse_flac_stream_info */
+
+gint mutil_probe_audio_file(
+        gchar const *audio_filename,
+        mutil_audio_type_t *o_audio_type,
+        mutil_stream_info_t *o_stream_info,
+        GError **o_error)
+{
+    gint ret_value;
+    gint fd = -1;
+    struct stat file_stat;
+    gint status;
+    guint8 magic[mutil_audio_magic_sz];
+    guint8 flac_header[8 + mutil_flac_stream_info_sz];
+    ssize_t read_sz;
+    off_t flac_offset;
+
+    g_assert(audio_filename != NULL);
+    g_assert(o_audio_type != NULL);
+    g_assert(o_stream_info != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Only the file's header is read--no tags are parsed. Stream properties
+     * that can't be found are left zero. */
+
+    memset(o_stream_info, 0, sizeof(mutil_stream_info_t));
+
+    fd = open(audio_filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open file '%s': %s",
+                audio_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    status = fstat(fd, &file_stat);
+    if (status == 0) {
+        o_stream_info->file_sz = file_stat.st_size;
+    }
+
+    memset(magic, 0, sizeof(magic));
+    read_sz = pread(fd, magic, sizeof(magic), 0);
+    if (read_sz == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to read file '%s': %s",
+                audio_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* FLAC files may be prefixed by an ID3v2 tag, which libFLAC skips. Its
+     * size is a 28-bit "syncsafe" integer that excludes the 10-byte header and
+     * the optional 10-byte footer. */
+    flac_offset = 0;
+    if (read_sz >= 10 && memcmp(magic, "ID3", 3) == 0) {
+        flac_offset = 10 +
+            ((off_t) (magic[6] & 0x7f) << 21) +
+            ((off_t) (magic[7] & 0x7f) << 14) +
+            ((off_t) (magic[8] & 0x7f) << 7) +
+            ((off_t) (magic[9] & 0x7f)) +
+            ((magic[5] & 0x10) != 0 ? 10 : 0);
+    }
+
+    /* The STREAMINFO block always comes first, right after the 'fLaC'
+     * marker. */
+    memset(flac_header, 0, sizeof(flac_header));
+    read_sz = pread(fd, flac_header, sizeof(flac_header), flac_offset);
+    if (read_sz == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to read file '%s': %s",
+                audio_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    if (memcmp(flac_header, "fLaC", 4) == 0) {
+        *o_audio_type = mutil_audio_type_flac;
+        if (read_sz == sizeof(flac_header) &&
+            (flac_header[4] & 0x7f) == FLAC__METADATA_TYPE_STREAMINFO) {
+            mutil_parse_flac_stream_info(&flac_header[8], o_stream_info);
+        }
+    } else if (memcmp(magic, "RIFF", 4) == 0 &&
+               memcmp(&magic[8], "WAVE", 4) == 0) {
+        *o_audio_type = mutil_audio_type_native;
+        mutil_probe_wav_chunks(fd, o_stream_info, NULL, NULL);
+    } else {
+        /* Anything unrecognized is passed through as-is. */
+        *o_audio_type = mutil_audio_type_native;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    return ret_value;
+} /* mutil_probe_audio_file */
+
+gint mutil_probe_wav_chunks(
+        gint fd,
+        mutil_stream_info_t *o_stream_info,
+        off_t *o_data_offset,
+        guint64 *o_data_sz)
+{
+    static guint8 const pcm_sub_format[16] = {
+        /* KSDATAFORMAT_SUBTYPE_PCM, as stored in the file */
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+        0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+    };
+
+    gint ret_value;
+    guint8 chunk_header[8];
+    guint8 fmt_chunk[mutil_wav_extensible_fmt_sz];
+    off_t pos;
+    guint32 chunk_sz;
+    ssize_t read_sz;
+    gint chunk_i;
+    guint32 block_align = 0;
+    guint16 format_tag;
+    gboolean is_fmt_found = FALSE;
+
+    g_assert(fd != -1);
+    g_assert(o_stream_info != NULL);
+
+    /* The RIFF header is followed by chunks, each an ID and a little-endian
+     * size, padded to an even size. The 'fmt ' chunk must precede the 'data'
+     * chunk, whose size gives the number of samples. WAVE_FORMAT_EXTENSIBLE
+     * files (format tag 0xfffe) store the same fields at the same offsets,
+     * followed by a SubFormat GUID that gives the actual encoding. */
+
+    pos = 12;
+    for (chunk_i = 0; chunk_i < mutil_wav_max_chunk_cnt; chunk_i++) {
+
+        read_sz = pread(fd, chunk_header, sizeof(chunk_header), pos);
+        if (read_sz != sizeof(chunk_header)) {
+            goto error_handling;
+        }
+        chunk_sz = mutil_read_le32(&chunk_header[4]);
+        pos += sizeof(chunk_header);
+
+        if (memcmp(chunk_header, "fmt ", 4) == 0 && chunk_sz >= 16) {
+
+            memset(fmt_chunk, 0, sizeof(fmt_chunk));
+            read_sz = pread(
+                    fd,
+                    fmt_chunk,
+                    MIN(chunk_sz, sizeof(fmt_chunk)),
+                    pos);
+            if (read_sz < 16) {
+                goto error_handling;
+            }
+
+            /* Only integer PCM is supported. IEEE float and other encodings
+             * would be decoded as noise. */
+            format_tag = mutil_read_le16(&fmt_chunk[0]);
+            if (format_tag != mutil_wav_format_pcm &&
+                format_tag != mutil_wav_format_extensible) {
+                goto error_handling;
+            }
+            if (format_tag == mutil_wav_format_extensible &&
+                (read_sz < mutil_wav_extensible_fmt_sz ||
+                 memcmp(
+                     &fmt_chunk[mutil_wav_sub_format_offset],
+                     pcm_sub_format,
+                     sizeof(pcm_sub_format)) != 0)) {
+                goto error_handling;
+            }
+
+            o_stream_info->channels = mutil_read_le16(&fmt_chunk[2]);
+            o_stream_info->sample_rate = mutil_read_le32(&fmt_chunk[4]);
+            block_align = mutil_read_le16(&fmt_chunk[12]);
+            o_stream_info->bits_per_sample = mutil_read_le16(&fmt_chunk[14]);
+            is_fmt_found = TRUE;
+
+        } else if (memcmp(chunk_header, "data", 4) == 0 && is_fmt_found) {
+
+            if (block_align != 0) {
+                o_stream_info->total_samples = chunk_sz / block_align;
+            }
+            if (o_data_offset != NULL) {
+                *o_data_offset = pos;
+            }
+            if (o_data_sz != NULL) {
+                *o_data_sz = chunk_sz;
+            }
+            break;
+        }
+
+        pos += chunk_sz + (chunk_sz & 1);
+    }
+
+    if (chunk_i == mutil_wav_max_chunk_cnt) {
+        goto error_handling;
+    }
+
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_probe_wav_chunks */
+
+guint32 mutil_read_le32(
+        guint8 const *data)
+{
+    g_assert(data != NULL);
+
+    return
+        (guint32) data[0] |
+        ((guint32) data[1] << 8) |
+        ((guint32) data[2] << 16) |
+        ((guint32) data[3] << 24);
+} /* mutil_read_le32 */
+
+guint16 mutil_read_le16(
+        guint8 const *data)
+{
+    g_assert(data != NULL);
 
+    return (guint16) data[0] | ((guint16) data[1] << 8);
+} /* mutil_read_le16 */
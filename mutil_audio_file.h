@@ -5,29 +5,135 @@
 #define mutil_audio_file_h
 
 #include "mutil_common.h"
+#include <sys/types.h>
 
 /* New audio types require implementation support added to:
  *   - mutil_create_track_from_audio_file
- *   - mutil_determine_file_audio_type
+ *   - mutil_probe_audio_file
  */
 typedef enum {
     mutil_audio_type_native,
     mutil_audio_type_flac
 } mutil_audio_type_t;
 
+/* Properties of an audio stream, read from a FLAC file's STREAMINFO block or a
+ * WAV file's 'fmt ' and 'data' chunks. Unknown properties are zero, including
+ * the MD5 of the unencoded audio, which only FLAC files record. */
+typedef struct {
+    guint32 sample_rate;
+    guint32 channels;
+    guint32 bits_per_sample;
+    guint64 total_samples;
+    guint8 md5[16];
+    guint64 file_sz;
+} mutil_stream_info_t;
+
+struct mutil_audio_scan;
+typedef struct mutil_audio_scan mutil_audio_scan_t;
+
+/* See mutil_track_cache.h. */
+struct mutil_track_cache;
+typedef struct mutil_track_cache mutil_track_cache_t;
+
 /* Creates a list of mutil_track_t objects, one object for each audio file.
+ * Files are probed concurrently by up to job_cnt threads, but the tracks in the
+ * list are in the same order as the filenames. A filename may name a directory,
+ * in which case its audio files are found recursively. A filename ending in
+ * ".cue" names a CUE sheet, which stands for the tracks it describes; see
+ * mutil_cue.h. Sheets are only read when named, not found in directories, so
+ * that their images aren't also taken as tracks of their own. If track_cache
+ * isn't NULL, files that haven't changed since they were cached aren't
+ * opened.
  *
- * Returns: NULL on error.
+ * Returns: -1 on error.
  */ 
 gint mutil_create_track_list_from_audio_files(
         gchar const * const *audio_filenames,
         gint audio_filename_cnt,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
+        GList **o_track_list,
+        GError **o_error);
+
+/* Same as mutil_create_track_list_from_audio_files but reads the filenames
+ * from a file, or from standard input if the filename is "-". Filenames are
+ * separated by null characters, as output by 'find -print0', and each one is
+ * probed as soon as it's read.
+ *
+ * Returns: -1 on error.
+ */
+gint mutil_create_track_list_from_file_list(
+        gchar const *list_filename,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
         GList **o_track_list,
         GError **o_error);
 
+/* Sets *o_content_key to a string that is equal for two files only if they
+ * hold the same audio samples, or to NULL if the stream properties don't allow
+ * one to be derived. Reads the whole audio data of WAV files, once per file and
+ * process: their MD5s are memoized by inode, size and modification time. Safe
+ * to call from several threads. */
+gint mutil_compute_audio_content_key(
+        gchar const *audio_filename,
+        mutil_audio_type_t audio_type,
+        mutil_stream_info_t const *stream_info,
+        gchar **o_content_key,
+        GError **o_error);
+
+/* Sets *o_hash to a digest of the file's size and of its first and last
+ * blocks. It changes with most edits at a fraction of the cost of hashing the
+ * whole file, but misses changes confined to the middle of the file. */
+gint mutil_compute_partial_file_hash(
+        gchar const *filename,
+        gchar **o_hash,
+        GError **o_error);
+
+/* Determines the audio type and stream properties of the file from its header
+ * only. o_stream_info may be NULL. */
 gint mutil_determine_file_audio_type(
         gchar const *audio_filename,
         mutil_audio_type_t *o_audio_type,
+        mutil_stream_info_t *o_stream_info,
+        GError **o_error);
+
+/* Reads the stream properties of the WAV file open as fd, whose RIFF header
+ * has been checked, and locates its 'data' chunk. o_data_offset and o_data_sz
+ * may be NULL. Fails for files that aren't integer PCM. */
+gint mutil_probe_wav_chunks(
+        gint fd,
+        mutil_stream_info_t *o_stream_info,
+        off_t *o_data_offset,
+        guint64 *o_data_sz);
+
+/* audio scan:
+ *
+ * An audio scan probes files on a pool of worker threads. Each file starts
+ * being probed as soon as it's pushed, and the finished track list is in push
+ * order. */
+
+mutil_audio_scan_t *mutil_audio_scan_alloc(
+        gint job_cnt,
+        mutil_track_cache_t *track_cache);
+
+gint mutil_audio_scan_finish(
+        mutil_audio_scan_t *audio_scan,
+        GList **o_track_list,
+        GError **o_error);
+
+void mutil_audio_scan_free(
+        mutil_audio_scan_t *audio_scan);
+
+void mutil_audio_scan_push(
+        mutil_audio_scan_t *audio_scan,
+        gchar const *audio_filename);
+
+/* Walks the directory recursively in the background, probing each audio file
+ * (by suffix) as soon as it's found. The directory's tracks are sorted by path
+ * and take the place of the directory in push order. */
+gint mutil_audio_scan_push_directory(
+        mutil_audio_scan_t *audio_scan,
+        gchar const *dir_name,
         GError **o_error);
 
 #endif /* #ifndef mutil_audio_file_h */
@@ -2,6 +2,151 @@
  */
 
 #include "mutil_common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+gint mutil_copy_file(
+        gchar const *src_filename,
+        gchar const *tgt_filename,
+        GError **o_error)
+{
+    gint ret_value;
+    gint src_fd = -1;
+    gint tgt_fd = -1;
+    gint status;
+    struct stat src_stat;
+    off_t remaining_sz;
+    ssize_t copied_sz;
+    gboolean is_sendfile_needed = FALSE;
+
+    g_assert(src_filename != NULL);
+    g_assert(tgt_filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    src_fd = open(src_filename, O_RDONLY | O_CLOEXEC);
+    if (src_fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open file '%s': %s",
+                src_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    status = fstat(src_fd, &src_stat);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to stat file '%s': %s",
+                src_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* An existing target may be hard-linked to an output cache entry, so it's
+     * replaced rather than truncated. */
+    unlink(tgt_filename);
+    tgt_fd = open(
+            tgt_filename,
+            O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+            0666);
+    if (tgt_fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create file '%s': %s",
+                tgt_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* Share the source's blocks if the file system supports it. Otherwise copy
+     * in the kernel, falling back to sendfile() where copy_file_range() can't
+     * cross file systems. */
+
+    status = ioctl(tgt_fd, FICLONE, src_fd);
+    remaining_sz = status == 0 ? 0 : src_stat.st_size;
+    while (remaining_sz > 0) {
+
+        if (!is_sendfile_needed) {
+            copied_sz = copy_file_range(
+                    src_fd,
+                    NULL,
+                    tgt_fd,
+                    NULL,
+                    remaining_sz,
+                    0);
+            if (copied_sz == -1 &&
+                remaining_sz == src_stat.st_size &&
+                (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                 errno == EOPNOTSUPP)) {
+                is_sendfile_needed = TRUE;
+                copied_sz = sendfile(tgt_fd, src_fd, NULL, remaining_sz);
+            }
+        } else {
+            copied_sz = sendfile(tgt_fd, src_fd, NULL, remaining_sz);
+        }
+
+        if (copied_sz <= 0) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to copy file '%s' to '%s': %s",
+                    src_filename,
+                    tgt_filename,
+                    copied_sz == 0 ? "unexpected end of file" :
+                        g_strerror(errno));
+            goto error_handling;
+        }
+
+        remaining_sz -= copied_sz;
+    }
+
+    status = close(tgt_fd);
+    tgt_fd = -1;
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to write file '%s': %s",
+                tgt_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (src_fd != -1) {
+        close(src_fd);
+    }
+    if (tgt_fd != -1) {
+        close(tgt_fd);
+    }
+
+    return ret_value;
+} /* mutil_copy_file */
 
 void mutil_print_warning(
         gboolean enable_flag,
@@ -17,6 +17,14 @@ enum {
     mutil_error_code_undefined
 };
 
+/* Copies the file, sharing its blocks where the file system allows, as
+ * 'cp --reflink=auto' does. An existing tgt_filename is unlinked first, never
+ * written to. */
+gint mutil_copy_file(
+        gchar const *src_filename,
+        gchar const *tgt_filename,
+        GError **o_error);
+
 void mutil_print_warning(
         gboolean enable_flag,
         gchar const *format,
@@ -0,0 +1,636 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_cue.h"
+#include "mutil_tag.h"
+#include "mutil_track.h"
+
+/* CD frames, the unit of CUE sheet times, per second. */
+#define mutil_cue_frames_per_sec 75
+
+/* UTF-8 byte order mark, which some programs write at the start of a sheet. */
+#define mutil_cue_utf8_bom "\xef\xbb\xbf"
+
+struct mutil_cue_file;
+typedef struct mutil_cue_file mutil_cue_file_t;
+
+struct mutil_cue_track;
+typedef struct mutil_cue_track mutil_cue_track_t;
+
+/* An image named by a FILE entry. */
+struct mutil_cue_file {
+    gchar *filename;
+    mutil_audio_type_t audio_type;
+    mutil_stream_info_t stream_info;
+};
+
+/* An audio track of the sheet, with the position of its INDEX 01 once that has
+ * been read. */
+struct mutil_cue_track {
+    mutil_cue_file_t *file;
+    guint line_no;
+    mutil_track_t *track;
+    gboolean has_first_sample;
+    guint64 first_sample;
+};
+
+static void mutil_cue_file_free(
+        mutil_cue_file_t *file);
+
+static gint mutil_cue_file_open(
+        gchar const *cue_filename,
+        gchar const *image_name,
+        mutil_cue_file_t **o_file,
+        GError **o_error);
+
+static gboolean mutil_cue_parse_time(
+        gchar const *time_text,
+        guint64 *o_frame_cnt);
+
+static gchar *mutil_cue_read_token(
+        gchar const **io_pos);
+
+static void mutil_cue_track_free(
+        mutil_cue_track_t *cue_track);
+
+gint mutil_create_track_list_from_cue_file(
+        gchar const *cue_filename,
+        GList **o_track_list,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    gchar *contents = NULL;
+    gchar *utf8_contents = NULL;
+    gchar const *text;
+    gchar **lines = NULL;
+    guint line_i;
+    gchar const *pos;
+    gchar *command = NULL;
+    gchar *arg_1 = NULL;
+    gchar *arg_2 = NULL;
+    GPtrArray *files = NULL;
+    GPtrArray *cue_tracks = NULL;
+    mutil_cue_file_t *file = NULL;
+    mutil_cue_file_t *new_file = NULL;
+    mutil_cue_track_t *cue_track = NULL;
+    mutil_cue_track_t *cue_track_i;
+    mutil_cue_track_t *next_cue_track;
+    gboolean is_in_track = FALSE;
+    gchar const *tag_name;
+    gchar const *tag_value;
+    GList *album_tag_list = NULL;
+    GList *node_j;
+    mutil_tag_t *new_tag = NULL;
+    gchar *track_no_text = NULL;
+    gchar *conv_ptr;
+    gint64 track_no;
+    guint64 frame_cnt;
+    guint64 sample_cnt;
+    guint64 total_samples;
+    GList *new_track_list = NULL;
+    guint i;
+
+    g_assert(cue_filename != NULL);
+    g_assert(o_track_list != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (!g_file_get_contents(cue_filename, &contents, NULL, o_error)) {
+        goto error_handling;
+    }
+
+    /* Sheets written on Windows are often in its code page rather than
+     * UTF-8. Latin-1 is the last resort, as any bytes convert from it. */
+    text = contents;
+    if (g_str_has_prefix(text, mutil_cue_utf8_bom)) {
+        text += strlen(mutil_cue_utf8_bom);
+    }
+    if (!g_utf8_validate(text, -1, NULL)) {
+        utf8_contents = g_convert(
+                text,
+                -1,
+                "UTF-8",
+                "WINDOWS-1252",
+                NULL,
+                NULL,
+                NULL);
+        if (utf8_contents == NULL) {
+            utf8_contents = g_convert(
+                    text,
+                    -1,
+                    "UTF-8",
+                    "ISO-8859-1",
+                    NULL,
+                    NULL,
+                    NULL);
+        }
+        if (utf8_contents == NULL) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "CUE sheet '%s' isn't text",
+                    cue_filename);
+            goto error_handling;
+        }
+        text = utf8_contents;
+    }
+
+    files = g_ptr_array_new_with_free_func(
+            (GDestroyNotify) mutil_cue_file_free);
+    cue_tracks = g_ptr_array_new_with_free_func(
+            (GDestroyNotify) mutil_cue_track_free);
+
+    /* Each line is a command followed by its arguments. Commands that don't
+     * affect the tracks or their tags, such as FLAGS, PREGAP and REM
+     * COMMENT, are ignored, and so are lines after a TRACK that isn't
+     * audio. */
+
+    lines = g_strsplit(text, "\n", -1);
+    for (line_i = 0; lines[line_i] != NULL; line_i++) {
+
+        pos = lines[line_i];
+        g_free(command);
+        command = mutil_cue_read_token(&pos);
+        g_free(arg_1);
+        arg_1 = mutil_cue_read_token(&pos);
+        g_free(arg_2);
+        arg_2 = mutil_cue_read_token(&pos);
+
+        if (command == NULL) {
+            continue;
+        }
+
+        tag_name = NULL;
+        tag_value = arg_1;
+
+        if (g_ascii_strcasecmp(command, "FILE") == 0) {
+
+            if (arg_1 == NULL) {
+                goto syntax_error;
+            }
+
+            g_assert(new_file == NULL);
+            status = mutil_cue_file_open(
+                    cue_filename,
+                    arg_1,
+                    &new_file,
+                    o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+            g_ptr_array_add(files, new_file);
+            file = new_file;
+            new_file = NULL;
+            cue_track = NULL;
+
+        } else if (g_ascii_strcasecmp(command, "TRACK") == 0) {
+
+            if (file == NULL || arg_1 == NULL || arg_2 == NULL) {
+                goto syntax_error;
+            }
+
+            is_in_track = TRUE;
+            cue_track = NULL;
+
+            /* Data tracks are skipped. */
+            if (g_ascii_strcasecmp(arg_2, "AUDIO") != 0) {
+                continue;
+            }
+
+            track_no = g_ascii_strtoll(arg_1, &conv_ptr, 10);
+            if (conv_ptr == arg_1 || *conv_ptr != '\0' || track_no < 1) {
+                goto syntax_error;
+            }
+
+            cue_track = g_malloc0(sizeof(mutil_cue_track_t));
+            cue_track->file = file;
+            cue_track->line_no = line_i + 1;
+            cue_track->track = mutil_track_alloc(
+                    file->filename,
+                    file->audio_type);
+            mutil_track_set_stream_info(cue_track->track, &file->stream_info);
+            g_ptr_array_add(cue_tracks, cue_track);
+
+            g_free(track_no_text);
+            track_no_text = g_strdup_printf("%d", (gint) track_no);
+            tag_name = mutil_tag_track_no;
+            tag_value = track_no_text;
+
+        } else if (g_ascii_strcasecmp(command, "INDEX") == 0) {
+
+            if (arg_1 == NULL ||
+                arg_2 == NULL ||
+                !mutil_cue_parse_time(arg_2, &frame_cnt)) {
+                goto syntax_error;
+            }
+
+            /* INDEX 00 marks the pregap, which is left at the end of the
+             * previous track, as it is on the disc. */
+            if (cue_track != NULL &&
+                g_ascii_strtoll(arg_1, NULL, 10) == 1) {
+                cue_track->first_sample = frame_cnt *
+                    file->stream_info.sample_rate / mutil_cue_frames_per_sec;
+                cue_track->has_first_sample = TRUE;
+            }
+
+        } else if (g_ascii_strcasecmp(command, "TITLE") == 0) {
+
+            tag_name = is_in_track ? mutil_tag_title : mutil_tag_album;
+
+        } else if (g_ascii_strcasecmp(command, "PERFORMER") == 0) {
+
+            tag_name = mutil_tag_artist;
+
+        } else if (g_ascii_strcasecmp(command, "ISRC") == 0) {
+
+            tag_name = is_in_track ? mutil_tag_isrc : NULL;
+
+        } else if (g_ascii_strcasecmp(command, "REM") == 0 &&
+                   arg_1 != NULL &&
+                   g_ascii_strcasecmp(arg_1, "GENRE") == 0) {
+
+            tag_name = mutil_tag_genre;
+            tag_value = arg_2;
+
+        } else if (g_ascii_strcasecmp(command, "REM") == 0 &&
+                   arg_1 != NULL &&
+                   g_ascii_strcasecmp(arg_1, "DATE") == 0) {
+
+            tag_name = mutil_tag_date;
+            tag_value = arg_2;
+        }
+
+        /* Tags before the first TRACK apply to every track that doesn't set
+         * its own. */
+        if (tag_name != NULL && tag_value != NULL && *tag_value != '\0') {
+            g_assert(new_tag == NULL);
+            new_tag = mutil_tag_alloc(tag_name, tag_value);
+            if (!is_in_track) {
+                album_tag_list = g_list_append(album_tag_list, new_tag);
+                new_tag = NULL;
+            } else if (cue_track != NULL) {
+                mutil_track_add_tag(cue_track->track, new_tag);
+            }
+            mutil_tag_free(new_tag);
+            new_tag = NULL;
+        }
+    }
+
+    if (cue_tracks->len == 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "CUE sheet '%s' has no audio tracks",
+                cue_filename);
+        goto error_handling;
+    }
+
+    for (i = 0; i < cue_tracks->len; i++) {
+        cue_track_i = g_ptr_array_index(cue_tracks, i);
+        if (!cue_track_i->has_first_sample) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "CUE sheet '%s' line %u: track has no INDEX 01",
+                    cue_filename,
+                    cue_track_i->line_no);
+            goto error_handling;
+        }
+    }
+
+    /* A track ends where the next one of the same image starts, and the last
+     * track of an image at the image's end. */
+    for (i = 0; i < cue_tracks->len; i++) {
+
+        cue_track_i = g_ptr_array_index(cue_tracks, i);
+        next_cue_track = i + 1 < cue_tracks->len ?
+            g_ptr_array_index(cue_tracks, i + 1) : NULL;
+        total_samples = cue_track_i->file->stream_info.total_samples;
+
+        if (next_cue_track != NULL &&
+            next_cue_track->file == cue_track_i->file) {
+            if (next_cue_track->first_sample <= cue_track_i->first_sample) {
+                g_set_error(
+                        o_error,
+                        mutil_error_domain,
+                        mutil_error_code_undefined,
+                        "CUE sheet '%s' line %u: track starts before the"
+                        " previous one ends",
+                        cue_filename,
+                        next_cue_track->line_no);
+                goto error_handling;
+            }
+            sample_cnt =
+                next_cue_track->first_sample - cue_track_i->first_sample;
+        } else {
+            sample_cnt = G_MAXUINT64;
+        }
+
+        if (total_samples > 0 && cue_track_i->first_sample >= total_samples) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "CUE sheet '%s' line %u: track starts past the end of"
+                    " '%s'",
+                    cue_filename,
+                    cue_track_i->line_no,
+                    cue_track_i->file->filename);
+            goto error_handling;
+        }
+
+        mutil_track_set_range(
+                cue_track_i->track,
+                cue_track_i->first_sample,
+                sample_cnt);
+
+        for (node_j = album_tag_list;
+             node_j != NULL;
+             node_j = node_j->next) {
+            if (!mutil_track_has_tag(
+                        cue_track_i->track,
+                        mutil_tag_get_name(node_j->data))) {
+                mutil_track_add_tag(cue_track_i->track, node_j->data);
+            }
+        }
+    }
+
+    /* The list is built backwards to avoid walking it once per track. */
+    for (i = cue_tracks->len; i > 0; i--) {
+        cue_track_i = g_ptr_array_index(cue_tracks, i - 1);
+        new_track_list = g_list_prepend(new_track_list, cue_track_i->track);
+        cue_track_i->track = NULL;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    *o_track_list = new_track_list;
+    new_track_list = NULL;
+    ret_value = 0;
+    goto cleanup;
+
+syntax_error:
+
+    g_set_error(
+            o_error,
+            mutil_error_domain,
+            mutil_error_code_undefined,
+            "CUE sheet '%s' line %u: invalid %s entry",
+            cue_filename,
+            line_i + 1,
+            command);
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    g_free(contents);
+    g_free(utf8_contents);
+    g_strfreev(lines);
+    g_free(command);
+    g_free(arg_1);
+    g_free(arg_2);
+    g_free(track_no_text);
+    mutil_cue_file_free(new_file);
+    if (cue_tracks != NULL) {
+        g_ptr_array_free(cue_tracks, TRUE);
+    }
+    if (files != NULL) {
+        g_ptr_array_free(files, TRUE);
+    }
+    mutil_tag_free_list_of(album_tag_list);
+    mutil_track_free_list_of(new_track_list);
+
+    return ret_value;
+} /* mutil_create_track_list_from_cue_file */
+
+void mutil_cue_file_free(
+        mutil_cue_file_t *file)
+{
+    if (file != NULL) {
+        g_free(file->filename);
+        g_free(file);
+    }
+
+    return;
+} /* mutil_cue_file_free */
+
+gint mutil_cue_file_open(
+        gchar const *cue_filename,
+        gchar const *image_name,
+        mutil_cue_file_t **o_file,
+        GError **o_error)
+{
+    static gchar const *image_suffixes[] = {
+        ".flac",
+        ".wav",
+        NULL
+    };
+
+    gint ret_value;
+    gint status;
+    mutil_cue_file_t *new_file = NULL;
+    gchar *dir_name = NULL;
+    gchar *image_filename = NULL;
+    gchar *stem = NULL;
+    gchar *alt_filename;
+    gchar const *slash_pos;
+    gchar const *dot_pos;
+    guint i;
+
+    g_assert(cue_filename != NULL);
+    g_assert(image_name != NULL);
+    g_assert(o_file != NULL);
+    g_assert(*o_file == NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    dir_name = g_path_get_dirname(cue_filename);
+    if (g_path_is_absolute(image_name)) {
+        image_filename = g_strdup(image_name);
+    } else {
+        image_filename = g_build_filename(dir_name, image_name, NULL);
+    }
+
+    /* The image may have been compressed, or decompressed, since the sheet was
+     * written. */
+    if (!g_file_test(image_filename, G_FILE_TEST_EXISTS)) {
+        slash_pos = strrchr(image_filename, G_DIR_SEPARATOR);
+        dot_pos = strrchr(slash_pos != NULL ? slash_pos : image_filename, '.');
+        stem = dot_pos != NULL ?
+            g_strndup(image_filename, dot_pos - image_filename) :
+            g_strdup(image_filename);
+        for (i = 0; image_suffixes[i] != NULL; i++) {
+            alt_filename = g_strconcat(stem, image_suffixes[i], NULL);
+            if (g_file_test(alt_filename, G_FILE_TEST_EXISTS)) {
+                g_free(image_filename);
+                image_filename = alt_filename;
+                break;
+            }
+            g_free(alt_filename);
+        }
+    }
+
+    if (!g_file_test(image_filename, G_FILE_TEST_IS_REGULAR)) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "image '%s' of CUE sheet '%s' not found",
+                image_filename,
+                cue_filename);
+        goto error_handling;
+    }
+
+    new_file = g_malloc0(sizeof(mutil_cue_file_t));
+    new_file->filename = image_filename;
+    image_filename = NULL;
+
+    status = mutil_determine_file_audio_type(
+            new_file->filename,
+            &new_file->audio_type,
+            &new_file->stream_info,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    /* Sheet times are converted to samples at the image's sample rate. */
+    if (new_file->stream_info.sample_rate == 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "image '%s' of CUE sheet '%s' isn't a FLAC or PCM WAV file",
+                new_file->filename,
+                cue_filename);
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    *o_file = new_file;
+    new_file = NULL;
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_cue_file_free(new_file);
+    g_free(dir_name);
+    g_free(image_filename);
+    g_free(stem);
+
+    return ret_value;
+} /* mutil_cue_file_open */
+
+gboolean mutil_cue_parse_time(
+        gchar const *time_text,
+        guint64 *o_frame_cnt)
+{
+    guint minute_cnt;
+    guint sec_cnt;
+    guint frame_cnt;
+    gchar extra_ch;
+
+    g_assert(time_text != NULL);
+    g_assert(o_frame_cnt != NULL);
+
+    /* mm:ss:ff, where minutes may exceed 59. */
+    if (sscanf(
+                time_text,
+                "%u:%u:%u%c",
+                &minute_cnt,
+                &sec_cnt,
+                &frame_cnt,
+                &extra_ch) != 3 ||
+        sec_cnt >= 60 ||
+        frame_cnt >= mutil_cue_frames_per_sec) {
+        return FALSE;
+    }
+
+    *o_frame_cnt = ((guint64) minute_cnt * 60 + sec_cnt) *
+        mutil_cue_frames_per_sec + frame_cnt;
+
+    return TRUE;
+} /* mutil_cue_parse_time */
+
+gchar *mutil_cue_read_token(
+        gchar const **io_pos)
+{
+    gchar const *pos;
+    gchar const *end_pos;
+    gchar *new_token;
+
+    g_assert(io_pos != NULL);
+    g_assert(*io_pos != NULL);
+
+    pos = *io_pos;
+    while (g_ascii_isspace(*pos)) {
+        pos++;
+    }
+
+    if (*pos == '\0') {
+        *io_pos = pos;
+        return NULL;
+    }
+
+    /* A quoted token may contain spaces. An unterminated one runs to the end
+     * of the line. */
+    if (*pos == '"') {
+        pos++;
+        end_pos = strchr(pos, '"');
+        if (end_pos != NULL) {
+            new_token = g_strndup(pos, end_pos - pos);
+            pos = end_pos + 1;
+        } else {
+            new_token = g_strchomp(g_strdup(pos));
+            pos += strlen(pos);
+        }
+    } else {
+        end_pos = pos;
+        while (*end_pos != '\0' && !g_ascii_isspace(*end_pos)) {
+            end_pos++;
+        }
+        new_token = g_strndup(pos, end_pos - pos);
+        pos = end_pos;
+    }
+
+    *io_pos = pos;
+
+    return new_token;
+} /* mutil_cue_read_token */
+
+gboolean mutil_is_cue_filename(
+        gchar const *filename)
+{
+    gchar const *dot_pos;
+
+    g_assert(filename != NULL);
+
+    dot_pos = strrchr(filename, '.');
+
+    return dot_pos != NULL && g_ascii_strcasecmp(dot_pos, ".cue") == 0 ?
+        TRUE : FALSE;
+} /* mutil_is_cue_filename */
+
+void mutil_cue_track_free(
+        mutil_cue_track_t *cue_track)
+{
+    if (cue_track != NULL) {
+        mutil_track_free(cue_track->track);
+        g_free(cue_track);
+    }
+
+    return;
+} /* mutil_cue_track_free */
@@ -0,0 +1,30 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_cue_h
+#define mutil_cue_h
+
+#include "mutil_common.h"
+
+/* A CUE sheet describes the tracks of a disc ripped to a single audio file, the
+ * image. Each audio track of the sheet becomes a track with the range of the
+ * image's samples from its INDEX 01 to the next track's, so pregaps stay with
+ * the track before them. The sheet's TITLE, PERFORMER, ISRC and 'REM GENRE' and
+ * 'REM DATE' entries become tags. Images are resolved relative to the sheet,
+ * and one named "x.wav" is also looked for as "x.flac" and the other way
+ * around, as sheets often aren't updated when their image is compressed. */
+
+/* Creates a list of tracks, one for each audio track of the CUE sheet, in
+ * sheet order.
+ *
+ * Returns: -1 on error.
+ */
+gint mutil_create_track_list_from_cue_file(
+        gchar const *cue_filename,
+        GList **o_track_list,
+        GError **o_error);
+
+gboolean mutil_is_cue_filename(
+        gchar const *filename);
+
+#endif /* #ifndef mutil_cue_h */
@@ -0,0 +1,2355 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_job.h"
+#include "mutil_output_file.h"
+#include "mutil_replay_gain.h"
+#include "mutil_transcode.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct mutil_job_runner;
+typedef struct mutil_job_runner mutil_job_runner_t;
+
+struct mutil_job {
+    mutil_job_type_t type;
+    gchar *target_filename;
+    mutil_track_t *track;
+    mutil_job_t *source_job;
+    guint flac_level;
+    guint ogg_bitrate;
+    GPtrArray *dependencies;
+    GPtrArray *order_only_dependencies;
+
+    /* Run state, protected by the runner's mutex. A job's dependencies are
+     * finished before it starts, so is_made may be read without the mutex by
+     * its dependents. */
+    GPtrArray *dependents;
+    guint pending_cnt;
+    gboolean is_made;
+
+    /* Set when the job's target was made by moving and retagging the output
+     * of an earlier run for the same source. */
+    gboolean is_reused;
+
+    /* Scheduling priority: the estimated work of the job and of the longest
+     * chain of jobs waiting for it, or a negative value until computed. seq is
+     * the job's position in the graph, which breaks ties. Both are set before
+     * the run starts. */
+    gdouble priority;
+    guint seq;
+
+    /* Encode jobs reading the same file are run as a group, so that the file
+     * is decoded once for all of them. group_leader is set for each member,
+     * the leader included. The leader holds the members in group, and is
+     * pushed once group_pending_cnt of them are ready. All three are set
+     * before the run starts; group_pending_cnt is protected by the runner's
+     * mutex. */
+    mutil_job_t *group_leader;
+    GPtrArray *group;
+    guint group_pending_cnt;
+
+    /* The job's key in the journal, or NULL until computed. It's computed when
+     * the job starts, after the keys of its dependencies. Encode jobs also
+     * have an audio key, which leaves out the track's tags: a target recorded
+     * under its audio key but not under its key only needs retagging. Jobs
+     * made from tracks, and replay gain jobs, have a source key, which leaves
+     * out the target too; its journal record holds the job's last target. */
+    gchar *journal_key;
+    gchar *audio_key;
+    gchar *source_key;
+
+    /* Loudness measured while making an 'archive_encode' or
+     * 'measure_loudness' job, for the replay gain jobs of the albums its
+     * target is in. */
+    mutil_loudness_t *loudness;
+};
+
+struct mutil_job_graph {
+    GPtrArray *jobs;
+};
+
+/* The state of a job being executed. Encode jobs are begun, encoded together
+ * with the other members of their group, and ended. */
+struct mutil_job_exec {
+    mutil_job_t *job;
+    gchar *part_filename;
+    gchar const *old_filename;
+    gchar *claimed_filename;
+    gchar *cache_key;
+    gboolean is_up_to_date;
+    gboolean is_retag;
+    gboolean is_encode_needed;
+    gboolean is_journaled;
+};
+typedef struct mutil_job_exec mutil_job_exec_t;
+
+/* Files are made under a temporary name and renamed into place once complete,
+ * so that an interrupted run never leaves a partial target that looks up to
+ * date. */
+#define mutil_job_part_suffix ".part"
+
+/* Work relative to encoding the track, for jobs that read or copy a track's
+ * audio. */
+#define mutil_job_copy_work_factor 0.05
+#define mutil_job_decode_work_factor 0.2
+
+/* Jobs are pushed to the pool once all their dependencies have finished. The
+ * pool starts queued jobs highest priority first, so the encodes at the head of
+ * the longest remaining chains, such as long tracks and albums with a replay
+ * gain step still to come, are started before short ones. After
+ * the first error, finished jobs no longer push their dependents, and the
+ * run ends when the jobs already pushed have finished. */
+struct mutil_job_runner {
+    GThreadPool *pool;
+    GMutex mutex;
+    GCond cond;
+    gint running_cnt;
+    GError *error;
+    gint job_cnt;
+    mutil_journal_t *journal;
+    mutil_output_cache_t *output_cache;
+    mutil_pcm_pool_t *pcm_pool;
+    mutil_output_sync_t *output_sync;
+    GHashTable *target_set;
+    gboolean opt_flag_incremental;
+    gboolean opt_flag_verbose;
+};
+
+static mutil_job_t *mutil_job_alloc(
+        mutil_job_type_t type,
+        gchar const *target_filename,
+        mutil_track_t *track,
+        mutil_job_t *source_job);
+
+static mutil_make_rule_t *mutil_job_create_make_rule(
+        mutil_job_t *job,
+        gboolean opt_flag_verbose_makefile,
+        gboolean opt_flag_use_echo_e);
+
+static gint mutil_job_compute_output_cache_key(
+        mutil_job_t *job,
+        gchar **o_cache_key,
+        GError **o_error);
+
+static gint mutil_job_compute_journal_key(
+        mutil_job_t *job,
+        mutil_journal_t *journal,
+        gboolean opt_flag_incremental,
+        GError **o_error);
+
+static gint mutil_job_encode(
+        mutil_job_exec_t *execs,
+        guint exec_cnt,
+        guint thread_cnt,
+        mutil_pcm_pool_t *pcm_pool,
+        GError **o_error);
+
+static void mutil_job_exec_abort(
+        mutil_job_exec_t *exec);
+
+static gint mutil_job_exec_begin(
+        mutil_job_exec_t *exec,
+        mutil_journal_t *journal,
+        mutil_output_cache_t *output_cache,
+        GHashTable *target_set,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_verbose,
+        GError **o_error);
+
+static void mutil_job_exec_clear(
+        mutil_job_exec_t *exec);
+
+static gint mutil_job_exec_end(
+        mutil_job_exec_t *exec,
+        mutil_output_cache_t *output_cache,
+        mutil_output_sync_t *output_sync,
+        GError **o_error);
+
+static gint mutil_job_execute(
+        mutil_job_t *job,
+        guint thread_cnt,
+        mutil_journal_t *journal,
+        mutil_output_cache_t *output_cache,
+        mutil_pcm_pool_t *pcm_pool,
+        mutil_output_sync_t *output_sync,
+        GHashTable *target_set,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_verbose,
+        GError **o_error);
+
+static void mutil_job_free(
+        mutil_job_t *job);
+
+static gdouble mutil_job_get_priority(
+        mutil_job_t *job);
+
+static gint mutil_job_make_replay_gain(
+        mutil_job_t *job,
+        gboolean opt_flag_verbose,
+        GError **o_error);
+
+static void mutil_job_graph_form_groups(
+        mutil_job_graph_t *job_graph);
+
+static gboolean mutil_job_is_up_to_date(
+        mutil_job_t const *job,
+        mutil_journal_t *journal,
+        gboolean opt_flag_incremental);
+
+static gint mutil_job_runner_cb_compare(
+        gconstpointer a,
+        gconstpointer b,
+        gpointer user_data);
+
+static void mutil_job_runner_cb_execute(
+        gpointer data,
+        gpointer user_data);
+
+static void mutil_job_runner_push(
+        mutil_job_runner_t *runner,
+        mutil_job_t *job);
+
+static void mutil_append_quoted_filename(
+        GString *command,
+        gchar const *filename);
+
+static gint mutil_compute_track_content_key(
+        mutil_track_t *track,
+        mutil_journal_t *journal,
+        gchar **o_content_key,
+        GError **o_error);
+
+void mutil_job_add_dependency(
+        mutil_job_t *job,
+        mutil_job_t *dependency)
+{
+    g_assert(job != NULL);
+    g_assert(dependency != NULL);
+    g_assert(job != dependency);
+
+    g_ptr_array_add(job->dependencies, dependency);
+
+    return;
+} /* mutil_job_add_dependency */
+
+void mutil_job_add_order_only_dependency(
+        mutil_job_t *job,
+        mutil_job_t *dependency)
+{
+    g_assert(job != NULL);
+    g_assert(dependency != NULL);
+    g_assert(job != dependency);
+
+    g_ptr_array_add(job->order_only_dependencies, dependency);
+
+    return;
+} /* mutil_job_add_order_only_dependency */
+
+mutil_job_t *mutil_job_alloc(
+        mutil_job_type_t type,
+        gchar const *target_filename,
+        mutil_track_t *track,
+        mutil_job_t *source_job)
+{
+    mutil_job_t *new_job;
+
+    g_assert(target_filename != NULL);
+
+    new_job = g_malloc0(sizeof(mutil_job_t));
+    new_job->type = type;
+    new_job->target_filename = g_strdup(target_filename);
+    new_job->track = track != NULL ? mutil_track_copy(track) : NULL;
+    new_job->source_job = source_job;
+    new_job->flac_level = mutil_flac_level_best;
+    new_job->ogg_bitrate = mutil_ogg_bitrate_default;
+    new_job->dependencies = g_ptr_array_new();
+    new_job->order_only_dependencies = g_ptr_array_new();
+    new_job->dependents = g_ptr_array_new();
+
+    if (source_job != NULL) {
+        mutil_job_add_order_only_dependency(new_job, source_job);
+    }
+
+    return new_job;
+} /* mutil_job_alloc */
+
+mutil_make_rule_t *mutil_job_create_make_rule(
+        mutil_job_t *job,
+        gboolean opt_flag_verbose_makefile,
+        gboolean opt_flag_use_echo_e)
+{
+    mutil_make_rule_t *new_rule = NULL;
+    mutil_job_t *dependency_i;
+    guint i;
+    gchar const *silent_text;
+    gchar *decode_command = NULL;
+    gchar *encode_command = NULL;
+    gchar *tmp_str = NULL;
+    GString *command = NULL;
+
+    g_assert(job != NULL);
+
+    silent_text = opt_flag_verbose_makefile ? "" : "@";
+
+    g_assert(new_rule == NULL);
+    new_rule = mutil_make_rule_alloc();
+    mutil_make_rule_append_target(new_rule, job->target_filename);
+
+    /* prereq: */
+
+    if (job->track != NULL) {
+        mutil_make_rule_append_prereq(
+                new_rule,
+                mutil_track_get_filename(job->track));
+    }
+
+    for (i = 0; i < job->dependencies->len; i++) {
+        dependency_i = g_ptr_array_index(job->dependencies, i);
+        mutil_make_rule_append_prereq(
+                new_rule,
+                dependency_i->target_filename);
+    }
+
+    for (i = 0; i < job->order_only_dependencies->len; i++) {
+        dependency_i = g_ptr_array_index(job->order_only_dependencies, i);
+        mutil_make_rule_append_order_only_prereq(
+                new_rule,
+                dependency_i->target_filename);
+    }
+
+    /* command: */
+
+    if (!opt_flag_verbose_makefile && job->type != mutil_job_type_mkdir) {
+        mutil_make_rule_append_command(new_rule, "@echo \"$@\"");
+    }
+
+    switch (job->type) {
+
+        case mutil_job_type_mkdir:
+
+            tmp_str = g_strdup_printf("%smkdir -p \"$@\"", silent_text);
+            mutil_make_rule_append_command(new_rule, tmp_str);
+            break;
+
+        case mutil_job_type_archive_encode:
+        case mutil_job_type_ogg_encode:
+
+            decode_command = mutil_track_format_decode_command(job->track);
+            if (job->type == mutil_job_type_archive_encode) {
+                encode_command = mutil_track_format_archive_encode_command(
+                        job->track,
+                        "$@" mutil_job_part_suffix,
+                        job->flac_level,
+                        opt_flag_use_echo_e);
+            } else {
+                encode_command = mutil_track_format_ogg_encode_command(
+                        job->track,
+                        "$@" mutil_job_part_suffix,
+                        job->ogg_bitrate,
+                        opt_flag_use_echo_e);
+            }
+
+            tmp_str = g_strdup_printf(
+                    "%s%s | %s",
+                    silent_text,
+                    decode_command,
+                    encode_command);
+            mutil_make_rule_append_command(new_rule, tmp_str);
+            g_free(tmp_str);
+
+            tmp_str = g_strdup_printf(
+                    "%smv -f \"$@" mutil_job_part_suffix "\" \"$@\"",
+                    silent_text);
+            mutil_make_rule_append_command(new_rule, tmp_str);
+            break;
+
+        case mutil_job_type_copy_retag:
+
+            /* The copy shares the source's blocks where the file system
+             * allows. */
+            tmp_str = g_strdup_printf(
+                    "%scp --reflink=auto \"%s\" \"$@" mutil_job_part_suffix
+                    "\"",
+                    silent_text,
+                    job->source_job->target_filename);
+            mutil_make_rule_append_command(new_rule, tmp_str);
+            g_free(tmp_str);
+
+            encode_command = mutil_track_format_archive_retag_command(
+                    job->track,
+                    "$@" mutil_job_part_suffix,
+                    opt_flag_use_echo_e);
+            tmp_str = g_strdup_printf("%s%s", silent_text, encode_command);
+            mutil_make_rule_append_command(new_rule, tmp_str);
+            g_free(tmp_str);
+
+            tmp_str = g_strdup_printf(
+                    "%smv -f \"$@" mutil_job_part_suffix "\" \"$@\"",
+                    silent_text);
+            mutil_make_rule_append_command(new_rule, tmp_str);
+            break;
+
+        case mutil_job_type_measure_loudness:
+
+            g_assert(FALSE);
+            break;
+
+        case mutil_job_type_replay_gain:
+
+            /* Tagged by mutil itself rather than 'metaflac --add-replay-gain',
+             * which computes ReplayGain 1.0 values, so that the tags are the
+             * same as those of an in-process run. The files are all of one
+             * album, and make already runs the rules in parallel. */
+            command = g_string_new("");
+            g_string_append_printf(
+                    command,
+                    "%smutil --replay-gain --run --simple-album --no-cache "
+                    "--jobs 1",
+                    silent_text);
+            for (i = 0; i < job->dependencies->len; i++) {
+                dependency_i = g_ptr_array_index(job->dependencies, i);
+                g_string_append_c(command, ' ');
+                mutil_append_quoted_filename(
+                        command,
+                        dependency_i->target_filename);
+            }
+            tmp_str = g_string_free(command, FALSE);
+            mutil_make_rule_append_command(new_rule, tmp_str);
+            break;
+    }
+
+    g_free(tmp_str);
+    g_free(decode_command);
+    g_free(encode_command);
+
+    g_assert(new_rule != NULL);
+    return new_rule;
+} /* mutil_job_create_make_rule */
+
+gint mutil_job_encode(
+        mutil_job_exec_t *execs,
+        guint exec_cnt,
+        guint thread_cnt,
+        mutil_pcm_pool_t *pcm_pool,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_transcode_target_t *targets = NULL;
+    mutil_job_t **encode_jobs = NULL;
+    mutil_transcode_target_t *target;
+    mutil_job_t *job_i;
+    guint target_cnt = 0;
+    guint i;
+
+    g_assert(execs != NULL);
+    g_assert(thread_cnt > 0);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* The jobs left to encode share their track's file, which is decoded once
+     * for all of them. */
+
+    targets = g_new0(mutil_transcode_target_t, exec_cnt);
+    encode_jobs = g_new0(mutil_job_t *, exec_cnt);
+
+    for (i = 0; i < exec_cnt; i++) {
+        if (!execs[i].is_encode_needed) {
+            continue;
+        }
+
+        job_i = execs[i].job;
+        target = &targets[target_cnt];
+        target->track = job_i->track;
+        target->tgt_filename = execs[i].part_filename;
+        if (job_i->type == mutil_job_type_archive_encode) {
+            target->format = mutil_transcode_format_flac;
+            target->flac_level = job_i->flac_level;
+            target->opt_flag_measure_loudness = TRUE;
+        } else {
+            g_assert(job_i->type == mutil_job_type_ogg_encode);
+            target->format = mutil_transcode_format_ogg;
+            target->ogg_bitrate = job_i->ogg_bitrate;
+        }
+        encode_jobs[target_cnt] = job_i;
+        target_cnt++;
+    }
+
+    if (target_cnt == 0) {
+        goto success;
+    }
+
+    status = mutil_transcode_tracks(
+            targets,
+            target_cnt,
+            thread_cnt,
+            pcm_pool,
+            o_error);
+    if (status == -1) {
+        if (target_cnt == 1) {
+            g_prefix_error(
+                    o_error,
+                    "failed to make '%s': ",
+                    encode_jobs[0]->target_filename);
+        } else {
+            g_prefix_error(
+                    o_error,
+                    "failed to make the tracks of '%s': ",
+                    mutil_track_get_filename(encode_jobs[0]->track));
+        }
+        goto error_handling;
+    }
+
+    for (i = 0; i < target_cnt; i++) {
+        g_assert(encode_jobs[i]->loudness == NULL);
+        encode_jobs[i]->loudness = targets[i].loudness;
+        targets[i].loudness = NULL;
+    }
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    g_free(targets);
+    g_free(encode_jobs);
+
+    return ret_value;
+} /* mutil_job_encode */
+
+void mutil_job_exec_abort(
+        mutil_job_exec_t *exec)
+{
+    g_assert(exec != NULL);
+
+    /* The target itself is only replaced once complete. A reused file is put
+     * back. */
+    if (exec->part_filename != NULL) {
+        g_unlink(exec->part_filename);
+    }
+    if (exec->claimed_filename != NULL) {
+        g_rename(exec->claimed_filename, exec->old_filename);
+        g_free(exec->claimed_filename);
+        exec->claimed_filename = NULL;
+    }
+
+    return;
+} /* mutil_job_exec_abort */
+
+gint mutil_job_exec_begin(
+        mutil_job_exec_t *exec,
+        mutil_journal_t *journal,
+        mutil_output_cache_t *output_cache,
+        GHashTable *target_set,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_verbose,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_job_t *job;
+    gboolean is_cached = FALSE;
+    GError *local_error = NULL;
+
+    g_assert(exec != NULL);
+    g_assert(exec->job != NULL);
+    g_assert(journal != NULL || !opt_flag_incremental);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    job = exec->job;
+    exec->is_journaled = journal != NULL;
+
+    if (journal != NULL) {
+        status = mutil_job_compute_journal_key(
+                job,
+                journal,
+                opt_flag_incremental,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    if (mutil_job_is_up_to_date(job, journal, opt_flag_incremental)) {
+        exec->is_up_to_date = TRUE;
+        goto success;
+    }
+
+    exec->part_filename = g_strconcat(
+            job->target_filename,
+            mutil_job_part_suffix,
+            NULL);
+
+    /* Only the tags changed since the target was encoded, so its audio is
+     * kept. */
+    if (job->audio_key != NULL &&
+        mutil_journal_contains(journal, job->audio_key) &&
+        g_file_test(job->target_filename, G_FILE_TEST_IS_REGULAR)) {
+        exec->is_retag = TRUE;
+    }
+
+    /* The target was renamed, as after fixing a typo in a title or album
+     * name: the output of the same source from an earlier run is moved over
+     * and retagged. It's claimed by renaming it, so that only one job can take
+     * it, and outputs that are still targets of this run are left alone. */
+    if (!exec->is_retag &&
+        job->source_key != NULL &&
+        (job->type == mutil_job_type_archive_encode ||
+         job->type == mutil_job_type_ogg_encode)) {
+        exec->old_filename = mutil_journal_look_up(journal, job->source_key);
+    }
+    if (exec->old_filename != NULL &&
+        strcmp(exec->old_filename, job->target_filename) != 0 &&
+        !g_hash_table_contains(target_set, exec->old_filename)) {
+        exec->claimed_filename = g_strconcat(
+                exec->old_filename,
+                mutil_job_part_suffix,
+                NULL);
+        job->is_reused =
+            g_rename(exec->old_filename, exec->claimed_filename) == 0;
+        if (!job->is_reused) {
+            g_free(exec->claimed_filename);
+            exec->claimed_filename = NULL;
+        }
+    }
+
+    if (!opt_flag_verbose && job->type != mutil_job_type_mkdir) {
+        g_printf("%s\n", job->target_filename);
+    }
+
+    switch (job->type) {
+
+        case mutil_job_type_mkdir:
+
+            if (opt_flag_verbose) {
+                g_printf("mkdir -p %s\n", job->target_filename);
+            }
+
+            status = g_mkdir_with_parents(job->target_filename, 0777);
+            if (status == -1) {
+                g_set_error(
+                        o_error,
+                        mutil_error_domain,
+                        mutil_error_code_undefined,
+                        "failed to create directory '%s': %s",
+                        job->target_filename,
+                        g_strerror(errno));
+                goto error_handling;
+            }
+            break;
+
+        case mutil_job_type_archive_encode:
+
+            /* Retagged in place, within the padding reserved when it was
+             * encoded. */
+            if (exec->is_retag || job->is_reused) {
+                if (opt_flag_verbose && job->is_reused) {
+                    g_printf(
+                            "reuse %s -> %s\n",
+                            exec->old_filename,
+                            job->target_filename);
+                } else if (opt_flag_verbose) {
+                    g_printf("retag %s\n", job->target_filename);
+                }
+
+                status = mutil_transcode_retag_flac(
+                        job->track,
+                        job->is_reused ?
+                            exec->claimed_filename : job->target_filename,
+                        TRUE, /* keep replay gain */
+                        o_error);
+                if (status == -1) {
+                    goto error_handling;
+                }
+                break;
+            }
+
+            /* Transcoded in-process through libFLAC. */
+            if (opt_flag_verbose) {
+                g_printf(
+                        "flac -%u %s -> %s\n",
+                        job->flac_level,
+                        mutil_track_get_filename(job->track),
+                        job->target_filename);
+            }
+
+            exec->is_encode_needed = TRUE;
+            break;
+
+        case mutil_job_type_ogg_encode:
+
+            /* Copied with a new comment header. */
+            if (exec->is_retag || job->is_reused) {
+                if (opt_flag_verbose && job->is_reused) {
+                    g_printf(
+                            "reuse %s -> %s\n",
+                            exec->old_filename,
+                            job->target_filename);
+                } else if (opt_flag_verbose) {
+                    g_printf("retag %s\n", job->target_filename);
+                }
+
+                status = mutil_transcode_retag_ogg(
+                        job->track,
+                        job->is_reused ?
+                            exec->claimed_filename : job->target_filename,
+                        exec->part_filename,
+                        o_error);
+                if (status == -1) {
+                    goto error_handling;
+                }
+                break;
+            }
+
+            /* Linked from the output cache if the track was encoded with the
+             * same tags before. The cache is only an optimization, so
+             * problems with it aren't fatal. */
+            if (output_cache != NULL) {
+                status = mutil_job_compute_output_cache_key(
+                        job,
+                        &exec->cache_key,
+                        &local_error);
+                if (status == 0 && exec->cache_key != NULL) {
+                    status = mutil_output_cache_fetch(
+                            output_cache,
+                            exec->cache_key,
+                            exec->part_filename,
+                            &is_cached,
+                            &local_error);
+                }
+                if (status == -1) {
+                    mutil_print_warning(TRUE, "%s", local_error->message);
+                    g_clear_error(&local_error);
+                }
+            }
+
+            if (is_cached) {
+                if (opt_flag_verbose) {
+                    g_printf(
+                            "cached %s -> %s\n",
+                            mutil_track_get_filename(job->track),
+                            job->target_filename);
+                }
+                break;
+            }
+
+            /* Encoded in-process through libvorbis. */
+            if (opt_flag_verbose) {
+                g_printf(
+                        "oggenc --bitrate=%u %s -> %s\n",
+                        job->ogg_bitrate,
+                        mutil_track_get_filename(job->track),
+                        job->target_filename);
+            }
+
+            exec->is_encode_needed = TRUE;
+            break;
+
+        case mutil_job_type_copy_retag:
+
+            if (opt_flag_verbose) {
+                g_printf(
+                        "cp --reflink=auto %s %s\n",
+                        job->source_job->target_filename,
+                        job->target_filename);
+            }
+
+            status = mutil_copy_file(
+                    job->source_job->target_filename,
+                    exec->part_filename,
+                    o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+
+            /* Same as 'metaflac --remove-all-tags' followed by the track's
+             * tags, which usually fit in the copy's padding. */
+            if (opt_flag_verbose) {
+                g_printf("retag %s\n", exec->part_filename);
+            }
+
+            status = mutil_transcode_retag_flac(
+                    job->track,
+                    exec->part_filename,
+                    FALSE, /* don't keep replay gain */
+                    o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+            break;
+
+        case mutil_job_type_measure_loudness:
+
+            if (opt_flag_verbose) {
+                g_printf("measure loudness %s\n", job->target_filename);
+            }
+
+            job->loudness = mutil_loudness_analyze_file(
+                    job->target_filename,
+                    o_error);
+            if (job->loudness == NULL) {
+                goto error_handling;
+            }
+            break;
+
+        case mutil_job_type_replay_gain:
+
+            status = mutil_job_make_replay_gain(job, opt_flag_verbose, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+            break;
+    }
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+    g_prefix_error(o_error, "failed to make '%s': ", job->target_filename);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_job_exec_begin */
+
+void mutil_job_exec_clear(
+        mutil_job_exec_t *exec)
+{
+    g_assert(exec != NULL);
+
+    g_free(exec->part_filename);
+    g_free(exec->claimed_filename);
+    g_free(exec->cache_key);
+    memset(exec, 0, sizeof(mutil_job_exec_t));
+
+    return;
+} /* mutil_job_exec_clear */
+
+gint mutil_job_exec_end(
+        mutil_job_exec_t *exec,
+        mutil_output_cache_t *output_cache,
+        mutil_output_sync_t *output_sync,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_job_t *job;
+    mutil_job_t *dependency_i;
+    gchar const *made_filename = NULL;
+    GError *local_error = NULL;
+    guint i;
+
+    g_assert(exec != NULL);
+    g_assert(exec->job != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    job = exec->job;
+
+    if (exec->is_up_to_date) {
+        goto success;
+    }
+
+    /* The job is recorded in the journal once it's ended, so what it wrote
+     * must be on disk by then: a record of a target truncated by a crash would
+     * be trusted by the next run. A file is synced before it's renamed into
+     * place. A replay gain job rewrote the tags of its album's tracks. */
+    if (job->type == mutil_job_type_archive_encode && job->is_reused) {
+        made_filename = exec->claimed_filename;
+    } else if (job->type == mutil_job_type_archive_encode && exec->is_retag) {
+        made_filename = job->target_filename;
+    } else if (job->type == mutil_job_type_archive_encode ||
+               job->type == mutil_job_type_ogg_encode ||
+               job->type == mutil_job_type_copy_retag) {
+        made_filename = exec->part_filename;
+    }
+    if (exec->is_journaled && made_filename != NULL) {
+        status = mutil_output_file_sync(made_filename, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+    if (exec->is_journaled && job->type == mutil_job_type_replay_gain) {
+        for (i = 0; i < job->dependencies->len; i++) {
+            dependency_i = g_ptr_array_index(job->dependencies, i);
+            status = mutil_output_file_sync(
+                    dependency_i->target_filename,
+                    o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+        }
+    }
+
+    if (exec->is_encode_needed && exec->cache_key != NULL) {
+        status = mutil_output_cache_store(
+                output_cache,
+                exec->cache_key,
+                exec->part_filename,
+                &local_error);
+        if (status == -1) {
+            mutil_print_warning(TRUE, "%s", local_error->message);
+            g_clear_error(&local_error);
+        }
+    }
+
+    /* A reused FLAC file was retagged where it was claimed. */
+    if (job->type == mutil_job_type_archive_encode && job->is_reused) {
+        status = g_rename(exec->claimed_filename, job->target_filename);
+        if (status == -1) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to rename '%s': %s",
+                    exec->claimed_filename,
+                    g_strerror(errno));
+            goto error_handling;
+        }
+    } else if ((job->type == mutil_job_type_archive_encode &&
+                !exec->is_retag) ||
+               job->type == mutil_job_type_ogg_encode ||
+               job->type == mutil_job_type_copy_retag) {
+        status = g_rename(exec->part_filename, job->target_filename);
+        if (status == -1) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to rename '%s': %s",
+                    exec->part_filename,
+                    g_strerror(errno));
+            goto error_handling;
+        }
+    }
+
+    if (exec->claimed_filename != NULL) {
+        g_unlink(exec->claimed_filename);
+        g_free(exec->claimed_filename);
+        exec->claimed_filename = NULL;
+    }
+
+    /* The files written are synced at the end of the run. A replay gain job
+     * rewrote the tags of its album's tracks. */
+    if (output_sync != NULL) {
+        if (job->type == mutil_job_type_archive_encode ||
+            job->type == mutil_job_type_ogg_encode ||
+            job->type == mutil_job_type_copy_retag) {
+            mutil_output_sync_add(output_sync, job->target_filename);
+        } else if (job->type == mutil_job_type_replay_gain) {
+            for (i = 0; i < job->dependencies->len; i++) {
+                dependency_i = g_ptr_array_index(job->dependencies, i);
+                mutil_output_sync_add(
+                        output_sync,
+                        dependency_i->target_filename);
+            }
+        }
+    }
+
+    /* A retagged or reused target keeps its audio, so jobs measuring it
+     * needn't be remade. */
+    if (!exec->is_retag && !job->is_reused) {
+        job->is_made = TRUE;
+    }
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+    g_prefix_error(o_error, "failed to make '%s': ", job->target_filename);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_job_exec_end */
+
+gint mutil_job_execute(
+        mutil_job_t *job,
+        guint thread_cnt,
+        mutil_journal_t *journal,
+        mutil_output_cache_t *output_cache,
+        mutil_pcm_pool_t *pcm_pool,
+        mutil_output_sync_t *output_sync,
+        GHashTable *target_set,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_verbose,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_job_t **members;
+    guint member_cnt;
+    mutil_job_exec_t *execs = NULL;
+    guint i;
+
+    g_assert(job != NULL);
+    g_assert(thread_cnt > 0);
+    g_assert(journal != NULL || !opt_flag_incremental);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* A group is run as a whole: each member is checked, retagged, reused or
+     * fetched from the output cache on its own, and those left to encode are
+     * encoded together. */
+    if (job->group != NULL) {
+        members = (mutil_job_t **) job->group->pdata;
+        member_cnt = job->group->len;
+    } else {
+        members = &job;
+        member_cnt = 1;
+    }
+
+    execs = g_new0(mutil_job_exec_t, member_cnt);
+
+    for (i = 0; i < member_cnt; i++) {
+        execs[i].job = members[i];
+        status = mutil_job_exec_begin(
+                &execs[i],
+                journal,
+                output_cache,
+                target_set,
+                opt_flag_incremental,
+                opt_flag_verbose,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    status = mutil_job_encode(
+            execs,
+            member_cnt,
+            thread_cnt,
+            pcm_pool,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    for (i = 0; i < member_cnt; i++) {
+        status = mutil_job_exec_end(
+                &execs[i],
+                output_cache,
+                output_sync,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    for (i = 0; i < member_cnt; i++) {
+        mutil_job_exec_abort(&execs[i]);
+    }
+
+    ret_value = -1;
+
+cleanup:
+
+    for (i = 0; i < member_cnt; i++) {
+        mutil_job_exec_clear(&execs[i]);
+    }
+    g_free(execs);
+
+    return ret_value;
+} /* mutil_job_execute */
+
+void mutil_job_free(
+        mutil_job_t *job)
+{
+    if (job != NULL) {
+        g_free(job->target_filename);
+        mutil_track_free(job->track);
+        g_ptr_array_free(job->dependencies, TRUE);
+        g_ptr_array_free(job->order_only_dependencies, TRUE);
+        g_ptr_array_free(job->dependents, TRUE);
+        mutil_loudness_free(job->loudness);
+        g_free(job->journal_key);
+        g_free(job->audio_key);
+        g_free(job->source_key);
+        g_free(job);
+    }
+
+    return;
+} /* mutil_job_free */
+
+gint mutil_job_compute_output_cache_key(
+        mutil_job_t *job,
+        gchar **o_cache_key,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    GString *key_text = NULL;
+    GList *tag_list;
+    GList *node_i;
+    gchar *content_key = NULL;
+    gchar *settings_text = NULL;
+
+    g_assert(job != NULL);
+    g_assert(job->type == mutil_job_type_ogg_encode);
+    g_assert(o_cache_key != NULL);
+    g_assert(*o_cache_key == NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* The key covers the decoded audio, the encoder and its settings, and the
+     * tags, but not the target or the source's name, so that entries are
+     * shared between layouts and copies of the same recording. Tracks whose
+     * audio can't be identified that way aren't cached. */
+
+    status = mutil_track_compute_audio_content_key(
+            job->track,
+            &content_key,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+    if (content_key == NULL) {
+        goto success;
+    }
+
+    settings_text = mutil_transcode_describe_ogg_settings(job->ogg_bitrate);
+    key_text = g_string_new("");
+    g_string_append_printf(
+            key_text,
+            "ogg\n%s\n%s\n",
+            content_key,
+            settings_text);
+
+    tag_list = mutil_track_create_tag_list(job->track);
+    for (node_i = tag_list;
+         node_i != NULL;
+         node_i = node_i->next) {
+        g_string_append_printf(
+                key_text,
+                "%s=%s\n",
+                mutil_tag_get_name(node_i->data),
+                mutil_tag_get_value(node_i->data));
+    }
+    mutil_tag_free_list_of(tag_list);
+
+    *o_cache_key = g_compute_checksum_for_string(
+            G_CHECKSUM_SHA1,
+            key_text->str,
+            key_text->len);
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (key_text != NULL) {
+        g_string_free(key_text, TRUE);
+    }
+    g_free(content_key);
+    g_free(settings_text);
+
+    return ret_value;
+} /* mutil_job_compute_output_cache_key */
+
+gint mutil_job_compute_journal_key(
+        mutil_job_t *job,
+        mutil_journal_t *journal,
+        gboolean opt_flag_incremental,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    GChecksum *checksum = NULL;
+    GString *key_text = NULL;
+    GString *audio_text = NULL;
+    GString *source_text = NULL;
+    gsize identity_pos;
+    mutil_stream_info_t const *stream_info;
+    GList *tag_list;
+    GList *node_i;
+    mutil_job_t *dependency_i;
+    gchar *md5_text = NULL;
+    gchar *content_key = NULL;
+    struct stat src_stat;
+    guint64 first_sample;
+    guint64 sample_cnt;
+    guint i;
+
+    g_assert(job != NULL);
+    g_assert(journal != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (job->journal_key != NULL) {
+        goto success;
+    }
+
+    /* The key is a digest of the job's recipe: its type and target, the
+     * identity, tags and encoding settings of its track, and the keys of its
+     * dependencies, so a change to any of those upstream changes it. In
+     * incremental runs, a track is identified by the content of its file
+     * rather than by its name, size, modification time, inode and STREAMINFO.
+     * The modification time and inode stand in for the content, which a WAV
+     * file's zero MD5 doesn't, so that a re-ripped or edited file of the same
+     * length is remade as make would. */
+
+    key_text = g_string_new("");
+    g_string_append_printf(
+            key_text,
+            "%d\n%s\n",
+            (gint) job->type,
+            job->target_filename);
+    identity_pos = key_text->len;
+
+    if (job->track != NULL && opt_flag_incremental) {
+        status = mutil_compute_track_content_key(
+                job->track,
+                journal,
+                &content_key,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+        g_string_append_printf(
+                key_text,
+                "%s %u\n",
+                content_key,
+                job->flac_level);
+    } else if (job->track != NULL) {
+        status = stat(mutil_track_get_filename(job->track), &src_stat);
+        if (status == -1) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to stat '%s': %s",
+                    mutil_track_get_filename(job->track),
+                    g_strerror(errno));
+            goto error_handling;
+        }
+        stream_info = mutil_track_get_stream_info(job->track);
+        md5_text = g_compute_checksum_for_data(
+                G_CHECKSUM_MD5,
+                stream_info->md5,
+                sizeof(stream_info->md5));
+        g_string_append_printf(
+                key_text,
+                "%s\n%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %s %u\n",
+                mutil_track_get_filename(job->track),
+                stream_info->file_sz,
+                stream_info->total_samples,
+                md5_text,
+                job->flac_level);
+        g_string_append_printf(
+                key_text,
+                "mtime %" G_GINT64_FORMAT ".%09ld ino %" G_GUINT64_FORMAT "\n",
+                (gint64) src_stat.st_mtim.tv_sec,
+                (glong) src_stat.st_mtim.tv_nsec,
+                (guint64) src_stat.st_ino);
+    }
+
+    /* An Ogg bitrate other than the default is part of the recipe. Keys made
+     * at the default are the same as before the bitrate could be chosen. */
+    if (job->type == mutil_job_type_ogg_encode &&
+        job->ogg_bitrate != mutil_ogg_bitrate_default) {
+        g_string_append_printf(key_text, "ogg %u\n", job->ogg_bitrate);
+    }
+
+    /* A track cut from an image is identified by its range as well. */
+    if (job->track != NULL &&
+        mutil_track_get_range(job->track, &first_sample, &sample_cnt)) {
+        g_string_append_printf(
+                key_text,
+                "range %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT "\n",
+                first_sample,
+                sample_cnt);
+    }
+
+    /* The source key leaves out the target as well, so that it survives a
+     * renamed target. A replay gain job's covers the sources of its album
+     * instead. */
+    if (job->track != NULL) {
+        source_text = g_string_new("source\n");
+        g_string_append_printf(source_text, "%d\n", (gint) job->type);
+        g_string_append(source_text, key_text->str + identity_pos);
+    } else if (job->type == mutil_job_type_replay_gain) {
+        source_text = g_string_new("source\n");
+        g_string_append_printf(source_text, "%d\n", (gint) job->type);
+        for (i = 0; i < job->dependencies->len; i++) {
+            dependency_i = g_ptr_array_index(job->dependencies, i);
+            g_assert(dependency_i->source_key != NULL);
+            g_string_append_printf(
+                    source_text,
+                    "%s\n",
+                    dependency_i->source_key);
+        }
+    }
+
+    /* The audio key of an encode job hashes the same text less the tags, after
+     * a prefix that keeps it apart from keys of tagless tracks. */
+    if (job->type == mutil_job_type_archive_encode ||
+        job->type == mutil_job_type_ogg_encode) {
+        audio_text = g_string_new("audio\n");
+        g_string_append_len(audio_text, key_text->str, key_text->len);
+    }
+
+    if (job->track != NULL) {
+        tag_list = mutil_track_create_tag_list(job->track);
+        for (node_i = tag_list;
+             node_i != NULL;
+             node_i = node_i->next) {
+            g_string_append_printf(
+                    key_text,
+                    "%s=%s\n",
+                    mutil_tag_get_name(node_i->data),
+                    mutil_tag_get_value(node_i->data));
+        }
+        mutil_tag_free_list_of(tag_list);
+    }
+
+    /* Dependencies have finished, so their keys are known. */
+    for (i = 0; i < job->dependencies->len; i++) {
+        dependency_i = g_ptr_array_index(job->dependencies, i);
+        g_assert(dependency_i->journal_key != NULL);
+        g_string_append_printf(key_text, "%s\n", dependency_i->journal_key);
+        if (audio_text != NULL) {
+            g_string_append_printf(
+                    audio_text,
+                    "%s\n",
+                    dependency_i->journal_key);
+        }
+    }
+    for (i = 0; i < job->order_only_dependencies->len; i++) {
+        dependency_i = g_ptr_array_index(job->order_only_dependencies, i);
+        g_assert(dependency_i->journal_key != NULL);
+        g_string_append_printf(key_text, "|%s\n", dependency_i->journal_key);
+        if (audio_text != NULL) {
+            g_string_append_printf(
+                    audio_text,
+                    "|%s\n",
+                    dependency_i->journal_key);
+        }
+    }
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(
+            checksum,
+            (guchar const *) key_text->str,
+            key_text->len);
+    job->journal_key = g_strdup(g_checksum_get_string(checksum));
+
+    if (audio_text != NULL) {
+        job->audio_key = g_compute_checksum_for_string(
+                G_CHECKSUM_SHA1,
+                audio_text->str,
+                audio_text->len);
+    }
+    if (source_text != NULL) {
+        job->source_key = g_compute_checksum_for_string(
+                G_CHECKSUM_SHA1,
+                source_text->str,
+                source_text->len);
+    }
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (checksum != NULL) {
+        g_checksum_free(checksum);
+    }
+    if (key_text != NULL) {
+        g_string_free(key_text, TRUE);
+    }
+    if (audio_text != NULL) {
+        g_string_free(audio_text, TRUE);
+    }
+    if (source_text != NULL) {
+        g_string_free(source_text, TRUE);
+    }
+    g_free(md5_text);
+    g_free(content_key);
+
+    return ret_value;
+} /* mutil_job_compute_journal_key */
+
+gdouble mutil_job_get_priority(
+        mutil_job_t *job)
+{
+    gdouble work;
+    gdouble tail_priority;
+    mutil_job_t *dependent_i;
+    guint i;
+
+    g_assert(job != NULL);
+
+    if (job->priority >= 0.0) {
+        return job->priority;
+    }
+
+    /* Estimate the job's own work from its track. Replay gain tagging and
+     * directory creation are cheap next to decoding. */
+    switch (job->type) {
+
+        case mutil_job_type_archive_encode:
+        case mutil_job_type_ogg_encode:
+            work = mutil_track_estimate_work(job->track);
+            break;
+
+        case mutil_job_type_copy_retag:
+            work = mutil_job_copy_work_factor *
+                mutil_track_estimate_work(job->track);
+            break;
+
+        case mutil_job_type_measure_loudness:
+            work = mutil_job_decode_work_factor *
+                mutil_track_estimate_work(job->track);
+            break;
+
+        default:
+            work = 0.0;
+            break;
+    }
+
+    /* The graph is acyclic, so the recursion ends. */
+    tail_priority = 0.0;
+    for (i = 0; i < job->dependents->len; i++) {
+        dependent_i = g_ptr_array_index(job->dependents, i);
+        tail_priority = MAX(tail_priority, mutil_job_get_priority(dependent_i));
+    }
+
+    job->priority = work + tail_priority;
+
+    return job->priority;
+} /* mutil_job_get_priority */
+
+gchar const *mutil_job_get_target_filename(
+        mutil_job_t const * const job)
+{
+    g_assert(job != NULL);
+
+    return job->target_filename;
+} /* mutil_job_get_target_filename */
+
+gint mutil_job_make_replay_gain(
+        mutil_job_t *job,
+        gboolean opt_flag_verbose,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_loudness_t *album_loudness = NULL;
+    GPtrArray *track_loudnesses = NULL;
+    GPtrArray *measured_loudnesses = NULL;
+    mutil_loudness_t *loudness_i;
+    mutil_job_t *dependency_i;
+    guint i;
+
+    g_assert(job != NULL);
+    g_assert(job->type == mutil_job_type_replay_gain);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* The loudness of tracks encoded in this run was measured by their
+     * encode jobs, and a copy has the loudness of its source. Only tracks
+     * that were already archived are decoded again. */
+
+    album_loudness = mutil_loudness_alloc(NULL);
+    track_loudnesses = g_ptr_array_new();
+    measured_loudnesses = g_ptr_array_new_with_free_func(
+            (GDestroyNotify) mutil_loudness_free);
+
+    for (i = 0; i < job->dependencies->len; i++) {
+        dependency_i = g_ptr_array_index(job->dependencies, i);
+
+        loudness_i = dependency_i->loudness;
+        if (loudness_i == NULL &&
+            dependency_i->type == mutil_job_type_copy_retag) {
+            loudness_i = dependency_i->source_job->loudness;
+        }
+        if (loudness_i == NULL) {
+            loudness_i = mutil_loudness_analyze_file(
+                    dependency_i->target_filename,
+                    o_error);
+            if (loudness_i == NULL) {
+                goto error_handling;
+            }
+            g_ptr_array_add(measured_loudnesses, loudness_i);
+        }
+
+        g_ptr_array_add(track_loudnesses, loudness_i);
+        mutil_loudness_merge(album_loudness, loudness_i);
+    }
+
+    for (i = 0; i < job->dependencies->len; i++) {
+        dependency_i = g_ptr_array_index(job->dependencies, i);
+        loudness_i = g_ptr_array_index(track_loudnesses, i);
+
+        if (opt_flag_verbose) {
+            g_printf(
+                    "replay gain %+.2f dB, album %+.2f dB: %s\n",
+                    mutil_replay_gain_get_gain(loudness_i),
+                    mutil_replay_gain_get_gain(album_loudness),
+                    dependency_i->target_filename);
+        }
+
+        status = mutil_replay_gain_write_tags(
+                dependency_i->target_filename,
+                loudness_i,
+                album_loudness,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_loudness_free(album_loudness);
+    if (track_loudnesses != NULL) {
+        g_ptr_array_free(track_loudnesses, TRUE);
+    }
+    if (measured_loudnesses != NULL) {
+        g_ptr_array_free(measured_loudnesses, TRUE);
+    }
+
+    return ret_value;
+} /* mutil_job_make_replay_gain */
+
+void mutil_job_set_flac_level(
+        mutil_job_t *job,
+        guint flac_level)
+{
+    g_assert(job != NULL);
+    g_assert(job->type == mutil_job_type_archive_encode);
+    g_assert(flac_level <= mutil_flac_level_best);
+
+    job->flac_level = flac_level;
+
+    return;
+} /* mutil_job_set_flac_level */
+
+void mutil_job_set_ogg_bitrate(
+        mutil_job_t *job,
+        guint ogg_bitrate)
+{
+    g_assert(job != NULL);
+    g_assert(job->type == mutil_job_type_ogg_encode);
+    g_assert(ogg_bitrate > 0);
+
+    job->ogg_bitrate = ogg_bitrate;
+
+    return;
+} /* mutil_job_set_ogg_bitrate */
+
+mutil_job_t *mutil_job_graph_add_job(
+        mutil_job_graph_t *job_graph,
+        mutil_job_type_t type,
+        gchar const *target_filename,
+        mutil_track_t *track,
+        mutil_job_t *source_job)
+{
+    mutil_job_t *new_job;
+
+    g_assert(job_graph != NULL);
+    g_assert(target_filename != NULL);
+    g_assert((track != NULL) ==
+             (type != mutil_job_type_mkdir &&
+              type != mutil_job_type_replay_gain));
+    g_assert((source_job != NULL) == (type == mutil_job_type_copy_retag));
+
+    new_job = mutil_job_alloc(type, target_filename, track, source_job);
+    g_ptr_array_add(job_graph->jobs, new_job);
+
+    return new_job;
+} /* mutil_job_graph_add_job */
+
+mutil_job_graph_t *mutil_job_graph_alloc(void)
+{
+    mutil_job_graph_t *new_job_graph;
+
+    new_job_graph = g_malloc0(sizeof(mutil_job_graph_t));
+    new_job_graph->jobs = g_ptr_array_new();
+
+    return new_job_graph;
+} /* mutil_job_graph_alloc */
+
+void mutil_job_graph_free(
+        mutil_job_graph_t *job_graph)
+{
+    guint i;
+
+    if (job_graph != NULL) {
+        for (i = 0; i < job_graph->jobs->len; i++) {
+            mutil_job_free(g_ptr_array_index(job_graph->jobs, i));
+        }
+        g_ptr_array_free(job_graph->jobs, TRUE);
+        g_free(job_graph);
+    }
+
+    return;
+} /* mutil_job_graph_free */
+
+void mutil_job_graph_form_groups(
+        mutil_job_graph_t *job_graph)
+{
+    GHashTable *group_table;
+    GHashTableIter iter;
+    gpointer value;
+    GPtrArray *group;
+    gchar const *filename;
+    gboolean is_groupable;
+    gdouble priority;
+    mutil_job_t *job_i;
+    mutil_job_t *dependency_j;
+    mutil_job_t *leader;
+    guint i;
+    guint j;
+
+    g_assert(job_graph != NULL);
+
+    /* Encode jobs are grouped by their track's file. Only jobs that wait for
+     * nothing but the directories of their targets are grouped, so that a
+     * group becomes ready at about the same time as its members would have.
+     * The leader is the member first in the graph. */
+    group_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (i = 0; i < job_graph->jobs->len; i++) {
+        job_i = g_ptr_array_index(job_graph->jobs, i);
+        if (job_i->type != mutil_job_type_archive_encode &&
+            job_i->type != mutil_job_type_ogg_encode) {
+            continue;
+        }
+
+        is_groupable = TRUE;
+        for (j = 0; j < job_i->dependencies->len; j++) {
+            dependency_j = g_ptr_array_index(job_i->dependencies, j);
+            is_groupable &= dependency_j->type == mutil_job_type_mkdir;
+        }
+        for (j = 0; j < job_i->order_only_dependencies->len; j++) {
+            dependency_j = g_ptr_array_index(job_i->order_only_dependencies, j);
+            is_groupable &= dependency_j->type == mutil_job_type_mkdir;
+        }
+        if (!is_groupable) {
+            continue;
+        }
+
+        filename = mutil_track_get_filename(job_i->track);
+        group = g_hash_table_lookup(group_table, filename);
+        if (group == NULL) {
+            group = g_ptr_array_new();
+            g_hash_table_insert(group_table, (gpointer) filename, group);
+        }
+        g_ptr_array_add(group, job_i);
+    }
+
+    /* A group is scheduled as one job, with the work of all its members. */
+    g_hash_table_iter_init(&iter, group_table);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        group = value;
+        if (group->len < 2) {
+            g_ptr_array_free(group, TRUE);
+            continue;
+        }
+
+        leader = g_ptr_array_index(group, 0);
+        leader->group = group;
+        priority = 0.0;
+        for (j = 0; j < group->len; j++) {
+            job_i = g_ptr_array_index(group, j);
+            job_i->group_leader = leader;
+            priority += mutil_job_get_priority(job_i);
+        }
+        leader->priority = priority;
+    }
+
+    g_hash_table_destroy(group_table);
+
+    return;
+} /* mutil_job_graph_form_groups */
+
+mutil_makefile_t *mutil_job_graph_generate_makefile(
+        mutil_job_graph_t *job_graph,
+        gboolean opt_flag_verbose_makefile,
+        gboolean opt_flag_use_echo_e)
+{
+    static gchar const *default_target = "all";
+
+    mutil_makefile_t *new_makefile = NULL;
+    mutil_make_rule_t *new_rule = NULL;
+    mutil_make_rule_t *default_rule = NULL;
+    mutil_job_t *job_i;
+    guint i;
+
+    g_assert(job_graph != NULL);
+
+    g_assert(new_makefile == NULL);
+    new_makefile = mutil_makefile_alloc();
+
+    /* default target: */
+
+    g_assert(new_rule == NULL);
+    new_rule = mutil_make_rule_alloc();
+    mutil_make_rule_append_target(new_rule, mutil_makefile_phony);
+    mutil_make_rule_append_prereq(new_rule, default_target);
+    mutil_makefile_append_rule(new_makefile, new_rule);
+    new_rule = NULL;
+
+    g_assert(default_rule == NULL);
+    default_rule = mutil_make_rule_alloc();
+    mutil_make_rule_append_target(default_rule, default_target);
+
+    /* Create a rule for each job. Replay gain rules have no target file, and
+     * the files that loudness is measured in already exist. */
+    for (i = 0; i < job_graph->jobs->len; i++) {
+
+        job_i = g_ptr_array_index(job_graph->jobs, i);
+
+        if (job_i->type == mutil_job_type_measure_loudness) {
+            continue;
+        }
+
+        mutil_make_rule_append_prereq(default_rule, job_i->target_filename);
+
+        g_assert(new_rule == NULL);
+        new_rule = mutil_job_create_make_rule(
+                job_i,
+                opt_flag_verbose_makefile,
+                opt_flag_use_echo_e);
+        mutil_makefile_append_rule(new_makefile, new_rule);
+        new_rule = NULL;
+
+        if (job_i->type == mutil_job_type_replay_gain) {
+            g_assert(new_rule == NULL);
+            new_rule = mutil_make_rule_alloc();
+            mutil_make_rule_append_target(new_rule, mutil_makefile_phony);
+            mutil_make_rule_append_prereq(new_rule, job_i->target_filename);
+            mutil_makefile_append_rule(new_makefile, new_rule);
+            new_rule = NULL;
+        }
+    }
+
+    mutil_makefile_prepend_rule(new_makefile, default_rule);
+    default_rule = NULL;
+
+    g_assert(new_makefile != NULL);
+    return new_makefile;
+} /* mutil_job_graph_generate_makefile */
+
+gint mutil_job_graph_run(
+        mutil_job_graph_t *job_graph,
+        gint job_cnt,
+        mutil_journal_t *journal,
+        mutil_output_cache_t *output_cache,
+        mutil_pcm_pool_t *pcm_pool,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_sync,
+        gboolean opt_flag_verbose,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_job_runner_t runner;
+    mutil_job_t *job_i;
+    mutil_job_t *dependency_j;
+    guint i;
+    guint j;
+
+    g_assert(job_graph != NULL);
+    g_assert(job_cnt > 0);
+    g_assert(journal != NULL || !opt_flag_incremental);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    memset(&runner, 0, sizeof(runner));
+    g_mutex_init(&runner.mutex);
+    g_cond_init(&runner.cond);
+    runner.job_cnt = job_cnt;
+    runner.journal = journal;
+    runner.output_cache = output_cache;
+    runner.pcm_pool = pcm_pool;
+    if (opt_flag_sync) {
+        runner.output_sync = mutil_output_sync_alloc();
+    }
+    runner.target_set = g_hash_table_new(g_str_hash, g_str_equal);
+    runner.opt_flag_incremental = opt_flag_incremental;
+    runner.opt_flag_verbose = opt_flag_verbose;
+
+    /* Link each job to the jobs waiting for it. */
+    for (i = 0; i < job_graph->jobs->len; i++) {
+        job_i = g_ptr_array_index(job_graph->jobs, i);
+        g_hash_table_add(runner.target_set, job_i->target_filename);
+        job_i->is_made = FALSE;
+        job_i->priority = -1.0;
+        job_i->seq = i;
+        g_free(job_i->journal_key);
+        job_i->journal_key = NULL;
+        g_free(job_i->audio_key);
+        job_i->audio_key = NULL;
+        g_free(job_i->source_key);
+        job_i->source_key = NULL;
+        job_i->is_reused = FALSE;
+        job_i->group_leader = NULL;
+        job_i->group = NULL;
+        mutil_loudness_free(job_i->loudness);
+        job_i->loudness = NULL;
+        job_i->pending_cnt =
+            job_i->dependencies->len + job_i->order_only_dependencies->len;
+        for (j = 0; j < job_i->dependencies->len; j++) {
+            dependency_j = g_ptr_array_index(job_i->dependencies, j);
+            g_ptr_array_add(dependency_j->dependents, job_i);
+        }
+        for (j = 0; j < job_i->order_only_dependencies->len; j++) {
+            dependency_j = g_ptr_array_index(job_i->order_only_dependencies, j);
+            g_ptr_array_add(dependency_j->dependents, job_i);
+        }
+    }
+
+    for (i = 0; i < job_graph->jobs->len; i++) {
+        mutil_job_get_priority(g_ptr_array_index(job_graph->jobs, i));
+    }
+
+    mutil_job_graph_form_groups(job_graph);
+    for (i = 0; i < job_graph->jobs->len; i++) {
+        job_i = g_ptr_array_index(job_graph->jobs, i);
+        if (job_i->group != NULL) {
+            job_i->group_pending_cnt = job_i->group->len;
+        }
+    }
+
+    runner.pool = g_thread_pool_new(
+            mutil_job_runner_cb_execute,
+            &runner,
+            job_cnt,
+            FALSE,
+            o_error);
+    if (runner.pool == NULL) {
+        goto error_handling;
+    }
+    g_thread_pool_set_sort_function(
+            runner.pool,
+            mutil_job_runner_cb_compare,
+            NULL);
+
+    /* Start the jobs without dependencies. The rest are started as their
+     * dependencies finish. */
+    g_mutex_lock(&runner.mutex);
+    for (i = 0; i < job_graph->jobs->len; i++) {
+        job_i = g_ptr_array_index(job_graph->jobs, i);
+        if (job_i->pending_cnt == 0) {
+            mutil_job_runner_push(&runner, job_i);
+        }
+    }
+    while (runner.running_cnt > 0) {
+        g_cond_wait(&runner.cond, &runner.mutex);
+    }
+    g_mutex_unlock(&runner.mutex);
+
+    if (runner.error != NULL) {
+        g_propagate_error(o_error, runner.error);
+        runner.error = NULL;
+        goto error_handling;
+    }
+
+    if (runner.output_sync != NULL) {
+        status = mutil_output_sync_flush(runner.output_sync, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (runner.pool != NULL) {
+        g_thread_pool_free(runner.pool, FALSE, TRUE);
+    }
+    g_mutex_clear(&runner.mutex);
+    g_cond_clear(&runner.cond);
+    g_hash_table_destroy(runner.target_set);
+    mutil_output_sync_free(runner.output_sync);
+
+    for (i = 0; i < job_graph->jobs->len; i++) {
+        job_i = g_ptr_array_index(job_graph->jobs, i);
+        g_ptr_array_set_size(job_i->dependents, 0);
+        if (job_i->group != NULL) {
+            g_ptr_array_free(job_i->group, TRUE);
+            job_i->group = NULL;
+        }
+        job_i->group_leader = NULL;
+    }
+
+    return ret_value;
+} /* mutil_job_graph_run */
+
+gboolean mutil_job_is_up_to_date(
+        mutil_job_t const *job,
+        mutil_journal_t *journal,
+        gboolean opt_flag_incremental)
+{
+    gboolean is_up_to_date = TRUE;
+    struct stat target_stat;
+    struct stat src_stat;
+    mutil_job_t const *dependency_i;
+    guint i;
+    gint status;
+
+    g_assert(job != NULL);
+
+    if (job->type == mutil_job_type_measure_loudness) {
+        is_up_to_date = FALSE;
+        goto cleanup;
+    }
+
+    /* Whatever the rules below, no job is up to date once one of its
+     * dependencies was remade. */
+    for (i = 0; is_up_to_date && i < job->dependencies->len; i++) {
+        dependency_i = g_ptr_array_index(job->dependencies, i);
+        if (dependency_i->is_made) {
+            is_up_to_date = FALSE;
+        }
+    }
+    if (!is_up_to_date) {
+        goto cleanup;
+    }
+
+    /* A job finished by an earlier run is trusted without re-reading its
+     * target's tags, as long as the target is still there: it may since have
+     * been moved to a renamed target. */
+    if (journal != NULL &&
+        mutil_journal_contains(journal, job->journal_key) &&
+        (job->type == mutil_job_type_replay_gain ||
+         g_file_test(job->target_filename, G_FILE_TEST_EXISTS))) {
+        goto cleanup;
+    }
+
+    /* A target recorded under the job's audio key but not its key has stale
+     * tags, whatever its modification time. */
+    if (journal != NULL &&
+        job->audio_key != NULL &&
+        mutil_journal_contains(journal, job->audio_key)) {
+        is_up_to_date = FALSE;
+        goto cleanup;
+    }
+
+    /* In incremental runs, a job made from a track is remade whenever its key
+     * is new, whatever the modification times. */
+    if (opt_flag_incremental && job->track != NULL) {
+        is_up_to_date = FALSE;
+        goto cleanup;
+    }
+
+    /* Same rules as make: the target must exist and the track's file must not
+     * be newer. A replay gain job has no target; it's up to date when all the
+     * files of its album have been tagged. */
+
+    if (job->type == mutil_job_type_replay_gain) {
+
+        /* Reused files carry the album gain of their earlier album, which
+         * only holds if the album has the same sources as one tagged
+         * before. */
+        for (i = 0; is_up_to_date && i < job->dependencies->len; i++) {
+            dependency_i = g_ptr_array_index(job->dependencies, i);
+            if (dependency_i->is_reused &&
+                !mutil_journal_contains(journal, job->source_key)) {
+                is_up_to_date = FALSE;
+            }
+        }
+
+        for (i = 0; is_up_to_date && i < job->dependencies->len; i++) {
+            dependency_i = g_ptr_array_index(job->dependencies, i);
+            if (!mutil_replay_gain_is_tagged(dependency_i->target_filename)) {
+                is_up_to_date = FALSE;
+            }
+        }
+        goto cleanup;
+    }
+
+    status = stat(job->target_filename, &target_stat);
+    if (status == -1) {
+        is_up_to_date = FALSE;
+        goto cleanup;
+    }
+
+    if (job->track != NULL) {
+        status = stat(mutil_track_get_filename(job->track), &src_stat);
+        if (status == -1 ||
+            src_stat.st_mtim.tv_sec > target_stat.st_mtim.tv_sec ||
+            (src_stat.st_mtim.tv_sec == target_stat.st_mtim.tv_sec &&
+             src_stat.st_mtim.tv_nsec > target_stat.st_mtim.tv_nsec)) {
+            is_up_to_date = FALSE;
+        }
+    }
+
+cleanup:
+
+    return is_up_to_date;
+} /* mutil_job_is_up_to_date */
+
+gint mutil_job_runner_cb_compare(
+        gconstpointer a,
+        gconstpointer b,
+        gpointer user_data)
+{
+    mutil_job_t const *job_a = a;
+    mutil_job_t const *job_b = b;
+
+    g_assert(job_a != NULL);
+    g_assert(job_b != NULL);
+
+    /* Highest priority first, then in graph order. */
+    if (job_a->priority != job_b->priority) {
+        return job_a->priority > job_b->priority ? -1 : 1;
+    }
+
+    return job_a->seq < job_b->seq ? -1 : (job_a->seq > job_b->seq ? 1 : 0);
+} /* mutil_job_runner_cb_compare */
+
+void mutil_job_runner_cb_execute(
+        gpointer data,
+        gpointer user_data)
+{
+    mutil_job_t *job = data;
+    mutil_job_runner_t *runner = user_data;
+    GError *local_error = NULL;
+    mutil_job_t **members;
+    guint member_cnt;
+    mutil_job_t *member_i;
+    mutil_job_t *dependent_j;
+    guint thread_cnt;
+    guint i;
+    guint j;
+    gint status;
+
+    g_assert(job != NULL);
+    g_assert(runner != NULL);
+
+    if (job->group != NULL) {
+        members = (mutil_job_t **) job->group->pdata;
+        member_cnt = job->group->len;
+    } else {
+        members = &job;
+        member_cnt = 1;
+    }
+
+    /* When fewer jobs than threads are pending, as at the end of a run or for
+     * albums of a few long tracks, the spare threads are shared out among the
+     * jobs that can use them. While any job is still queued, a pool thread is
+     * about to take it, so none is spare: each encoder keeps its threads until
+     * it finishes, and granting threads to the jobs as they start would add up
+     * to many times the pool size. */
+    g_mutex_lock(&runner->mutex);
+    if (g_thread_pool_unprocessed(runner->pool) > 0) {
+        thread_cnt = 1;
+    } else {
+        thread_cnt = MAX(1, runner->job_cnt / runner->running_cnt);
+    }
+    g_mutex_unlock(&runner->mutex);
+
+    status = mutil_job_execute(
+            job,
+            thread_cnt,
+            runner->journal,
+            runner->output_cache,
+            runner->pcm_pool,
+            runner->output_sync,
+            runner->target_set,
+            runner->opt_flag_incremental,
+            runner->opt_flag_verbose,
+            &local_error);
+
+    /* Record the finished jobs, whether they were made or already up to date.
+     * 'measure_loudness' jobs are always run, so they aren't recorded. */
+    for (i = 0; status == 0 && i < member_cnt; i++) {
+        member_i = members[i];
+        if (status == 0 &&
+            runner->journal != NULL &&
+            member_i->type != mutil_job_type_measure_loudness &&
+            !mutil_journal_contains(runner->journal, member_i->journal_key)) {
+            status = mutil_journal_append(
+                    runner->journal,
+                    member_i->journal_key,
+                    member_i->target_filename,
+                    &local_error);
+        }
+        if (status == 0 &&
+            runner->journal != NULL &&
+            member_i->audio_key != NULL &&
+            !mutil_journal_contains(runner->journal, member_i->audio_key)) {
+            status = mutil_journal_append(
+                    runner->journal,
+                    member_i->audio_key,
+                    member_i->target_filename,
+                    &local_error);
+        }
+
+        /* A source's record follows its target through renames. */
+        if (status == 0 &&
+            runner->journal != NULL &&
+            member_i->type != mutil_job_type_measure_loudness &&
+            member_i->source_key != NULL &&
+            g_strcmp0(
+                mutil_journal_look_up(runner->journal, member_i->source_key),
+                member_i->target_filename) != 0) {
+            status = mutil_journal_append(
+                    runner->journal,
+                    member_i->source_key,
+                    member_i->target_filename,
+                    &local_error);
+        }
+    }
+
+    g_mutex_lock(&runner->mutex);
+
+    if (status == -1) {
+        if (runner->error == NULL) {
+            runner->error = local_error;
+        } else {
+            g_error_free(local_error);
+        }
+        local_error = NULL;
+    }
+
+    for (i = 0; runner->error == NULL && i < member_cnt; i++) {
+        member_i = members[i];
+        for (j = 0; j < member_i->dependents->len; j++) {
+            dependent_j = g_ptr_array_index(member_i->dependents, j);
+            g_assert(dependent_j->pending_cnt > 0);
+            dependent_j->pending_cnt--;
+            if (dependent_j->pending_cnt == 0) {
+                mutil_job_runner_push(runner, dependent_j);
+            }
+        }
+    }
+
+    runner->running_cnt--;
+    g_cond_broadcast(&runner->cond);
+
+    g_mutex_unlock(&runner->mutex);
+
+    g_assert(local_error == NULL);
+
+    return;
+} /* mutil_job_runner_cb_execute */
+
+void mutil_job_runner_push(
+        mutil_job_runner_t *runner,
+        mutil_job_t *job)
+{
+    g_assert(runner != NULL);
+    g_assert(job != NULL);
+
+    /* The caller holds the runner's mutex. */
+
+    /* A group is pushed as its leader once all its members are ready. */
+    if (job->group_leader != NULL) {
+        job = job->group_leader;
+        g_assert(job->group_pending_cnt > 0);
+        job->group_pending_cnt--;
+        if (job->group_pending_cnt > 0) {
+            return;
+        }
+    }
+
+    runner->running_cnt++;
+    g_thread_pool_push(runner->pool, job, NULL);
+
+    return;
+} /* mutil_job_runner_push */
+
+/* Appends the filename to a recipe as one double-quoted shell word. The
+ * characters the shell still interprets inside double quotes are escaped, and
+ * '$' is doubled for make as well. */
+void mutil_append_quoted_filename(
+        GString *command,
+        gchar const *filename)
+{
+    gchar const *src_pos_i;
+
+    g_assert(command != NULL);
+    g_assert(filename != NULL);
+
+    g_string_append_c(command, '\"');
+    for (src_pos_i = filename; *src_pos_i != '\0'; src_pos_i++) {
+        if (*src_pos_i == '\\' ||
+            *src_pos_i == '\"' ||
+            *src_pos_i == '`' ||
+            *src_pos_i == '$') {
+            g_string_append_c(command, '\\');
+        }
+        if (*src_pos_i == '$') {
+            g_string_append_c(command, '$');
+        }
+        g_string_append_c(command, *src_pos_i);
+    }
+    g_string_append_c(command, '\"');
+
+    return;
+} /* mutil_append_quoted_filename */
+
+gint mutil_compute_track_content_key(
+        mutil_track_t *track,
+        mutil_journal_t *journal,
+        gchar **o_content_key,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    gchar const *filename;
+    struct stat src_stat;
+    gchar *partial_hash = NULL;
+    gchar *memo_text = NULL;
+    gchar *memo_key = NULL;
+    gchar const *memo_value;
+
+    g_assert(track != NULL);
+    g_assert(journal != NULL);
+    g_assert(o_content_key != NULL);
+    g_assert(*o_content_key == NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Hashing the audio of a WAV file reads all of it, so the result is kept
+     * in the journal under the file's name, size, modification time, inode and
+     * partial hash. The partial hash alone would miss an edit in the middle of
+     * a file, so the whole file is read again whenever it's been written to or
+     * replaced. Files whose audio can't be hashed are identified by their
+     * partial hash alone. */
+
+    filename = mutil_track_get_filename(track);
+
+    status = stat(filename, &src_stat);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to stat '%s': %s",
+                filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    status = mutil_compute_partial_file_hash(filename, &partial_hash, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    memo_text = g_strdup_printf(
+            "%s\n%" G_GUINT64_FORMAT " %" G_GINT64_FORMAT ".%09ld %"
+            G_GUINT64_FORMAT "\n%s",
+            filename,
+            (guint64) src_stat.st_size,
+            (gint64) src_stat.st_mtim.tv_sec,
+            (glong) src_stat.st_mtim.tv_nsec,
+            (guint64) src_stat.st_ino,
+            partial_hash);
+    memo_key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, memo_text, -1);
+    memo_value = mutil_journal_look_up(journal, memo_key);
+    if (memo_value != NULL) {
+        *o_content_key = g_strdup(memo_value);
+        goto success;
+    }
+
+    status = mutil_compute_audio_content_key(
+            filename,
+            mutil_track_get_audio_type(track),
+            mutil_track_get_stream_info(track),
+            o_content_key,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+    if (*o_content_key == NULL) {
+        *o_content_key = g_strdup(partial_hash);
+    }
+
+    status = mutil_journal_append(journal, memo_key, *o_content_key, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    g_free(*o_content_key);
+    *o_content_key = NULL;
+
+    ret_value = -1;
+
+cleanup:
+
+    g_free(partial_hash);
+    g_free(memo_text);
+    g_free(memo_key);
+
+    return ret_value;
+} /* mutil_compute_track_content_key */
@@ -0,0 +1,122 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_job_h
+#define mutil_job_h
+
+#include "mutil_common.h"
+#include "mutil_journal.h"
+#include "mutil_makefile.h"
+#include "mutil_output_cache.h"
+#include "mutil_pcm_pipe.h"
+#include "mutil_track.h"
+
+/* A job graph holds the work of the 'archive' and 'oggify' commands. It is
+ * either written out as a makefile or run in-process. A job is remade when its
+ * target is missing, older than its track's file, or when a dependency was
+ * remade. Order-only dependencies are made first but don't cause remaking.
+ * Replay gain jobs are phony rules in a makefile. When run in-process, they
+ * tag the targets of their dependencies, and are remade when one of those was
+ * remade or lacks album gain tags. 'measure_loudness' jobs have an existing
+ * FLAC file as their target, which they read but never remake; they have no
+ * makefile rule and are always run in-process. Files are written under a
+ * temporary name and renamed to their target name once complete. */
+
+typedef enum {
+    mutil_job_type_mkdir,
+    mutil_job_type_archive_encode,
+    mutil_job_type_ogg_encode,
+    mutil_job_type_copy_retag,
+    mutil_job_type_measure_loudness,
+    mutil_job_type_replay_gain
+} mutil_job_type_t;
+
+struct mutil_job;
+typedef struct mutil_job mutil_job_t;
+
+struct mutil_job_graph;
+typedef struct mutil_job_graph mutil_job_graph_t;
+
+/* job: */
+
+void mutil_job_add_dependency(
+        mutil_job_t *job,
+        mutil_job_t *dependency);
+
+void mutil_job_add_order_only_dependency(
+        mutil_job_t *job,
+        mutil_job_t *dependency);
+
+gchar const *mutil_job_get_target_filename(
+        mutil_job_t const * const job);
+
+/* Sets the compression level of an 'archive_encode' job, which defaults to
+ * mutil_flac_level_best. */
+void mutil_job_set_flac_level(
+        mutil_job_t *job,
+        guint flac_level);
+
+/* Sets the average bitrate in kbit/s of an 'ogg_encode' job, which defaults to
+ * mutil_ogg_bitrate_default. */
+void mutil_job_set_ogg_bitrate(
+        mutil_job_t *job,
+        guint ogg_bitrate);
+
+/* job graph: */
+
+/* Adds a job to the graph, which owns it. track is NULL for 'mkdir' and
+ * 'replay_gain' jobs. source_job is the job whose target a 'copy_retag' job
+ * copies; it becomes an order-only dependency. */
+mutil_job_t *mutil_job_graph_add_job(
+        mutil_job_graph_t *job_graph,
+        mutil_job_type_t type,
+        gchar const *target_filename,
+        mutil_track_t *track,
+        mutil_job_t *source_job);
+
+mutil_job_graph_t *mutil_job_graph_alloc(void);
+
+void mutil_job_graph_free(
+        mutil_job_graph_t *job_graph);
+
+mutil_makefile_t *mutil_job_graph_generate_makefile(
+        mutil_job_graph_t *job_graph,
+        gboolean opt_flag_verbose_makefile,
+        gboolean opt_flag_use_echo_e);
+
+/* Runs the jobs on up to job_cnt threads, starting the jobs with the most
+ * estimated work left after them first. If journal isn't NULL, finished jobs
+ * are recorded in it, and jobs it records from earlier runs are skipped. With
+ * opt_flag_incremental, which needs a journal, jobs are keyed by the content of
+ * their track's file, its tags and the encoder settings, and those made from a
+ * track are remade exactly when their key is new, ignoring modification
+ * times. An encoded target whose track changed only in its tags is retagged
+ * rather than encoded again: FLAC files in place, Ogg files by copying their
+ * pages behind a new comment header. A target that was renamed, as after a
+ * title or album name was corrected, is made by moving the output of the same
+ * source from an earlier run, unless that is still a target, and retagging
+ * it. If output_cache isn't NULL, Ogg files are linked from it where it has
+ * the same track encoded with the same tags, and added to it when encoded.
+ * Encoding, retagging and replay gain are done in-process, and loudness is
+ * measured during FLAC encoding. Encode jobs reading the same file, such as the
+ * tracks of a CUE sheet's image, run together on one thread, which decodes the
+ * file once for all of them. If pcm_pool isn't NULL, each such file is decoded
+ * on a thread of its own, ahead of its encoders, with blocks from the pool,
+ * which caps the decoded audio held at any time however many jobs are queued.
+ * When fewer jobs than threads are pending, FLAC encoders use the spare
+ * threads. Encoders write through mutil_output_file_t, which preallocates each
+ * file and writes it in large chunks. With opt_flag_sync, the files made are
+ * synced once the run succeeds, directory by directory, rather than each as
+ * it's made. After a job fails, no further jobs are started. */
+gint mutil_job_graph_run(
+        mutil_job_graph_t *job_graph,
+        gint job_cnt,
+        mutil_journal_t *journal,
+        mutil_output_cache_t *output_cache,
+        mutil_pcm_pool_t *pcm_pool,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_sync,
+        gboolean opt_flag_verbose,
+        GError **o_error);
+
+#endif /* #ifndef mutil_job_h */
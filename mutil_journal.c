@@ -0,0 +1,234 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_journal.h"
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+/* Each line holds a key and a value, separated by a space. The value is escaped
+ * as a C string. The values of the records are kept in a string chunk, so that
+ * a value returned by a look-up stays valid when its record is replaced. */
+struct mutil_journal {
+    gchar *filename;
+    GHashTable *records;
+    GStringChunk *values;
+    FILE *file;
+    GMutex mutex;
+};
+
+gint mutil_journal_append(
+        mutil_journal_t *journal,
+        gchar const *key,
+        gchar const *value,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    gchar *safe_value = NULL;
+
+    g_assert(journal != NULL);
+    g_assert(key != NULL);
+    g_assert(strchr(key, ' ') == NULL && strchr(key, '\n') == NULL);
+    g_assert(value != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* The line is synced at once, so that it's in the file if the process is
+     * killed or the system crashes later. */
+    safe_value = g_strescape(value, NULL);
+
+    g_mutex_lock(&journal->mutex);
+    status = fprintf(journal->file, "%s %s\n", key, safe_value);
+    if (status >= 0) {
+        status = fflush(journal->file);
+    }
+    if (status >= 0) {
+        status = fdatasync(fileno(journal->file));
+    }
+    if (status >= 0) {
+        g_hash_table_replace(
+                journal->records,
+                g_strdup(key),
+                g_string_chunk_insert_const(journal->values, value));
+    }
+    g_mutex_unlock(&journal->mutex);
+
+    if (status < 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to write journal file '%s': %s",
+                journal->filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    g_free(safe_value);
+
+    return ret_value;
+} /* mutil_journal_append */
+
+gboolean mutil_journal_contains(
+        mutil_journal_t *journal,
+        gchar const *key)
+{
+    gboolean is_contained;
+
+    g_assert(journal != NULL);
+    g_assert(key != NULL);
+
+    g_mutex_lock(&journal->mutex);
+    is_contained = g_hash_table_contains(journal->records, key);
+    g_mutex_unlock(&journal->mutex);
+
+    return is_contained;
+} /* mutil_journal_contains */
+
+gchar const *mutil_journal_look_up(
+        mutil_journal_t *journal,
+        gchar const *key)
+{
+    gchar const *value;
+
+    g_assert(journal != NULL);
+    g_assert(key != NULL);
+
+    g_mutex_lock(&journal->mutex);
+    value = g_hash_table_lookup(journal->records, key);
+    g_mutex_unlock(&journal->mutex);
+
+    return value;
+} /* mutil_journal_look_up */
+
+gchar *mutil_journal_default_filename(void)
+{
+    return g_strdup(".mutil_journal");
+} /* mutil_journal_default_filename */
+
+void mutil_journal_free(
+        mutil_journal_t *journal)
+{
+    if (journal != NULL) {
+        if (journal->file != NULL) {
+            fclose(journal->file);
+        }
+        g_hash_table_destroy(journal->records);
+        g_string_chunk_free(journal->values);
+        g_mutex_clear(&journal->mutex);
+        g_free(journal->filename);
+        g_free(journal);
+    }
+
+    return;
+} /* mutil_journal_free */
+
+mutil_journal_t *mutil_journal_open(
+        gchar const *journal_filename,
+        GError **o_error)
+{
+    mutil_journal_t *new_journal = NULL;
+    gchar *contents = NULL;
+    gsize contents_sz;
+    GError *local_error = NULL;
+    gchar *line_i;
+    gchar *end_i;
+    gchar *space_i;
+    gchar *safe_value;
+    gchar *value;
+    gboolean status;
+
+    g_assert(journal_filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    new_journal = g_malloc0(sizeof(mutil_journal_t));
+    new_journal->filename = g_strdup(journal_filename);
+    new_journal->records = g_hash_table_new_full(
+            g_str_hash,
+            g_str_equal,
+            g_free,
+            NULL);
+    new_journal->values = g_string_chunk_new(4096);
+    g_mutex_init(&new_journal->mutex);
+
+    status = g_file_get_contents(
+            journal_filename,
+            &contents,
+            &contents_sz,
+            &local_error);
+    if (!status &&
+        !g_error_matches(local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+        g_propagate_prefixed_error(
+                o_error,
+                local_error,
+                "failed to read journal file: ");
+        local_error = NULL;
+        goto error_handling;
+    }
+    g_clear_error(&local_error);
+
+    /* Only whole lines count; a line cut short by a crash has no newline. */
+    for (line_i = contents;
+         line_i != NULL && (end_i = memchr(
+                 line_i,
+                 '\n',
+                 contents + contents_sz - line_i)) != NULL;
+         line_i = end_i + 1) {
+        space_i = memchr(line_i, ' ', end_i - line_i);
+        if (space_i != NULL && space_i > line_i) {
+            safe_value = g_strndup(space_i + 1, end_i - space_i - 1);
+            value = g_strcompress(safe_value);
+            g_hash_table_replace(
+                    new_journal->records,
+                    g_strndup(line_i, space_i - line_i),
+                    g_string_chunk_insert_const(new_journal->values, value));
+            g_free(value);
+            g_free(safe_value);
+        }
+    }
+
+    new_journal->file = g_fopen(journal_filename, "a");
+    if (new_journal->file == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open journal file '%s': %s",
+                journal_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* End a cut-short line, so that the next key starts on a line of its
+     * own. */
+    if (contents_sz > 0 && contents[contents_sz - 1] != '\n') {
+        fputc('\n', new_journal->file);
+    }
+
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    mutil_journal_free(new_journal);
+    new_journal = NULL;
+
+cleanup:
+
+    g_free(contents);
+
+    return new_journal;
+} /* mutil_journal_open */
@@ -0,0 +1,63 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_journal_h
+#define mutil_journal_h
+
+#include "mutil_common.h"
+
+/* The journal records the jobs finished by in-process runs, so that a run
+ * restarted after a crash or kill skips them without checking their targets
+ * again. Each job is identified by a key that covers everything its target is
+ * made from; a changed job gets a new key and is checked as usual.
+ *
+ * Besides finished jobs, the journal remembers values that are costly to
+ * compute, such as the content hashes used by incremental runs. Every record
+ * is a key and a value; for a job, the value is its target filename.
+ *
+ * The journal file is only ever appended to, one line per record, so a run
+ * that dies while writing it loses at most its last, incomplete line. Each
+ * record is synced as it's appended, and a job's target is synced before the
+ * job is recorded, so that a crash never leaves a record of a target that
+ * didn't reach the disk. Delete the file to have every target checked
+ * again. */
+
+struct mutil_journal;
+typedef struct mutil_journal mutil_journal_t;
+
+/* Appends a record, which look-ups see from then on. The key may not contain
+ * spaces or newlines. May be called from multiple threads. */
+gint mutil_journal_append(
+        mutil_journal_t *journal,
+        gchar const *key,
+        gchar const *value,
+        GError **o_error);
+
+/* Returns TRUE if the key is in the journal. */
+gboolean mutil_journal_contains(
+        mutil_journal_t *journal,
+        gchar const *key);
+
+/* Returns the last value recorded for the key, or NULL if there is none. The
+ * value stays valid until the journal is freed. */
+gchar const *mutil_journal_look_up(
+        mutil_journal_t *journal,
+        gchar const *key);
+
+/* Returns the default journal filename, which is in the current directory
+ * like the targets of a run. */
+gchar *mutil_journal_default_filename(void);
+
+void mutil_journal_free(
+        mutil_journal_t *journal);
+
+/* Reads the journal file, if it exists, and opens it for appending. A missing
+ * journal file results in an empty journal.
+ *
+ * Returns: NULL on error.
+ */
+mutil_journal_t *mutil_journal_open(
+        gchar const *journal_filename,
+        GError **o_error);
+
+#endif /* #ifndef mutil_journal_h */
@@ -2,23 +2,49 @@
  */
 
 #include "mutil_album.h"
+#include "mutil_job.h"
 #include "mutil_main.h"
 #include "mutil_makefile.h"
 #include "mutil_track.h"
+#include "mutil_track_cache.h"
 #include "mutil_xml.h"
 
 struct mutil_cl_info;
 typedef struct mutil_cl_info mutil_cl_info_t;
 
+/* Average Ogg bitrates in kbit/s that libvorbis can encode 44.1 kHz stereo
+ * at. */
+#define mutil_ogg_bitrate_min 45
+#define mutil_ogg_bitrate_max 500
+
+/* Default cap on decoded audio held between decoders and encoders, in MiB. */
+#define mutil_pcm_buffer_size_default 32
+
 struct mutil_cl_info {
     gboolean cmd_flag_archive;
     gboolean opt_flag_auto_track_no_tags;
     gboolean opt_flag_create_global_section;
+    gboolean opt_flag_dedup;
     gboolean cmd_flag_generate_xml;
+    gboolean opt_flag_incremental;
+    gboolean opt_flag_no_cache;
     gboolean cmd_flag_oggify;
+    gboolean cmd_flag_replay_gain;
+    gboolean opt_flag_run;
     gboolean opt_flag_simple_album;
+    gboolean opt_flag_sync;
     gboolean opt_flag_use_echo_e;
     gboolean opt_flag_verbose_makefile;
+    gint job_cnt;
+    gint output_cache_size_mib;
+    gint pcm_buffer_size_mib;
+    gdouble adaptive_level_pct;
+    gchar *cache_filename;
+    gchar *file_list_filename;
+    gchar *output_cache_dirname;
+    gchar **ogg_bitrate_texts;
+    guint *ogg_bitrates;
+    guint ogg_bitrate_cnt;
     gchar const *xml_spec_filename;
     gint arg_list_sz;
     gchar const **arg_list;
@@ -30,27 +56,78 @@ static gint mutil_parse_command_line(
         gchar ***o_argv,
         GError **o_error);
 
+static gint mutil_output_job_graph(
+        mutil_job_graph_t *job_graph,
+        gboolean opt_flag_run,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_sync,
+        gchar const *output_cache_dirname,
+        guint64 output_cache_max_sz,
+        guint64 pcm_buffer_max_sz,
+        gint job_cnt,
+        gboolean opt_flag_verbose_makefile,
+        gboolean opt_flag_use_echo_e,
+        GError **o_error);
+
 static gint mutil_run_command_archive(
         gchar const *xml_spec_filename,
         gboolean opt_flag_verbose_makefile,
         gboolean opt_flag_simple_album,
         gboolean opt_flag_use_echo_e,
+        gboolean opt_flag_dedup,
+        gboolean opt_flag_run,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_sync,
+        gdouble adaptive_level_pct,
+        guint const *ogg_bitrates,
+        guint ogg_bitrate_cnt,
+        gchar const *output_cache_dirname,
+        guint64 output_cache_max_sz,
+        guint64 pcm_buffer_max_sz,
+        gint job_cnt,
         GError **o_error);
 
 static gint mutil_run_command_generate_xml(
         gchar const * const *audio_filenames,
         gint audio_filename_cnt,
+        gchar const *file_list_filename,
         gboolean opt_flag_auto_track_no_tags,
         gboolean opt_flag_simple_album,
         gboolean opt_flag_create_global_section,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
         GError **o_error);
 
 static gint mutil_run_command_oggify(
         gchar const * const *audio_filenames,
         gint audio_filename_cnt,
+        gchar const *file_list_filename,
+        gboolean opt_flag_verbose_makefile,
+        gboolean opt_flag_simple_album,
+        gboolean opt_flag_use_echo_e,
+        gboolean opt_flag_run,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_sync,
+        guint const *ogg_bitrates,
+        guint ogg_bitrate_cnt,
+        gchar const *output_cache_dirname,
+        guint64 output_cache_max_sz,
+        guint64 pcm_buffer_max_sz,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
+        GError **o_error);
+
+static gint mutil_run_command_replay_gain(
+        gchar const * const *audio_filenames,
+        gint audio_filename_cnt,
+        gchar const *file_list_filename,
         gboolean opt_flag_verbose_makefile,
         gboolean opt_flag_simple_album,
         gboolean opt_flag_use_echo_e,
+        gboolean opt_flag_run,
+        gboolean opt_flag_sync,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
         GError **o_error);
 
 gint main(
@@ -61,6 +138,7 @@ gint main(
     GError *local_error = NULL;
     gint status;
     mutil_cl_info_t cl_info;
+    mutil_track_cache_t *track_cache = NULL;
 
     /* Parse the command line. */
     status = mutil_parse_command_line(&cl_info, &argc, &argv, &local_error);
@@ -68,13 +146,41 @@ gint main(
         goto error_handling;
     }
 
-    /* Dispatch command. */
+    /* Open the track cache for commands that read tags from audio files. The
+     * cache is only an optimization, so problems with it aren't fatal. */
+    if ((cl_info.cmd_flag_generate_xml ||
+         (cl_info.cmd_flag_oggify && !cl_info.cmd_flag_archive) ||
+         cl_info.cmd_flag_replay_gain) &&
+        !cl_info.opt_flag_no_cache) {
+        g_assert(track_cache == NULL);
+        track_cache = mutil_track_cache_open(
+                cl_info.cache_filename,
+                &local_error);
+        if (track_cache == NULL) {
+            mutil_print_warning(TRUE, "%s", local_error->message);
+            g_clear_error(&local_error);
+        }
+    }
+
+    /* Dispatch command. 'archive' with 'oggify' makes the Ogg files as
+     * well. */
     if (cl_info.cmd_flag_archive) {
         status = mutil_run_command_archive(
                 cl_info.xml_spec_filename,
                 cl_info.opt_flag_verbose_makefile,
                 cl_info.opt_flag_simple_album,
                 cl_info.opt_flag_use_echo_e,
+                cl_info.opt_flag_dedup,
+                cl_info.opt_flag_run,
+                cl_info.opt_flag_incremental,
+                cl_info.opt_flag_sync,
+                cl_info.adaptive_level_pct,
+                cl_info.cmd_flag_oggify ? cl_info.ogg_bitrates : NULL,
+                cl_info.cmd_flag_oggify ? cl_info.ogg_bitrate_cnt : 0,
+                cl_info.output_cache_dirname,
+                (guint64) cl_info.output_cache_size_mib << 20,
+                (guint64) cl_info.pcm_buffer_size_mib << 20,
+                cl_info.job_cnt,
                 &local_error);
         if (status == -1) {
             goto error_handling;
@@ -83,9 +189,12 @@ gint main(
         status = mutil_run_command_generate_xml(
                 cl_info.arg_list,
                 cl_info.arg_list_sz,
+                cl_info.file_list_filename,
                 cl_info.opt_flag_auto_track_no_tags,
                 cl_info.opt_flag_simple_album,
                 cl_info.opt_flag_create_global_section,
+                cl_info.job_cnt,
+                track_cache,
                 &local_error);
         if (status == -1) {
             goto error_handling;
@@ -94,9 +203,36 @@ gint main(
         status = mutil_run_command_oggify(
                 cl_info.arg_list,
                 cl_info.arg_list_sz,
+                cl_info.file_list_filename,
+                cl_info.opt_flag_verbose_makefile,
+                cl_info.opt_flag_simple_album,
+                cl_info.opt_flag_use_echo_e,
+                cl_info.opt_flag_run,
+                cl_info.opt_flag_incremental,
+                cl_info.opt_flag_sync,
+                cl_info.ogg_bitrates,
+                cl_info.ogg_bitrate_cnt,
+                cl_info.output_cache_dirname,
+                (guint64) cl_info.output_cache_size_mib << 20,
+                (guint64) cl_info.pcm_buffer_size_mib << 20,
+                cl_info.job_cnt,
+                track_cache,
+                &local_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    } else if (cl_info.cmd_flag_replay_gain) {
+        status = mutil_run_command_replay_gain(
+                cl_info.arg_list,
+                cl_info.arg_list_sz,
+                cl_info.file_list_filename,
                 cl_info.opt_flag_verbose_makefile,
                 cl_info.opt_flag_simple_album,
                 cl_info.opt_flag_use_echo_e,
+                cl_info.opt_flag_run,
+                cl_info.opt_flag_sync,
+                cl_info.job_cnt,
+                track_cache,
                 &local_error);
         if (status == -1) {
             goto error_handling;
@@ -105,6 +241,14 @@ gint main(
         g_assert(FALSE);
     }
 
+    if (track_cache != NULL) {
+        status = mutil_track_cache_save(track_cache, &local_error);
+        if (status == -1) {
+            mutil_print_warning(TRUE, "%s", local_error->message);
+            g_clear_error(&local_error);
+        }
+    }
+
     g_assert(local_error == NULL);
     ret_value = EXIT_SUCCESS;
     goto cleanup;
@@ -126,6 +270,12 @@ cleanup:
 
     g_assert(local_error == NULL);
 
+    mutil_track_cache_free(track_cache);
+    g_free(cl_info.cache_filename);
+    g_free(cl_info.file_list_filename);
+    g_free(cl_info.output_cache_dirname);
+    g_strfreev(cl_info.ogg_bitrate_texts);
+    g_free(cl_info.ogg_bitrates);
     g_free(cl_info.arg_list);
 
     return ret_value;
@@ -138,17 +288,38 @@ gint mutil_parse_command_line(
         GError **o_error)
 {
     GOptionEntry const opt_ctx_main_entries[] = {
+        {"adaptive-level", 0, 0, G_OPTION_ARG_DOUBLE,
+            &o_cl_info->adaptive_level_pct,
+            "Use the fastest FLAC level within PERCENT of the smallest size",
+            "PERCENT"},
         {"archive", 0, 0, G_OPTION_ARG_NONE, &o_cl_info->cmd_flag_archive,
             "To FLAC using XML file argument", NULL},
         {"auto-track-no", 0, 0, G_OPTION_ARG_NONE,
             &o_cl_info->opt_flag_auto_track_no_tags,
             "Auto-generate track-number tags", NULL},
+        {"cache-file", 0, 0, G_OPTION_ARG_FILENAME,
+            &o_cl_info->cache_filename,
+            "Cache tags read from audio files in FILE", "FILE"},
         {"create-global", 0, 0, G_OPTION_ARG_NONE,
             &o_cl_info->opt_flag_create_global_section,
             "Create an empty global section in XML", NULL},
+        {"dedup", 0, 0, G_OPTION_ARG_NONE, &o_cl_info->opt_flag_dedup,
+            "Encode identical recordings once and copy them", NULL},
+        {"files0-from", 0, 0, G_OPTION_ARG_FILENAME,
+            &o_cl_info->file_list_filename,
+            "Read null-separated audio filenames from FILE ('-' for stdin)",
+            "FILE"},
         {"generate-xml", 0, 0, G_OPTION_ARG_NONE,
             &o_cl_info->cmd_flag_generate_xml,
             "Write XML output using audio file arguments", NULL},
+        {"incremental", 0, 0, G_OPTION_ARG_NONE,
+            &o_cl_info->opt_flag_incremental,
+            "With 'run', remake files only when their content key changes",
+            NULL},
+        {"jobs", 'j', 0, G_OPTION_ARG_INT, &o_cl_info->job_cnt,
+            "Run N jobs at once (default: all CPUs)", "N"},
+        {"no-cache", 0, 0, G_OPTION_ARG_NONE, &o_cl_info->opt_flag_no_cache,
+            "Always read tags from audio files", NULL},
         /* use-echo-e:
          *
          * Make executes commands like 'ls $$(echo .)' using '/bin/sh'. On some
@@ -159,11 +330,36 @@ gint mutil_parse_command_line(
          * be corrupted with extraneous '-e' prefixes. */
         {"use-echo-e", 0, 0, G_OPTION_ARG_NONE, &o_cl_info->opt_flag_use_echo_e,
             "Never use '-e' argument in 'echo'", NULL},
+        {"ogg-bitrate", 0, 0, G_OPTION_ARG_STRING_ARRAY,
+            &o_cl_info->ogg_bitrate_texts,
+            "Encode OGG at an average of KBPS (default: 128); repeat for "
+            "several", "KBPS"},
         {"oggify", 0, 0, G_OPTION_ARG_NONE, &o_cl_info->cmd_flag_oggify,
-            "To OGG using audio file arguments", NULL},
+            "To OGG using audio file arguments, or with 'archive' using its "
+            "XML file argument", NULL},
+        {"output-cache", 0, 0, G_OPTION_ARG_FILENAME,
+            &o_cl_info->output_cache_dirname,
+            "With 'run', link Ogg files encoded before from a cache in DIR",
+            "DIR"},
+        {"output-cache-size", 0, 0, G_OPTION_ARG_INT,
+            &o_cl_info->output_cache_size_mib,
+            "Evict least recently used files beyond MIB from the output cache "
+            "(default: no limit)", "MIB"},
+        {"pcm-buffer-size", 0, 0, G_OPTION_ARG_INT,
+            &o_cl_info->pcm_buffer_size_mib,
+            "With 'run', hold at most MIB of decoded audio at once "
+            "(default: 32)", "MIB"},
+        {"replay-gain", 0, 0, G_OPTION_ARG_NONE,
+            &o_cl_info->cmd_flag_replay_gain,
+            "Add ReplayGain 2.0 tags (-18 LUFS reference) to FLAC file "
+            "arguments", NULL},
+        {"run", 0, 0, G_OPTION_ARG_NONE, &o_cl_info->opt_flag_run,
+            "Run the jobs instead of printing a makefile", NULL},
         {"simple-album", 0, 0, G_OPTION_ARG_NONE,
             &o_cl_info->opt_flag_simple_album,
             "Group tracks using ALBUM tag only", NULL},
+        {"sync", 0, 0, G_OPTION_ARG_NONE, &o_cl_info->opt_flag_sync,
+            "With 'run', make the files durable once all jobs finish", NULL},
         {"verbose-makefile", 0, 0, G_OPTION_ARG_NONE,
             &o_cl_info->opt_flag_verbose_makefile, "Generate verbose makefile",
             NULL},
@@ -174,6 +370,10 @@ gint mutil_parse_command_line(
     GOptionContext *opt_ctx = NULL;
     gboolean parse_result;
     gint cmd_cnt;
+    guint64 ogg_bitrate;
+    gchar *end_pos;
+    guint i;
+    guint j;
 
     g_assert(o_cl_info != NULL);
     g_assert(o_argc != NULL);
@@ -189,9 +389,14 @@ gint mutil_parse_command_line(
             "command options:\n"
             "  --archive\n"
             "  --generate-xml\n"
-            "  --oggify");
+            "  --oggify\n"
+            "  --replay-gain\n"
+            "except that --archive and --oggify may be combined, decoding each "
+            "track once for both.");
     g_option_context_add_main_entries(opt_ctx, opt_ctx_main_entries, NULL);
     memset(o_cl_info, 0, sizeof(mutil_cl_info_t));
+    o_cl_info->adaptive_level_pct = -1.0;
+    o_cl_info->pcm_buffer_size_mib = -1;
     parse_result = g_option_context_parse(opt_ctx, o_argc, o_argv, o_error);
     if (!parse_result) {
         goto error_handling;
@@ -201,7 +406,13 @@ gint mutil_parse_command_line(
     cmd_cnt =
         (o_cl_info->cmd_flag_archive ? 1 : 0) +
         (o_cl_info->cmd_flag_generate_xml ? 1 : 0) +
-        (o_cl_info->cmd_flag_oggify ? 1 : 0);
+        (o_cl_info->cmd_flag_oggify ? 1 : 0) +
+        (o_cl_info->cmd_flag_replay_gain ? 1 : 0);
+
+    /* 'archive' and 'oggify' together count as one command. */
+    if (o_cl_info->cmd_flag_archive && o_cl_info->cmd_flag_oggify) {
+        cmd_cnt--;
+    }
 
     if (cmd_cnt < 1) {
         g_set_error(
@@ -221,6 +432,24 @@ gint mutil_parse_command_line(
         goto error_handling;
     }
 
+    if (o_cl_info->job_cnt < 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies negative job count");
+        goto error_handling;
+    }
+
+    /* Default to one job per processor. */
+    if (o_cl_info->job_cnt == 0) {
+        o_cl_info->job_cnt = g_get_num_processors();
+    }
+
+    if (o_cl_info->cache_filename == NULL) {
+        o_cl_info->cache_filename = mutil_track_cache_default_filename();
+    }
+
     /* Verify that exactly one argument is specified if the 'archive' command is
      * specified. */
     if (o_cl_info->cmd_flag_archive && *o_argc < 2) {
@@ -245,10 +474,210 @@ gint mutil_parse_command_line(
         o_cl_info->xml_spec_filename = (*o_argv)[1];
     }
 
-    /* Allocate argument lits if the 'generate-xml' or 'oggify' commands are
-     * specified. */
+    /* A negative level tolerance means that '--adaptive-level' wasn't given,
+     * so only -1.0 itself is accepted. */
+    if (o_cl_info->adaptive_level_pct < 0.0 &&
+        o_cl_info->adaptive_level_pct != -1.0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies negative level tolerance");
+        goto error_handling;
+    }
+
+    if (o_cl_info->adaptive_level_pct >= 0.0 &&
+        !o_cl_info->cmd_flag_archive) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies adaptive level for command other than "
+                "'archive'");
+        goto error_handling;
+    }
+
+    /* A file list replaces the audio file arguments, so it's only meaningful
+     * for the 'generate-xml', 'oggify' and 'replay-gain' commands. */
+    if (o_cl_info->file_list_filename != NULL &&
+        o_cl_info->cmd_flag_archive) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies file list for 'archive' command");
+        goto error_handling;
+    }
+
+    if (o_cl_info->file_list_filename != NULL && *o_argc > 1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies both file list and audio files");
+        goto error_handling;
+    }
+
+    if (o_cl_info->opt_flag_run && o_cl_info->cmd_flag_generate_xml) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies 'run' for 'generate-xml' command");
+        goto error_handling;
+    }
+
+    /* Content keys are kept in the journal, which only in-process runs
+     * have. */
+    if (o_cl_info->opt_flag_incremental &&
+        (!o_cl_info->opt_flag_run || o_cl_info->cmd_flag_generate_xml ||
+         o_cl_info->cmd_flag_replay_gain)) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies 'incremental' without 'run' for "
+                "'archive' or 'oggify' command");
+        goto error_handling;
+    }
+
+    /* Only in-process runs write the files themselves. */
+    if (o_cl_info->opt_flag_sync && !o_cl_info->opt_flag_run) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies 'sync' without 'run'");
+        goto error_handling;
+    }
+
+    /* The output cache holds Ogg files, which only in-process runs link
+     * from it. */
+    if (o_cl_info->output_cache_dirname != NULL &&
+        (!o_cl_info->opt_flag_run || !o_cl_info->cmd_flag_oggify)) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies output cache without 'run' for "
+                "'oggify' command");
+        goto error_handling;
+    }
+
+    /* Each bitrate makes a set of Ogg files of its own. */
+    if (o_cl_info->ogg_bitrate_texts != NULL && !o_cl_info->cmd_flag_oggify) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies Ogg bitrate for command other than "
+                "'oggify'");
+        goto error_handling;
+    }
+
+    if (o_cl_info->ogg_bitrate_texts != NULL) {
+        o_cl_info->ogg_bitrate_cnt = g_strv_length(
+                o_cl_info->ogg_bitrate_texts);
+        o_cl_info->ogg_bitrates = g_new0(guint, o_cl_info->ogg_bitrate_cnt);
+        for (i = 0; i < o_cl_info->ogg_bitrate_cnt; i++) {
+            ogg_bitrate = g_ascii_strtoull(
+                    o_cl_info->ogg_bitrate_texts[i],
+                    &end_pos,
+                    10);
+            if (end_pos == o_cl_info->ogg_bitrate_texts[i] ||
+                *end_pos != '\0' ||
+                ogg_bitrate < mutil_ogg_bitrate_min ||
+                ogg_bitrate > mutil_ogg_bitrate_max) {
+                g_set_error(
+                        o_error,
+                        mutil_error_domain,
+                        mutil_error_code_undefined,
+                        "command line specifies invalid Ogg bitrate '%s' "
+                        "(expected %d to %d kbit/s)",
+                        o_cl_info->ogg_bitrate_texts[i],
+                        mutil_ogg_bitrate_min,
+                        mutil_ogg_bitrate_max);
+                goto error_handling;
+            }
+            for (j = 0; j < i; j++) {
+                if (o_cl_info->ogg_bitrates[j] == ogg_bitrate) {
+                    g_set_error(
+                            o_error,
+                            mutil_error_domain,
+                            mutil_error_code_undefined,
+                            "command line specifies Ogg bitrate '%s' more "
+                            "than once",
+                            o_cl_info->ogg_bitrate_texts[i]);
+                    goto error_handling;
+                }
+            }
+            o_cl_info->ogg_bitrates[i] = (guint) ogg_bitrate;
+        }
+    } else {
+        o_cl_info->ogg_bitrate_cnt = 1;
+        o_cl_info->ogg_bitrates = g_new0(guint, 1);
+        o_cl_info->ogg_bitrates[0] = mutil_ogg_bitrate_default;
+    }
+
+    if (o_cl_info->output_cache_size_mib < 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies negative output cache size");
+        goto error_handling;
+    }
+
+    if (o_cl_info->output_cache_size_mib > 0 &&
+        o_cl_info->output_cache_dirname == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies output cache size without output "
+                "cache");
+        goto error_handling;
+    }
+
+    /* A negative size means that '--pcm-buffer-size' wasn't given, so only -1
+     * itself is accepted. The pool is only used by in-process runs. */
+    if (o_cl_info->pcm_buffer_size_mib < -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies negative PCM buffer size");
+        goto error_handling;
+    }
+
+    if (o_cl_info->pcm_buffer_size_mib >= 0 && !o_cl_info->opt_flag_run) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies PCM buffer size without 'run'");
+        goto error_handling;
+    }
+
+    if (o_cl_info->pcm_buffer_size_mib == 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "command line specifies zero PCM buffer size");
+        goto error_handling;
+    }
+
+    if (o_cl_info->pcm_buffer_size_mib < 0) {
+        o_cl_info->pcm_buffer_size_mib = mutil_pcm_buffer_size_default;
+    }
+
+    /* Allocate argument lits if the 'generate-xml', 'oggify' or 'replay-gain'
+     * commands are specified. With 'archive', 'oggify' reads the XML file
+     * instead. */
     if (o_cl_info->cmd_flag_generate_xml ||
-        o_cl_info->cmd_flag_oggify) {
+        (o_cl_info->cmd_flag_oggify && !o_cl_info->cmd_flag_archive) ||
+        o_cl_info->cmd_flag_replay_gain) {
         o_cl_info->arg_list = g_malloc0((*o_argc - 1) * sizeof(gchar const *));
         memcpy(
                 o_cl_info->arg_list,
@@ -279,11 +708,128 @@ cleanup:
     return ret_value;
 } /* mutil_parse_command_line */
 
+gint mutil_output_job_graph(
+        mutil_job_graph_t *job_graph,
+        gboolean opt_flag_run,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_sync,
+        gchar const *output_cache_dirname,
+        guint64 output_cache_max_sz,
+        guint64 pcm_buffer_max_sz,
+        gint job_cnt,
+        gboolean opt_flag_verbose_makefile,
+        gboolean opt_flag_use_echo_e,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_makefile_t *makefile = NULL;
+    gchar *makefile_text = NULL;
+    gchar *journal_filename = NULL;
+    mutil_journal_t *journal = NULL;
+    mutil_output_cache_t *output_cache = NULL;
+    mutil_pcm_pool_t *pcm_pool = NULL;
+    GError *local_error = NULL;
+
+    g_assert(job_graph != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Either run the jobs or print them as a makefile. */
+
+    if (opt_flag_run) {
+        journal_filename = mutil_journal_default_filename();
+        journal = mutil_journal_open(journal_filename, o_error);
+        if (journal == NULL) {
+            goto error_handling;
+        }
+
+        /* The output cache is only an optimization, so problems with it
+         * aren't fatal. */
+        if (output_cache_dirname != NULL) {
+            output_cache = mutil_output_cache_open(
+                    output_cache_dirname,
+                    output_cache_max_sz,
+                    &local_error);
+            if (output_cache == NULL) {
+                mutil_print_warning(TRUE, "%s", local_error->message);
+                g_clear_error(&local_error);
+            }
+        }
+
+        /* The pool is allocated once, up front, for all the jobs. */
+        if (pcm_buffer_max_sz > 0) {
+            pcm_pool = mutil_pcm_pool_alloc(pcm_buffer_max_sz);
+        }
+
+        status = mutil_job_graph_run(
+                job_graph,
+                job_cnt,
+                journal,
+                output_cache,
+                pcm_pool,
+                opt_flag_incremental,
+                opt_flag_sync,
+                opt_flag_verbose_makefile,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+
+        if (output_cache != NULL) {
+            status = mutil_output_cache_trim(output_cache, &local_error);
+            if (status == -1) {
+                mutil_print_warning(TRUE, "%s", local_error->message);
+                g_clear_error(&local_error);
+            }
+        }
+    } else {
+        g_assert(makefile == NULL);
+        makefile = mutil_job_graph_generate_makefile(
+                job_graph,
+                opt_flag_verbose_makefile,
+                opt_flag_use_echo_e);
+        makefile_text = mutil_makefile_to_string(makefile);
+        g_printf("%s", makefile_text);
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_makefile_free(makefile);
+    g_free(makefile_text);
+    mutil_journal_free(journal);
+    mutil_output_cache_free(output_cache);
+    mutil_pcm_pool_free(pcm_pool);
+    g_free(journal_filename);
+
+    return ret_value;
+} /* mutil_output_job_graph */
+
 gint mutil_run_command_archive(
         gchar const *xml_spec_filename,
         gboolean opt_flag_verbose_makefile,
         gboolean opt_flag_simple_album,
         gboolean opt_flag_use_echo_e,
+        gboolean opt_flag_dedup,
+        gboolean opt_flag_run,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_sync,
+        gdouble adaptive_level_pct,
+        guint const *ogg_bitrates,
+        guint ogg_bitrate_cnt,
+        gchar const *output_cache_dirname,
+        guint64 output_cache_max_sz,
+        guint64 pcm_buffer_max_sz,
+        gint job_cnt,
         GError **o_error)
 {
 
@@ -292,8 +838,7 @@ gint mutil_run_command_archive(
     GList *track_list = NULL;
     gint status;
     GList *album_list = NULL;
-    mutil_makefile_t *makefile = NULL;
-    gchar *makefile_text = NULL;
+    mutil_job_graph_t *job_graph = NULL;
 
     g_assert(xml_spec_filename != NULL);
     g_assert(o_error == NULL || *o_error == NULL);
@@ -335,16 +880,50 @@ gint mutil_run_command_archive(
         goto error_handling;
     }
 
-    /* Generate and print the makefile. */
-    g_assert(makefile == NULL);
-    makefile = mutil_album_list_generate_archive_makefile(
+    /* Trial-encode each album to choose its FLAC compression level. */
+    if (adaptive_level_pct >= 0.0) {
+        status = mutil_album_list_choose_flac_levels(
+                album_list,
+                adaptive_level_pct / 100.0,
+                job_cnt,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    /* Generate the jobs and run them or print the makefile. */
+    g_assert(job_graph == NULL);
+    job_graph = mutil_album_list_create_archive_job_graph(
             album_list,
-            opt_flag_verbose_makefile,
-            opt_flag_use_echo_e);
-    makefile_text = mutil_makefile_to_string(makefile);
-    g_printf("%s", makefile_text);
+            opt_flag_dedup,
+            job_cnt);
+
+    /* The Ogg files of each track are made along with its FLAC file, from
+     * the same decode. */
+    if (ogg_bitrate_cnt > 0) {
+        mutil_album_list_add_oggify_jobs(
+                album_list,
+                job_graph,
+                ogg_bitrates,
+                ogg_bitrate_cnt);
+    }
 
-    /* Output the makefile. */
+    status = mutil_output_job_graph(
+            job_graph,
+            opt_flag_run,
+            opt_flag_incremental,
+            opt_flag_sync,
+            output_cache_dirname,
+            output_cache_max_sz,
+            pcm_buffer_max_sz,
+            job_cnt,
+            opt_flag_verbose_makefile,
+            opt_flag_use_echo_e,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
 
     g_assert(o_error == NULL || *o_error == NULL);
     ret_value = 0;
@@ -361,8 +940,7 @@ cleanup:
     xmlFreeDoc(xml_doc);
     mutil_track_free_list_of(track_list);
     mutil_album_list_free(album_list);
-    mutil_makefile_free(makefile);
-    g_free(makefile_text);
+    mutil_job_graph_free(job_graph);
 
     return ret_value;
 } /* mutil_run_command_archive */
@@ -370,9 +948,12 @@ cleanup:
 gint mutil_run_command_generate_xml(
         gchar const * const *audio_filenames,
         gint audio_filename_cnt,
+        gchar const *file_list_filename,
         gboolean opt_flag_auto_track_no_tags,
         gboolean opt_flag_simple_album,
         gboolean opt_flag_create_global_section,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
         GError **o_error)
 {
     gint ret_value;
@@ -386,11 +967,22 @@ gint mutil_run_command_generate_xml(
     /* Create the XML document and write it to standard out. */
 
     g_assert(track_list == NULL);
-    status = mutil_create_track_list_from_audio_files(
-            audio_filenames,
-            audio_filename_cnt,
-            &track_list,
-            o_error);
+    if (file_list_filename != NULL) {
+        status = mutil_create_track_list_from_file_list(
+                file_list_filename,
+                job_cnt,
+                track_cache,
+                &track_list,
+                o_error);
+    } else {
+        status = mutil_create_track_list_from_audio_files(
+                audio_filenames,
+                audio_filename_cnt,
+                job_cnt,
+                track_cache,
+                &track_list,
+                o_error);
+    }
     if (status == -1) {
         goto error_handling;
     }
@@ -447,28 +1039,49 @@ cleanup:
 gint mutil_run_command_oggify(
         gchar const * const *audio_filenames,
         gint audio_filename_cnt,
+        gchar const *file_list_filename,
         gboolean opt_flag_verbose_makefile,
         gboolean opt_flag_simple_album,
         gboolean opt_flag_use_echo_e,
+        gboolean opt_flag_run,
+        gboolean opt_flag_incremental,
+        gboolean opt_flag_sync,
+        guint const *ogg_bitrates,
+        guint ogg_bitrate_cnt,
+        gchar const *output_cache_dirname,
+        guint64 output_cache_max_sz,
+        guint64 pcm_buffer_max_sz,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
         GError **o_error)
 {
     gint ret_value;
     gint status;
     GList *track_list = NULL;
     GList *album_list = NULL;
-    mutil_makefile_t *makefile = NULL;
-    gchar *makefile_text = NULL;
+    mutil_job_graph_t *job_graph = NULL;
 
     g_assert(o_error == NULL || *o_error == NULL);
 
     /* Create a track for each audio file, and separate the tracks into albums.
      * */
 
-    status = mutil_create_track_list_from_audio_files(
-            audio_filenames,
-            audio_filename_cnt,
-            &track_list,
-            o_error);
+    if (file_list_filename != NULL) {
+        status = mutil_create_track_list_from_file_list(
+                file_list_filename,
+                job_cnt,
+                track_cache,
+                &track_list,
+                o_error);
+    } else {
+        status = mutil_create_track_list_from_audio_files(
+                audio_filenames,
+                audio_filename_cnt,
+                job_cnt,
+                track_cache,
+                &track_list,
+                o_error);
+    }
     if (status == -1) {
         goto error_handling;
     }
@@ -485,14 +1098,27 @@ gint mutil_run_command_oggify(
         goto error_handling;
     }
 
-    /* Generate and print the makefile. */
-    g_assert(makefile == NULL);
-    makefile = mutil_album_list_generate_oggify_makefile(
+    /* Generate the jobs and run them or print the makefile. */
+    g_assert(job_graph == NULL);
+    job_graph = mutil_album_list_create_oggify_job_graph(
             album_list,
+            ogg_bitrates,
+            ogg_bitrate_cnt);
+    status = mutil_output_job_graph(
+            job_graph,
+            opt_flag_run,
+            opt_flag_incremental,
+            opt_flag_sync,
+            output_cache_dirname,
+            output_cache_max_sz,
+            pcm_buffer_max_sz,
+            job_cnt,
             opt_flag_verbose_makefile,
-            opt_flag_use_echo_e);
-    makefile_text = mutil_makefile_to_string(makefile);
-    g_printf("%s", makefile_text);
+            opt_flag_use_echo_e,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
 
     g_assert(o_error == NULL || *o_error == NULL);
     ret_value = 0;
@@ -508,9 +1134,102 @@ cleanup:
 
     mutil_album_list_free(album_list);
     mutil_track_free_list_of(track_list);
-    mutil_makefile_free(makefile);
-    g_free(makefile_text);
+    mutil_job_graph_free(job_graph);
 
     return ret_value;
 } /* mutil_run_command_oggify */
 
+gint mutil_run_command_replay_gain(
+        gchar const * const *audio_filenames,
+        gint audio_filename_cnt,
+        gchar const *file_list_filename,
+        gboolean opt_flag_verbose_makefile,
+        gboolean opt_flag_simple_album,
+        gboolean opt_flag_use_echo_e,
+        gboolean opt_flag_run,
+        gboolean opt_flag_sync,
+        gint job_cnt,
+        mutil_track_cache_t *track_cache,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    GList *track_list = NULL;
+    GList *album_list = NULL;
+    mutil_job_graph_t *job_graph = NULL;
+
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Create a track for each audio file, and separate the tracks into albums.
+     * */
+
+    if (file_list_filename != NULL) {
+        status = mutil_create_track_list_from_file_list(
+                file_list_filename,
+                job_cnt,
+                track_cache,
+                &track_list,
+                o_error);
+    } else {
+        status = mutil_create_track_list_from_audio_files(
+                audio_filenames,
+                audio_filename_cnt,
+                job_cnt,
+                track_cache,
+                &track_list,
+                o_error);
+    }
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(album_list == NULL);
+    status = mutil_album_list_create_from_track_list(
+            &album_list,
+            track_list,
+            opt_flag_simple_album,
+            FALSE, /* disable sanity warnings */
+            FALSE, /* don't auto-generate track-number tags */
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    /* Generate the jobs and run them or print the makefile. Existing files are
+     * retagged, so nothing needs to be encoded. */
+    g_assert(job_graph == NULL);
+    job_graph = mutil_album_list_create_replay_gain_job_graph(album_list);
+    status = mutil_output_job_graph(
+            job_graph,
+            opt_flag_run,
+            FALSE, /* not incremental */
+            opt_flag_sync,
+            NULL, /* no output cache */
+            0,
+            0, /* loudness jobs decode without the pool */
+            job_cnt,
+            opt_flag_verbose_makefile,
+            opt_flag_use_echo_e,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_album_list_free(album_list);
+    mutil_track_free_list_of(track_list);
+    mutil_job_graph_free(job_graph);
+
+    return ret_value;
+} /* mutil_run_command_replay_gain */
@@ -7,6 +7,7 @@
 struct mutil_make_rule {
     GList *targets;
     GList *prereqs;
+    GList *order_only_prereqs;
     GList *commands;
 };
 
@@ -66,6 +67,23 @@ void mutil_make_rule_append_command(
     return;
 } /* mutil_make_rule_append_command */
 
+void mutil_make_rule_append_order_only_prereq(
+        mutil_make_rule_t *make_rule,
+        gchar const *filename)
+{
+    gchar *safe_filename;
+
+    g_assert(make_rule != NULL);
+    g_assert(filename != NULL);
+
+    safe_filename = mutil_format_filename_safe_for_make(filename);
+    make_rule->order_only_prereqs = g_list_append(
+            make_rule->order_only_prereqs,
+            safe_filename);
+
+    return;
+} /* mutil_make_rule_append_order_only_prereq */
+
 void mutil_make_rule_append_prereq(
         mutil_make_rule_t *make_rule,
         gchar const *filename)
@@ -115,6 +133,13 @@ void mutil_make_rule_free(
                     make_rule->prereqs);
         }
 
+        while (make_rule->order_only_prereqs != NULL) {
+            g_free(make_rule->order_only_prereqs->data);
+            make_rule->order_only_prereqs = g_list_delete_link(
+                    make_rule->order_only_prereqs,
+                    make_rule->order_only_prereqs);
+        }
+
         while (make_rule->commands != NULL) {
             g_free(make_rule->commands->data);
             make_rule->commands = g_list_delete_link(
@@ -216,6 +241,19 @@ gchar *mutil_makefile_to_string(
                     (gchar const *) node_j->data);
         }
 
+        if (make_rule_i->order_only_prereqs != NULL) {
+            g_string_append(makefile_text, " |");
+        }
+
+        for (node_j = make_rule_i->order_only_prereqs;
+             node_j != NULL;
+             node_j = node_j->next) {
+            g_string_append_printf(
+                    makefile_text,
+                    " %s",
+                    (gchar const *) node_j->data);
+        }
+
         g_string_append(makefile_text, "\n");
 
         for (node_j = make_rule_i->commands;
@@ -20,6 +20,12 @@ void mutil_make_rule_append_command(
         mutil_make_rule_t *make_rule,
         gchar const *command);
 
+/* Order-only prerequisites must be made before the rule's target, but their
+ * being newer doesn't cause the target to be remade. */
+void mutil_make_rule_append_order_only_prereq(
+        mutil_make_rule_t *make_rule,
+        gchar const *filename);
+
 void mutil_make_rule_append_prereq(
         mutil_make_rule_t *make_rule,
         gchar const *filename);
@@ -0,0 +1,395 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_output_cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct mutil_output_cache_entry;
+typedef struct mutil_output_cache_entry mutil_output_cache_entry_t;
+
+/* Entries are spread over subdirectories named after the first two characters
+ * of their keys, so that no directory grows too large. */
+struct mutil_output_cache {
+    gchar *dirname;
+    guint64 max_sz;
+};
+
+/* An entry found while trimming the cache. */
+struct mutil_output_cache_entry {
+    gchar *filename;
+    struct timespec mtime;
+    guint64 sz;
+};
+
+static gchar *mutil_output_cache_build_entry_filename(
+        mutil_output_cache_t const *output_cache,
+        gchar const *key);
+
+static gint mutil_output_cache_cb_compare_entries(
+        gconstpointer a,
+        gconstpointer b);
+
+gchar *mutil_output_cache_build_entry_filename(
+        mutil_output_cache_t const *output_cache,
+        gchar const *key)
+{
+    gchar *new_filename;
+    gchar *subdir_name;
+
+    g_assert(output_cache != NULL);
+    g_assert(key != NULL);
+    g_assert(strlen(key) > 2 && strchr(key, G_DIR_SEPARATOR) == NULL);
+
+    subdir_name = g_strndup(key, 2);
+    new_filename = g_build_filename(
+            output_cache->dirname,
+            subdir_name,
+            key,
+            NULL);
+    g_free(subdir_name);
+
+    return new_filename;
+} /* mutil_output_cache_build_entry_filename */
+
+gint mutil_output_cache_cb_compare_entries(
+        gconstpointer a,
+        gconstpointer b)
+{
+    mutil_output_cache_entry_t const *entry_a = a;
+    mutil_output_cache_entry_t const *entry_b = b;
+
+    /* Least recently used first. */
+    if (entry_a->mtime.tv_sec != entry_b->mtime.tv_sec) {
+        return entry_a->mtime.tv_sec < entry_b->mtime.tv_sec ? -1 : 1;
+    }
+    if (entry_a->mtime.tv_nsec != entry_b->mtime.tv_nsec) {
+        return entry_a->mtime.tv_nsec < entry_b->mtime.tv_nsec ? -1 : 1;
+    }
+
+    return 0;
+} /* mutil_output_cache_cb_compare_entries */
+
+gint mutil_output_cache_fetch(
+        mutil_output_cache_t *output_cache,
+        gchar const *key,
+        gchar const *tgt_filename,
+        gboolean *o_is_hit,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    gchar *entry_filename = NULL;
+
+    g_assert(output_cache != NULL);
+    g_assert(key != NULL);
+    g_assert(tgt_filename != NULL);
+    g_assert(o_is_hit != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    *o_is_hit = FALSE;
+
+    entry_filename = mutil_output_cache_build_entry_filename(output_cache, key);
+
+    /* A hard link costs no space and no copying. Across file systems, or
+     * where hard links aren't supported, the entry is copied instead. */
+    g_unlink(tgt_filename);
+    status = link(entry_filename, tgt_filename);
+    if (status == -1 && errno == ENOENT) {
+        goto success;
+    }
+    if (status == -1) {
+        status = mutil_copy_file(entry_filename, tgt_filename, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    /* Mark the entry as recently used. A failure only affects the order of
+     * eviction. */
+    utimensat(AT_FDCWD, entry_filename, NULL, 0);
+
+    *o_is_hit = TRUE;
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    g_free(entry_filename);
+
+    return ret_value;
+} /* mutil_output_cache_fetch */
+
+void mutil_output_cache_free(
+        mutil_output_cache_t *output_cache)
+{
+    if (output_cache != NULL) {
+        g_free(output_cache->dirname);
+        g_free(output_cache);
+    }
+
+    return;
+} /* mutil_output_cache_free */
+
+mutil_output_cache_t *mutil_output_cache_open(
+        gchar const *dirname,
+        guint64 max_sz,
+        GError **o_error)
+{
+    mutil_output_cache_t *new_output_cache = NULL;
+    gint status;
+
+    g_assert(dirname != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    status = g_mkdir_with_parents(dirname, 0777);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create output cache directory '%s': %s",
+                dirname,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    new_output_cache = g_malloc0(sizeof(mutil_output_cache_t));
+    new_output_cache->dirname = g_strdup(dirname);
+    new_output_cache->max_sz = max_sz;
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    mutil_output_cache_free(new_output_cache);
+    new_output_cache = NULL;
+
+cleanup:
+
+    return new_output_cache;
+} /* mutil_output_cache_open */
+
+gint mutil_output_cache_store(
+        mutil_output_cache_t *output_cache,
+        gchar const *key,
+        gchar const *src_filename,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    gchar *entry_filename = NULL;
+    gchar *subdir_name = NULL;
+    gchar *tmp_filename = NULL;
+    gint tmp_fd;
+
+    g_assert(output_cache != NULL);
+    g_assert(key != NULL);
+    g_assert(src_filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    entry_filename = mutil_output_cache_build_entry_filename(output_cache, key);
+    subdir_name = g_path_get_dirname(entry_filename);
+
+    status = g_mkdir_with_parents(subdir_name, 0777);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create output cache directory '%s': %s",
+                subdir_name,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* Linking is atomic, so the entry appears complete. If another job or
+     * process stored the key first, its entry is as good. */
+    status = link(src_filename, entry_filename);
+    if (status == 0 || errno == EEXIST) {
+        goto success;
+    }
+
+    /* Otherwise the file is copied under a temporary name, which is then
+     * renamed into place. */
+    tmp_filename = g_strconcat(entry_filename, ".XXXXXX", NULL);
+    tmp_fd = g_mkstemp(tmp_filename);
+    if (tmp_fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create file '%s': %s",
+                tmp_filename,
+                g_strerror(errno));
+        g_free(tmp_filename);
+        tmp_filename = NULL;
+        goto error_handling;
+    }
+    close(tmp_fd);
+
+    status = mutil_copy_file(src_filename, tmp_filename, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    status = g_rename(tmp_filename, entry_filename);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to rename '%s': %s",
+                tmp_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+    g_free(tmp_filename);
+    tmp_filename = NULL;
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+    g_prefix_error(o_error, "failed to add to output cache: ");
+
+    if (tmp_filename != NULL) {
+        g_unlink(tmp_filename);
+    }
+
+    ret_value = -1;
+
+cleanup:
+
+    g_free(entry_filename);
+    g_free(subdir_name);
+    g_free(tmp_filename);
+
+    return ret_value;
+} /* mutil_output_cache_store */
+
+gint mutil_output_cache_trim(
+        mutil_output_cache_t *output_cache,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    GDir *dir = NULL;
+    GDir *subdir = NULL;
+    gchar const *name_i;
+    gchar const *entry_name_j;
+    gchar *subdir_name = NULL;
+    GArray *entries = NULL;
+    mutil_output_cache_entry_t entry;
+    mutil_output_cache_entry_t *entry_i;
+    struct stat entry_stat;
+    guint64 total_sz = 0;
+    guint i;
+
+    g_assert(output_cache != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (output_cache->max_sz == 0) {
+        goto success;
+    }
+
+    /* Stray temporary files left by killed processes are counted like
+     * entries, so they are removed in their turn. Entries still linked to a
+     * target take no space of their own, since removing them would free
+     * nothing, so they are neither counted nor removed. */
+
+    entries = g_array_new(FALSE, FALSE, sizeof(mutil_output_cache_entry_t));
+
+    dir = g_dir_open(output_cache->dirname, 0, o_error);
+    if (dir == NULL) {
+        goto error_handling;
+    }
+
+    while ((name_i = g_dir_read_name(dir)) != NULL) {
+        g_free(subdir_name);
+        subdir_name = g_build_filename(output_cache->dirname, name_i, NULL);
+        subdir = g_dir_open(subdir_name, 0, NULL);
+        if (subdir == NULL) {
+            continue;
+        }
+
+        while ((entry_name_j = g_dir_read_name(subdir)) != NULL) {
+            entry.filename = g_build_filename(subdir_name, entry_name_j, NULL);
+            status = g_stat(entry.filename, &entry_stat);
+            if (status == -1 ||
+                !S_ISREG(entry_stat.st_mode) ||
+                entry_stat.st_nlink > 1) {
+                g_free(entry.filename);
+                continue;
+            }
+            entry.mtime = entry_stat.st_mtim;
+            entry.sz = entry_stat.st_size;
+            g_array_append_val(entries, entry);
+            total_sz += entry.sz;
+        }
+
+        g_dir_close(subdir);
+        subdir = NULL;
+    }
+
+    /* Entries another process removed meanwhile are simply skipped. */
+    g_array_sort(entries, mutil_output_cache_cb_compare_entries);
+    for (i = 0; total_sz > output_cache->max_sz && i < entries->len; i++) {
+        entry_i = &g_array_index(entries, mutil_output_cache_entry_t, i);
+        g_unlink(entry_i->filename);
+        total_sz -= entry_i->sz;
+    }
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+    g_prefix_error(o_error, "failed to trim output cache: ");
+
+    ret_value = -1;
+
+cleanup:
+
+    if (entries != NULL) {
+        for (i = 0; i < entries->len; i++) {
+            entry_i = &g_array_index(entries, mutil_output_cache_entry_t, i);
+            g_free(entry_i->filename);
+        }
+        g_array_free(entries, TRUE);
+    }
+    if (subdir != NULL) {
+        g_dir_close(subdir);
+    }
+    if (dir != NULL) {
+        g_dir_close(dir);
+    }
+    g_free(subdir_name);
+
+    return ret_value;
+} /* mutil_output_cache_trim */
@@ -0,0 +1,60 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_output_cache_h
+#define mutil_output_cache_h
+
+#include "mutil_common.h"
+
+/* The output cache keeps encoded files by a key that covers everything they
+ * are made from, so that the same encoding needed under another name, as in
+ * another directory layout, is linked or copied from the cache instead of
+ * being encoded again. Keys are hex digests chosen by the caller.
+ *
+ * Entries are plain files in a directory, named after their key. They are
+ * hard-linked to their targets where the file system allows, so they must
+ * never be modified in place. A hit touches the entry's modification time,
+ * which orders the entries for least-recently-used eviction. Fetches and
+ * stores may be done concurrently from multiple threads and processes. */
+
+struct mutil_output_cache;
+typedef struct mutil_output_cache mutil_output_cache_t;
+
+/* Links or copies the entry for the key to tgt_filename and sets *o_is_hit,
+ * or leaves *o_is_hit FALSE if there is no entry. */
+gint mutil_output_cache_fetch(
+        mutil_output_cache_t *output_cache,
+        gchar const *key,
+        gchar const *tgt_filename,
+        gboolean *o_is_hit,
+        GError **o_error);
+
+void mutil_output_cache_free(
+        mutil_output_cache_t *output_cache);
+
+/* Opens the cache in the directory, creating it if needed. If max_sz isn't
+ * zero, mutil_output_cache_trim() keeps the cache within max_sz bytes.
+ *
+ * Returns: NULL on error.
+ */
+mutil_output_cache_t *mutil_output_cache_open(
+        gchar const *dirname,
+        guint64 max_sz,
+        GError **o_error);
+
+/* Adds the complete file src_filename as the entry for the key, unless there
+ * is one already. */
+gint mutil_output_cache_store(
+        mutil_output_cache_t *output_cache,
+        gchar const *key,
+        gchar const *src_filename,
+        GError **o_error);
+
+/* Removes the least recently used entries until the cache is within its size
+ * limit. Entries hard-linked to targets are left alone and don't count
+ * towards the limit, as their space isn't the cache's alone. */
+gint mutil_output_cache_trim(
+        mutil_output_cache_t *output_cache,
+        GError **o_error);
+
+#endif /* #ifndef mutil_output_cache_h */
@@ -0,0 +1,466 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_output_file.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Size of the chunks written at a time, and their alignment in the file. */
+#define mutil_output_chunk_sz (1024 * 1024)
+
+/* The buffer holds the bytes from buf_offset on, up to the next chunk boundary
+ * at most, so that each full buffer is written as an aligned chunk. end_offset
+ * is the end of what has been written, which may be past the current position
+ * after a seek back, as when a FLAC encoder fills in its header at the end. */
+struct mutil_output_file {
+    gchar *filename;
+    gint fd;
+    guint8 *buf;
+    gsize buf_len;
+    guint64 buf_offset;
+    guint64 end_offset;
+};
+
+/* The files added, as sets by directory, so that a file added by several jobs,
+ * such as an encoded track later tagged with its replay gain, is synced
+ * once. */
+struct mutil_output_sync {
+    GMutex mutex;
+    GHashTable *dir_table;
+};
+
+static gint mutil_output_file_flush(
+        mutil_output_file_t *file,
+        GError **o_error);
+
+static gint mutil_sync_filename(
+        gchar const *filename,
+        gint flags,
+        GError **o_error);
+
+gint mutil_output_file_commit(
+        mutil_output_file_t *file,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+
+    g_assert(file != NULL);
+    g_assert(file->fd != -1);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    status = mutil_output_file_flush(file, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    /* The preallocated space past the end is given back. */
+    status = ftruncate(file->fd, file->end_offset);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to truncate file '%s': %s",
+                file->filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* Start writing the file back now rather than when the kernel gets around
+     * to it, so that a sync at the end of the run has little left to do. */
+    sync_file_range(file->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+
+    status = close(file->fd);
+    file->fd = -1;
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to write file '%s': %s",
+                file->filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_output_file_commit */
+
+gint mutil_output_file_flush(
+        mutil_output_file_t *file,
+        GError **o_error)
+{
+    gint ret_value;
+    gsize written_sz = 0;
+    gssize status;
+
+    g_assert(file != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    while (written_sz < file->buf_len) {
+        status = pwrite(
+                file->fd,
+                file->buf + written_sz,
+                file->buf_len - written_sz,
+                file->buf_offset + written_sz);
+        if (status == -1 && errno == EINTR) {
+            continue;
+        }
+        if (status <= 0) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to write file '%s': %s",
+                    file->filename,
+                    status == 0 ? "no space written" : g_strerror(errno));
+            goto error_handling;
+        }
+        written_sz += status;
+    }
+
+    file->buf_offset += file->buf_len;
+    file->buf_len = 0;
+    file->end_offset = MAX(file->end_offset, file->buf_offset);
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_output_file_flush */
+
+void mutil_output_file_free(
+        mutil_output_file_t *file)
+{
+    if (file != NULL) {
+        if (file->fd != -1) {
+            close(file->fd);
+        }
+        g_free(file->filename);
+        g_free(file->buf);
+        g_free(file);
+    }
+
+    return;
+} /* mutil_output_file_free */
+
+mutil_output_file_t *mutil_output_file_open(
+        gchar const *filename,
+        guint64 expected_sz,
+        GError **o_error)
+{
+    mutil_output_file_t *new_file = NULL;
+
+    g_assert(filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    new_file = g_malloc0(sizeof(mutil_output_file_t));
+    new_file->filename = g_strdup(filename);
+
+    /* An existing file, such as a part file left by a killed run, may be
+     * hard-linked to an output cache entry or a target, so it's replaced
+     * rather than truncated. */
+    g_unlink(filename);
+    new_file->fd = open(
+            filename,
+            O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+            0666);
+    if (new_file->fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create file '%s': %s",
+                filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* Reserve the whole file at once, so that the file system can lay it out
+     * contiguously instead of growing it a write at a time. It's fine if the
+     * file system can't, or if the estimate is off either way. */
+    if (expected_sz > 0) {
+        fallocate(new_file->fd, 0, 0, expected_sz);
+    }
+
+    new_file->buf = g_malloc(mutil_output_chunk_sz);
+
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    mutil_output_file_free(new_file);
+    new_file = NULL;
+
+cleanup:
+
+    return new_file;
+} /* mutil_output_file_open */
+
+gint mutil_output_file_seek(
+        mutil_output_file_t *file,
+        guint64 offset,
+        GError **o_error)
+{
+    gint status;
+
+    g_assert(file != NULL);
+    g_assert(file->fd != -1);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    status = mutil_output_file_flush(file, o_error);
+    if (status == -1) {
+        return -1;
+    }
+
+    file->buf_offset = offset;
+
+    return 0;
+} /* mutil_output_file_seek */
+
+gint mutil_output_file_sync(
+        gchar const *filename,
+        GError **o_error)
+{
+    return mutil_sync_filename(filename, O_RDONLY, o_error);
+} /* mutil_output_file_sync */
+
+guint64 mutil_output_file_tell(
+        mutil_output_file_t const *file)
+{
+    g_assert(file != NULL);
+
+    return file->buf_offset + file->buf_len;
+} /* mutil_output_file_tell */
+
+gint mutil_output_file_write(
+        mutil_output_file_t *file,
+        gconstpointer data,
+        gsize data_sz,
+        GError **o_error)
+{
+    guint8 const *src_pos = data;
+    gsize boundary_sz;
+    gsize copy_sz;
+    gint status;
+
+    g_assert(file != NULL);
+    g_assert(file->fd != -1);
+    g_assert(data != NULL || data_sz == 0);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* The buffer is filled up to the next chunk boundary and written out. */
+    while (data_sz > 0) {
+        boundary_sz = mutil_output_chunk_sz -
+            (file->buf_offset + file->buf_len) % mutil_output_chunk_sz;
+        copy_sz = MIN(data_sz, boundary_sz);
+        memcpy(file->buf + file->buf_len, src_pos, copy_sz);
+        file->buf_len += copy_sz;
+        src_pos += copy_sz;
+        data_sz -= copy_sz;
+
+        if (copy_sz == boundary_sz) {
+            status = mutil_output_file_flush(file, o_error);
+            if (status == -1) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+} /* mutil_output_file_write */
+
+void mutil_output_sync_add(
+        mutil_output_sync_t *sync,
+        gchar const *filename)
+{
+    gchar *dirname;
+    GHashTable *filename_set;
+
+    g_assert(sync != NULL);
+    g_assert(filename != NULL);
+
+    dirname = g_path_get_dirname(filename);
+
+    g_mutex_lock(&sync->mutex);
+    filename_set = g_hash_table_lookup(sync->dir_table, dirname);
+    if (filename_set == NULL) {
+        filename_set = g_hash_table_new_full(
+                g_str_hash,
+                g_str_equal,
+                g_free,
+                NULL);
+        g_hash_table_insert(sync->dir_table, dirname, filename_set);
+        dirname = NULL;
+    }
+    if (!g_hash_table_contains(filename_set, filename)) {
+        g_hash_table_add(filename_set, g_strdup(filename));
+    }
+    g_mutex_unlock(&sync->mutex);
+
+    g_free(dirname);
+
+    return;
+} /* mutil_output_sync_add */
+
+mutil_output_sync_t *mutil_output_sync_alloc(void)
+{
+    mutil_output_sync_t *new_sync;
+
+    new_sync = g_malloc0(sizeof(mutil_output_sync_t));
+    g_mutex_init(&new_sync->mutex);
+    new_sync->dir_table = g_hash_table_new_full(
+            g_str_hash,
+            g_str_equal,
+            g_free,
+            (GDestroyNotify) g_hash_table_destroy);
+
+    return new_sync;
+} /* mutil_output_sync_alloc */
+
+gint mutil_output_sync_flush(
+        mutil_output_sync_t *sync,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    GHashTableIter dir_iter;
+    GHashTableIter file_iter;
+    gpointer dirname;
+    gpointer filename_set;
+    gpointer filename;
+
+    g_assert(sync != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    g_mutex_lock(&sync->mutex);
+
+    /* A directory is synced after its files, so that a rename is never made
+     * durable before the data it points to. */
+    g_hash_table_iter_init(&dir_iter, sync->dir_table);
+    while (g_hash_table_iter_next(&dir_iter, &dirname, &filename_set)) {
+        g_hash_table_iter_init(&file_iter, filename_set);
+        while (g_hash_table_iter_next(&file_iter, &filename, NULL)) {
+            status = mutil_sync_filename(filename, O_RDONLY, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+        }
+
+        status = mutil_sync_filename(dirname, O_RDONLY | O_DIRECTORY, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    g_hash_table_remove_all(sync->dir_table);
+    g_mutex_unlock(&sync->mutex);
+
+    return ret_value;
+} /* mutil_output_sync_flush */
+
+void mutil_output_sync_free(
+        mutil_output_sync_t *sync)
+{
+    if (sync != NULL) {
+        g_hash_table_destroy(sync->dir_table);
+        g_mutex_clear(&sync->mutex);
+        g_free(sync);
+    }
+
+    return;
+} /* mutil_output_sync_free */
+
+gint mutil_sync_filename(
+        gchar const *filename,
+        gint flags,
+        GError **o_error)
+{
+    gint ret_value;
+    gint fd = -1;
+    gint status;
+
+    g_assert(filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    fd = open(filename, flags | O_CLOEXEC);
+    if (fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open '%s': %s",
+                filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    status = fsync(fd);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to sync '%s': %s",
+                filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    return ret_value;
+} /* mutil_sync_filename */
@@ -0,0 +1,91 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_output_file_h
+#define mutil_output_file_h
+
+#include "mutil_common.h"
+
+/* An output file is written through a buffer that is flushed in large chunks,
+ * aligned to their size within the file, so that the many small writes of an
+ * encoder reach the file system as a few large ones. The file is preallocated
+ * with fallocate() to the size it's expected to reach, so that it's laid out
+ * in few extents, and truncated to the size actually written when it's
+ * committed. Committing also starts writing the file back, without waiting for
+ * it. */
+
+struct mutil_output_file;
+typedef struct mutil_output_file mutil_output_file_t;
+
+/* An output sync collects the files made by a run and makes them durable at
+ * the end of it, directory by directory: the files of a directory are synced,
+ * then the directory itself once, for the renames into it. By then, most of
+ * the data has been written back already, so this is much cheaper than syncing
+ * each file as it's made. Runs that keep a journal sync each file before
+ * recording it anyway, which leaves little but the directories. */
+
+struct mutil_output_sync;
+typedef struct mutil_output_sync mutil_output_sync_t;
+
+/* output file: */
+
+/* Creates filename, with expected_sz bytes preallocated. A file of that name is
+ * unlinked rather than truncated, as it may be linked elsewhere. An expected_sz
+ * of 0 means that the size isn't known, and nothing is preallocated.
+ * Preallocation is only an optimization, so file systems that don't support it
+ * are fine. */
+mutil_output_file_t *mutil_output_file_open(
+        gchar const *filename,
+        guint64 expected_sz,
+        GError **o_error);
+
+/* Writes at the current position, which it advances. */
+gint mutil_output_file_write(
+        mutil_output_file_t *file,
+        gconstpointer data,
+        gsize data_sz,
+        GError **o_error);
+
+gint mutil_output_file_seek(
+        mutil_output_file_t *file,
+        guint64 offset,
+        GError **o_error);
+
+guint64 mutil_output_file_tell(
+        mutil_output_file_t const *file);
+
+/* Flushes the file, truncates it to the end of what was written and closes
+ * it. */
+gint mutil_output_file_commit(
+        mutil_output_file_t *file,
+        GError **o_error);
+
+/* Closes the file if it wasn't committed, leaving it incomplete. */
+void mutil_output_file_free(
+        mutil_output_file_t *file);
+
+/* Syncs a file that has been made, whether through an output file or not,
+ * waiting for its data to reach the disk. */
+gint mutil_output_file_sync(
+        gchar const *filename,
+        GError **o_error);
+
+/* output sync: */
+
+/* Adds a file that has been made under its final name. Safe to call from
+ * several threads. */
+void mutil_output_sync_add(
+        mutil_output_sync_t *sync,
+        gchar const *filename);
+
+mutil_output_sync_t *mutil_output_sync_alloc(void);
+
+/* Syncs the files added so far and their directories, and forgets them. */
+gint mutil_output_sync_flush(
+        mutil_output_sync_t *sync,
+        GError **o_error);
+
+void mutil_output_sync_free(
+        mutil_output_sync_t *sync);
+
+#endif /* #ifndef mutil_output_file_h */
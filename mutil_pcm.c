@@ -0,0 +1,580 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_pcm.h"
+#include <FLAC/all.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Number of sample frames read from a WAV file at a time. */
+#define mutil_wav_read_frame_cnt 4096
+
+struct mutil_flac_read;
+typedef struct mutil_flac_read mutil_flac_read_t;
+
+struct mutil_flac_read {
+    gchar const *filename;
+    mutil_pcm_cb_start_t cb_start;
+    mutil_pcm_cb_write_t cb_write;
+    gpointer user_data;
+    guint64 first_sample;
+    guint64 remaining_cnt;
+    gboolean is_started;
+    GError *error;
+};
+
+static void mutil_flac_read_cb_error(
+        FLAC__StreamDecoder const *decoder,
+        FLAC__StreamDecoderErrorStatus status,
+        void *client_data);
+
+static void mutil_flac_read_cb_metadata(
+        FLAC__StreamDecoder const *decoder,
+        FLAC__StreamMetadata const *metadata,
+        void *client_data);
+
+static FLAC__StreamDecoderWriteStatus mutil_flac_read_cb_write(
+        FLAC__StreamDecoder const *decoder,
+        FLAC__Frame const *frame,
+        FLAC__int32 const * const buffer[],
+        void *client_data);
+
+static gint mutil_pcm_read_flac(
+        gchar const *filename,
+        guint64 first_sample,
+        guint64 sample_cnt,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error);
+
+static gint mutil_pcm_read_wav(
+        gchar const *filename,
+        guint64 first_sample,
+        guint64 sample_cnt,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error);
+
+void mutil_flac_read_cb_error(
+        FLAC__StreamDecoder const *decoder,
+        FLAC__StreamDecoderErrorStatus status,
+        void *client_data)
+{
+    mutil_flac_read_t *flac_read = client_data;
+
+    g_assert(flac_read != NULL);
+
+    if (flac_read->error == NULL) {
+        g_set_error(
+                &flac_read->error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to decode file '%s': %s",
+                flac_read->filename,
+                FLAC__StreamDecoderErrorStatusString[status]);
+    }
+
+    return;
+} /* mutil_flac_read_cb_error */
+
+void mutil_flac_read_cb_metadata(
+        FLAC__StreamDecoder const *decoder,
+        FLAC__StreamMetadata const *metadata,
+        void *client_data)
+{
+    mutil_flac_read_t *flac_read = client_data;
+    mutil_stream_info_t stream_info;
+    gint status;
+
+    g_assert(flac_read != NULL);
+    g_assert(metadata != NULL);
+
+    if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO &&
+        !flac_read->is_started &&
+        flac_read->error == NULL) {
+
+        memset(&stream_info, 0, sizeof(stream_info));
+        stream_info.sample_rate = metadata->data.stream_info.sample_rate;
+        stream_info.channels = metadata->data.stream_info.channels;
+        stream_info.bits_per_sample =
+            metadata->data.stream_info.bits_per_sample;
+        stream_info.total_samples = metadata->data.stream_info.total_samples;
+        if (stream_info.total_samples > 0) {
+            stream_info.total_samples = MIN(
+                    stream_info.total_samples - MIN(
+                        stream_info.total_samples,
+                        flac_read->first_sample),
+                    flac_read->remaining_cnt);
+        }
+        memcpy(
+                stream_info.md5,
+                metadata->data.stream_info.md5sum,
+                sizeof(stream_info.md5));
+
+        /* The decoder can't be aborted from here, so an error stops it at the
+         * first frame. */
+        status = flac_read->cb_start(
+                &stream_info,
+                flac_read->user_data,
+                &flac_read->error);
+        flac_read->is_started = status == 0;
+    }
+
+    return;
+} /* mutil_flac_read_cb_metadata */
+
+FLAC__StreamDecoderWriteStatus mutil_flac_read_cb_write(
+        FLAC__StreamDecoder const *decoder,
+        FLAC__Frame const *frame,
+        FLAC__int32 const * const buffer[],
+        void *client_data)
+{
+    mutil_flac_read_t *flac_read = client_data;
+    FLAC__StreamDecoderWriteStatus write_status;
+    guint32 sample_cnt;
+    gint status;
+
+    g_assert(flac_read != NULL);
+    g_assert(frame != NULL);
+
+    write_status = FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+
+    if (flac_read->error != NULL) {
+        goto cleanup;
+    }
+
+    if (!flac_read->is_started) {
+        g_set_error(
+                &flac_read->error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to decode file '%s': missing STREAMINFO block",
+                flac_read->filename);
+        goto cleanup;
+    }
+
+    /* After a seek, libFLAC passes the frame from the target sample on. */
+    sample_cnt = MIN(frame->header.blocksize, flac_read->remaining_cnt);
+    status = flac_read->cb_write(
+            (gint32 const * const *) buffer,
+            sample_cnt,
+            flac_read->user_data,
+            &flac_read->error);
+    if (status == -1) {
+        goto cleanup;
+    }
+    flac_read->remaining_cnt -= sample_cnt;
+
+    write_status = FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+
+cleanup:
+
+    return write_status;
+} /* mutil_flac_read_cb_write */
+
+gint mutil_pcm_read_flac(
+        gchar const *filename,
+        guint64 first_sample,
+        guint64 sample_cnt,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    FLAC__StreamDecoder *decoder = NULL;
+    FLAC__StreamDecoderInitStatus init_status;
+    FLAC__bool flac_status;
+    gboolean is_whole_stream;
+    mutil_flac_read_t flac_read;
+
+    g_assert(filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    memset(&flac_read, 0, sizeof(flac_read));
+    flac_read.filename = filename;
+    flac_read.cb_start = cb_start;
+    flac_read.cb_write = cb_write;
+    flac_read.user_data = user_data;
+    flac_read.first_sample = first_sample;
+    flac_read.remaining_cnt = sample_cnt;
+
+    decoder = FLAC__stream_decoder_new();
+    if (decoder == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to allocate FLAC decoder");
+        goto error_handling;
+    }
+
+    /* The MD5 can only be checked when the whole stream is decoded. */
+    is_whole_stream = first_sample == 0 && sample_cnt == G_MAXUINT64;
+    FLAC__stream_decoder_set_md5_checking(decoder, is_whole_stream);
+
+    init_status = FLAC__stream_decoder_init_file(
+            decoder,
+            filename,
+            mutil_flac_read_cb_write,
+            mutil_flac_read_cb_metadata,
+            mutil_flac_read_cb_error,
+            &flac_read);
+    if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open FLAC file '%s': %s",
+                filename,
+                FLAC__StreamDecoderInitStatusString[init_status]);
+        goto error_handling;
+    }
+
+    if (is_whole_stream) {
+        flac_status = FLAC__stream_decoder_process_until_end_of_stream(
+                decoder);
+    } else {
+        flac_status = FLAC__stream_decoder_process_until_end_of_metadata(
+                decoder);
+        if (flac_status && first_sample > 0 && flac_read.error == NULL) {
+            flac_status = FLAC__stream_decoder_seek_absolute(
+                    decoder,
+                    first_sample);
+        }
+        while (flac_status &&
+               flac_read.remaining_cnt > 0 &&
+               flac_read.error == NULL &&
+               FLAC__stream_decoder_get_state(decoder) !=
+                   FLAC__STREAM_DECODER_END_OF_STREAM) {
+            flac_status = FLAC__stream_decoder_process_single(decoder);
+        }
+    }
+    if (flac_read.error != NULL) {
+        g_propagate_error(o_error, flac_read.error);
+        flac_read.error = NULL;
+        goto error_handling;
+    }
+
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to decode file '%s': %s",
+                filename,
+                FLAC__StreamDecoderStateString[
+                    FLAC__stream_decoder_get_state(decoder)]);
+        goto error_handling;
+    }
+
+    /* Finishing checks the MD5 of the decoded samples. */
+    flac_status = FLAC__stream_decoder_finish(decoder);
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to decode file '%s': MD5 mismatch",
+                filename);
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (decoder != NULL) {
+        FLAC__stream_decoder_delete(decoder);
+    }
+    g_clear_error(&flac_read.error);
+
+    return ret_value;
+} /* mutil_pcm_read_flac */
+
+gint mutil_pcm_read_track(
+        mutil_track_t *track,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error)
+{
+    return mutil_pcm_read_track_range(
+            track,
+            0,
+            G_MAXUINT64,
+            cb_start,
+            cb_write,
+            user_data,
+            o_error);
+} /* mutil_pcm_read_track */
+
+gint mutil_pcm_read_track_range(
+        mutil_track_t *track,
+        guint64 first_sample,
+        guint64 sample_cnt,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status = -1;
+    gchar const *filename;
+    guint64 track_first_sample;
+    guint64 track_sample_cnt;
+
+    g_assert(track != NULL);
+    g_assert(cb_start != NULL);
+    g_assert(cb_write != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    filename = mutil_track_get_filename(track);
+
+    /* The range is taken from within the track's own range, if it has one. */
+    if (mutil_track_get_range(track, &track_first_sample, &track_sample_cnt)) {
+        first_sample = MIN(first_sample, track_sample_cnt);
+        sample_cnt = MIN(sample_cnt, track_sample_cnt - first_sample);
+        first_sample += track_first_sample;
+    }
+
+    switch (mutil_track_get_audio_type(track)) {
+        case mutil_audio_type_flac:
+            status = mutil_pcm_read_flac(
+                    filename,
+                    first_sample,
+                    sample_cnt,
+                    cb_start,
+                    cb_write,
+                    user_data,
+                    o_error);
+            break;
+        case mutil_audio_type_native:
+            status = mutil_pcm_read_wav(
+                    filename,
+                    first_sample,
+                    sample_cnt,
+                    cb_start,
+                    cb_write,
+                    user_data,
+                    o_error);
+            break;
+    }
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_pcm_read_track_range */
+
+gint mutil_pcm_read_wav(
+        gchar const *filename,
+        guint64 first_sample,
+        guint64 sample_cnt,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    gint fd = -1;
+    guint8 riff_header[12];
+    mutil_stream_info_t stream_info;
+    off_t data_offset = 0;
+    guint64 data_sz = 0;
+    guint32 sample_sz;
+    guint32 frame_sz;
+    guint8 *read_buffer = NULL;
+    gint32 *channel_buffers[FLAC__MAX_CHANNELS];
+    guint64 remaining_sz;
+    ssize_t read_sz;
+    guint32 frame_cnt;
+    guint32 frame_i;
+    guint32 channel_i;
+    guint8 const *sample_pos;
+
+    g_assert(filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    memset(channel_buffers, 0, sizeof(channel_buffers));
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open file '%s': %s",
+                filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    memset(&stream_info, 0, sizeof(stream_info));
+    read_sz = pread(fd, riff_header, sizeof(riff_header), 0);
+    if (read_sz == sizeof(riff_header) &&
+        memcmp(riff_header, "RIFF", 4) == 0 &&
+        memcmp(&riff_header[8], "WAVE", 4) == 0) {
+        status = mutil_probe_wav_chunks(
+                fd,
+                &stream_info,
+                &data_offset,
+                &data_sz);
+    } else {
+        status = -1;
+    }
+    if (status == -1 || data_offset == 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "file '%s' is not a PCM WAV file",
+                filename);
+        goto error_handling;
+    }
+
+    /* Samples are little-endian and interleaved. 8-bit samples are unsigned,
+     * wider ones signed. */
+    if (stream_info.channels == 0 ||
+        stream_info.channels > FLAC__MAX_CHANNELS ||
+        (stream_info.bits_per_sample != 8 &&
+         stream_info.bits_per_sample != 16 &&
+         stream_info.bits_per_sample != 24)) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "WAV file '%s' has unsupported format (%u channels, %u bits)",
+                filename,
+                (guint) stream_info.channels,
+                (guint) stream_info.bits_per_sample);
+        goto error_handling;
+    }
+
+    sample_sz = stream_info.bits_per_sample / 8;
+    frame_sz = sample_sz * stream_info.channels;
+    stream_info.total_samples = data_sz / frame_sz;
+
+    first_sample = MIN(first_sample, stream_info.total_samples);
+    stream_info.total_samples = MIN(
+            stream_info.total_samples - first_sample,
+            sample_cnt);
+    data_offset += first_sample * frame_sz;
+
+    status = cb_start(&stream_info, user_data, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    posix_fadvise(fd, data_offset, data_sz, POSIX_FADV_SEQUENTIAL);
+
+    read_buffer = g_malloc(mutil_wav_read_frame_cnt * frame_sz);
+    for (channel_i = 0; channel_i < stream_info.channels; channel_i++) {
+        channel_buffers[channel_i] =
+            g_malloc(mutil_wav_read_frame_cnt * sizeof(gint32));
+    }
+
+    remaining_sz = stream_info.total_samples * frame_sz;
+    while (remaining_sz > 0) {
+
+        read_sz = pread(
+                fd,
+                read_buffer,
+                MIN(remaining_sz, mutil_wav_read_frame_cnt * frame_sz),
+                data_offset);
+        if (read_sz <= 0 || read_sz % frame_sz != 0) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to read file '%s': %s",
+                    filename,
+                    read_sz == -1 ? g_strerror(errno) :
+                        "unexpected end of file");
+            goto error_handling;
+        }
+        data_offset += read_sz;
+        remaining_sz -= read_sz;
+
+        /* Deinterleave. */
+        frame_cnt = read_sz / frame_sz;
+        sample_pos = read_buffer;
+        for (frame_i = 0; frame_i < frame_cnt; frame_i++) {
+            for (channel_i = 0;
+                 channel_i < stream_info.channels;
+                 channel_i++, sample_pos += sample_sz) {
+                switch (sample_sz) {
+                    case 1:
+                        channel_buffers[channel_i][frame_i] =
+                            (gint32) sample_pos[0] - 128;
+                        break;
+                    case 2:
+                        channel_buffers[channel_i][frame_i] =
+                            (gint16) (sample_pos[0] | (sample_pos[1] << 8));
+                        break;
+                    case 3:
+                        channel_buffers[channel_i][frame_i] =
+                            ((gint32) ((guint32) sample_pos[0] << 8 |
+                                       (guint32) sample_pos[1] << 16 |
+                                       (guint32) sample_pos[2] << 24)) >> 8;
+                        break;
+                }
+            }
+        }
+
+        status = cb_write(
+                (gint32 const * const *) channel_buffers,
+                frame_cnt,
+                user_data,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (fd != -1) {
+        close(fd);
+    }
+    g_free(read_buffer);
+    for (channel_i = 0; channel_i < FLAC__MAX_CHANNELS; channel_i++) {
+        g_free(channel_buffers[channel_i]);
+    }
+
+    return ret_value;
+} /* mutil_pcm_read_wav */
@@ -0,0 +1,51 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_pcm_h
+#define mutil_pcm_h
+
+#include "mutil_common.h"
+#include "mutil_track.h"
+
+/* PCM samples are delivered as one buffer per channel of signed, right-aligned
+ * integers, which is what libFLAC's decoder produces and its encoder takes.
+ * cb_start is called once, before any samples, with the stream's format. A
+ * callback that fails stops the read with its error. */
+
+typedef gint (*mutil_pcm_cb_start_t)(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error);
+
+typedef gint (*mutil_pcm_cb_write_t)(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error);
+
+/* Decodes the track's audio file. FLAC files are decoded with libFLAC, and
+ * their MD5 is checked, same as 'flac --decode'. WAV files are read
+ * directly. Only the samples in the track's range are delivered if it has
+ * one. */
+gint mutil_pcm_read_track(
+        mutil_track_t *track,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error);
+
+/* Same as mutil_pcm_read_track but only delivers up to sample_cnt samples from
+ * first_sample on, and the stream info passed to cb_start has the number of
+ * samples in the range. For a track with a range, first_sample counts from the
+ * start of that range. FLAC files are seeked, and their MD5 isn't checked
+ * unless the whole file is read. */
+gint mutil_pcm_read_track_range(
+        mutil_track_t *track,
+        guint64 first_sample,
+        guint64 sample_cnt,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error);
+
+#endif /* #ifndef mutil_pcm_h */
@@ -0,0 +1,521 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_pcm_pipe.h"
+#include <FLAC/all.h>
+
+/* Size of a block of samples: 16384 stereo frames of 32 bits. */
+#define mutil_pcm_block_sz (128 * 1024)
+
+/* Most blocks a pipe takes from the pool, which is plenty for the decoder to
+ * stay ahead of the encoders. */
+#define mutil_pcm_pipe_block_cnt 8
+
+/* Slots in a ring, a power of two. A ring never holds more than a pipe's
+ * blocks and the end of the stream, so it never fills up. */
+#define mutil_pcm_ring_sz 16
+
+struct mutil_pcm_block;
+typedef struct mutil_pcm_block mutil_pcm_block_t;
+
+struct mutil_pcm_ring;
+typedef struct mutil_pcm_ring mutil_pcm_ring_t;
+
+struct mutil_pcm_pipe;
+typedef struct mutil_pcm_pipe mutil_pcm_pipe_t;
+
+/* The samples of a block are stored one channel after the other, with room
+ * for frame_cap frames each. */
+struct mutil_pcm_block {
+    gint32 *data;
+    gint32 *channel_buffers[FLAC__MAX_CHANNELS];
+    guint32 sample_cnt;
+};
+
+struct mutil_pcm_pool {
+    GMutex mutex;
+    GCond cond;
+    gint32 *data;
+    mutil_pcm_block_t *blocks;
+    guint block_cnt;
+    GPtrArray *free_blocks;
+};
+
+/* A single-producer, single-consumer ring. head is only used by the consumer
+ * and tail only by the producer; the two only share cnt, which is updated
+ * atomically after the slot is written or read. The mutex and condition are
+ * only used to sleep on an empty ring: waiter_cnt tells the producer whether
+ * anyone needs waking. */
+struct mutil_pcm_ring {
+    gpointer slots[mutil_pcm_ring_sz];
+    guint head;
+    guint tail;
+    gint cnt;
+    gint waiter_cnt;
+    GMutex mutex;
+    GCond cond;
+};
+
+/* full_ring carries filled blocks to the consumer, and a NULL block at the end
+ * of the stream; free_ring returns them to the decoder. The decoder sets
+ * stream_info, frame_cap and is_started and takes its blocks before its first
+ * push, and sets error before its last, so the consumer reads them after a
+ * pop. */
+struct mutil_pcm_pipe {
+    mutil_track_t *track;
+    guint64 first_sample;
+    guint64 sample_cnt;
+    mutil_pcm_pool_t *pool;
+    mutil_pcm_ring_t full_ring;
+    mutil_pcm_ring_t free_ring;
+    mutil_stream_info_t stream_info;
+    guint32 frame_cap;
+    gboolean is_started;
+    mutil_pcm_block_t *blocks[mutil_pcm_pipe_block_cnt];
+    guint block_cnt;
+    guint fresh_block_cnt;
+    mutil_pcm_block_t *block;
+    gint is_cancelled;
+    GError *error;
+};
+
+static guint mutil_pcm_pool_acquire(
+        mutil_pcm_pool_t *pool,
+        mutil_pcm_block_t **o_blocks,
+        guint max_block_cnt);
+
+static void mutil_pcm_pool_release(
+        mutil_pcm_pool_t *pool,
+        mutil_pcm_block_t **blocks,
+        guint block_cnt);
+
+static gint mutil_pcm_pipe_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error);
+
+static gint mutil_pcm_pipe_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error);
+
+static gpointer mutil_pcm_pipe_decode(
+        gpointer data);
+
+static void mutil_pcm_ring_clear(
+        mutil_pcm_ring_t *ring);
+
+static void mutil_pcm_ring_init(
+        mutil_pcm_ring_t *ring);
+
+static gpointer mutil_pcm_ring_pop(
+        mutil_pcm_ring_t *ring);
+
+static void mutil_pcm_ring_push(
+        mutil_pcm_ring_t *ring,
+        gpointer item);
+
+guint mutil_pcm_pool_acquire(
+        mutil_pcm_pool_t *pool,
+        mutil_pcm_block_t **o_blocks,
+        guint max_block_cnt)
+{
+    guint block_cnt;
+    guint i;
+
+    g_assert(pool != NULL);
+    g_assert(o_blocks != NULL);
+    g_assert(max_block_cnt > 0);
+
+    /* One block is enough for a pipe to make progress, so a pipe waits only
+     * while the pool is empty, and then takes what it can. */
+    g_mutex_lock(&pool->mutex);
+    while (pool->free_blocks->len == 0) {
+        g_cond_wait(&pool->cond, &pool->mutex);
+    }
+    block_cnt = MIN(pool->free_blocks->len, max_block_cnt);
+    for (i = 0; i < block_cnt; i++) {
+        o_blocks[i] = g_ptr_array_remove_index_fast(
+                pool->free_blocks,
+                pool->free_blocks->len - 1);
+    }
+    g_mutex_unlock(&pool->mutex);
+
+    return block_cnt;
+} /* mutil_pcm_pool_acquire */
+
+mutil_pcm_pool_t *mutil_pcm_pool_alloc(
+        guint64 max_sz)
+{
+    mutil_pcm_pool_t *new_pool;
+    guint i;
+
+    new_pool = g_malloc0(sizeof(mutil_pcm_pool_t));
+    g_mutex_init(&new_pool->mutex);
+    g_cond_init(&new_pool->cond);
+
+    /* Two blocks at least, so that a pipe's decoder can fill one while its
+     * consumer reads the other. */
+    new_pool->block_cnt = MAX(2, MIN(max_sz / mutil_pcm_block_sz, G_MAXUINT));
+    new_pool->data = g_malloc(
+            (gsize) new_pool->block_cnt * mutil_pcm_block_sz);
+    new_pool->blocks = g_new0(mutil_pcm_block_t, new_pool->block_cnt);
+    new_pool->free_blocks = g_ptr_array_sized_new(new_pool->block_cnt);
+    for (i = 0; i < new_pool->block_cnt; i++) {
+        new_pool->blocks[i].data =
+            new_pool->data + (gsize) i * (mutil_pcm_block_sz / sizeof(gint32));
+        g_ptr_array_add(new_pool->free_blocks, &new_pool->blocks[i]);
+    }
+
+    return new_pool;
+} /* mutil_pcm_pool_alloc */
+
+void mutil_pcm_pool_free(
+        mutil_pcm_pool_t *pool)
+{
+    if (pool != NULL) {
+        g_assert(pool->free_blocks->len == pool->block_cnt);
+        g_ptr_array_free(pool->free_blocks, TRUE);
+        g_free(pool->blocks);
+        g_free(pool->data);
+        g_mutex_clear(&pool->mutex);
+        g_cond_clear(&pool->cond);
+        g_free(pool);
+    }
+
+    return;
+} /* mutil_pcm_pool_free */
+
+void mutil_pcm_pool_release(
+        mutil_pcm_pool_t *pool,
+        mutil_pcm_block_t **blocks,
+        guint block_cnt)
+{
+    guint i;
+
+    g_assert(pool != NULL);
+
+    if (block_cnt == 0) {
+        return;
+    }
+
+    g_mutex_lock(&pool->mutex);
+    for (i = 0; i < block_cnt; i++) {
+        g_ptr_array_add(pool->free_blocks, blocks[i]);
+    }
+    g_cond_broadcast(&pool->cond);
+    g_mutex_unlock(&pool->mutex);
+
+    return;
+} /* mutil_pcm_pool_release */
+
+gint mutil_pcm_pipe_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error)
+{
+    mutil_pcm_pipe_t *pipe = user_data;
+    mutil_pcm_block_t *block_i;
+    guint i;
+    guint j;
+
+    g_assert(stream_info != NULL);
+    g_assert(pipe != NULL);
+    g_assert(!pipe->is_started);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (stream_info->channels == 0 ||
+        stream_info->channels > FLAC__MAX_CHANNELS) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "unsupported number of channels: %u",
+                stream_info->channels);
+        return -1;
+    }
+
+    pipe->stream_info = *stream_info;
+    pipe->frame_cap =
+        mutil_pcm_block_sz / sizeof(gint32) / stream_info->channels;
+
+    /* Backpressure across pipes: the stream waits here until the pool has a
+     * block to spare. */
+    pipe->block_cnt = mutil_pcm_pool_acquire(
+            pipe->pool,
+            pipe->blocks,
+            mutil_pcm_pipe_block_cnt);
+    for (i = 0; i < pipe->block_cnt; i++) {
+        block_i = pipe->blocks[i];
+        for (j = 0; j < stream_info->channels; j++) {
+            block_i->channel_buffers[j] = block_i->data + j * pipe->frame_cap;
+        }
+    }
+
+    pipe->is_started = TRUE;
+
+    return 0;
+} /* mutil_pcm_pipe_cb_start */
+
+gint mutil_pcm_pipe_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error)
+{
+    mutil_pcm_pipe_t *pipe = user_data;
+    mutil_pcm_block_t *block;
+    guint32 copy_cnt;
+    guint32 offset = 0;
+    guint i;
+
+    g_assert(channel_buffers != NULL);
+    g_assert(pipe != NULL);
+    g_assert(pipe->is_started);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (g_atomic_int_get(&pipe->is_cancelled)) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "decoding cancelled");
+        return -1;
+    }
+
+    /* The samples are gathered into whole blocks, which are handed over as
+     * they fill up. Backpressure within the pipe: once the decoder has used
+     * all its blocks, it waits for the consumer to return one. */
+    while (offset < sample_cnt) {
+        if (pipe->block == NULL) {
+            if (pipe->fresh_block_cnt < pipe->block_cnt) {
+                pipe->block = pipe->blocks[pipe->fresh_block_cnt++];
+            } else {
+                pipe->block = mutil_pcm_ring_pop(&pipe->free_ring);
+            }
+            pipe->block->sample_cnt = 0;
+        }
+
+        block = pipe->block;
+        copy_cnt = MIN(
+                sample_cnt - offset,
+                pipe->frame_cap - block->sample_cnt);
+        for (i = 0; i < pipe->stream_info.channels; i++) {
+            memcpy(
+                    block->channel_buffers[i] + block->sample_cnt,
+                    channel_buffers[i] + offset,
+                    copy_cnt * sizeof(gint32));
+        }
+        block->sample_cnt += copy_cnt;
+        offset += copy_cnt;
+
+        if (block->sample_cnt == pipe->frame_cap) {
+            mutil_pcm_ring_push(&pipe->full_ring, block);
+            pipe->block = NULL;
+        }
+    }
+
+    return 0;
+} /* mutil_pcm_pipe_cb_write */
+
+gpointer mutil_pcm_pipe_decode(
+        gpointer data)
+{
+    mutil_pcm_pipe_t *pipe = data;
+    gint status;
+
+    g_assert(pipe != NULL);
+
+    status = mutil_pcm_read_track_range(
+            pipe->track,
+            pipe->first_sample,
+            pipe->sample_cnt,
+            mutil_pcm_pipe_cb_start,
+            mutil_pcm_pipe_cb_write,
+            pipe,
+            &pipe->error);
+
+    /* The last, partly filled block, and the end of the stream. */
+    if (status == 0 && pipe->block != NULL && pipe->block->sample_cnt > 0) {
+        mutil_pcm_ring_push(&pipe->full_ring, pipe->block);
+    }
+    pipe->block = NULL;
+    mutil_pcm_ring_push(&pipe->full_ring, NULL);
+
+    return NULL;
+} /* mutil_pcm_pipe_decode */
+
+gint mutil_pcm_pipe_read_track_range(
+        mutil_track_t *track,
+        guint64 first_sample,
+        guint64 sample_cnt,
+        mutil_pcm_pool_t *pool,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status = 0;
+    mutil_pcm_pipe_t pipe;
+    GThread *decode_thread;
+    mutil_pcm_block_t *block;
+    gboolean is_started = FALSE;
+
+    g_assert(track != NULL);
+    g_assert(pool != NULL);
+    g_assert(cb_start != NULL);
+    g_assert(cb_write != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.track = track;
+    pipe.first_sample = first_sample;
+    pipe.sample_cnt = sample_cnt;
+    pipe.pool = pool;
+    mutil_pcm_ring_init(&pipe.full_ring);
+    mutil_pcm_ring_init(&pipe.free_ring);
+
+    decode_thread = g_thread_try_new(
+            "mutil-decode",
+            mutil_pcm_pipe_decode,
+            &pipe,
+            o_error);
+    if (decode_thread == NULL) {
+        goto error_handling;
+    }
+
+    /* After a callback fails, the decoder is cancelled, and the blocks it
+     * already filled are returned unread until it stops. */
+    for (;;) {
+        block = mutil_pcm_ring_pop(&pipe.full_ring);
+
+        if (!is_started && pipe.is_started && status == 0) {
+            is_started = TRUE;
+            status = cb_start(&pipe.stream_info, user_data, o_error);
+            if (status == -1) {
+                g_atomic_int_set(&pipe.is_cancelled, TRUE);
+            }
+        }
+
+        if (block == NULL) {
+            break;
+        }
+
+        if (status == 0) {
+            status = cb_write(
+                    (gint32 const * const *) block->channel_buffers,
+                    block->sample_cnt,
+                    user_data,
+                    o_error);
+            if (status == -1) {
+                g_atomic_int_set(&pipe.is_cancelled, TRUE);
+            }
+        }
+
+        mutil_pcm_ring_push(&pipe.free_ring, block);
+    }
+
+    g_thread_join(decode_thread);
+
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    if (pipe.error != NULL) {
+        g_propagate_error(o_error, pipe.error);
+        pipe.error = NULL;
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_pcm_pool_release(pool, pipe.blocks, pipe.block_cnt);
+    g_clear_error(&pipe.error);
+    mutil_pcm_ring_clear(&pipe.full_ring);
+    mutil_pcm_ring_clear(&pipe.free_ring);
+
+    return ret_value;
+} /* mutil_pcm_pipe_read_track_range */
+
+void mutil_pcm_ring_clear(
+        mutil_pcm_ring_t *ring)
+{
+    g_assert(ring != NULL);
+
+    g_mutex_clear(&ring->mutex);
+    g_cond_clear(&ring->cond);
+
+    return;
+} /* mutil_pcm_ring_clear */
+
+void mutil_pcm_ring_init(
+        mutil_pcm_ring_t *ring)
+{
+    g_assert(ring != NULL);
+
+    memset(ring, 0, sizeof(mutil_pcm_ring_t));
+    g_mutex_init(&ring->mutex);
+    g_cond_init(&ring->cond);
+
+    return;
+} /* mutil_pcm_ring_init */
+
+gpointer mutil_pcm_ring_pop(
+        mutil_pcm_ring_t *ring)
+{
+    gpointer item;
+
+    g_assert(ring != NULL);
+
+    /* The waiter is counted before cnt is checked again, and the producer
+     * updates cnt before checking for waiters, so one of them sees the
+     * other. The producer takes the mutex to wake the consumer, which holds it
+     * until it's waiting. */
+    if (g_atomic_int_get(&ring->cnt) == 0) {
+        g_mutex_lock(&ring->mutex);
+        g_atomic_int_inc(&ring->waiter_cnt);
+        while (g_atomic_int_get(&ring->cnt) == 0) {
+            g_cond_wait(&ring->cond, &ring->mutex);
+        }
+        g_atomic_int_add(&ring->waiter_cnt, -1);
+        g_mutex_unlock(&ring->mutex);
+    }
+
+    item = ring->slots[ring->head];
+    ring->head = (ring->head + 1) % mutil_pcm_ring_sz;
+    g_atomic_int_add(&ring->cnt, -1);
+
+    return item;
+} /* mutil_pcm_ring_pop */
+
+void mutil_pcm_ring_push(
+        mutil_pcm_ring_t *ring,
+        gpointer item)
+{
+    g_assert(ring != NULL);
+    g_assert(g_atomic_int_get(&ring->cnt) < mutil_pcm_ring_sz);
+
+    ring->slots[ring->tail] = item;
+    ring->tail = (ring->tail + 1) % mutil_pcm_ring_sz;
+    g_atomic_int_inc(&ring->cnt);
+
+    if (g_atomic_int_get(&ring->waiter_cnt) > 0) {
+        g_mutex_lock(&ring->mutex);
+        g_cond_broadcast(&ring->cond);
+        g_mutex_unlock(&ring->mutex);
+    }
+
+    return;
+} /* mutil_pcm_ring_push */
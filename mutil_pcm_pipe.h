@@ -0,0 +1,46 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_pcm_pipe_h
+#define mutil_pcm_pipe_h
+
+#include "mutil_common.h"
+#include "mutil_pcm.h"
+#include "mutil_track.h"
+
+/* A pipe decodes a track on a thread of its own while the caller's thread
+ * consumes the samples, so that decoding overlaps encoding. The two stages
+ * pass blocks of samples through a pair of lock-free single-producer,
+ * single-consumer rings: one carries filled blocks to the consumer, the other
+ * returns them to the decoder. The blocks come from a pool shared by all pipes,
+ * which is allocated up front and caps the decoded audio in flight. A pipe
+ * takes its blocks when its stream starts and gives them back when it ends;
+ * while the pool is exhausted, new pipes wait, and a decoder that gets ahead
+ * of its consumer waits for blocks to come back. */
+
+struct mutil_pcm_pool;
+typedef struct mutil_pcm_pool mutil_pcm_pool_t;
+
+/* Allocates a pool of max_sz bytes of sample blocks, or of the least that lets
+ * a pipe run if max_sz is smaller. */
+mutil_pcm_pool_t *mutil_pcm_pool_alloc(
+        guint64 max_sz);
+
+void mutil_pcm_pool_free(
+        mutil_pcm_pool_t *pool);
+
+/* Same as mutil_pcm_read_track_range() but decodes on a separate thread, with
+ * blocks from pool. The callbacks are called on the caller's thread, in the
+ * same order and with the same samples, although not necessarily cut into the
+ * same buffers. If a callback fails, decoding is stopped. */
+gint mutil_pcm_pipe_read_track_range(
+        mutil_track_t *track,
+        guint64 first_sample,
+        guint64 sample_cnt,
+        mutil_pcm_pool_t *pool,
+        mutil_pcm_cb_start_t cb_start,
+        mutil_pcm_cb_write_t cb_write,
+        gpointer user_data,
+        GError **o_error);
+
+#endif /* #ifndef mutil_pcm_pipe_h */
@@ -0,0 +1,852 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_pcm.h"
+#include "mutil_replay_gain.h"
+#include <FLAC/all.h>
+#include <math.h>
+
+/* ReplayGain 2.0 reference level, in LUFS. */
+#define mutil_replay_gain_reference_lufs -18.0
+
+/* BS.1770 gating: blocks of 4 sub-blocks of 100 ms, an absolute gate at
+ * -70 LUFS and a relative gate 10 LU below the loudness of the blocks above
+ * the absolute gate. */
+#define mutil_loudness_sub_block_cnt 4
+#define mutil_loudness_abs_gate_lufs -70.0
+#define mutil_loudness_rel_gate_lu -10.0
+
+/* Histogram of block loudness from the absolute gate to +5 LUFS in 0.01 LU
+ * bins. Each bin keeps the sum of its blocks' mean square as well as their
+ * count, so the result only depends on the bin width through the relative
+ * gate. */
+#define mutil_loudness_bin_width_lu 0.01
+#define mutil_loudness_bin_cnt 7500
+
+/* Two channels are filtered at once, one per vector lane. */
+typedef gdouble mutil_v2df __attribute__((vector_size(16)));
+
+/* Coefficients of a biquad, normalized to a0 = 1. */
+typedef struct {
+    mutil_v2df b0;
+    mutil_v2df b1;
+    mutil_v2df b2;
+    mutil_v2df a1;
+    mutil_v2df a2;
+} mutil_biquad_t;
+
+/* State of one channel pair: the two transposed direct form II delay lines of
+ * each of the two K-weighting stages, and the weighted sum of squares of the
+ * current sub-block. */
+typedef struct {
+    mutil_v2df s1[2];
+    mutil_v2df s2[2];
+    mutil_v2df weight;
+    mutil_v2df sum_sq;
+} mutil_loudness_pair_t;
+
+struct mutil_loudness {
+    guint32 channels;
+    gdouble scale;
+    mutil_biquad_t stages[2];
+    mutil_loudness_pair_t *pairs;
+    guint32 pair_cnt;
+
+    guint32 sub_block_sz;
+    guint32 sub_block_pos;
+    gdouble sub_block_energies[mutil_loudness_sub_block_cnt];
+    guint64 sub_block_cnt;
+
+    gint32 sample_min;
+    gint32 sample_max;
+    gdouble peak;
+
+    guint32 *bin_counts;
+    gdouble *bin_energies;
+};
+
+static gint mutil_loudness_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error);
+
+static gint mutil_loudness_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error);
+
+static gdouble mutil_loudness_get_channel_weight(
+        guint32 channel,
+        guint32 channels);
+
+static gboolean mutil_loudness_get_integrated(
+        mutil_loudness_t const *loudness,
+        gdouble *o_lufs);
+
+static void mutil_loudness_filter_pair(
+        mutil_loudness_t *loudness,
+        mutil_loudness_pair_t *pair,
+        gint32 const *samples_0,
+        gint32 const *samples_1,
+        guint32 sample_cnt);
+
+static void mutil_loudness_finish_sub_block(
+        mutil_loudness_t *loudness);
+
+static void mutil_biquad_init(
+        mutil_biquad_t *biquad,
+        gdouble b0,
+        gdouble b1,
+        gdouble b2,
+        gdouble a1,
+        gdouble a2);
+
+static gint mutil_replay_gain_append_tag(
+        FLAC__StreamMetadata *block,
+        gchar const *name,
+        gchar const *format,
+        gdouble value,
+        gchar const *unit,
+        GError **o_error);
+
+mutil_loudness_t *mutil_loudness_alloc(
+        mutil_stream_info_t const *stream_info)
+{
+    mutil_loudness_t *new_loudness = NULL;
+    mutil_loudness_pair_t *pair_i;
+    gdouble k;
+    gdouble vh;
+    gdouble vb;
+    gdouble a0;
+    guint32 i;
+
+    /* A NULL stream_info makes a loudness that can only be merged into. */
+
+    new_loudness = g_malloc0(sizeof(mutil_loudness_t));
+    new_loudness->bin_counts = g_new0(guint32, mutil_loudness_bin_cnt);
+    new_loudness->bin_energies = g_new0(gdouble, mutil_loudness_bin_cnt);
+
+    if (stream_info == NULL) {
+        goto cleanup;
+    }
+
+    if (stream_info->channels == 0 ||
+        stream_info->sample_rate == 0 ||
+        stream_info->bits_per_sample == 0) {
+        mutil_loudness_free(new_loudness);
+        new_loudness = NULL;
+        goto cleanup;
+    }
+
+    new_loudness->channels = stream_info->channels;
+    new_loudness->scale = ldexp(1.0, 1 - (gint) stream_info->bits_per_sample);
+    new_loudness->sub_block_sz = MAX(1, (stream_info->sample_rate + 5) / 10);
+
+    /* K-weighting for the stream's sample rate: a high shelf followed by a
+     * high pass, derived from the analog prototypes of BS.1770 by the bilinear
+     * transform. At 48 kHz these give the coefficients in the standard. */
+
+    k = tan(G_PI * 1681.974450955533 / stream_info->sample_rate);
+    vh = pow(10.0, 3.999843853973347 / 20.0);
+    vb = pow(vh, 0.4996667741545416);
+    a0 = 1.0 + k / 0.7071752369554196 + k * k;
+    mutil_biquad_init(
+            &new_loudness->stages[0],
+            (vh + vb * k / 0.7071752369554196 + k * k) / a0,
+            2.0 * (k * k - vh) / a0,
+            (vh - vb * k / 0.7071752369554196 + k * k) / a0,
+            2.0 * (k * k - 1.0) / a0,
+            (1.0 - k / 0.7071752369554196 + k * k) / a0);
+
+    k = tan(G_PI * 38.13547087602444 / stream_info->sample_rate);
+    a0 = 1.0 + k / 0.5003270373238773 + k * k;
+    mutil_biquad_init(
+            &new_loudness->stages[1],
+            1.0,
+            -2.0,
+            1.0,
+            2.0 * (k * k - 1.0) / a0,
+            (1.0 - k / 0.5003270373238773 + k * k) / a0);
+
+    /* With an odd channel count, the last pair filters its channel twice and
+     * the second lane is weighted out. */
+
+    new_loudness->pair_cnt = (stream_info->channels + 1) / 2;
+    new_loudness->pairs = g_new0(
+            mutil_loudness_pair_t,
+            new_loudness->pair_cnt);
+    for (i = 0; i < new_loudness->pair_cnt; i++) {
+        pair_i = &new_loudness->pairs[i];
+        pair_i->weight[0] = mutil_loudness_get_channel_weight(
+                2 * i,
+                stream_info->channels);
+        pair_i->weight[1] = 2 * i + 1 < stream_info->channels ?
+            mutil_loudness_get_channel_weight(
+                    2 * i + 1,
+                    stream_info->channels) :
+            0.0;
+    }
+
+cleanup:
+
+    return new_loudness;
+} /* mutil_loudness_alloc */
+
+mutil_loudness_t *mutil_loudness_analyze_file(
+        gchar const *filename,
+        GError **o_error)
+{
+    mutil_loudness_t *new_loudness = NULL;
+    mutil_track_t *track = NULL;
+    gint status;
+
+    g_assert(filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    track = mutil_track_alloc(filename, mutil_audio_type_flac);
+
+    status = mutil_pcm_read_track(
+            track,
+            mutil_loudness_cb_start,
+            mutil_loudness_cb_write,
+            &new_loudness,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(new_loudness != NULL);
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    mutil_loudness_free(new_loudness);
+    new_loudness = NULL;
+
+cleanup:
+
+    mutil_track_free(track);
+
+    return new_loudness;
+} /* mutil_loudness_analyze_file */
+
+gint mutil_loudness_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    mutil_loudness_t **loudness = user_data;
+
+    g_assert(stream_info != NULL);
+    g_assert(loudness != NULL && *loudness == NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    *loudness = mutil_loudness_alloc(stream_info);
+    if (*loudness == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "unsupported audio format");
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_loudness_cb_start */
+
+gint mutil_loudness_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error)
+{
+    mutil_loudness_t **loudness = user_data;
+
+    g_assert(loudness != NULL && *loudness != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    mutil_loudness_process(*loudness, channel_buffers, sample_cnt);
+
+    return 0;
+} /* mutil_loudness_cb_write */
+
+void mutil_loudness_free(
+        mutil_loudness_t *loudness)
+{
+    if (loudness != NULL) {
+        g_free(loudness->pairs);
+        g_free(loudness->bin_counts);
+        g_free(loudness->bin_energies);
+        g_free(loudness);
+    }
+
+    return;
+} /* mutil_loudness_free */
+
+void mutil_loudness_filter_pair(
+        mutil_loudness_t *loudness,
+        mutil_loudness_pair_t *pair,
+        gint32 const *samples_0,
+        gint32 const *samples_1,
+        guint32 sample_cnt)
+{
+    mutil_biquad_t const *shelf = &loudness->stages[0];
+    mutil_biquad_t const *high_pass = &loudness->stages[1];
+    mutil_v2df scale = { loudness->scale, loudness->scale };
+    mutil_v2df s1_0 = pair->s1[0];
+    mutil_v2df s2_0 = pair->s2[0];
+    mutil_v2df s1_1 = pair->s1[1];
+    mutil_v2df s2_1 = pair->s2[1];
+    mutil_v2df sum_sq = pair->sum_sq;
+    mutil_v2df x;
+    mutil_v2df y;
+    mutil_v2df z;
+    guint32 i;
+
+    /* The filters are recursive in time, so the vector lanes run across
+     * channels instead. Weights are applied to sum_sq per sub-block. */
+
+    for (i = 0; i < sample_cnt; i++) {
+        x = (mutil_v2df) { samples_0[i], samples_1[i] } * scale;
+
+        y = shelf->b0 * x + s1_0;
+        s1_0 = shelf->b1 * x - shelf->a1 * y + s2_0;
+        s2_0 = shelf->b2 * x - shelf->a2 * y;
+
+        z = high_pass->b0 * y + s1_1;
+        s1_1 = high_pass->b1 * y - high_pass->a1 * z + s2_1;
+        s2_1 = high_pass->b2 * y - high_pass->a2 * z;
+
+        sum_sq += z * z;
+    }
+
+    pair->s1[0] = s1_0;
+    pair->s2[0] = s2_0;
+    pair->s1[1] = s1_1;
+    pair->s2[1] = s2_1;
+    pair->sum_sq = sum_sq;
+
+    return;
+} /* mutil_loudness_filter_pair */
+
+void mutil_loudness_finish_sub_block(
+        mutil_loudness_t *loudness)
+{
+    mutil_loudness_pair_t *pair_i;
+    mutil_v2df energy = { 0.0, 0.0 };
+    gdouble block_energy;
+    gdouble lufs;
+    gint bin;
+    guint32 i;
+
+    for (i = 0; i < loudness->pair_cnt; i++) {
+        pair_i = &loudness->pairs[i];
+        energy += pair_i->weight * pair_i->sum_sq;
+        pair_i->sum_sq = (mutil_v2df) { 0.0, 0.0 };
+    }
+
+    loudness->sub_block_energies[
+        loudness->sub_block_cnt % mutil_loudness_sub_block_cnt] =
+        energy[0] + energy[1];
+    loudness->sub_block_cnt++;
+    loudness->sub_block_pos = 0;
+
+    /* Blocks overlap by 75%, so one ends with every sub-block from the
+     * fourth on. */
+
+    if (loudness->sub_block_cnt < mutil_loudness_sub_block_cnt) {
+        goto cleanup;
+    }
+
+    block_energy = 0.0;
+    for (i = 0; i < mutil_loudness_sub_block_cnt; i++) {
+        block_energy += loudness->sub_block_energies[i];
+    }
+    block_energy /=
+        (gdouble) mutil_loudness_sub_block_cnt * loudness->sub_block_sz;
+
+    if (block_energy <= 0.0) {
+        goto cleanup;
+    }
+
+    lufs = -0.691 + 10.0 * log10(block_energy);
+    if (lufs < mutil_loudness_abs_gate_lufs) {
+        goto cleanup;
+    }
+
+    bin = (gint) ((lufs - mutil_loudness_abs_gate_lufs) /
+            mutil_loudness_bin_width_lu);
+    bin = MIN(bin, mutil_loudness_bin_cnt - 1);
+    loudness->bin_counts[bin]++;
+    loudness->bin_energies[bin] += block_energy;
+
+cleanup:
+
+    return;
+} /* mutil_loudness_finish_sub_block */
+
+gdouble mutil_loudness_get_channel_weight(
+        guint32 channel,
+        guint32 channels)
+{
+    gdouble weight = 1.0;
+
+    /* BS.1770 weights the surround channels by +1.5 dB and leaves out the LFE
+     * channel. The channel orders are those of FLAC and WAVE: front left and
+     * right, then front center from 5 channels on, LFE from 6 on, and the
+     * rest are surrounds. */
+
+    if (channels == 4 && channel >= 2) {
+        weight = 1.41;
+    } else if (channels == 5 && channel >= 3) {
+        weight = 1.41;
+    } else if (channels >= 6 && channel == 3) {
+        weight = 0.0;
+    } else if (channels >= 6 && channel >= 4) {
+        weight = 1.41;
+    }
+
+    return weight;
+} /* mutil_loudness_get_channel_weight */
+
+gboolean mutil_loudness_get_integrated(
+        mutil_loudness_t const *loudness,
+        gdouble *o_lufs)
+{
+    gboolean is_defined = FALSE;
+    guint64 block_cnt = 0;
+    gdouble energy = 0.0;
+    gdouble rel_gate_lufs;
+    gint first_bin;
+    gint i;
+
+    g_assert(loudness != NULL);
+    g_assert(o_lufs != NULL);
+
+    for (i = 0; i < mutil_loudness_bin_cnt; i++) {
+        block_cnt += loudness->bin_counts[i];
+        energy += loudness->bin_energies[i];
+    }
+    if (block_cnt == 0) {
+        goto cleanup;
+    }
+
+    rel_gate_lufs = -0.691 + 10.0 * log10(energy / block_cnt) +
+        mutil_loudness_rel_gate_lu;
+    first_bin = (gint) ceil((rel_gate_lufs - mutil_loudness_abs_gate_lufs) /
+            mutil_loudness_bin_width_lu);
+    first_bin = CLAMP(first_bin, 0, mutil_loudness_bin_cnt - 1);
+
+    block_cnt = 0;
+    energy = 0.0;
+    for (i = first_bin; i < mutil_loudness_bin_cnt; i++) {
+        block_cnt += loudness->bin_counts[i];
+        energy += loudness->bin_energies[i];
+    }
+
+    /* The blocks above the mean can't all be gated. */
+    g_assert(block_cnt > 0);
+
+    *o_lufs = -0.691 + 10.0 * log10(energy / block_cnt);
+    is_defined = TRUE;
+
+cleanup:
+
+    return is_defined;
+} /* mutil_loudness_get_integrated */
+
+void mutil_loudness_merge(
+        mutil_loudness_t *dst,
+        mutil_loudness_t const *src)
+{
+    gint i;
+
+    g_assert(dst != NULL);
+    g_assert(src != NULL);
+
+    for (i = 0; i < mutil_loudness_bin_cnt; i++) {
+        dst->bin_counts[i] += src->bin_counts[i];
+        dst->bin_energies[i] += src->bin_energies[i];
+    }
+    dst->peak = MAX(dst->peak, src->peak);
+
+    return;
+} /* mutil_loudness_merge */
+
+void mutil_loudness_process(
+        mutil_loudness_t *loudness,
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt)
+{
+    gint32 const *samples_i;
+    gint32 sample_min;
+    gint32 sample_max;
+    guint32 pos;
+    guint32 run_cnt;
+    guint32 i;
+    guint32 j;
+
+    g_assert(loudness != NULL);
+    g_assert(loudness->pairs != NULL);
+    g_assert(channel_buffers != NULL);
+
+    /* peak: */
+
+    sample_min = loudness->sample_min;
+    sample_max = loudness->sample_max;
+    for (i = 0; i < loudness->channels; i++) {
+        samples_i = channel_buffers[i];
+        for (j = 0; j < sample_cnt; j++) {
+            sample_min = MIN(sample_min, samples_i[j]);
+            sample_max = MAX(sample_max, samples_i[j]);
+        }
+    }
+    loudness->sample_min = sample_min;
+    loudness->sample_max = sample_max;
+    loudness->peak = MAX(-(gdouble) sample_min, (gdouble) sample_max) *
+        loudness->scale;
+
+    /* loudness: the samples are filtered in runs that end at sub-block
+     * boundaries. */
+
+    for (pos = 0; pos < sample_cnt; pos += run_cnt) {
+        run_cnt = MIN(
+                sample_cnt - pos,
+                loudness->sub_block_sz - loudness->sub_block_pos);
+
+        for (i = 0; i < loudness->pair_cnt; i++) {
+            mutil_loudness_filter_pair(
+                    loudness,
+                    &loudness->pairs[i],
+                    channel_buffers[2 * i] + pos,
+                    channel_buffers[MIN(2 * i + 1, loudness->channels - 1)] +
+                        pos,
+                    run_cnt);
+        }
+
+        loudness->sub_block_pos += run_cnt;
+        if (loudness->sub_block_pos == loudness->sub_block_sz) {
+            mutil_loudness_finish_sub_block(loudness);
+        }
+    }
+
+    return;
+} /* mutil_loudness_process */
+
+void mutil_biquad_init(
+        mutil_biquad_t *biquad,
+        gdouble b0,
+        gdouble b1,
+        gdouble b2,
+        gdouble a1,
+        gdouble a2)
+{
+    g_assert(biquad != NULL);
+
+    biquad->b0 = (mutil_v2df) { b0, b0 };
+    biquad->b1 = (mutil_v2df) { b1, b1 };
+    biquad->b2 = (mutil_v2df) { b2, b2 };
+    biquad->a1 = (mutil_v2df) { a1, a1 };
+    biquad->a2 = (mutil_v2df) { a2, a2 };
+
+    return;
+} /* mutil_biquad_init */
+
+gint mutil_replay_gain_append_tag(
+        FLAC__StreamMetadata *block,
+        gchar const *name,
+        gchar const *format,
+        gdouble value,
+        gchar const *unit,
+        GError **o_error)
+{
+    gint ret_value;
+    gchar number_text[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar *value_text = NULL;
+    FLAC__StreamMetadata_VorbisComment_Entry entry;
+    FLAC__bool flac_status;
+
+    g_assert(block != NULL);
+    g_assert(name != NULL);
+    g_assert(format != NULL);
+    g_assert(unit != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Tag values always use a decimal point, whatever the locale. */
+    g_ascii_formatd(number_text, sizeof(number_text), format, value);
+    value_text = g_strconcat(number_text, unit, NULL);
+
+    flac_status =
+        FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(
+                &entry,
+                name,
+                value_text);
+    if (flac_status) {
+        flac_status = FLAC__metadata_object_vorbiscomment_append_comment(
+                block,
+                entry,
+                FALSE);
+    }
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to add tag %s",
+                name);
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    g_free(value_text);
+
+    return ret_value;
+} /* mutil_replay_gain_append_tag */
+
+gdouble mutil_replay_gain_get_gain(
+        mutil_loudness_t const *loudness)
+{
+    gdouble gain = 0.0;
+    gdouble lufs;
+
+    g_assert(loudness != NULL);
+
+    /* Audio without a single block above the absolute gate is left alone. */
+    if (mutil_loudness_get_integrated(loudness, &lufs)) {
+        gain = mutil_replay_gain_reference_lufs - lufs;
+    }
+
+    return gain;
+} /* mutil_replay_gain_get_gain */
+
+gdouble mutil_replay_gain_get_peak(
+        mutil_loudness_t const *loudness)
+{
+    g_assert(loudness != NULL);
+
+    return loudness->peak;
+} /* mutil_replay_gain_get_peak */
+
+gboolean mutil_replay_gain_is_tagged(
+        gchar const *filename)
+{
+    gboolean is_tagged = FALSE;
+    FLAC__StreamMetadata *tags = NULL;
+    FLAC__bool flac_status;
+
+    g_assert(filename != NULL);
+
+    /* metaflac also writes its 89 dB reference, which ReplayGain 2.0 tags
+     * leave out. */
+    flac_status = FLAC__metadata_get_tags(filename, &tags);
+    if (flac_status) {
+        is_tagged =
+            FLAC__metadata_object_vorbiscomment_find_entry_from(
+                    tags,
+                    0,
+                    "REPLAYGAIN_ALBUM_GAIN") >= 0 &&
+            FLAC__metadata_object_vorbiscomment_find_entry_from(
+                    tags,
+                    0,
+                    "REPLAYGAIN_REFERENCE_LOUDNESS") < 0;
+        FLAC__metadata_object_delete(tags);
+    }
+
+    return is_tagged;
+} /* mutil_replay_gain_is_tagged */
+
+gint mutil_replay_gain_write_tags(
+        gchar const *filename,
+        mutil_loudness_t const *track_loudness,
+        mutil_loudness_t const *album_loudness,
+        GError **o_error)
+{
+    static gchar const * const tag_names[] = {
+        "REPLAYGAIN_TRACK_GAIN",
+        "REPLAYGAIN_TRACK_PEAK",
+        "REPLAYGAIN_ALBUM_GAIN",
+        "REPLAYGAIN_ALBUM_PEAK",
+        "REPLAYGAIN_REFERENCE_LOUDNESS"
+    };
+    gint ret_value;
+    gint status;
+    FLAC__Metadata_Chain *chain = NULL;
+    FLAC__Metadata_Iterator *iterator = NULL;
+    FLAC__StreamMetadata *block = NULL;
+    FLAC__StreamMetadata *new_block = NULL;
+    FLAC__bool flac_status;
+    guint i;
+
+    g_assert(filename != NULL);
+    g_assert(track_loudness != NULL);
+    g_assert(album_loudness != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    chain = FLAC__metadata_chain_new();
+    iterator = FLAC__metadata_iterator_new();
+    if (chain == NULL || iterator == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to allocate FLAC metadata chain");
+        goto error_handling;
+    }
+
+    flac_status = FLAC__metadata_chain_read(chain, filename);
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to read tags of '%s': %s",
+                filename,
+                FLAC__Metadata_ChainStatusString[
+                    FLAC__metadata_chain_status(chain)]);
+        goto error_handling;
+    }
+
+    /* Find the Vorbis comment block, or add one after STREAMINFO. */
+
+    FLAC__metadata_iterator_init(iterator, chain);
+    do {
+        if (FLAC__metadata_iterator_get_block_type(iterator) ==
+                FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+            block = FLAC__metadata_iterator_get_block(iterator);
+        }
+    } while (block == NULL && FLAC__metadata_iterator_next(iterator));
+
+    if (block == NULL) {
+        new_block = FLAC__metadata_object_new(
+                FLAC__METADATA_TYPE_VORBIS_COMMENT);
+        FLAC__metadata_iterator_init(iterator, chain);
+        if (new_block == NULL ||
+            !FLAC__metadata_iterator_insert_block_after(iterator, new_block)) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to add Vorbis comment to '%s'",
+                    filename);
+            goto error_handling;
+        }
+        block = new_block;
+        new_block = NULL;
+    }
+
+    /* Tags left by 'metaflac --add-replay-gain' are replaced, including its
+     * 89 dB reference, which doesn't apply to ReplayGain 2.0 values. */
+
+    for (i = 0; i < G_N_ELEMENTS(tag_names); i++) {
+        FLAC__metadata_object_vorbiscomment_remove_entries_matching(
+                block,
+                tag_names[i]);
+    }
+
+    status = mutil_replay_gain_append_tag(
+            block,
+            "REPLAYGAIN_TRACK_GAIN",
+            "%+.2f",
+            mutil_replay_gain_get_gain(track_loudness),
+            " dB",
+            o_error);
+    if (status == 0) {
+        status = mutil_replay_gain_append_tag(
+                block,
+                "REPLAYGAIN_TRACK_PEAK",
+                "%.6f",
+                mutil_replay_gain_get_peak(track_loudness),
+                "",
+                o_error);
+    }
+    if (status == 0) {
+        status = mutil_replay_gain_append_tag(
+                block,
+                "REPLAYGAIN_ALBUM_GAIN",
+                "%+.2f",
+                mutil_replay_gain_get_gain(album_loudness),
+                " dB",
+                o_error);
+    }
+    if (status == 0) {
+        status = mutil_replay_gain_append_tag(
+                block,
+                "REPLAYGAIN_ALBUM_PEAK",
+                "%.6f",
+                mutil_replay_gain_get_peak(album_loudness),
+                "",
+                o_error);
+    }
+    if (status == -1) {
+        g_prefix_error(o_error, "'%s': ", filename);
+        goto error_handling;
+    }
+
+    /* Merging the padding at the end lets the tags grow into it, so that only
+     * the metadata is rewritten. */
+
+    FLAC__metadata_chain_sort_padding(chain);
+    flac_status = FLAC__metadata_chain_write(chain, TRUE, FALSE);
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to write tags of '%s': %s",
+                filename,
+                FLAC__Metadata_ChainStatusString[
+                    FLAC__metadata_chain_status(chain)]);
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (new_block != NULL) {
+        FLAC__metadata_object_delete(new_block);
+    }
+    if (iterator != NULL) {
+        FLAC__metadata_iterator_delete(iterator);
+    }
+    if (chain != NULL) {
+        FLAC__metadata_chain_delete(chain);
+    }
+
+    return ret_value;
+} /* mutil_replay_gain_write_tags */
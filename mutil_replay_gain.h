@@ -0,0 +1,68 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_replay_gain_h
+#define mutil_replay_gain_h
+
+#include "mutil_common.h"
+#include "mutil_audio_file.h"
+
+/* Loudness is measured as in ReplayGain 2.0: the signal is K-weighted and its
+ * gated mean square is taken over 400 ms blocks (ITU-R BS.1770). Block
+ * loudness values are kept in a histogram, so the loudness of an album is
+ * found by merging the histograms of its tracks. */
+
+struct mutil_loudness;
+typedef struct mutil_loudness mutil_loudness_t;
+
+/* loudness: */
+
+/* Returns NULL if the stream has no channels or no sample rate. */
+mutil_loudness_t *mutil_loudness_alloc(
+        mutil_stream_info_t const *stream_info);
+
+/* Decodes the FLAC file and measures its loudness. */
+mutil_loudness_t *mutil_loudness_analyze_file(
+        gchar const *filename,
+        GError **o_error);
+
+void mutil_loudness_free(
+        mutil_loudness_t *loudness);
+
+/* Adds the blocks and peak of src to dst. The two may differ in format. */
+void mutil_loudness_merge(
+        mutil_loudness_t *dst,
+        mutil_loudness_t const *src);
+
+/* Adds samples in the layout of mutil_pcm_cb_write_t. */
+void mutil_loudness_process(
+        mutil_loudness_t *loudness,
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt);
+
+/* replay gain: */
+
+/* Returns the gain in dB that brings the audio to the ReplayGain 2.0 reference
+ * level of -18 LUFS. */
+gdouble mutil_replay_gain_get_gain(
+        mutil_loudness_t const *loudness);
+
+/* Returns the sample peak, where 1.0 is full scale. */
+gdouble mutil_replay_gain_get_peak(
+        mutil_loudness_t const *loudness);
+
+/* Returns TRUE if the FLAC file has ReplayGain 2.0 album gain tags. Tags left
+ * by 'metaflac --add-replay-gain' are ReplayGain 1.0 values, and don't
+ * count. */
+gboolean mutil_replay_gain_is_tagged(
+        gchar const *filename);
+
+/* Replaces the ReplayGain tags of the FLAC file. The metadata is rewritten in
+ * place when it fits in the file's padding. */
+gint mutil_replay_gain_write_tags(
+        gchar const *filename,
+        mutil_loudness_t const *track_loudness,
+        mutil_loudness_t const *album_loudness,
+        GError **o_error);
+
+#endif /* #ifndef mutil_replay_gain_h */
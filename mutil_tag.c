@@ -35,19 +35,35 @@ static gboolean mutil_tag_map_destruct_value(
 mutil_tag_t *mutil_tag_alloc(
         gchar const *name,
         gchar const *value)
+{
+    return mutil_tag_alloc_len(name, -1, value, -1);
+} /* mutil_tag_alloc */
+
+mutil_tag_t *mutil_tag_alloc_len(
+        gchar const *name,
+        gssize name_len,
+        gchar const *value,
+        gssize value_len)
 {
     mutil_tag_t *new_tag;
 
     g_assert(name != NULL);
     g_assert(value != NULL);
 
+    if (name_len < 0) {
+        name_len = strlen(name);
+    }
+    if (value_len < 0) {
+        value_len = strlen(value);
+    }
+
     new_tag = g_malloc0(sizeof(mutil_tag_t));
     new_tag->ref_cnt = 1;
-    new_tag->name = g_strdup(name);
-    new_tag->value = g_strdup(value);
+    new_tag->name = g_strndup(name, name_len);
+    new_tag->value = g_strndup(value, value_len);
 
     return new_tag;
-} /* mutil_tag_alloc */
+} /* mutil_tag_alloc_len */
 
 mutil_tag_t *mutil_tag_copy(
         mutil_tag_t *tag)
@@ -81,42 +97,53 @@ GList *mutil_tag_copy_list_of(
 
 mutil_tag_t *mutil_tag_create_from_simple_assignment(
         gchar const *tag_text,
+        gssize tag_text_len,
         gunichar separator,
         GError **o_error)
 {
     mutil_tag_t *new_tag = NULL;
     gchar const *sep_pos;
-    gchar *name = NULL;
+    gchar const *end_pos;
 
     g_assert(tag_text != NULL);
     g_assert(o_error == NULL || *o_error == NULL);
 
-    sep_pos = g_utf8_strchr(tag_text, -1, separator);
+    if (tag_text_len < 0) {
+        tag_text_len = strlen(tag_text);
+    }
+    end_pos = tag_text + tag_text_len;
+
+    sep_pos = g_utf8_strchr(tag_text, tag_text_len, separator);
     if (sep_pos == NULL) {
         g_set_error(
                 o_error,
                 mutil_error_domain,
                 mutil_error_code_undefined,
-                "no tag separator found in text '%s'", tag_text);
+                "no tag separator found in text '%.*s'",
+                (gint) tag_text_len,
+                tag_text);
         goto error_handling;
     }
 
-    if (sep_pos[1] == '\0') {
+    if (&sep_pos[1] == end_pos || sep_pos[1] == '\0') {
         g_set_error(
                 o_error,
                 mutil_error_domain,
                 mutil_error_code_undefined,
-                "no value found in text '%s'", tag_text);
+                "no value found in text '%.*s'",
+                (gint) tag_text_len,
+                tag_text);
         goto error_handling;
     }
 
-    g_assert(name == NULL);
-    name = g_malloc((sep_pos - tag_text + 1) * sizeof(gchar));
-    memcpy(name, tag_text, (sep_pos - tag_text) * sizeof(gchar));
-    name[sep_pos - tag_text] = '\0';
-
+    /* The name and value are copied straight out of the source text, which
+     * may be a view into a larger buffer. */
     g_assert(new_tag == NULL);
-    new_tag = mutil_tag_alloc(name, &sep_pos[1]);
+    new_tag = mutil_tag_alloc_len(
+            tag_text,
+            sep_pos - tag_text,
+            &sep_pos[1],
+            end_pos - &sep_pos[1]);
 
     g_assert(o_error == NULL || *o_error == NULL);
     g_assert(new_tag != NULL);
@@ -131,8 +158,6 @@ error_handling:
 
 cleanup:
 
-    g_free(name);
-
     return new_tag;
 } /* mutil_tag_create_from_simple_assignment */
 
@@ -33,11 +33,23 @@ mutil_tag_t *mutil_tag_alloc(
         gchar const *name,
         gchar const *value);
 
+/* Same as mutil_tag_alloc(), except that the name and value need not be
+ * null-terminated if their lengths aren't negative. */
+mutil_tag_t *mutil_tag_alloc_len(
+        gchar const *name,
+        gssize name_len,
+        gchar const *value,
+        gssize value_len);
+
 mutil_tag_t *mutil_tag_copy(
         mutil_tag_t *tag);
 
+/* Creates a tag from text of the form "<name><separator><value>". The text need
+ * not be null-terminated if tag_text_len isn't negative.
+ */
 mutil_tag_t *mutil_tag_create_from_simple_assignment(
         gchar const *tag_text,
+        gssize tag_text_len,
         gunichar separator,
         GError **o_error);
 
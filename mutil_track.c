@@ -7,9 +7,19 @@ struct mutil_track {
     gint ref_cnt;
     gchar *filename;
     mutil_audio_type_t audio_type;
+    mutil_stream_info_t stream_info;
     mutil_tag_map_t *tag_map;
+
+    /* The samples of the file that the track plays, if not all of them. */
+    gboolean is_ranged;
+    guint64 first_sample;
+    guint64 sample_cnt;
 };
 
+/* Bytes per second and channel of CD audio, used to estimate the work for
+ * tracks whose stream properties are unknown. */
+#define mutil_cd_audio_channel_byte_rate (44100 * 2)
+
 static gchar *mutil_format_escaped_string(
         gchar const *src_str,
         gboolean opt_flag_escape_newlines,
@@ -96,10 +106,63 @@ mutil_track_t *mutil_track_alloc(
     new_track->filename = g_strdup(audio_filename);
     new_track->audio_type = audio_type;
     new_track->tag_map = mutil_tag_map_alloc();
+    new_track->sample_cnt = G_MAXUINT64;
 
     return new_track;
 } /* mutil_track_alloc */
 
+gint mutil_track_compute_audio_content_key(
+        mutil_track_t *track,
+        gchar **o_content_key,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    gchar *file_content_key = NULL;
+
+    g_assert(track != NULL);
+    g_assert(o_content_key != NULL);
+    g_assert(*o_content_key == NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    status = mutil_compute_audio_content_key(
+            track->filename,
+            track->audio_type,
+            &track->stream_info,
+            &file_content_key,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    if (file_content_key != NULL && track->is_ranged) {
+        *o_content_key = g_strdup_printf(
+                "%s@%" G_GUINT64_FORMAT "+%" G_GUINT64_FORMAT,
+                file_content_key,
+                track->first_sample,
+                mutil_track_get_sample_cnt(track));
+    } else {
+        *o_content_key = file_content_key;
+        file_content_key = NULL;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    g_free(file_content_key);
+
+    return ret_value;
+} /* mutil_track_compute_audio_content_key */
+
 mutil_track_t *mutil_track_copy(
         mutil_track_t *track)
 {
@@ -143,6 +206,7 @@ GList *mutil_track_create_tag_list(
 gchar *mutil_track_format_archive_encode_command(
         mutil_track_t *track,
         gchar const *tgt_filename,
+        guint flac_level,
         gboolean opt_flag_use_echo_e)
 {
     GString *new_cmd = NULL;
@@ -155,12 +219,18 @@ gchar *mutil_track_format_archive_encode_command(
 
     g_assert(track != NULL);
     g_assert(tgt_filename != NULL);
+    g_assert(flac_level <= mutil_flac_level_best);
 
     tag_list = mutil_track_create_tag_list(track);
 
     new_cmd = g_string_new("flac --silent");
     g_string_append_printf(new_cmd, " --output-name=\"%s\"", tgt_filename);
-    g_string_append(new_cmd, " --best");
+    if (flac_level == mutil_flac_level_best) {
+        g_string_append(new_cmd, " --best");
+    } else {
+        g_string_append_printf(new_cmd, " -%u", flac_level);
+    }
+    g_string_append_printf(new_cmd, " --padding=%u", mutil_flac_padding_sz);
 
     for (node_i = tag_list;
          node_i != NULL;
@@ -196,13 +266,97 @@ gchar *mutil_track_format_archive_encode_command(
     return g_string_free(new_cmd, FALSE);
 } /* mutil_track_format_archive_encode_command */
 
+gchar *mutil_track_format_archive_retag_command(
+        mutil_track_t *track,
+        gchar const *tgt_filename,
+        gboolean opt_flag_use_echo_e)
+{
+    GString *new_cmd = NULL;
+    GList *tag_list;
+    GList *node_i;
+    mutil_tag_t *tag_i;
+    gchar const *name_text;
+    gchar const *value_text;
+    gchar *safe_value_text = NULL;
+
+    g_assert(track != NULL);
+    g_assert(tgt_filename != NULL);
+
+    tag_list = mutil_track_create_tag_list(track);
+
+    /* metaflac runs its operations in command-line order, so the old tags are
+     * removed before the new ones are set. */
+    new_cmd = g_string_new("metaflac --remove-all-tags");
+
+    for (node_i = tag_list;
+         node_i != NULL;
+         node_i = node_i->next) {
+
+        tag_i = node_i->data;
+
+        name_text = mutil_tag_get_name(tag_i);
+        value_text = mutil_tag_get_value(tag_i);
+
+        g_free(safe_value_text);
+        safe_value_text = mutil_format_escaped_string(value_text, TRUE, TRUE);
+
+        g_string_append_printf(
+                new_cmd,
+                " --set-tag=%s=\"$$(echo %s%s)\"",
+                name_text,
+                opt_flag_use_echo_e ? "-e " : "",
+                safe_value_text);
+    }
+
+    g_string_append_printf(new_cmd, " \"%s\"", tgt_filename);
+
+    mutil_tag_free_list_of(tag_list);
+    g_free(safe_value_text);
+
+    g_assert(new_cmd != NULL);
+    return g_string_free(new_cmd, FALSE);
+} /* mutil_track_format_archive_retag_command */
+
 gchar *mutil_track_format_decode_command(
         mutil_track_t *track)
 {
     gchar *new_cmd = NULL;
+    gchar *until_text = NULL;
 
     g_assert(track != NULL);
 
+    /* 'flac' cuts the range out of a WAV file by encoding it at the fastest
+     * level, which is cheap next to the encode the output is piped to. */
+    if (track->is_ranged) {
+        until_text = track->sample_cnt == G_MAXUINT64 ? g_strdup("") :
+            g_strdup_printf(
+                    " --until=%" G_GUINT64_FORMAT,
+                    track->first_sample + track->sample_cnt);
+        switch (track->audio_type) {
+            case mutil_audio_type_flac:
+                new_cmd = g_strdup_printf(
+                        "flac --decode --silent --stdout"
+                        " --skip=%" G_GUINT64_FORMAT "%s \"%s\"",
+                        track->first_sample,
+                        until_text,
+                        track->filename);
+                break;
+            case mutil_audio_type_native:
+                new_cmd = g_strdup_printf(
+                        "flac -0 --silent --stdout"
+                        " --skip=%" G_GUINT64_FORMAT "%s \"%s\""
+                        " | flac --decode --silent --stdout -",
+                        track->first_sample,
+                        until_text,
+                        track->filename);
+                break;
+        }
+        g_free(until_text);
+
+        g_assert(new_cmd != NULL);
+        return new_cmd;
+    }
+
     switch (track->audio_type) {
         case mutil_audio_type_flac:
             new_cmd = g_strdup_printf(
@@ -221,6 +375,7 @@ gchar *mutil_track_format_decode_command(
 gchar *mutil_track_format_ogg_encode_command(
         mutil_track_t *track,
         gchar const *tgt_filename,
+        guint ogg_bitrate,
         gboolean opt_flag_use_echo_e)
 {
     GString *new_cmd = NULL;
@@ -233,10 +388,12 @@ gchar *mutil_track_format_ogg_encode_command(
 
     g_assert(track != NULL);
     g_assert(tgt_filename != NULL);
+    g_assert(ogg_bitrate > 0);
 
     tag_list = mutil_track_create_tag_list(track);
 
-    new_cmd = g_string_new("oggenc --quiet --bitrate=128");
+    new_cmd = g_string_new(NULL);
+    g_string_append_printf(new_cmd, "oggenc --quiet --bitrate=%u", ogg_bitrate);
     g_string_append_printf(new_cmd, " --output=\"%s\"", tgt_filename);
 
     for (node_i = tag_list;
@@ -294,6 +451,48 @@ void mutil_track_free_list_of(
     return;
 } /* mutil_track_free_list_of */
 
+gdouble mutil_track_estimate_work(
+        mutil_track_t const * const track)
+{
+    gdouble work;
+
+    g_assert(track != NULL);
+
+    if (track->stream_info.sample_rate != 0 &&
+        track->stream_info.channels != 0 &&
+        mutil_track_get_sample_cnt(track) != 0) {
+        work = mutil_track_get_duration(track) * track->stream_info.channels;
+    } else {
+        work = (gdouble) track->stream_info.file_sz /
+            mutil_cd_audio_channel_byte_rate;
+    }
+
+    return work;
+} /* mutil_track_estimate_work */
+
+mutil_audio_type_t mutil_track_get_audio_type(
+        mutil_track_t const * const track)
+{
+    g_assert(track != NULL);
+
+    return track->audio_type;
+} /* mutil_track_get_audio_type */
+
+gdouble mutil_track_get_duration(
+        mutil_track_t const * const track)
+{
+    gdouble duration = 0.0;
+
+    g_assert(track != NULL);
+
+    if (track->stream_info.sample_rate != 0) {
+        duration = (gdouble) mutil_track_get_sample_cnt(track) /
+            track->stream_info.sample_rate;
+    }
+
+    return duration;
+} /* mutil_track_get_duration */
+
 gchar const *mutil_track_get_filename(
         mutil_track_t const * const track)
 {
@@ -322,6 +521,48 @@ gchar const *mutil_track_get_first_tag_value_by_name(
     return tag_value;
 } /* mutil_track_get_first_tag_value_by_name */
 
+gboolean mutil_track_get_range(
+        mutil_track_t const * const track,
+        guint64 *o_first_sample,
+        guint64 *o_sample_cnt)
+{
+    g_assert(track != NULL);
+
+    if (o_first_sample != NULL) {
+        *o_first_sample = track->first_sample;
+    }
+    if (o_sample_cnt != NULL) {
+        *o_sample_cnt = track->sample_cnt;
+    }
+
+    return track->is_ranged;
+} /* mutil_track_get_range */
+
+guint64 mutil_track_get_sample_cnt(
+        mutil_track_t const * const track)
+{
+    guint64 total_samples;
+
+    g_assert(track != NULL);
+
+    total_samples = track->stream_info.total_samples;
+    if (total_samples == 0) {
+        return 0;
+    }
+
+    return MIN(
+            total_samples - MIN(total_samples, track->first_sample),
+            track->sample_cnt);
+} /* mutil_track_get_sample_cnt */
+
+mutil_stream_info_t const *mutil_track_get_stream_info(
+        mutil_track_t const * const track)
+{
+    g_assert(track != NULL);
+
+    return &track->stream_info;
+} /* mutil_track_get_stream_info */
+
 gboolean mutil_track_has_duplicate_tags(
         mutil_track_t *track,
         gchar const *tag_name)
@@ -350,6 +591,33 @@ gboolean mutil_track_has_tag(
     return tag_bucket != NULL ? TRUE : FALSE;
 } /* mutil_track_has_tag */
 
+void mutil_track_set_range(
+        mutil_track_t *track,
+        guint64 first_sample,
+        guint64 sample_cnt)
+{
+    g_assert(track != NULL);
+    g_assert(sample_cnt > 0);
+
+    track->is_ranged = TRUE;
+    track->first_sample = first_sample;
+    track->sample_cnt = sample_cnt;
+
+    return;
+} /* mutil_track_set_range */
+
+void mutil_track_set_stream_info(
+        mutil_track_t *track,
+        mutil_stream_info_t const *stream_info)
+{
+    g_assert(track != NULL);
+    g_assert(stream_info != NULL);
+
+    track->stream_info = *stream_info;
+
+    return;
+} /* mutil_track_set_stream_info */
+
 void mutil_track_list_generate_track_number_tags(
         GList *track_list)
 {
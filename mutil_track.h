@@ -25,6 +25,14 @@ mutil_track_t *mutil_track_alloc(
         gchar const *audio_filename,
         mutil_audio_type_t audio_type);
 
+/* Sets *o_content_key to a string that is equal for two tracks only if they
+ * hold the same audio samples, as mutil_compute_audio_content_key() does for
+ * files, qualified by the track's range if it has one. */
+gint mutil_track_compute_audio_content_key(
+        mutil_track_t *track,
+        gchar **o_content_key,
+        GError **o_error);
+
 mutil_track_t *mutil_track_copy(
         mutil_track_t *track);
 
@@ -34,17 +42,45 @@ GList *mutil_track_copy_list_of(
 GList *mutil_track_create_tag_list(
         mutil_track_t *track);
 
+/* 'flac --best' */
+#define mutil_flac_level_best 8
+
+/* Padding reserved in archived FLAC files, so that retagging them rewrites
+ * their metadata in place. The 'flac' command's default of 8 KiB is easily
+ * used up by a few long tags such as lyrics. */
+#define mutil_flac_padding_sz 65536
+
+/* 'oggenc --bitrate=128', in kbit/s. */
+#define mutil_ogg_bitrate_default 128
+
+/* Formats a command that encodes WAV data on its standard input to the FLAC
+ * file tgt_filename at the given compression level, with
+ * mutil_flac_padding_sz bytes of padding. */
 gchar *mutil_track_format_archive_encode_command(
+        mutil_track_t *track,
+        gchar const *tgt_filename,
+        guint flac_level,
+        gboolean opt_flag_use_echo_e);
+
+/* Formats a command that replaces all tags of the FLAC file tgt_filename with
+ * the track's tags. */
+gchar *mutil_track_format_archive_retag_command(
         mutil_track_t *track,
         gchar const *tgt_filename,
         gboolean opt_flag_use_echo_e);
 
+/* Formats a command that decodes the track's audio to WAV data on its standard
+ * output. A track with a range is cut from its file by 'flac', which also
+ * reads WAV files. */
 gchar *mutil_track_format_decode_command(
         mutil_track_t *track);
 
+/* Formats a command that encodes WAV data on its standard input to the Ogg
+ * Vorbis file tgt_filename at an average of ogg_bitrate kbit/s. */
 gchar *mutil_track_format_ogg_encode_command(
         mutil_track_t *track,
         gchar const *tgt_filename,
+        guint ogg_bitrate,
         gboolean opt_flag_use_echo_e);
 
 void mutil_track_free(
@@ -53,13 +89,45 @@ void mutil_track_free(
 void mutil_track_free_list_of(
         GList *track_list);
 
+/* Returns a relative estimate of the work needed to decode or encode the
+ * track: its duration times its channel count, in sample-seconds. Tracks whose
+ * stream properties are unknown are estimated from their file size as if they
+ * held CD audio. */
+gdouble mutil_track_estimate_work(
+        mutil_track_t const * const track);
+
+mutil_audio_type_t mutil_track_get_audio_type(
+        mutil_track_t const * const track);
+
 gchar const *mutil_track_get_filename(
         mutil_track_t const * const track);
 
+/* Returns the track's playing time in seconds, or zero if unknown. */
+gdouble mutil_track_get_duration(
+        mutil_track_t const * const track);
+
 gchar const *mutil_track_get_first_tag_value_by_name(
         mutil_track_t *track,
         gchar const *tag_name);
 
+/* Returns TRUE if the track is a range of its file's samples, and sets
+ * *o_first_sample and *o_sample_cnt, which may be NULL, to the range. A track
+ * without a range covers its whole file, from sample 0 with a sample count of
+ * G_MAXUINT64. */
+gboolean mutil_track_get_range(
+        mutil_track_t const * const track,
+        guint64 *o_first_sample,
+        guint64 *o_sample_cnt);
+
+/* Returns the number of samples the track plays, or zero if unknown. */
+guint64 mutil_track_get_sample_cnt(
+        mutil_track_t const * const track);
+
+/* Returns the stream properties of the track's file. For a track with a range,
+ * they describe the whole file. */
+mutil_stream_info_t const *mutil_track_get_stream_info(
+        mutil_track_t const * const track);
+
 gboolean mutil_track_has_duplicate_tags(
         mutil_track_t *track,
         gchar const *tag_name);
@@ -68,6 +136,18 @@ gboolean mutil_track_has_tag(
         mutil_track_t *track,
         gchar const *tag_name);
 
+/* Limits the track to sample_cnt samples of its file from first_sample on, as
+ * for a track of a CUE sheet's image. sample_cnt may be G_MAXUINT64 for the
+ * rest of the file. */
+void mutil_track_set_range(
+        mutil_track_t *track,
+        guint64 first_sample,
+        guint64 sample_cnt);
+
+void mutil_track_set_stream_info(
+        mutil_track_t *track,
+        mutil_stream_info_t const *stream_info);
+
 /* track list: */
 
 void mutil_track_list_generate_track_number_tags(
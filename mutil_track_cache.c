@@ -0,0 +1,679 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_track_cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Cache file layout, in host byte order:
+ *
+ *   header
+ *   record[record_cnt], sorted by device and inode
+ *   tag text: for each record, tag_cnt null-terminated "name=value" strings
+ *
+ * The magic, version and record size are checked on open, and a cache file
+ * that doesn't match is ignored and rewritten on save. */
+
+#define mutil_track_cache_magic "mutiltc"
+#define mutil_track_cache_version 2
+
+struct mutil_track_cache_header;
+typedef struct mutil_track_cache_header mutil_track_cache_header_t;
+
+struct mutil_track_cache_record;
+typedef struct mutil_track_cache_record mutil_track_cache_record_t;
+
+struct mutil_track_cache_entry;
+typedef struct mutil_track_cache_entry mutil_track_cache_entry_t;
+
+struct mutil_track_cache_header {
+    gchar magic[8];
+    guint32 version;
+    guint32 record_sz;
+    guint64 record_cnt;
+    guint64 tag_text_sz;
+};
+
+struct mutil_track_cache_record {
+    guint64 dev;
+    guint64 ino;
+    guint64 size;
+    gint64 mtime_sec;
+    gint64 mtime_nsec;
+    guint64 tag_text_offset;
+    guint64 tag_text_sz;
+    guint32 audio_type;
+    guint32 tag_cnt;
+    guint32 sample_rate;
+    guint32 channels;
+    guint32 bits_per_sample;
+    guint32 reserved;
+    guint64 total_samples;
+    guint8 md5[16];
+};
+
+/* An entry is a record plus its tag text, either pointing into the mapped
+ * cache file or owning a copy of new text. */
+struct mutil_track_cache_entry {
+    mutil_track_cache_record_t record;
+    gchar const *tag_text;
+    GString *new_tag_text;
+};
+
+struct mutil_track_cache {
+    gchar *filename;
+    guint8 const *map_data;
+    gsize map_sz;
+    mutil_track_cache_record_t const *records;
+    guint64 record_cnt;
+    gchar const *tag_text;
+    guint64 tag_text_sz;
+    gint *record_used_flags;
+    GMutex mutex;
+    GPtrArray *new_entries;
+};
+
+static gint mutil_track_cache_cb_compare_entries(
+        gconstpointer a,
+        gconstpointer b);
+
+static gint mutil_track_cache_cb_compare_records(
+        gconstpointer a,
+        gconstpointer b);
+
+static void mutil_track_cache_entry_free(
+        mutil_track_cache_entry_t *entry);
+
+static void mutil_track_cache_record_init(
+        mutil_track_cache_record_t *record,
+        struct stat const *file_stat);
+
+gint mutil_track_cache_cb_compare_entries(
+        gconstpointer a,
+        gconstpointer b)
+{
+    mutil_track_cache_entry_t const *entry_a;
+    mutil_track_cache_entry_t const *entry_b;
+    gint cmp_result;
+
+    /* The arguments point to elements of a pointer array. */
+    entry_a = *(mutil_track_cache_entry_t const * const *) a;
+    entry_b = *(mutil_track_cache_entry_t const * const *) b;
+
+    cmp_result = mutil_track_cache_cb_compare_records(
+            &entry_a->record,
+            &entry_b->record);
+
+    /* New entries sort before old entries for the same file so that they
+     * replace them. */
+    if (cmp_result == 0) {
+        cmp_result =
+            (entry_a->new_tag_text != NULL ? 0 : 1) -
+            (entry_b->new_tag_text != NULL ? 0 : 1);
+    }
+
+    return cmp_result;
+} /* mutil_track_cache_cb_compare_entries */
+
+gint mutil_track_cache_cb_compare_records(
+        gconstpointer a,
+        gconstpointer b)
+{
+    mutil_track_cache_record_t const *record_a = a;
+    mutil_track_cache_record_t const *record_b = b;
+
+    if (record_a->dev != record_b->dev) {
+        return record_a->dev < record_b->dev ? -1 : 1;
+    }
+
+    if (record_a->ino != record_b->ino) {
+        return record_a->ino < record_b->ino ? -1 : 1;
+    }
+
+    return 0;
+} /* mutil_track_cache_cb_compare_records */
+
+gchar *mutil_track_cache_default_filename(void)
+{
+    return g_build_filename(
+            g_get_user_cache_dir(),
+            "mutil",
+            "track_cache",
+            NULL);
+} /* mutil_track_cache_default_filename */
+
+void mutil_track_cache_entry_free(
+        mutil_track_cache_entry_t *entry)
+{
+    if (entry != NULL) {
+        if (entry->new_tag_text != NULL) {
+            g_string_free(entry->new_tag_text, TRUE);
+        }
+        g_free(entry);
+    }
+
+    return;
+} /* mutil_track_cache_entry_free */
+
+void mutil_track_cache_free(
+        mutil_track_cache_t *track_cache)
+{
+    guint i;
+
+    if (track_cache != NULL) {
+
+        for (i = 0; i < track_cache->new_entries->len; i++) {
+            mutil_track_cache_entry_free(
+                    g_ptr_array_index(track_cache->new_entries, i));
+        }
+        g_ptr_array_free(track_cache->new_entries, TRUE);
+
+        if (track_cache->map_data != NULL) {
+            munmap((gpointer) track_cache->map_data, track_cache->map_sz);
+        }
+        g_free(track_cache->record_used_flags);
+
+        g_mutex_clear(&track_cache->mutex);
+        g_free(track_cache->filename);
+        g_free(track_cache);
+    }
+
+    return;
+} /* mutil_track_cache_free */
+
+void mutil_track_cache_insert(
+        mutil_track_cache_t *track_cache,
+        struct stat const *file_stat,
+        mutil_track_t *track)
+{
+    mutil_track_cache_entry_t *new_entry;
+    GList *tag_list;
+    GList *node_i;
+    mutil_tag_t *tag_i;
+    mutil_stream_info_t const *stream_info;
+
+    g_assert(track_cache != NULL);
+    g_assert(file_stat != NULL);
+    g_assert(track != NULL);
+
+    new_entry = g_malloc0(sizeof(mutil_track_cache_entry_t));
+    mutil_track_cache_record_init(&new_entry->record, file_stat);
+    new_entry->record.audio_type = mutil_track_get_audio_type(track);
+    stream_info = mutil_track_get_stream_info(track);
+    new_entry->record.sample_rate = stream_info->sample_rate;
+    new_entry->record.channels = stream_info->channels;
+    new_entry->record.bits_per_sample = stream_info->bits_per_sample;
+    new_entry->record.total_samples = stream_info->total_samples;
+    memcpy(
+            new_entry->record.md5,
+            stream_info->md5,
+            sizeof(new_entry->record.md5));
+    new_entry->new_tag_text = g_string_new("");
+
+    tag_list = mutil_track_create_tag_list(track);
+    for (node_i = tag_list;
+         node_i != NULL;
+         node_i = node_i->next) {
+
+        tag_i = node_i->data;
+
+        g_string_append_printf(
+                new_entry->new_tag_text,
+                "%s=%s",
+                mutil_tag_get_name(tag_i),
+                mutil_tag_get_value(tag_i));
+        g_string_append_c(new_entry->new_tag_text, '\0');
+        new_entry->record.tag_cnt++;
+    }
+    mutil_tag_free_list_of(tag_list);
+
+    new_entry->record.tag_text_sz = new_entry->new_tag_text->len;
+    new_entry->tag_text = new_entry->new_tag_text->str;
+
+    g_mutex_lock(&track_cache->mutex);
+    g_ptr_array_add(track_cache->new_entries, new_entry);
+    g_mutex_unlock(&track_cache->mutex);
+
+    return;
+} /* mutil_track_cache_insert */
+
+mutil_track_t *mutil_track_cache_look_up(
+        mutil_track_cache_t *track_cache,
+        gchar const *audio_filename,
+        struct stat const *file_stat)
+{
+    mutil_track_t *new_track = NULL;
+    mutil_track_cache_record_t key;
+    mutil_track_cache_record_t const *record;
+    mutil_stream_info_t stream_info;
+    gchar const *text_pos;
+    gchar const *text_end;
+    gchar const *tag_end;
+    guint32 tag_i;
+    mutil_tag_t *new_tag = NULL;
+
+    g_assert(track_cache != NULL);
+    g_assert(audio_filename != NULL);
+    g_assert(file_stat != NULL);
+
+    /* The mapped records are never modified, so no lock is needed. */
+
+    mutil_track_cache_record_init(&key, file_stat);
+    record = bsearch(
+            &key,
+            track_cache->records,
+            track_cache->record_cnt,
+            sizeof(mutil_track_cache_record_t),
+            mutil_track_cache_cb_compare_records);
+    if (record == NULL ||
+        record->size != key.size ||
+        record->mtime_sec != key.mtime_sec ||
+        record->mtime_nsec != key.mtime_nsec ||
+        record->audio_type > mutil_audio_type_flac) {
+        goto cleanup;
+    }
+
+    if (record->tag_text_offset > track_cache->tag_text_sz ||
+        record->tag_text_sz >
+            track_cache->tag_text_sz - record->tag_text_offset) {
+        goto cleanup;
+    }
+
+    /* Tags are created straight from the mapped text. */
+
+    new_track = mutil_track_alloc(audio_filename, record->audio_type);
+
+    memset(&stream_info, 0, sizeof(stream_info));
+    stream_info.sample_rate = record->sample_rate;
+    stream_info.channels = record->channels;
+    stream_info.bits_per_sample = record->bits_per_sample;
+    stream_info.total_samples = record->total_samples;
+    memcpy(stream_info.md5, record->md5, sizeof(stream_info.md5));
+    stream_info.file_sz = record->size;
+    mutil_track_set_stream_info(new_track, &stream_info);
+
+    text_pos = &track_cache->tag_text[record->tag_text_offset];
+    text_end = text_pos + record->tag_text_sz;
+    for (tag_i = 0; tag_i < record->tag_cnt; tag_i++) {
+
+        tag_end = memchr(text_pos, '\0', text_end - text_pos);
+        if (tag_end == NULL) {
+            mutil_track_free(new_track);
+            new_track = NULL;
+            goto cleanup;
+        }
+
+        g_assert(new_tag == NULL);
+        new_tag = mutil_tag_create_from_simple_assignment(
+                text_pos,
+                tag_end - text_pos,
+                '=',
+                NULL);
+        if (new_tag != NULL) {
+            mutil_track_add_tag(new_track, new_tag);
+            mutil_tag_free(new_tag);
+            new_tag = NULL;
+        }
+
+        text_pos = tag_end + 1;
+    }
+
+    /* The record is kept on save. */
+    g_atomic_int_set(
+            &track_cache->record_used_flags[record - track_cache->records],
+            1);
+
+cleanup:
+
+    mutil_tag_free(new_tag);
+
+    return new_track;
+} /* mutil_track_cache_look_up */
+
+mutil_track_cache_t *mutil_track_cache_open(
+        gchar const *cache_filename,
+        GError **o_error)
+{
+    mutil_track_cache_t *new_track_cache = NULL;
+    gint fd = -1;
+    struct stat file_stat;
+    gint status;
+    gpointer map_data;
+    mutil_track_cache_header_t const *header;
+    guint64 records_sz;
+
+    g_assert(cache_filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    new_track_cache = g_malloc0(sizeof(mutil_track_cache_t));
+    new_track_cache->filename = g_strdup(cache_filename);
+    g_mutex_init(&new_track_cache->mutex);
+    new_track_cache->new_entries = g_ptr_array_new();
+
+    fd = open(cache_filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT) {
+        goto cleanup;
+    }
+
+    if (fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open track cache file '%s': %s",
+                cache_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    status = fstat(fd, &file_stat);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to stat track cache file '%s': %s",
+                cache_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* A cache file that's too small, or whose header doesn't match, is
+     * ignored. It'll be replaced on save. */
+    if (file_stat.st_size < sizeof(mutil_track_cache_header_t)) {
+        goto cleanup;
+    }
+
+    map_data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map_data == MAP_FAILED) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to map track cache file '%s': %s",
+                cache_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    new_track_cache->map_data = map_data;
+    new_track_cache->map_sz = file_stat.st_size;
+
+    header = map_data;
+    if (memcmp(header->magic, mutil_track_cache_magic, 8) != 0 ||
+        header->version != mutil_track_cache_version ||
+        header->record_sz != sizeof(mutil_track_cache_record_t) ||
+        header->record_cnt > new_track_cache->map_sz / header->record_sz) {
+        goto cleanup;
+    }
+
+    records_sz = header->record_cnt * header->record_sz;
+    if (sizeof(mutil_track_cache_header_t) + records_sz +
+        header->tag_text_sz > new_track_cache->map_sz) {
+        goto cleanup;
+    }
+
+    new_track_cache->records = (gconstpointer) &header[1];
+    new_track_cache->record_cnt = header->record_cnt;
+    new_track_cache->tag_text = (gchar const *) &header[1] + records_sz;
+    new_track_cache->tag_text_sz = header->tag_text_sz;
+    new_track_cache->record_used_flags = g_new0(gint, header->record_cnt);
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    mutil_track_cache_free(new_track_cache);
+    new_track_cache = NULL;
+
+cleanup:
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    return new_track_cache;
+} /* mutil_track_cache_open */
+
+void mutil_track_cache_record_init(
+        mutil_track_cache_record_t *record,
+        struct stat const *file_stat)
+{
+    g_assert(record != NULL);
+    g_assert(file_stat != NULL);
+
+    memset(record, 0, sizeof(mutil_track_cache_record_t));
+    record->dev = file_stat->st_dev;
+    record->ino = file_stat->st_ino;
+    record->size = file_stat->st_size;
+    record->mtime_sec = file_stat->st_mtim.tv_sec;
+    record->mtime_nsec = file_stat->st_mtim.tv_nsec;
+
+    return;
+} /* mutil_track_cache_record_init */
+
+gint mutil_track_cache_save(
+        mutil_track_cache_t *track_cache,
+        GError **o_error)
+{
+    gint ret_value;
+    GPtrArray *entries = NULL;
+    mutil_track_cache_entry_t *entry_i;
+    mutil_track_cache_entry_t *prev_entry;
+    guint64 i;
+    gchar *dir_name = NULL;
+    gchar *tmp_filename = NULL;
+    gint fd = -1;
+    FILE *file = NULL;
+    mutil_track_cache_header_t header;
+    mutil_track_cache_record_t record;
+    guint64 tag_text_offset;
+    guint64 used_record_cnt = 0;
+    gint status;
+
+    g_assert(track_cache != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Records that this run didn't look up are dropped, so that the files
+     * that were deleted, renamed or edited since don't accumulate. A run
+     * that looked up and added nothing leaves the cache alone. */
+    for (i = 0; i < track_cache->record_cnt; i++) {
+        if (g_atomic_int_get(&track_cache->record_used_flags[i])) {
+            used_record_cnt++;
+        }
+    }
+    if (track_cache->new_entries->len == 0 &&
+        (used_record_cnt == 0 ||
+         used_record_cnt == track_cache->record_cnt)) {
+        ret_value = 0;
+        goto cleanup;
+    }
+
+    /* Merge the used old records with the new entries. A new entry replaces
+     * any old record for the same file. */
+
+    entries = g_ptr_array_new_with_free_func(g_free);
+
+    for (i = 0; i < track_cache->record_cnt; i++) {
+        if (!g_atomic_int_get(&track_cache->record_used_flags[i])) {
+            continue;
+        }
+        entry_i = g_malloc0(sizeof(mutil_track_cache_entry_t));
+        entry_i->record = track_cache->records[i];
+        entry_i->tag_text = NULL;
+        if (entry_i->record.tag_text_offset <= track_cache->tag_text_sz &&
+            entry_i->record.tag_text_sz <=
+                track_cache->tag_text_sz - entry_i->record.tag_text_offset) {
+            entry_i->tag_text =
+                &track_cache->tag_text[entry_i->record.tag_text_offset];
+            g_ptr_array_add(entries, entry_i);
+        } else {
+            g_free(entry_i);
+        }
+    }
+
+    /* The new entries' tag text is borrowed--the array frees only the entry
+     * copies. */
+    for (i = 0; i < track_cache->new_entries->len; i++) {
+        entry_i = g_malloc0(sizeof(mutil_track_cache_entry_t));
+        *entry_i = *(mutil_track_cache_entry_t *) g_ptr_array_index(
+                track_cache->new_entries,
+                i);
+        g_ptr_array_add(entries, entry_i);
+    }
+    g_ptr_array_sort(entries, mutil_track_cache_cb_compare_entries);
+
+    /* Write the merged cache to a temporary file in the same directory, then
+     * rename it over the old cache file. */
+
+    dir_name = g_path_get_dirname(track_cache->filename);
+    status = g_mkdir_with_parents(dir_name, 0755);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create directory '%s': %s",
+                dir_name,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    tmp_filename = g_strdup_printf("%s.XXXXXX", track_cache->filename);
+    fd = g_mkstemp(tmp_filename);
+    if (fd == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create temporary file '%s': %s",
+                tmp_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    file = fdopen(fd, "wb");
+    if (file == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open temporary file '%s': %s",
+                tmp_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+    fd = -1;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, mutil_track_cache_magic, 8);
+    header.version = mutil_track_cache_version;
+    header.record_sz = sizeof(mutil_track_cache_record_t);
+    for (i = 0, prev_entry = NULL; i < entries->len; i++) {
+        entry_i = g_ptr_array_index(entries, i);
+        if (prev_entry == NULL ||
+            mutil_track_cache_cb_compare_records(
+                &prev_entry->record,
+                &entry_i->record) != 0) {
+            header.record_cnt++;
+            header.tag_text_sz += entry_i->record.tag_text_sz;
+        }
+        prev_entry = entry_i;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+
+    tag_text_offset = 0;
+    for (i = 0, prev_entry = NULL; i < entries->len; i++) {
+        entry_i = g_ptr_array_index(entries, i);
+        if (prev_entry == NULL ||
+            mutil_track_cache_cb_compare_records(
+                &prev_entry->record,
+                &entry_i->record) != 0) {
+            record = entry_i->record;
+            record.tag_text_offset = tag_text_offset;
+            fwrite(&record, sizeof(record), 1, file);
+            tag_text_offset += record.tag_text_sz;
+        }
+        prev_entry = entry_i;
+    }
+
+    for (i = 0, prev_entry = NULL; i < entries->len; i++) {
+        entry_i = g_ptr_array_index(entries, i);
+        if (prev_entry == NULL ||
+            mutil_track_cache_cb_compare_records(
+                &prev_entry->record,
+                &entry_i->record) != 0) {
+            fwrite(entry_i->tag_text, 1, entry_i->record.tag_text_sz, file);
+        }
+        prev_entry = entry_i;
+    }
+
+    status = ferror(file) ? EOF : 0;
+    if (fclose(file) != 0) {
+        status = EOF;
+    }
+    file = NULL;
+    if (status != 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to write temporary file '%s': %s",
+                tmp_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    status = g_rename(tmp_filename, track_cache->filename);
+    if (status == -1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to rename '%s' to '%s': %s",
+                tmp_filename,
+                track_cache->filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+    g_free(tmp_filename);
+    tmp_filename = NULL;
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    if (fd != -1) {
+        close(fd);
+    }
+
+    if (tmp_filename != NULL) {
+        g_unlink(tmp_filename);
+    }
+
+    if (entries != NULL) {
+        g_ptr_array_free(entries, TRUE);
+    }
+    g_free(dir_name);
+    g_free(tmp_filename);
+
+    return ret_value;
+} /* mutil_track_cache_save */
@@ -0,0 +1,61 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_track_cache_h
+#define mutil_track_cache_h
+
+#include "mutil_common.h"
+#include "mutil_track.h"
+#include <sys/stat.h>
+
+/* The track cache remembers the audio type and tags of audio files between
+ * runs so that unchanged files needn't be opened again. Entries are keyed by
+ * the file's device, inode, size and modification time--if any of those
+ * change, the entry is ignored.
+ *
+ * The cache file is memory-mapped and looked up in place, so opening a large
+ * cache costs nothing until entries are actually used. Look-ups and inserts
+ * may be done concurrently from multiple threads. */
+
+struct mutil_track_cache;
+typedef struct mutil_track_cache mutil_track_cache_t;
+
+/* Returns the default cache filename, which is in the user's cache directory
+ * (e.g., $XDG_CACHE_HOME/mutil/track_cache). */
+gchar *mutil_track_cache_default_filename(void);
+
+void mutil_track_cache_free(
+        mutil_track_cache_t *track_cache);
+
+/* Records a track created from the file with the given status. */
+void mutil_track_cache_insert(
+        mutil_track_cache_t *track_cache,
+        struct stat const *file_stat,
+        mutil_track_t *track);
+
+/* Returns a new track for the file if the cache has an up-to-date entry for
+ * it, or else NULL. */
+mutil_track_t *mutil_track_cache_look_up(
+        mutil_track_cache_t *track_cache,
+        gchar const *audio_filename,
+        struct stat const *file_stat);
+
+/* Opens the cache file, if it exists. A missing cache file results in an empty
+ * cache.
+ *
+ * Returns: NULL on error.
+ */
+mutil_track_cache_t *mutil_track_cache_open(
+        gchar const *cache_filename,
+        GError **o_error);
+
+/* Writes the cache file if any entries were inserted or any records weren't
+ * looked up. Only the records looked up since the cache was opened are kept,
+ * along with the inserted entries, so records of files that are gone are
+ * pruned; a run that looked up and inserted nothing leaves the file alone. The
+ * file is replaced atomically. */
+gint mutil_track_cache_save(
+        mutil_track_cache_t *track_cache,
+        GError **o_error);
+
+#endif /* #ifndef mutil_track_cache_h */
@@ -0,0 +1,2162 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#include "mutil_output_file.h"
+#include "mutil_pcm.h"
+#include "mutil_replay_gain.h"
+#include "mutil_transcode.h"
+#include <FLAC/all.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <vorbis/vorbisenc.h>
+
+/* Seek point spacing of the 'flac' command's defaults. */
+#define mutil_flac_seek_point_interval_sec 10
+
+/* Choosing a compression level trial-encodes a window from the middle of up to
+ * three tracks. */
+#define mutil_flac_trial_window_cnt 3
+#define mutil_flac_trial_window_sec 5
+
+/* A FLAC target made from uncompressed audio is preallocated as if it
+ * compressed to this fraction of its size, which is typical of CD audio. */
+#define mutil_flac_expected_ratio 0.6
+
+/* libFLAC 1.5 can encode frames on several threads. */
+#if FLAC_API_VERSION_CURRENT >= 14
+#define mutil_flac_have_threads
+#endif
+
+/* Ogg files are retagged by reading them in blocks of this size. */
+#define mutil_ogg_read_block_sz 65536
+
+/* Byte offset of the little-endian page sequence number in an Ogg page
+ * header. */
+#define mutil_ogg_page_no_offset 18
+
+/* Room preallocated for the headers of an Ogg target, beyond its audio. */
+#define mutil_ogg_header_sz_estimate 8192
+
+/* Vorbis comment field names of the ReplayGain tags. */
+#define mutil_flac_replay_gain_prefix "REPLAYGAIN_"
+
+struct mutil_flac_encode;
+typedef struct mutil_flac_encode mutil_flac_encode_t;
+
+struct mutil_flac_trial;
+typedef struct mutil_flac_trial mutil_flac_trial_t;
+
+struct mutil_ogg_encode;
+typedef struct mutil_ogg_encode mutil_ogg_encode_t;
+
+struct mutil_transcode_output;
+typedef struct mutil_transcode_output mutil_transcode_output_t;
+
+struct mutil_transcode_pass;
+typedef struct mutil_transcode_pass mutil_transcode_pass_t;
+
+struct mutil_flac_encode {
+    mutil_track_t *track;
+    gchar const *tgt_filename;
+    mutil_output_file_t *tgt_file;
+    GError *file_error;
+    guint level;
+    guint thread_cnt;
+    FLAC__StreamEncoder *encoder;
+    FLAC__StreamMetadata *metadata[3];
+    guint metadata_cnt;
+    gboolean opt_flag_analyze;
+    mutil_loudness_t *loudness;
+};
+
+/* The samples of a trial window, one array per channel. */
+struct mutil_flac_trial {
+    mutil_stream_info_t stream_info;
+    GArray *samples[FLAC__MAX_CHANNELS];
+};
+
+/* The Vorbis info and comment are set up before decoding starts; the rest is
+ * set up by mutil_ogg_encode_cb_start(), which sets is_started. */
+struct mutil_ogg_encode {
+    mutil_track_t *track;
+    gchar const *tgt_filename;
+    guint bitrate;
+    mutil_output_file_t *tgt_file;
+    gdouble scale;
+    gboolean is_started;
+    vorbis_info info;
+    vorbis_comment comment;
+    vorbis_dsp_state dsp;
+    vorbis_block block;
+    ogg_stream_state stream;
+};
+
+/* The encoder of a target, with its track's range relative to the first sample
+ * the pass reads. It's started when the pass reaches the track and finished
+ * when the pass leaves it, so only the encoders of overlapping tracks are open
+ * at once. */
+struct mutil_transcode_output {
+    mutil_transcode_target_t *target;
+    guint64 first_sample;
+    guint64 sample_cnt;
+    gboolean is_started;
+    gboolean is_finished;
+    mutil_flac_encode_t flac_encode;
+    mutil_ogg_encode_t ogg_encode;
+};
+
+/* A single pass over an audio file, which feeds the decoded samples to the
+ * encoders of all the targets made from it. */
+struct mutil_transcode_pass {
+    mutil_transcode_output_t *outputs;
+    guint output_cnt;
+    guint thread_cnt;
+    mutil_stream_info_t stream_info;
+    guint64 sample_pos;
+};
+
+static FLAC__StreamEncoderSeekStatus mutil_flac_encode_cb_file_seek(
+        FLAC__StreamEncoder const *encoder,
+        FLAC__uint64 absolute_byte_offset,
+        void *client_data);
+
+static FLAC__StreamEncoderTellStatus mutil_flac_encode_cb_file_tell(
+        FLAC__StreamEncoder const *encoder,
+        FLAC__uint64 *absolute_byte_offset,
+        void *client_data);
+
+static FLAC__StreamEncoderWriteStatus mutil_flac_encode_cb_file_write(
+        FLAC__StreamEncoder const *encoder,
+        FLAC__byte const buffer[],
+        size_t byte_cnt,
+        uint32_t sample_cnt,
+        uint32_t current_frame,
+        void *client_data);
+
+static gint mutil_flac_encode_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error);
+
+static gint mutil_flac_encode_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error);
+
+static FLAC__StreamMetadata *mutil_flac_create_vorbis_comment(
+        mutil_track_t *track);
+
+static gint mutil_flac_trial_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error);
+
+static gint mutil_flac_trial_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error);
+
+static FLAC__StreamEncoderWriteStatus mutil_flac_trial_cb_count(
+        FLAC__StreamEncoder const *encoder,
+        FLAC__byte const buffer[],
+        size_t byte_cnt,
+        uint32_t sample_cnt,
+        uint32_t current_frame,
+        void *client_data);
+
+static gint mutil_flac_trial_encode(
+        mutil_flac_trial_t *trial,
+        guint level,
+        guint64 *o_byte_cnt,
+        gdouble *o_cpu_sec,
+        GError **o_error);
+
+static gdouble mutil_get_thread_cpu_sec(void);
+
+static gint mutil_ogg_encode_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error);
+
+static gint mutil_ogg_encode_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error);
+
+static gint mutil_ogg_encode_flush(
+        mutil_ogg_encode_t *ogg_encode,
+        GError **o_error);
+
+static gint mutil_ogg_read_page(
+        ogg_sync_state *sync,
+        FILE *file,
+        gchar const *filename,
+        ogg_page *o_page,
+        GError **o_error);
+
+static gint mutil_ogg_write_page(
+        mutil_output_file_t *file,
+        ogg_page const *page,
+        GError **o_error);
+
+static gint mutil_transcode_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error);
+
+static gint mutil_transcode_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error);
+
+static void mutil_transcode_output_clear(
+        mutil_transcode_output_t *output);
+
+static guint64 mutil_transcode_output_estimate_sz(
+        mutil_transcode_output_t const *output,
+        mutil_stream_info_t const *stream_info);
+
+static gint mutil_transcode_output_finish(
+        mutil_transcode_output_t *output,
+        GError **o_error);
+
+static gint mutil_transcode_output_start(
+        mutil_transcode_pass_t *pass,
+        mutil_transcode_output_t *output,
+        GError **o_error);
+
+FLAC__StreamEncoderSeekStatus mutil_flac_encode_cb_file_seek(
+        FLAC__StreamEncoder const *encoder,
+        FLAC__uint64 absolute_byte_offset,
+        void *client_data)
+{
+    mutil_flac_encode_t *flac_encode = client_data;
+    gint status;
+
+    g_assert(flac_encode != NULL);
+
+    if (flac_encode->file_error != NULL) {
+        return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+    }
+
+    status = mutil_output_file_seek(
+            flac_encode->tgt_file,
+            absolute_byte_offset,
+            &flac_encode->file_error);
+    if (status == -1) {
+        return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+    }
+
+    return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
+} /* mutil_flac_encode_cb_file_seek */
+
+FLAC__StreamEncoderTellStatus mutil_flac_encode_cb_file_tell(
+        FLAC__StreamEncoder const *encoder,
+        FLAC__uint64 *absolute_byte_offset,
+        void *client_data)
+{
+    mutil_flac_encode_t *flac_encode = client_data;
+
+    g_assert(flac_encode != NULL);
+
+    *absolute_byte_offset = mutil_output_file_tell(flac_encode->tgt_file);
+
+    return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
+} /* mutil_flac_encode_cb_file_tell */
+
+/* A write error is kept in file_error, as libFLAC only reports that the
+ * encoder failed. */
+FLAC__StreamEncoderWriteStatus mutil_flac_encode_cb_file_write(
+        FLAC__StreamEncoder const *encoder,
+        FLAC__byte const buffer[],
+        size_t byte_cnt,
+        uint32_t sample_cnt,
+        uint32_t current_frame,
+        void *client_data)
+{
+    mutil_flac_encode_t *flac_encode = client_data;
+    gint status;
+
+    g_assert(flac_encode != NULL);
+
+    if (flac_encode->file_error != NULL) {
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    }
+
+    status = mutil_output_file_write(
+            flac_encode->tgt_file,
+            buffer,
+            byte_cnt,
+            &flac_encode->file_error);
+    if (status == -1) {
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    }
+
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+} /* mutil_flac_encode_cb_file_write */
+
+gint mutil_flac_encode_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    mutil_flac_encode_t *flac_encode = user_data;
+    FLAC__StreamMetadata *new_block;
+    FLAC__StreamEncoderInitStatus init_status;
+
+    g_assert(stream_info != NULL);
+    g_assert(flac_encode != NULL);
+    g_assert(flac_encode->encoder != NULL);
+    g_assert(flac_encode->tgt_file != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    FLAC__stream_encoder_set_channels(
+            flac_encode->encoder,
+            stream_info->channels);
+    FLAC__stream_encoder_set_bits_per_sample(
+            flac_encode->encoder,
+            stream_info->bits_per_sample);
+    FLAC__stream_encoder_set_sample_rate(
+            flac_encode->encoder,
+            stream_info->sample_rate);
+    FLAC__stream_encoder_set_compression_level(
+            flac_encode->encoder,
+            flac_encode->level);
+    FLAC__stream_encoder_set_total_samples_estimate(
+            flac_encode->encoder,
+            stream_info->total_samples);
+
+#ifdef mutil_flac_have_threads
+    /* A libFLAC built without threads, or one limited to fewer, rejects the
+     * count and encodes on the calling thread, which is fine. */
+    if (flac_encode->thread_cnt > 1) {
+        FLAC__stream_encoder_set_num_threads(
+                flac_encode->encoder,
+                flac_encode->thread_cnt);
+    }
+#endif
+
+    /* metadata: the seek table is filled in by the encoder when it finishes,
+     * and the padding leaves room to add tags later without rewriting the
+     * file. */
+
+    g_assert(flac_encode->metadata_cnt == 0);
+    g_assert(flac_encode->loudness == NULL);
+
+    new_block = mutil_flac_create_vorbis_comment(flac_encode->track);
+    flac_encode->metadata[flac_encode->metadata_cnt++] = new_block;
+
+    if (stream_info->total_samples > 0) {
+        new_block = FLAC__metadata_object_new(FLAC__METADATA_TYPE_SEEKTABLE);
+        flac_encode->metadata[flac_encode->metadata_cnt++] = new_block;
+        FLAC__metadata_object_seektable_template_append_spaced_points_by_samples(
+                new_block,
+                mutil_flac_seek_point_interval_sec * stream_info->sample_rate,
+                stream_info->total_samples);
+        FLAC__metadata_object_seektable_template_sort(new_block, TRUE);
+    }
+
+    new_block = FLAC__metadata_object_new(FLAC__METADATA_TYPE_PADDING);
+    new_block->length = mutil_flac_padding_sz;
+    flac_encode->metadata[flac_encode->metadata_cnt++] = new_block;
+
+    FLAC__stream_encoder_set_metadata(
+            flac_encode->encoder,
+            flac_encode->metadata,
+            flac_encode->metadata_cnt);
+
+    /* The file is written through the callbacks, so that it goes through the
+     * output file's buffer. */
+    init_status = FLAC__stream_encoder_init_stream(
+            flac_encode->encoder,
+            mutil_flac_encode_cb_file_write,
+            mutil_flac_encode_cb_file_seek,
+            mutil_flac_encode_cb_file_tell,
+            NULL,
+            flac_encode);
+    if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create FLAC file '%s': %s",
+                flac_encode->tgt_filename,
+                FLAC__StreamEncoderInitStatusString[init_status]);
+        goto error_handling;
+    }
+
+    if (flac_encode->opt_flag_analyze) {
+        flac_encode->loudness = mutil_loudness_alloc(stream_info);
+        if (flac_encode->loudness == NULL) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "can't measure loudness of '%s'",
+                    mutil_track_get_filename(flac_encode->track));
+            goto error_handling;
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_flac_encode_cb_start */
+
+gint mutil_flac_encode_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    mutil_flac_encode_t *flac_encode = user_data;
+    FLAC__bool flac_status;
+
+    g_assert(channel_buffers != NULL);
+    g_assert(flac_encode != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    flac_status = FLAC__stream_encoder_process(
+            flac_encode->encoder,
+            (FLAC__int32 const * const *) channel_buffers,
+            sample_cnt);
+    if (!flac_status && flac_encode->file_error != NULL) {
+        g_propagate_error(o_error, flac_encode->file_error);
+        flac_encode->file_error = NULL;
+        goto error_handling;
+    }
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to encode FLAC file '%s': %s",
+                flac_encode->tgt_filename,
+                FLAC__StreamEncoderStateString[
+                    FLAC__stream_encoder_get_state(flac_encode->encoder)]);
+        goto error_handling;
+    }
+
+    /* The samples are measured while they're still in cache. */
+    if (flac_encode->loudness != NULL) {
+        mutil_loudness_process(
+                flac_encode->loudness,
+                channel_buffers,
+                sample_cnt);
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_flac_encode_cb_write */
+
+FLAC__StreamMetadata *mutil_flac_create_vorbis_comment(
+        mutil_track_t *track)
+{
+    FLAC__StreamMetadata *new_block;
+    FLAC__StreamMetadata_VorbisComment_Entry entry;
+    GList *tag_list;
+    GList *node_i;
+    mutil_tag_t *tag_i;
+    FLAC__bool flac_status;
+
+    g_assert(track != NULL);
+
+    new_block = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
+
+    tag_list = mutil_track_create_tag_list(track);
+
+    for (node_i = tag_list;
+         node_i != NULL;
+         node_i = node_i->next) {
+
+        tag_i = node_i->data;
+
+        /* Tags with names that aren't valid Vorbis comment field names are
+         * skipped, same as 'flac --tag' would refuse them. */
+        flac_status =
+            FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(
+                    &entry,
+                    mutil_tag_get_name(tag_i),
+                    mutil_tag_get_value(tag_i));
+        if (flac_status) {
+            FLAC__metadata_object_vorbiscomment_append_comment(
+                    new_block,
+                    entry,
+                    FALSE);
+        }
+    }
+
+    mutil_tag_free_list_of(tag_list);
+
+    return new_block;
+} /* mutil_flac_create_vorbis_comment */
+
+gint mutil_flac_trial_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    mutil_flac_trial_t *trial = user_data;
+    guint32 i;
+
+    g_assert(stream_info != NULL);
+    g_assert(trial != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    if (stream_info->channels == 0 ||
+        stream_info->channels > FLAC__MAX_CHANNELS) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "unsupported channel count %u",
+                (guint) stream_info->channels);
+        goto error_handling;
+    }
+
+    trial->stream_info = *stream_info;
+    for (i = 0; i < stream_info->channels; i++) {
+        trial->samples[i] = g_array_sized_new(
+                FALSE,
+                FALSE,
+                sizeof(gint32),
+                (guint) MIN(stream_info->total_samples, G_MAXUINT));
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_flac_trial_cb_start */
+
+gint mutil_flac_trial_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error)
+{
+    mutil_flac_trial_t *trial = user_data;
+    guint32 i;
+
+    g_assert(channel_buffers != NULL);
+    g_assert(trial != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    for (i = 0; i < trial->stream_info.channels; i++) {
+        g_array_append_vals(trial->samples[i], channel_buffers[i], sample_cnt);
+    }
+
+    return 0;
+} /* mutil_flac_trial_cb_write */
+
+FLAC__StreamEncoderWriteStatus mutil_flac_trial_cb_count(
+        FLAC__StreamEncoder const *encoder,
+        FLAC__byte const buffer[],
+        size_t byte_cnt,
+        uint32_t sample_cnt,
+        uint32_t current_frame,
+        void *client_data)
+{
+    guint64 *total_byte_cnt = client_data;
+
+    g_assert(total_byte_cnt != NULL);
+
+    *total_byte_cnt += byte_cnt;
+
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+} /* mutil_flac_trial_cb_count */
+
+gint mutil_flac_trial_encode(
+        mutil_flac_trial_t *trial,
+        guint level,
+        guint64 *o_byte_cnt,
+        gdouble *o_cpu_sec,
+        GError **o_error)
+{
+    gint ret_value;
+    FLAC__StreamEncoder *encoder = NULL;
+    FLAC__StreamEncoderInitStatus init_status;
+    FLAC__bool flac_status;
+    FLAC__int32 const *channel_buffers[FLAC__MAX_CHANNELS];
+    guint64 byte_cnt = 0;
+    gdouble start_sec;
+    guint32 i;
+
+    g_assert(trial != NULL);
+    g_assert(trial->samples[0] != NULL);
+    g_assert(o_byte_cnt != NULL);
+    g_assert(o_cpu_sec != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Only the size of the output is kept. */
+
+    start_sec = mutil_get_thread_cpu_sec();
+
+    encoder = FLAC__stream_encoder_new();
+    if (encoder == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to allocate FLAC encoder");
+        goto error_handling;
+    }
+
+    FLAC__stream_encoder_set_channels(encoder, trial->stream_info.channels);
+    FLAC__stream_encoder_set_bits_per_sample(
+            encoder,
+            trial->stream_info.bits_per_sample);
+    FLAC__stream_encoder_set_sample_rate(
+            encoder,
+            trial->stream_info.sample_rate);
+    FLAC__stream_encoder_set_compression_level(encoder, level);
+    FLAC__stream_encoder_set_total_samples_estimate(
+            encoder,
+            trial->samples[0]->len);
+
+    init_status = FLAC__stream_encoder_init_stream(
+            encoder,
+            mutil_flac_trial_cb_count,
+            NULL,
+            NULL,
+            NULL,
+            &byte_cnt);
+    if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to set up FLAC encoder: %s",
+                FLAC__StreamEncoderInitStatusString[init_status]);
+        goto error_handling;
+    }
+
+    for (i = 0; i < trial->stream_info.channels; i++) {
+        channel_buffers[i] = (FLAC__int32 const *) trial->samples[i]->data;
+    }
+
+    flac_status = FLAC__stream_encoder_process(
+            encoder,
+            channel_buffers,
+            trial->samples[0]->len);
+    if (flac_status) {
+        flac_status = FLAC__stream_encoder_finish(encoder);
+    }
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to encode FLAC: %s",
+                FLAC__StreamEncoderStateString[
+                    FLAC__stream_encoder_get_state(encoder)]);
+        goto error_handling;
+    }
+
+    *o_byte_cnt = byte_cnt;
+    *o_cpu_sec = mutil_get_thread_cpu_sec() - start_sec;
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (encoder != NULL) {
+        FLAC__stream_encoder_delete(encoder);
+    }
+
+    return ret_value;
+} /* mutil_flac_trial_encode */
+
+gdouble mutil_get_thread_cpu_sec(void)
+{
+    struct timespec now;
+
+    /* CPU time rather than wall time, so that trials running next to other
+     * jobs are still comparable. */
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+} /* mutil_get_thread_cpu_sec */
+
+gint mutil_ogg_encode_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_ogg_encode_t *ogg_encode = user_data;
+    ogg_packet header_packets[3];
+    ogg_page page;
+    guint i;
+
+    g_assert(stream_info != NULL);
+    g_assert(ogg_encode != NULL);
+    g_assert(!ogg_encode->is_started);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* 'oggenc --bitrate': an average bitrate, without the hard limits of
+     * '--managed'. */
+    status = vorbis_encode_setup_managed(
+            &ogg_encode->info,
+            stream_info->channels,
+            stream_info->sample_rate,
+            -1,
+            (glong) ogg_encode->bitrate * 1000,
+            -1);
+    if (status == 0) {
+        status = vorbis_encode_ctl(
+                &ogg_encode->info,
+                OV_ECTL_RATEMANAGE2_SET,
+                NULL);
+    }
+    if (status == 0) {
+        status = vorbis_encode_setup_init(&ogg_encode->info);
+    }
+    if (status != 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "can't encode %u channels at %u Hz to Ogg Vorbis at %u "
+                "kbit/s",
+                stream_info->channels,
+                stream_info->sample_rate,
+                ogg_encode->bitrate);
+        goto error_handling;
+    }
+
+    vorbis_analysis_init(&ogg_encode->dsp, &ogg_encode->info);
+    vorbis_block_init(&ogg_encode->dsp, &ogg_encode->block);
+    ogg_stream_init(&ogg_encode->stream, (gint) g_random_int());
+    ogg_encode->is_started = TRUE;
+
+    ogg_encode->scale = ldexp(1.0, 1 - (gint) stream_info->bits_per_sample);
+
+    /* The three header packets go on pages of their own, so that the audio
+     * starts on a fresh page. */
+
+    vorbis_analysis_headerout(
+            &ogg_encode->dsp,
+            &ogg_encode->comment,
+            &header_packets[0],
+            &header_packets[1],
+            &header_packets[2]);
+    for (i = 0; i < G_N_ELEMENTS(header_packets); i++) {
+        ogg_stream_packetin(&ogg_encode->stream, &header_packets[i]);
+    }
+
+    while (ogg_stream_flush(&ogg_encode->stream, &page) != 0) {
+        status = mutil_ogg_write_page(ogg_encode->tgt_file, &page, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_ogg_encode_cb_start */
+
+gint mutil_ogg_encode_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_ogg_encode_t *ogg_encode = user_data;
+    gfloat **analysis_buffers;
+    gfloat *analysis_buffer_i;
+    gint32 const *channel_buffer_i;
+    gfloat scale;
+    gint i;
+    guint32 j;
+
+    g_assert(channel_buffers != NULL);
+    g_assert(ogg_encode != NULL);
+    g_assert(ogg_encode->is_started);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* The encoder takes floating point samples in [-1, 1). */
+
+    scale = ogg_encode->scale;
+    analysis_buffers = vorbis_analysis_buffer(&ogg_encode->dsp, sample_cnt);
+    for (i = 0; i < ogg_encode->info.channels; i++) {
+        analysis_buffer_i = analysis_buffers[i];
+        channel_buffer_i = channel_buffers[i];
+        for (j = 0; j < sample_cnt; j++) {
+            analysis_buffer_i[j] = channel_buffer_i[j] * scale;
+        }
+    }
+    vorbis_analysis_wrote(&ogg_encode->dsp, sample_cnt);
+
+    status = mutil_ogg_encode_flush(ogg_encode, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_ogg_encode_cb_write */
+
+gint mutil_ogg_encode_flush(
+        mutil_ogg_encode_t *ogg_encode,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    ogg_packet packet;
+    ogg_page page;
+
+    g_assert(ogg_encode != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Write out every page that the samples given so far complete. */
+
+    while (vorbis_analysis_blockout(
+                &ogg_encode->dsp,
+                &ogg_encode->block) == 1) {
+        vorbis_analysis(&ogg_encode->block, NULL);
+        vorbis_bitrate_addblock(&ogg_encode->block);
+
+        while (vorbis_bitrate_flushpacket(&ogg_encode->dsp, &packet) == 1) {
+            ogg_stream_packetin(&ogg_encode->stream, &packet);
+
+            while (ogg_stream_pageout(&ogg_encode->stream, &page) != 0) {
+                status = mutil_ogg_write_page(
+                        ogg_encode->tgt_file,
+                        &page,
+                        o_error);
+                if (status == -1) {
+                    goto error_handling;
+                }
+            }
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_ogg_encode_flush */
+
+gint mutil_ogg_read_page(
+        ogg_sync_state *sync,
+        FILE *file,
+        gchar const *filename,
+        ogg_page *o_page,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    gchar *buffer;
+    gsize read_cnt;
+
+    g_assert(sync != NULL);
+    g_assert(file != NULL);
+    g_assert(filename != NULL);
+    g_assert(o_page != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Returns 1 with the next page, or 0 at the end of the file. */
+
+    while ((status = ogg_sync_pageout(sync, o_page)) != 1) {
+        if (status == -1) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "corrupt Ogg page in '%s'",
+                    filename);
+            goto error_handling;
+        }
+
+        buffer = ogg_sync_buffer(sync, mutil_ogg_read_block_sz);
+        read_cnt = fread(buffer, 1, mutil_ogg_read_block_sz, file);
+        if (read_cnt == 0 && ferror(file)) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "failed to read file '%s': %s",
+                    filename,
+                    g_strerror(errno));
+            goto error_handling;
+        }
+        if (read_cnt == 0) {
+            ret_value = 0;
+            goto cleanup;
+        }
+        ogg_sync_wrote(sync, read_cnt);
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 1;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_ogg_read_page */
+
+gint mutil_ogg_write_page(
+        mutil_output_file_t *file,
+        ogg_page const *page,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+
+    g_assert(file != NULL);
+    g_assert(page != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    status = mutil_output_file_write(
+            file,
+            page->header,
+            page->header_len,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+    status = mutil_output_file_write(
+            file,
+            page->body,
+            page->body_len,
+            o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_ogg_write_page */
+
+gint mutil_transcode_cb_start(
+        mutil_stream_info_t const *stream_info,
+        gpointer user_data,
+        GError **o_error)
+{
+    mutil_transcode_pass_t *pass = user_data;
+
+    g_assert(stream_info != NULL);
+    g_assert(pass != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    /* Encoders are started as the pass reaches their tracks. */
+    pass->stream_info = *stream_info;
+    pass->sample_pos = 0;
+
+    return 0;
+} /* mutil_transcode_cb_start */
+
+gint mutil_transcode_cb_write(
+        gint32 const * const *channel_buffers,
+        guint32 sample_cnt,
+        gpointer user_data,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status = -1;
+    mutil_transcode_pass_t *pass = user_data;
+    mutil_transcode_output_t *output_i;
+    gint32 const *output_buffers[FLAC__MAX_CHANNELS];
+    guint64 start_pos;
+    guint64 end_pos;
+    guint64 output_start_pos;
+    guint64 output_end_pos;
+    guint i;
+    guint j;
+
+    g_assert(channel_buffers != NULL);
+    g_assert(pass != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    start_pos = pass->sample_pos;
+    end_pos = start_pos + sample_cnt;
+
+    for (i = 0; i < pass->output_cnt; i++) {
+
+        output_i = &pass->outputs[i];
+        if (output_i->is_finished || output_i->first_sample >= end_pos) {
+            continue;
+        }
+
+        if (!output_i->is_started) {
+            status = mutil_transcode_output_start(pass, output_i, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+        }
+
+        /* Each encoder is given the part of the block within its track. */
+        output_start_pos = MAX(start_pos, output_i->first_sample);
+        output_end_pos = output_i->sample_cnt == G_MAXUINT64 ? end_pos :
+            MIN(end_pos, output_i->first_sample + output_i->sample_cnt);
+
+        if (output_start_pos < output_end_pos) {
+            for (j = 0; j < pass->stream_info.channels; j++) {
+                output_buffers[j] =
+                    channel_buffers[j] + (output_start_pos - start_pos);
+            }
+
+            switch (output_i->target->format) {
+                case mutil_transcode_format_flac:
+                    status = mutil_flac_encode_cb_write(
+                            output_buffers,
+                            output_end_pos - output_start_pos,
+                            &output_i->flac_encode,
+                            o_error);
+                    break;
+                case mutil_transcode_format_ogg:
+                    status = mutil_ogg_encode_cb_write(
+                            output_buffers,
+                            output_end_pos - output_start_pos,
+                            &output_i->ogg_encode,
+                            o_error);
+                    break;
+            }
+            if (status == -1) {
+                goto error_handling;
+            }
+        }
+
+        /* An encoder is finished as soon as its track ends, which frees its
+         * buffers for the next. */
+        if (output_i->sample_cnt != G_MAXUINT64 &&
+            output_i->first_sample + output_i->sample_cnt <= end_pos) {
+            status = mutil_transcode_output_finish(output_i, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+        }
+    }
+
+    pass->sample_pos = end_pos;
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_transcode_cb_write */
+
+gint mutil_transcode_choose_flac_level(
+        GList *track_list,
+        gdouble tolerance,
+        mutil_flac_level_choice_t *o_choice,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    guint64 byte_cnts[mutil_flac_level_best + 1];
+    gdouble cpu_secs[mutil_flac_level_best + 1];
+    guint64 byte_cnt;
+    gdouble cpu_sec;
+    guint64 min_byte_cnt;
+    mutil_flac_trial_t trial;
+    guint track_cnt;
+    guint window_cnt;
+    mutil_track_t *track_i;
+    mutil_stream_info_t const *stream_info;
+    guint64 window_sz;
+    guint64 first_sample;
+    guint level;
+    guint i;
+    guint j;
+
+    g_assert(tolerance >= 0.0);
+    g_assert(o_choice != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    memset(&trial, 0, sizeof(trial));
+    memset(byte_cnts, 0, sizeof(byte_cnts));
+    memset(cpu_secs, 0, sizeof(cpu_secs));
+
+    /* Encode windows of the first, middle and last tracks at every level. */
+
+    track_cnt = g_list_length(track_list);
+    window_cnt = MIN(track_cnt, mutil_flac_trial_window_cnt);
+
+    for (i = 0; i < window_cnt; i++) {
+
+        track_i = g_list_nth_data(
+                track_list,
+                window_cnt > 1 ? i * (track_cnt - 1) / (window_cnt - 1) : 0);
+        stream_info = mutil_track_get_stream_info(track_i);
+
+        /* Tracks with unknown properties are sampled from their start. */
+        window_sz = (guint64) mutil_flac_trial_window_sec *
+            (stream_info->sample_rate > 0 ? stream_info->sample_rate : 44100);
+        first_sample = mutil_track_get_sample_cnt(track_i) > window_sz ?
+            (mutil_track_get_sample_cnt(track_i) - window_sz) / 2 : 0;
+
+        status = mutil_pcm_read_track_range(
+                track_i,
+                first_sample,
+                window_sz,
+                mutil_flac_trial_cb_start,
+                mutil_flac_trial_cb_write,
+                &trial,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+
+        for (level = 0;
+             level <= mutil_flac_level_best && trial.samples[0]->len > 0;
+             level++) {
+            status = mutil_flac_trial_encode(
+                    &trial,
+                    level,
+                    &byte_cnt,
+                    &cpu_sec,
+                    o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+            byte_cnts[level] += byte_cnt;
+            cpu_secs[level] += cpu_sec;
+        }
+
+        for (j = 0; j < FLAC__MAX_CHANNELS; j++) {
+            if (trial.samples[j] != NULL) {
+                g_array_free(trial.samples[j], TRUE);
+                trial.samples[j] = NULL;
+            }
+        }
+    }
+
+    /* Pick the level that took the least time among those within tolerance
+     * of the smallest output. */
+
+    memset(o_choice, 0, sizeof(mutil_flac_level_choice_t));
+    o_choice->level = mutil_flac_level_best;
+
+    min_byte_cnt = byte_cnts[0];
+    for (level = 1; level <= mutil_flac_level_best; level++) {
+        min_byte_cnt = MIN(min_byte_cnt, byte_cnts[level]);
+    }
+    if (min_byte_cnt == 0) {
+        goto success;
+    }
+
+    for (level = 0; level <= mutil_flac_level_best; level++) {
+        if (byte_cnts[level] <= min_byte_cnt * (1.0 + tolerance) &&
+            cpu_secs[level] < cpu_secs[o_choice->level]) {
+            o_choice->level = level;
+        }
+    }
+
+    o_choice->size_increase =
+        (gdouble) byte_cnts[o_choice->level] / min_byte_cnt - 1.0;
+    if (cpu_secs[mutil_flac_level_best] > 0.0) {
+        o_choice->time_saving = 1.0 -
+            cpu_secs[o_choice->level] / cpu_secs[mutil_flac_level_best];
+    }
+
+success:
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    for (j = 0; j < FLAC__MAX_CHANNELS; j++) {
+        if (trial.samples[j] != NULL) {
+            g_array_free(trial.samples[j], TRUE);
+        }
+    }
+
+    return ret_value;
+} /* mutil_transcode_choose_flac_level */
+
+gchar *mutil_transcode_describe_ogg_settings(
+        guint ogg_bitrate)
+{
+    g_assert(ogg_bitrate > 0);
+
+    /* The library version covers changes to libvorbis's tuning. */
+    return g_strdup_printf(
+            "%s, %u bps average",
+            vorbis_version_string(),
+            ogg_bitrate * 1000);
+} /* mutil_transcode_describe_ogg_settings */
+
+void mutil_transcode_output_clear(
+        mutil_transcode_output_t *output)
+{
+    mutil_flac_encode_t *flac_encode;
+    mutil_ogg_encode_t *ogg_encode;
+    guint i;
+
+    g_assert(output != NULL);
+
+    if (!output->is_started) {
+        return;
+    }
+
+    switch (output->target->format) {
+
+        case mutil_transcode_format_flac:
+
+            flac_encode = &output->flac_encode;
+            mutil_loudness_free(flac_encode->loudness);
+            if (flac_encode->encoder != NULL) {
+                FLAC__stream_encoder_delete(flac_encode->encoder);
+            }
+            for (i = 0; i < flac_encode->metadata_cnt; i++) {
+                FLAC__metadata_object_delete(flac_encode->metadata[i]);
+            }
+            mutil_output_file_free(flac_encode->tgt_file);
+            g_clear_error(&flac_encode->file_error);
+            break;
+
+        case mutil_transcode_format_ogg:
+
+            ogg_encode = &output->ogg_encode;
+            mutil_output_file_free(ogg_encode->tgt_file);
+            if (ogg_encode->is_started) {
+                ogg_stream_clear(&ogg_encode->stream);
+                vorbis_block_clear(&ogg_encode->block);
+                vorbis_dsp_clear(&ogg_encode->dsp);
+            }
+            vorbis_comment_clear(&ogg_encode->comment);
+            vorbis_info_clear(&ogg_encode->info);
+            break;
+    }
+
+    memset(output, 0, sizeof(mutil_transcode_output_t));
+
+    return;
+} /* mutil_transcode_output_clear */
+
+/* Returns the size the output's file is expected to reach, to preallocate it,
+ * or 0 if there's no telling. */
+guint64 mutil_transcode_output_estimate_sz(
+        mutil_transcode_output_t const *output,
+        mutil_stream_info_t const *stream_info)
+{
+    mutil_track_t *track;
+    mutil_stream_info_t const *src_info;
+    guint64 pcm_sz;
+    gdouble duration;
+
+    g_assert(output != NULL);
+    g_assert(stream_info != NULL);
+
+    if (stream_info->total_samples == 0 || stream_info->sample_rate == 0) {
+        return 0;
+    }
+
+    track = output->target->track;
+    switch (output->target->format) {
+
+        case mutil_transcode_format_flac:
+
+            /* A FLAC file is re-encoded to about its share of the file. */
+            src_info = mutil_track_get_stream_info(track);
+            if (mutil_track_get_audio_type(track) == mutil_audio_type_flac &&
+                    src_info->file_sz > 0 &&
+                    src_info->total_samples > 0) {
+                return (gdouble) src_info->file_sz *
+                    stream_info->total_samples / src_info->total_samples;
+            }
+
+            pcm_sz = stream_info->total_samples * stream_info->channels *
+                ((stream_info->bits_per_sample + 7) / 8);
+            return pcm_sz * mutil_flac_expected_ratio + mutil_flac_padding_sz;
+
+        case mutil_transcode_format_ogg:
+
+            duration = (gdouble) stream_info->total_samples /
+                stream_info->sample_rate;
+            return output->target->ogg_bitrate * 1000.0 / 8.0 * duration +
+                mutil_ogg_header_sz_estimate;
+    }
+
+    return 0;
+} /* mutil_transcode_output_estimate_sz */
+
+gint mutil_transcode_output_finish(
+        mutil_transcode_output_t *output,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    FLAC__bool flac_status;
+    mutil_flac_encode_t *flac_encode;
+    mutil_ogg_encode_t *ogg_encode;
+
+    g_assert(output != NULL);
+    g_assert(output->is_started);
+    g_assert(!output->is_finished);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    output->is_finished = TRUE;
+
+    switch (output->target->format) {
+
+        case mutil_transcode_format_flac:
+
+            flac_encode = &output->flac_encode;
+            flac_status = FLAC__stream_encoder_finish(flac_encode->encoder);
+            if (!flac_status && flac_encode->file_error != NULL) {
+                g_propagate_error(o_error, flac_encode->file_error);
+                flac_encode->file_error = NULL;
+                goto error_handling;
+            }
+            if (!flac_status) {
+                g_set_error(
+                        o_error,
+                        mutil_error_domain,
+                        mutil_error_code_undefined,
+                        "failed to finish FLAC file '%s': %s",
+                        flac_encode->tgt_filename,
+                        FLAC__StreamEncoderStateString[
+                            FLAC__stream_encoder_get_state(
+                                flac_encode->encoder)]);
+                goto error_handling;
+            }
+
+            status = mutil_output_file_commit(flac_encode->tgt_file, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+
+            output->target->loudness = flac_encode->loudness;
+            flac_encode->loudness = NULL;
+            break;
+
+        case mutil_transcode_format_ogg:
+
+            /* An empty write marks the end of the stream. */
+            ogg_encode = &output->ogg_encode;
+            g_assert(ogg_encode->is_started);
+            vorbis_analysis_wrote(&ogg_encode->dsp, 0);
+            status = mutil_ogg_encode_flush(ogg_encode, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+
+            status = mutil_output_file_commit(ogg_encode->tgt_file, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+            break;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    return ret_value;
+} /* mutil_transcode_output_finish */
+
+gint mutil_transcode_output_start(
+        mutil_transcode_pass_t *pass,
+        mutil_transcode_output_t *output,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status = -1;
+    mutil_transcode_target_t *target;
+    mutil_flac_encode_t *flac_encode;
+    mutil_ogg_encode_t *ogg_encode;
+    mutil_stream_info_t stream_info;
+    GList *tag_list = NULL;
+    GList *node_i;
+    mutil_tag_t *tag_i;
+    guint64 total_samples;
+    guint64 expected_sz;
+
+    g_assert(pass != NULL);
+    g_assert(output != NULL);
+    g_assert(!output->is_started);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    target = output->target;
+    output->is_started = TRUE;
+
+    /* The encoder is given the length of its track where the file's is
+     * known. */
+    stream_info = pass->stream_info;
+    total_samples = stream_info.total_samples;
+    if (total_samples > 0) {
+        stream_info.total_samples = MIN(
+                total_samples - MIN(total_samples, output->first_sample),
+                output->sample_cnt);
+    }
+    expected_sz = mutil_transcode_output_estimate_sz(output, &stream_info);
+
+    switch (target->format) {
+
+        case mutil_transcode_format_flac:
+
+            flac_encode = &output->flac_encode;
+            flac_encode->track = target->track;
+            flac_encode->tgt_filename = target->tgt_filename;
+            flac_encode->level = target->flac_level;
+            flac_encode->thread_cnt = pass->thread_cnt;
+            flac_encode->opt_flag_analyze = target->opt_flag_measure_loudness;
+
+            flac_encode->encoder = FLAC__stream_encoder_new();
+            if (flac_encode->encoder == NULL) {
+                g_set_error(
+                        o_error,
+                        mutil_error_domain,
+                        mutil_error_code_undefined,
+                        "failed to allocate FLAC encoder");
+                goto error_handling;
+            }
+
+            flac_encode->tgt_file = mutil_output_file_open(
+                    target->tgt_filename,
+                    expected_sz,
+                    o_error);
+            if (flac_encode->tgt_file == NULL) {
+                goto error_handling;
+            }
+
+            status = mutil_flac_encode_cb_start(
+                    &stream_info,
+                    flac_encode,
+                    o_error);
+            break;
+
+        case mutil_transcode_format_ogg:
+
+            ogg_encode = &output->ogg_encode;
+            ogg_encode->track = target->track;
+            ogg_encode->tgt_filename = target->tgt_filename;
+            ogg_encode->bitrate = target->ogg_bitrate;
+            vorbis_info_init(&ogg_encode->info);
+            vorbis_comment_init(&ogg_encode->comment);
+
+            /* comments: same as 'oggenc --comment' for each tag. */
+
+            tag_list = mutil_track_create_tag_list(target->track);
+            for (node_i = tag_list;
+                 node_i != NULL;
+                 node_i = node_i->next) {
+
+                tag_i = node_i->data;
+                vorbis_comment_add_tag(
+                        &ogg_encode->comment,
+                        mutil_tag_get_name(tag_i),
+                        mutil_tag_get_value(tag_i));
+            }
+
+            ogg_encode->tgt_file = mutil_output_file_open(
+                    target->tgt_filename,
+                    expected_sz,
+                    o_error);
+            if (ogg_encode->tgt_file == NULL) {
+                goto error_handling;
+            }
+
+            status = mutil_ogg_encode_cb_start(
+                    &stream_info,
+                    ogg_encode,
+                    o_error);
+            break;
+    }
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    mutil_tag_free_list_of(tag_list);
+
+    return ret_value;
+} /* mutil_transcode_output_start */
+
+gint mutil_transcode_retag_flac(
+        mutil_track_t *track,
+        gchar const *filename,
+        gboolean opt_flag_keep_replay_gain,
+        GError **o_error)
+{
+    gint ret_value;
+    FLAC__Metadata_Chain *chain = NULL;
+    FLAC__Metadata_Iterator *iterator = NULL;
+    FLAC__StreamMetadata *block = NULL;
+    FLAC__StreamMetadata *new_block = NULL;
+    FLAC__StreamMetadata_VorbisComment_Entry *entry_i;
+    FLAC__bool flac_status;
+    guint i;
+
+    g_assert(track != NULL);
+    g_assert(filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    chain = FLAC__metadata_chain_new();
+    iterator = FLAC__metadata_iterator_new();
+    if (chain == NULL || iterator == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to allocate FLAC metadata chain");
+        goto error_handling;
+    }
+
+    flac_status = FLAC__metadata_chain_read(chain, filename);
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to read tags of '%s': %s",
+                filename,
+                FLAC__Metadata_ChainStatusString[
+                    FLAC__metadata_chain_status(chain)]);
+        goto error_handling;
+    }
+
+    new_block = mutil_flac_create_vorbis_comment(track);
+
+    /* Find the Vorbis comment block. Its ReplayGain tags still hold, since
+     * the audio is the same. */
+
+    FLAC__metadata_iterator_init(iterator, chain);
+    do {
+        if (FLAC__metadata_iterator_get_block_type(iterator) ==
+                FLAC__METADATA_TYPE_VORBIS_COMMENT) {
+            block = FLAC__metadata_iterator_get_block(iterator);
+        }
+    } while (block == NULL && FLAC__metadata_iterator_next(iterator));
+
+    if (block != NULL && opt_flag_keep_replay_gain) {
+        for (i = 0; i < block->data.vorbis_comment.num_comments; i++) {
+            entry_i = &block->data.vorbis_comment.comments[i];
+            if (g_ascii_strncasecmp(
+                        (gchar const *) entry_i->entry,
+                        mutil_flac_replay_gain_prefix,
+                        strlen(mutil_flac_replay_gain_prefix)) == 0) {
+                FLAC__metadata_object_vorbiscomment_append_comment(
+                        new_block,
+                        *entry_i,
+                        TRUE);
+            }
+        }
+    }
+
+    /* The new block replaces the old one, or goes after STREAMINFO. */
+    if (block != NULL) {
+        flac_status = FLAC__metadata_iterator_set_block(iterator, new_block);
+    } else {
+        FLAC__metadata_iterator_init(iterator, chain);
+        flac_status = FLAC__metadata_iterator_insert_block_after(
+                iterator,
+                new_block);
+    }
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to replace tags of '%s'",
+                filename);
+        goto error_handling;
+    }
+    new_block = NULL;
+
+    /* Padding is merged at the end, where it absorbs the change in size. If
+     * it's too small, the file is rewritten anyway, so it's topped up to
+     * leave room for the next retag. */
+
+    FLAC__metadata_chain_sort_padding(chain);
+    if (FLAC__metadata_chain_check_if_tempfile_needed(chain, TRUE)) {
+        FLAC__metadata_iterator_init(iterator, chain);
+        while (FLAC__metadata_iterator_next(iterator)) {
+        }
+        if (FLAC__metadata_iterator_get_block_type(iterator) ==
+                FLAC__METADATA_TYPE_PADDING) {
+            block = FLAC__metadata_iterator_get_block(iterator);
+            block->length = MAX(block->length, mutil_flac_padding_sz);
+        } else {
+            new_block = FLAC__metadata_object_new(
+                    FLAC__METADATA_TYPE_PADDING);
+            if (new_block == NULL ||
+                !FLAC__metadata_iterator_insert_block_after(
+                    iterator,
+                    new_block)) {
+                g_set_error(
+                        o_error,
+                        mutil_error_domain,
+                        mutil_error_code_undefined,
+                        "failed to add padding to '%s'",
+                        filename);
+                goto error_handling;
+            }
+            new_block->length = mutil_flac_padding_sz;
+            new_block = NULL;
+        }
+    }
+
+    flac_status = FLAC__metadata_chain_write(chain, TRUE, FALSE);
+    if (!flac_status) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to write tags of '%s': %s",
+                filename,
+                FLAC__Metadata_ChainStatusString[
+                    FLAC__metadata_chain_status(chain)]);
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (new_block != NULL) {
+        FLAC__metadata_object_delete(new_block);
+    }
+    if (iterator != NULL) {
+        FLAC__metadata_iterator_delete(iterator);
+    }
+    if (chain != NULL) {
+        FLAC__metadata_chain_delete(chain);
+    }
+
+    return ret_value;
+} /* mutil_transcode_retag_flac */
+
+gint mutil_transcode_retag_ogg(
+        mutil_track_t *track,
+        gchar const *src_filename,
+        gchar const *tgt_filename,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    FILE *src_file = NULL;
+    mutil_output_file_t *tgt_file = NULL;
+    struct stat src_stat;
+    guint64 expected_sz = 0;
+    ogg_sync_state sync;
+    ogg_stream_state src_stream;
+    ogg_stream_state tgt_stream;
+    gboolean is_src_stream_init = FALSE;
+    gboolean is_tgt_stream_init = FALSE;
+    vorbis_comment comment;
+    ogg_packet header_packets[3];
+    ogg_packet packet;
+    ogg_page page;
+    GList *tag_list = NULL;
+    GList *node_i;
+    mutil_tag_t *tag_i;
+    gint serial_no = 0;
+    glong src_header_page_cnt = 0;
+    glong tgt_header_page_cnt = 0;
+    glong header_body_sz = 0;
+    glong header_packet_sz = 0;
+    glong page_no;
+    guint packet_cnt = 0;
+    guint i;
+
+    g_assert(track != NULL);
+    g_assert(src_filename != NULL);
+    g_assert(tgt_filename != NULL);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    memset(header_packets, 0, sizeof(header_packets));
+    ogg_sync_init(&sync);
+    vorbis_comment_init(&comment);
+
+    src_file = g_fopen(src_filename, "rb");
+    if (src_file == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to open file '%s': %s",
+                src_filename,
+                g_strerror(errno));
+        goto error_handling;
+    }
+
+    /* The copy is about the size of the original. */
+    if (fstat(fileno(src_file), &src_stat) == 0) {
+        expected_sz = src_stat.st_size;
+    }
+
+    tgt_file = mutil_output_file_open(tgt_filename, expected_sz, o_error);
+    if (tgt_file == NULL) {
+        goto error_handling;
+    }
+
+    /* Read the three header packets. Only the comment header is replaced;
+     * the identification and setup headers are kept as they are. */
+
+    while (packet_cnt < G_N_ELEMENTS(header_packets)) {
+        status = mutil_ogg_read_page(
+                &sync,
+                src_file,
+                src_filename,
+                &page,
+                o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+        if (status == 0) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "'%s' isn't an Ogg Vorbis file",
+                    src_filename);
+            goto error_handling;
+        }
+
+        if (!is_src_stream_init) {
+            serial_no = ogg_page_serialno(&page);
+            ogg_stream_init(&src_stream, serial_no);
+            is_src_stream_init = TRUE;
+        }
+        if (ogg_page_serialno(&page) != serial_no ||
+            ogg_stream_pagein(&src_stream, &page) != 0) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "can't retag '%s': it has more than one stream",
+                    src_filename);
+            goto error_handling;
+        }
+        src_header_page_cnt++;
+        header_body_sz += page.body_len;
+
+        /* Packets point into the stream's buffer, which reading further pages
+         * may move. */
+        while (packet_cnt < G_N_ELEMENTS(header_packets) &&
+               ogg_stream_packetout(&src_stream, &packet) == 1) {
+            header_packets[packet_cnt] = packet;
+            header_packets[packet_cnt].packet =
+                g_memdup2(packet.packet, packet.bytes);
+            header_packet_sz += packet.bytes;
+            packet_cnt++;
+        }
+    }
+
+    if (vorbis_synthesis_idheader(&header_packets[0]) != 1) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "'%s' isn't an Ogg Vorbis file",
+                src_filename);
+        goto error_handling;
+    }
+
+    /* The audio pages are copied as they are, so the audio must start on a
+     * page of its own, as mutil_transcode_tracks() and 'oggenc' have
+     * it. */
+    if (header_body_sz != header_packet_sz) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "can't retag '%s': its audio starts on a header page",
+                src_filename);
+        goto error_handling;
+    }
+
+    /* comments: same as mutil_transcode_tracks(). */
+
+    tag_list = mutil_track_create_tag_list(track);
+    for (node_i = tag_list;
+         node_i != NULL;
+         node_i = node_i->next) {
+
+        tag_i = node_i->data;
+        vorbis_comment_add_tag(
+                &comment,
+                mutil_tag_get_name(tag_i),
+                mutil_tag_get_value(tag_i));
+    }
+
+    status = vorbis_commentheader_out(&comment, &packet);
+    if (status != 0) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "failed to create Vorbis comment for '%s'",
+                tgt_filename);
+        goto error_handling;
+    }
+    g_free(header_packets[1].packet);
+    header_packets[1] = packet;
+    header_packets[1].packet = g_memdup2(packet.packet, packet.bytes);
+    ogg_packet_clear(&packet);
+
+    /* The headers go on pages of their own, as when encoding. */
+
+    ogg_stream_init(&tgt_stream, serial_no);
+    is_tgt_stream_init = TRUE;
+    for (i = 0; i < G_N_ELEMENTS(header_packets); i++) {
+        ogg_stream_packetin(&tgt_stream, &header_packets[i]);
+    }
+    while (ogg_stream_flush(&tgt_stream, &page) != 0) {
+        status = mutil_ogg_write_page(tgt_file, &page, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+        tgt_header_page_cnt++;
+    }
+
+    /* Audio pages: only their sequence numbers, and so their checksums, change
+     * if the comment header now spans a different number of pages. */
+
+    while ((status = mutil_ogg_read_page(
+                    &sync,
+                    src_file,
+                    src_filename,
+                    &page,
+                    o_error)) == 1) {
+        if (ogg_page_serialno(&page) != serial_no) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "can't retag '%s': it has more than one stream",
+                    src_filename);
+            goto error_handling;
+        }
+
+        if (tgt_header_page_cnt != src_header_page_cnt) {
+            page_no = ogg_page_pageno(&page) +
+                tgt_header_page_cnt - src_header_page_cnt;
+            for (i = 0; i < 4; i++) {
+                page.header[mutil_ogg_page_no_offset + i] =
+                    (page_no >> (8 * i)) & 0xff;
+            }
+            ogg_page_checksum_set(&page);
+        }
+
+        status = mutil_ogg_write_page(tgt_file, &page, o_error);
+        if (status == -1) {
+            goto error_handling;
+        }
+    }
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    status = mutil_output_file_commit(tgt_file, o_error);
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    ret_value = -1;
+
+cleanup:
+
+    if (src_file != NULL) {
+        fclose(src_file);
+    }
+    mutil_output_file_free(tgt_file);
+    if (is_src_stream_init) {
+        ogg_stream_clear(&src_stream);
+    }
+    if (is_tgt_stream_init) {
+        ogg_stream_clear(&tgt_stream);
+    }
+    for (i = 0; i < G_N_ELEMENTS(header_packets); i++) {
+        g_free(header_packets[i].packet);
+    }
+    ogg_sync_clear(&sync);
+    vorbis_comment_clear(&comment);
+    mutil_tag_free_list_of(tag_list);
+
+    return ret_value;
+} /* mutil_transcode_retag_ogg */
+
+gint mutil_transcode_tracks(
+        mutil_transcode_target_t *targets,
+        guint target_cnt,
+        guint thread_cnt,
+        mutil_pcm_pool_t *pcm_pool,
+        GError **o_error)
+{
+    gint ret_value;
+    gint status;
+    mutil_transcode_pass_t pass;
+    mutil_transcode_output_t *output_i;
+    mutil_track_t *file_track = NULL;
+    gchar const *filename;
+    guint64 track_first_sample;
+    guint64 track_sample_cnt;
+    guint64 first_sample = G_MAXUINT64;
+    guint64 end_sample = 0;
+    guint i;
+
+    g_assert(targets != NULL);
+    g_assert(target_cnt > 0);
+    g_assert(thread_cnt > 0);
+    g_assert(o_error == NULL || *o_error == NULL);
+
+    memset(&pass, 0, sizeof(pass));
+    pass.outputs = g_new0(mutil_transcode_output_t, target_cnt);
+    pass.output_cnt = target_cnt;
+    pass.thread_cnt = thread_cnt;
+
+    /* The file is read from the first sample any target needs to the last. */
+
+    filename = mutil_track_get_filename(targets[0].track);
+    for (i = 0; i < target_cnt; i++) {
+        g_assert(targets[i].tgt_filename != NULL);
+        g_assert(targets[i].loudness == NULL);
+        g_assert(strcmp(
+                    mutil_track_get_filename(targets[i].track),
+                    filename) == 0);
+
+        mutil_track_get_range(
+                targets[i].track,
+                &track_first_sample,
+                &track_sample_cnt);
+        first_sample = MIN(first_sample, track_first_sample);
+        end_sample = MAX(
+                end_sample,
+                track_sample_cnt == G_MAXUINT64 ?
+                    G_MAXUINT64 : track_first_sample + track_sample_cnt);
+    }
+
+    for (i = 0; i < target_cnt; i++) {
+        output_i = &pass.outputs[i];
+        mutil_track_get_range(
+                targets[i].track,
+                &track_first_sample,
+                &track_sample_cnt);
+        output_i->target = &targets[i];
+        output_i->first_sample = track_first_sample - first_sample;
+        output_i->sample_cnt = track_sample_cnt;
+    }
+
+    /* A track of the whole file is read as such, so that a FLAC file's MD5 is
+     * checked. */
+
+    file_track = mutil_track_alloc(
+            filename,
+            mutil_track_get_audio_type(targets[0].track));
+
+    if (pcm_pool != NULL) {
+        status = mutil_pcm_pipe_read_track_range(
+                file_track,
+                first_sample,
+                end_sample == G_MAXUINT64 ?
+                    G_MAXUINT64 : end_sample - first_sample,
+                pcm_pool,
+                mutil_transcode_cb_start,
+                mutil_transcode_cb_write,
+                &pass,
+                o_error);
+    } else {
+        status = mutil_pcm_read_track_range(
+                file_track,
+                first_sample,
+                end_sample == G_MAXUINT64 ?
+                    G_MAXUINT64 : end_sample - first_sample,
+                mutil_transcode_cb_start,
+                mutil_transcode_cb_write,
+                &pass,
+                o_error);
+    }
+    if (status == -1) {
+        goto error_handling;
+    }
+
+    /* Outputs whose tracks end with the file, or lie past its end, are
+     * finished last. */
+    for (i = 0; i < pass.output_cnt; i++) {
+        output_i = &pass.outputs[i];
+        if (!output_i->is_started) {
+            status = mutil_transcode_output_start(&pass, output_i, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+        }
+        if (!output_i->is_finished) {
+            status = mutil_transcode_output_finish(output_i, o_error);
+            if (status == -1) {
+                goto error_handling;
+            }
+        }
+    }
+
+    g_assert(o_error == NULL || *o_error == NULL);
+    ret_value = 0;
+    goto cleanup;
+
+error_handling:
+
+    g_assert(o_error == NULL || *o_error != NULL);
+
+    for (i = 0; i < target_cnt; i++) {
+        mutil_loudness_free(targets[i].loudness);
+        targets[i].loudness = NULL;
+    }
+
+    ret_value = -1;
+
+cleanup:
+
+    for (i = 0; i < pass.output_cnt; i++) {
+        mutil_transcode_output_clear(&pass.outputs[i]);
+    }
+    g_free(pass.outputs);
+    mutil_track_free(file_track);
+
+    return ret_value;
+} /* mutil_transcode_tracks */
@@ -0,0 +1,95 @@
+/* vim: tabstop=4:shiftwidth=4:expandtab:tw=80
+ */
+
+#ifndef mutil_transcode_h
+#define mutil_transcode_h
+
+#include "mutil_common.h"
+#include "mutil_pcm_pipe.h"
+#include "mutil_replay_gain.h"
+#include "mutil_track.h"
+
+/* A FLAC compression level chosen by trial encoding, with its output size
+ * relative to the smallest level's and the encoding time it saves relative to
+ * mutil_flac_level_best, both as fractions. */
+typedef struct {
+    guint level;
+    gdouble size_increase;
+    gdouble time_saving;
+} mutil_flac_level_choice_t;
+
+typedef enum {
+    mutil_transcode_format_flac,
+    mutil_transcode_format_ogg
+} mutil_transcode_format_t;
+
+/* A file for mutil_transcode_tracks() to encode the track to. FLAC files are
+ * encoded at flac_level with the same settings and tags as
+ * mutil_track_format_archive_encode_command(), and if
+ * opt_flag_measure_loudness, the loudness of the track is measured on the way
+ * and returned in loudness. Ogg Vorbis files are encoded at an average of
+ * ogg_bitrate kbit/s with the same settings and comments as
+ * mutil_track_format_ogg_encode_command(). */
+typedef struct {
+    mutil_track_t *track;
+    gchar const *tgt_filename;
+    mutil_transcode_format_t format;
+    guint flac_level;
+    guint ogg_bitrate;
+    gboolean opt_flag_measure_loudness;
+    mutil_loudness_t *loudness;
+} mutil_transcode_target_t;
+
+/* Trial-encodes a few seconds of some of the tracks at each FLAC compression
+ * level and chooses the fastest level whose output is at most tolerance (a
+ * fraction) larger than the smallest. */
+gint mutil_transcode_choose_flac_level(
+        GList *track_list,
+        gdouble tolerance,
+        mutil_flac_level_choice_t *o_choice,
+        GError **o_error);
+
+/* Returns a description of the Ogg Vorbis encoder and its settings at the
+ * given bitrate in kbit/s, which differs whenever they would encode a track
+ * differently. */
+gchar *mutil_transcode_describe_ogg_settings(
+        guint ogg_bitrate);
+
+/* Replaces the tags of the FLAC file with the track's tags, keeping its
+ * ReplayGain tags if opt_flag_keep_replay_gain. The audio isn't touched. The
+ * metadata is rewritten in place when it fits in the file's padding; otherwise
+ * the audio frames are copied over to a new file as they are, with
+ * mutil_flac_padding_sz bytes of padding again for the next time. */
+gint mutil_transcode_retag_flac(
+        mutil_track_t *track,
+        gchar const *filename,
+        gboolean opt_flag_keep_replay_gain,
+        GError **o_error);
+
+/* Copies the Ogg Vorbis file src_filename to tgt_filename with its comment
+ * header replaced by the track's tags, as mutil_transcode_tracks() would
+ * have written them. The audio pages are copied as they are, renumbered if the
+ * comment header now spans a different number of pages. */
+gint mutil_transcode_retag_ogg(
+        mutil_track_t *track,
+        gchar const *src_filename,
+        gchar const *tgt_filename,
+        GError **o_error);
+
+/* Encodes the targets in-process in a single pass over the file of their
+ * tracks, which they must share: it's decoded once, from the first sample any
+ * of the tracks needs to the last, and each track's samples go to its target's
+ * encoder as they're decoded. Tracks may overlap, as when one track is encoded
+ * to several targets. FLAC frames are encoded on up to thread_cnt threads per
+ * encoder where libFLAC supports it. If pcm_pool isn't NULL, the file is
+ * decoded on a thread of its own through a pipe with blocks from it;
+ * otherwise the decoder's buffers are passed straight to the encoders. On
+ * error, the target files may be left incomplete. */
+gint mutil_transcode_tracks(
+        mutil_transcode_target_t *targets,
+        guint target_cnt,
+        guint thread_cnt,
+        mutil_pcm_pool_t *pcm_pool,
+        GError **o_error);
+
+#endif /* #ifndef mutil_transcode_h */
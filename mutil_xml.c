@@ -7,6 +7,8 @@
 #include <libxml/xmlsave.h>
 
 #define mutil_xml_attr_name_filename "filename"
+#define mutil_xml_attr_name_first_sample "first_sample"
+#define mutil_xml_attr_name_sample_cnt "sample_count"
 
 #define mutil_xml_tag_global "global"
 #define mutil_xml_tag_tag_list "tag_list"
@@ -130,6 +132,9 @@ xmlDoc *mutil_create_xml_doc_from_track_list(
     GList *tag_list = NULL;
     GList *node_j;
     mutil_tag_t *tag_j;
+    guint64 first_sample;
+    guint64 sample_cnt;
+    gchar *sample_text = NULL;
 
     g_assert(new_xml_doc == NULL);
     mutil_xmlstrdup(&tmp_xml_str_1, "1.0");
@@ -175,6 +180,24 @@ xmlDoc *mutil_create_xml_doc_from_track_list(
         track_node = xmlNewChild(track_list_node, NULL, tmp_xml_str_1, NULL);
         xmlNewProp(track_node, tmp_xml_str_2, tmp_xml_str_3);
 
+        /* A track cut from an image keeps its range. A range to the end of
+         * the image has no sample count. */
+        if (mutil_track_get_range(track_i, &first_sample, &sample_cnt)) {
+            g_free(sample_text);
+            sample_text = g_strdup_printf("%" G_GUINT64_FORMAT, first_sample);
+            mutil_xmlstrdup(&tmp_xml_str_2, mutil_xml_attr_name_first_sample);
+            mutil_xmlstrdup(&tmp_xml_str_3, sample_text);
+            xmlNewProp(track_node, tmp_xml_str_2, tmp_xml_str_3);
+        }
+        if (mutil_track_get_range(track_i, NULL, NULL) &&
+            sample_cnt != G_MAXUINT64) {
+            g_free(sample_text);
+            sample_text = g_strdup_printf("%" G_GUINT64_FORMAT, sample_cnt);
+            mutil_xmlstrdup(&tmp_xml_str_2, mutil_xml_attr_name_sample_cnt);
+            mutil_xmlstrdup(&tmp_xml_str_3, sample_text);
+            xmlNewProp(track_node, tmp_xml_str_2, tmp_xml_str_3);
+        }
+
         mutil_xmlstrdup(&tmp_xml_str_1, mutil_xml_tag_tag_list);
         tag_list_node = xmlNewChild(track_node, NULL, tmp_xml_str_1, NULL);
 
@@ -199,6 +222,7 @@ xmlDoc *mutil_create_xml_doc_from_track_list(
     mutil_xmlstrdup(&tmp_xml_str_2, NULL);
     mutil_xmlstrdup(&tmp_xml_str_3, NULL);
     mutil_tag_free_list_of(tag_list);
+    g_free(sample_text);
 
     g_assert(new_node == NULL);
     g_assert(new_xml_doc != NULL);
@@ -493,6 +517,13 @@ gint mutil_parse_xml_element_track(
     gint status;
     gchar const *track_filename = NULL;
     mutil_audio_type_t track_audio_type;
+    mutil_stream_info_t track_stream_info;
+    gchar const *first_sample_text = NULL;
+    gchar const *sample_cnt_text = NULL;
+    gchar const **attr_value_ptr;
+    guint64 first_sample = 0;
+    guint64 sample_cnt = G_MAXUINT64;
+    gchar *conv_ptr;
 
     g_assert(o_track != NULL);
     g_assert(*o_track == NULL);
@@ -506,8 +537,25 @@ gint mutil_parse_xml_element_track(
          attr_i != NULL;
          attr_i = attr_i->next) {
 
-        mutil_xmlstrdup(&tmp_xml_str_1, mutil_xml_attr_name_filename);
-        if (!xmlStrEqual(tmp_xml_str_1, attr_i->name)) {
+        if (xmlStrEqual(
+                    mutil_xmlstrdup(
+                        &tmp_xml_str_1,
+                        mutil_xml_attr_name_filename),
+                    attr_i->name)) {
+            attr_value_ptr = &track_filename;
+        } else if (xmlStrEqual(
+                    mutil_xmlstrdup(
+                        &tmp_xml_str_1,
+                        mutil_xml_attr_name_first_sample),
+                    attr_i->name)) {
+            attr_value_ptr = &first_sample_text;
+        } else if (xmlStrEqual(
+                    mutil_xmlstrdup(
+                        &tmp_xml_str_1,
+                        mutil_xml_attr_name_sample_cnt),
+                    attr_i->name)) {
+            attr_value_ptr = &sample_cnt_text;
+        } else {
             g_set_error(
                     o_error,
                     mutil_error_domain,
@@ -518,7 +566,7 @@ gint mutil_parse_xml_element_track(
             goto error_handling;
         }
 
-        if (track_filename != NULL) {
+        if (*attr_value_ptr != NULL) {
             g_set_error(
                     o_error,
                     mutil_error_domain,
@@ -529,7 +577,48 @@ gint mutil_parse_xml_element_track(
             goto error_handling;
         }
 
-        track_filename = (gchar const *) attr_i->children->content;
+        *attr_value_ptr = (gchar const *) attr_i->children->content;
+    }
+
+    if (track_filename == NULL) {
+        g_set_error(
+                o_error,
+                mutil_error_domain,
+                mutil_error_code_undefined,
+                "XML element '%s' lacks attribute '%s'",
+                (gchar const *) root_node->name,
+                mutil_xml_attr_name_filename);
+        goto error_handling;
+    }
+
+    if (first_sample_text != NULL) {
+        first_sample = g_ascii_strtoull(first_sample_text, &conv_ptr, 10);
+        if (conv_ptr == first_sample_text || *conv_ptr != '\0') {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "XML element '%s' contains invalid attribute '%s'",
+                    (gchar const *) root_node->name,
+                    mutil_xml_attr_name_first_sample);
+            goto error_handling;
+        }
+    }
+
+    if (sample_cnt_text != NULL) {
+        sample_cnt = g_ascii_strtoull(sample_cnt_text, &conv_ptr, 10);
+        if (conv_ptr == sample_cnt_text ||
+            *conv_ptr != '\0' ||
+            sample_cnt == 0) {
+            g_set_error(
+                    o_error,
+                    mutil_error_domain,
+                    mutil_error_code_undefined,
+                    "XML element '%s' contains invalid attribute '%s'",
+                    (gchar const *) root_node->name,
+                    mutil_xml_attr_name_sample_cnt);
+            goto error_handling;
+        }
     }
 
     for (node_i = root_node->children;
@@ -585,6 +674,7 @@ gint mutil_parse_xml_element_track(
     status = mutil_determine_file_audio_type(
             track_filename,
             &track_audio_type,
+            &track_stream_info,
             o_error);
     if (status == -1) {
         goto error_handling;
@@ -592,6 +682,10 @@ gint mutil_parse_xml_element_track(
 
     g_assert(new_track == NULL);
     new_track = mutil_track_alloc(track_filename, track_audio_type);
+    mutil_track_set_stream_info(new_track, &track_stream_info);
+    if (first_sample_text != NULL || sample_cnt_text != NULL) {
+        mutil_track_set_range(new_track, first_sample, sample_cnt);
+    }
     mutil_track_add_tag_list(new_track, new_tag_list);
 
     *o_track = new_track;